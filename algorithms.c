@@ -1,7 +1,18 @@
 #include "algorithms.h"
+#include "buffers.h"
+#include "bands.h"
+#include "stats.h"
+#include <string.h>
 
+#define MAX_BANDS (HEIGHT / MASKER_BAND_ROWS + 1)
 
-static int met_to_gray(png_byte *result, png_byte *pixel)
+/* Kernels written once over a constant pixel size, then instantiated for
+ * gray (1) and met (4) frames so each variant has a fixed stride. Callers
+ * pick the variant once per call. */
+#define PIXEL_KERNEL static inline __attribute__((always_inline))
+
+
+int met_to_gray(png_byte *result, const png_byte *pixel)
 {
   /* Shonky hash - convert met colors to rain in grayscale */
   if (pixel[3] < 255) {
@@ -89,7 +100,7 @@ static int met_to_float(float *result, png_byte *pixel)
 }
 
 
-static int gray_to_channel(png_byte pixel) {
+int gray_to_channel(png_byte pixel) {
   /* Convert grayscale rain value to neural net channel */
   switch (pixel) {
     case 1: return 0;
@@ -105,12 +116,23 @@ static int gray_to_channel(png_byte pixel) {
 }
 
 
+/* Pixels a kernel visits for the mask, as counted by stats */
+static unsigned long long bbox_pixels(masker_mask_t mask)
+{
+  if (mask.x_max < mask.x_min || mask.y_max < mask.y_min) return 0;
+  return (unsigned long long)(mask.x_max - mask.x_min + 1)
+    * (mask.y_max - mask.y_min + 1);
+}
+
+
 
 int mask_total_met_image(
   float* res, masker_mask_t mask, const char* file_name)
 {
+  unsigned long long frame_start = STATS_START();
   masker_image_t image;
-  int error_bit = read_png_file(&image, file_name);
+  int error_bit = read_frame_region(&image, file_name,
+    mask.x_min, mask.x_max, mask.y_min, mask.y_max);
   if (error_bit != MASKER_SUCCESS) return error_bit;
 
   if (image.bytes_per_pixel != 4) {
@@ -118,31 +140,246 @@ int mask_total_met_image(
     return MASKER_MET_COLOR_ERROR;
   }
 
+  unsigned long long start = STATS_START();
   *res = 0.0;
   error_bit = 0;
-  for (int y=mask.y_min; y<mask.y_max; y++) {
+  for (int y=mask.y_min; y<=mask.y_max; y++) {
     png_byte *mask_row = mask.image[y];
     png_byte *image_row = image.image[y];
-    for (int x=mask.x_min; x<mask.x_max; x++) {
-      if (mask_row[x * mask.bytes_per_pixel] == 0) continue;
+    for (int x=mask.x_min; x<=mask.x_max; x++) {
+      if (mask_row[x] == 0) continue;
       float value;
-      png_byte* pixel = &(image_row[x * image.bytes_per_pixel]);
-      error_bit |= met_to_float(&value, pixel);
+      error_bit |= met_to_float(&value, &image_row[x * 4]);
       *res += value;
     }
   }
 
   free_image_memory(&image);
   if (error_bit != MASKER_SUCCESS) return MASKER_MET_COLOR_ERROR;
+  stats_record(MASKER_STAGE_MASK, start,
+    4 * bbox_pixels(mask), bbox_pixels(mask));
+  stats_frame(frame_start);
   return MASKER_SUCCESS;
 }
 
 
+void masks_bounding_box(const masker_mask_t *masks, int n_masks,
+  int *x_min, int *x_max, int *y_min, int *y_max)
+{
+  *x_min = WIDTH - 1;
+  *y_min = HEIGHT - 1;
+  *x_max = 0;
+  *y_max = 0;
+  for (int m=0; m<n_masks; m++) {
+    if (masks[m].x_min < *x_min) *x_min = masks[m].x_min;
+    if (masks[m].x_max > *x_max) *x_max = masks[m].x_max;
+    if (masks[m].y_min < *y_min) *y_min = masks[m].y_min;
+    if (masks[m].y_max > *y_max) *y_max = masks[m].y_max;
+  }
+}
+
+
+typedef struct totals_bands {
+  long *partials;             // n_masks per band
+  const masker_mask_t *masks;
+  int n_masks;
+  masker_image_t image;
+  int errors[MAX_BANDS];
+} totals_bands_t;
+
+PIXEL_KERNEL void mask_totals_rows(totals_bands_t *bands, int band,
+  int y_start, int y_end, const int bytes_per_pixel)
+{
+  masker_image_t image = bands->image;
+  long *partials = &bands->partials[band * bands->n_masks];
+  bands->errors[band] = MASKER_SUCCESS;
+  for (int m=0; m<bands->n_masks; m++) {
+    const masker_mask_t *mask = &bands->masks[m];
+    long total = 0;
+    int y_first = y_start > mask->y_min ? y_start : mask->y_min;
+    int y_last = y_end < mask->y_max ? y_end : mask->y_max;
+    for (int y=y_first; y<=y_last; y++) {
+      png_byte *mask_row = mask->image[y];
+      png_byte *image_row = image.image[y];
+      for (int x=mask->x_min; x<=mask->x_max; x++) {
+        if (bytes_per_pixel == 1) {
+          // Branch free, so the loop vectorizes
+          total += (mask_row[x] != 0) * image_row[x];
+          continue;
+        }
+        png_byte value;
+        if (mask_row[x] == 0) continue;
+        if (met_to_gray(&value, &image_row[x * 4]) != MASKER_SUCCESS)
+          bands->errors[band] = MASKER_MET_COLOR_ERROR;
+        else
+          total += value;
+      }
+    }
+    partials[m] = total;
+  }
+}
+
+static void mask_totals_band_gray(void *arg, int band, int y_start, int y_end) {
+  mask_totals_rows(arg, band, y_start, y_end, 1);
+}
+
+static void mask_totals_band_met(void *arg, int band, int y_start, int y_end) {
+  mask_totals_rows(arg, band, y_start, y_end, 4);
+}
+
+int mask_totals_image(
+  long *res, const masker_mask_t *masks, int n_masks, masker_image_t image)
+{
+  if (image.bytes_per_pixel != 1 && image.bytes_per_pixel != 4)
+    return MASKER_COLOR_TYPE_ERROR;
+
+  int x_min, x_max, y_min, y_max;
+  masks_bounding_box(masks, n_masks, &x_min, &x_max, &y_min, &y_max);
+  int n_bands = bands_count(y_min, y_max);
+  totals_bands_t bands = {NULL, masks, n_masks, image};
+  // Sized for the most bands, so the block is reused whatever the box
+  bands.partials = buffers_scratch(MASKER_SCRATCH_BANDS,
+    ((size_t)MAX_BANDS * n_masks + 1) * sizeof(long));
+  if (bands.partials == NULL) return MASKER_MEMORY_ERROR;
+
+  unsigned long long start = STATS_START();
+  bands_run(y_min, y_max, image.bytes_per_pixel == 1
+    ? mask_totals_band_gray : mask_totals_band_met, &bands);
+
+  // Merge in band order
+  int error_bit = MASKER_SUCCESS;
+  for (int m=0; m<n_masks; m++) res[m] = 0;
+  for (int b=0; b<n_bands; b++) {
+    for (int m=0; m<n_masks; m++) res[m] += bands.partials[b * n_masks + m];
+    if (bands.errors[b] != MASKER_SUCCESS) error_bit = bands.errors[b];
+  }
+
+  unsigned long long pixels = 0;
+  for (int m=0; start && m<n_masks; m++) pixels += bbox_pixels(masks[m]);
+  stats_record(MASKER_STAGE_MASK, start,
+    pixels * image.bytes_per_pixel, pixels);
+  return error_bit;
+}
+
+
+int mask_totals_file(
+  long *res, const masker_mask_t *masks, int n_masks, const char *file_name)
+{
+  unsigned long long frame_start = STATS_START();
+  int x_min, x_max, y_min, y_max;
+  masks_bounding_box(masks, n_masks, &x_min, &x_max, &y_min, &y_max);
+
+  masker_image_t image;
+  int error_bit = read_frame_region(&image, file_name,
+    x_min, x_max, y_min, y_max);
+  if (error_bit != MASKER_SUCCESS) return error_bit;
+
+  error_bit = mask_totals_image(res, masks, n_masks, image);
+  free_image_memory(&image);
+  if (error_bit == MASKER_SUCCESS) stats_frame(frame_start);
+  return error_bit;
+}
+
+
+PIXEL_KERNEL int mask_weighted_total(long long *res,
+  const masker_mask_t *mask, masker_image_t image, const int bytes_per_pixel)
+{
+  // Sum gray x weight in integers, 255 being a whole pixel
+  long long total = 0;
+  int error_bit = MASKER_SUCCESS;
+  for (int y=mask->y_min; y<=mask->y_max; y++) {
+    png_byte *mask_row = mask->image[y];
+    png_byte *image_row = image.image[y];
+    for (int x=mask->x_min; x<=mask->x_max; x++) {
+      if (bytes_per_pixel == 1) {
+        total += (long)image_row[x] * mask_row[x];
+        continue;
+      }
+      png_byte value;
+      if (mask_row[x] == 0) continue;
+      if (met_to_gray(&value, &image_row[x * 4]) != MASKER_SUCCESS) {
+        error_bit = MASKER_MET_COLOR_ERROR;
+        continue;
+      }
+      total += (long)value * mask_row[x];
+    }
+  }
+  *res = total;
+  return error_bit;
+}
+
+int mask_weighted_totals_image(
+  double *res, const masker_mask_t *masks, int n_masks, masker_image_t image)
+{
+  if (image.bytes_per_pixel != 1 && image.bytes_per_pixel != 4)
+    return MASKER_COLOR_TYPE_ERROR;
+
+  unsigned long long start = STATS_START();
+  unsigned long long pixels = 0;
+  int error_bit = MASKER_SUCCESS;
+  for (int m=0; m<n_masks; m++) {
+    long long total;
+    int mask_error = image.bytes_per_pixel == 1
+      ? mask_weighted_total(&total, &masks[m], image, 1)
+      : mask_weighted_total(&total, &masks[m], image, 4);
+    if (mask_error != MASKER_SUCCESS) error_bit = mask_error;
+    res[m] = total / 255.0;
+    if (start) pixels += bbox_pixels(masks[m]);
+  }
+  stats_record(MASKER_STAGE_MASK, start,
+    pixels * image.bytes_per_pixel, pixels);
+  return error_bit;
+}
+
+
+int mask_weighted_totals_file(
+  double *res, const masker_mask_t *masks, int n_masks, const char *file_name)
+{
+  unsigned long long frame_start = STATS_START();
+  int x_min, x_max, y_min, y_max;
+  masks_bounding_box(masks, n_masks, &x_min, &x_max, &y_min, &y_max);
+
+  masker_image_t image;
+  int error_bit = read_frame_region(&image, file_name,
+    x_min, x_max, y_min, y_max);
+  if (error_bit != MASKER_SUCCESS) return error_bit;
+
+  error_bit = mask_weighted_totals_image(res, masks, n_masks, image);
+  free_image_memory(&image);
+  if (error_bit == MASKER_SUCCESS) stats_frame(frame_start);
+  return error_bit;
+}
+
+
+typedef struct gray_bands {
+  const masker_mask_t *mask;
+  masker_image_t image;
+  float *data_ptr;
+  long totals[MAX_BANDS];
+} gray_bands_t;
+
+static void mask_total_gray_band(void *arg, int band, int y_start, int y_end)
+{
+  gray_bands_t *bands = arg;
+  const masker_mask_t *mask = bands->mask;
+  long total = 0;
+  for (int y=y_start; y<=y_end; y++) {
+    png_byte *mask_row = mask->image[y];
+    png_byte *image_row = bands->image.image[y];
+    for (int x=mask->x_min; x<=mask->x_max; x++) {
+      total += (mask_row[x] != 0) * image_row[x];
+    }
+  }
+  bands->totals[band] = total;
+}
+
 int mask_total_gray_image(
   float* res, masker_mask_t mask, const char *file_name)
 {
+  unsigned long long frame_start = STATS_START();
   masker_image_t image;
-  int error_bit = read_png_file(&image, file_name);
+  int error_bit = read_frame_region(&image, file_name,
+    mask.x_min, mask.x_max, mask.y_min, mask.y_max);
   if (error_bit != MASKER_SUCCESS) return error_bit;
 
   if (image.bytes_per_pixel != 1) {
@@ -150,28 +387,47 @@ int mask_total_gray_image(
     return MASKER_COLOR_TYPE_ERROR;
   }
 
-  error_bit = 0;
-  int total = 0;
-  for (int y=mask.y_min; y<mask.y_max; y++) {
-    png_byte *mask_row = mask.image[y];
-    png_byte *image_row = image.image[y];
-    for (int x=mask.x_min; x<mask.x_max; x++) {
-      if (mask_row[x * mask.bytes_per_pixel] == 0) continue;
-      total += image_row[x];
-    }
-  }
+  unsigned long long start = STATS_START();
+  gray_bands_t bands = {&mask, image};
+  bands_run(mask.y_min, mask.y_max, mask_total_gray_band, &bands);
+  long total = 0;
+  for (int b=0; b<bands_count(mask.y_min, mask.y_max); b++)
+    total += bands.totals[b];
   *res = 0.25 * (float)total;   // Grayscale pixels are rain scaled up by 4
+  stats_record(MASKER_STAGE_MASK, start, bbox_pixels(mask), bbox_pixels(mask));
 
   free_image_memory(&image);
+  stats_frame(frame_start);
   return MASKER_SUCCESS;
 }
 
 
+static void mask_gray_band(void *arg, int band, int y_start, int y_end)
+{
+  gray_bands_t *bands = arg;
+  const masker_mask_t *mask = bands->mask;
+  float *data_ptr = bands->data_ptr;
+  for (int y=y_start; y<=y_end; y++) {
+    float *out = &data_ptr[y * HEIGHT];
+    memset(out, 0, WIDTH * sizeof(float));
+    // Region reads only decode the mask's box
+    if (y < mask->y_min || y > mask->y_max) continue;
+    png_byte *mask_row = mask->image[y];
+    png_byte *image_row = bands->image.image[y];
+    for (int x=mask->x_min; x<=mask->x_max; x++) {
+      float value = 0.25 * (float)image_row[x];
+      out[x] = mask_row[x] != 0 ? value : 0.0;
+    }
+  }
+}
+
 int mask_gray_image(
   float *data_ptr, masker_mask_t mask, const char *file_name)
 {
+  unsigned long long frame_start = STATS_START();
   masker_image_t res;
-  int error_bit = read_png_file(&res, file_name);
+  int error_bit = read_frame_region(&res, file_name,
+    mask.x_min, mask.x_max, mask.y_min, mask.y_max);
   if (error_bit != MASKER_SUCCESS) return error_bit;
 
   if (res.bytes_per_pixel != 1) {
@@ -179,26 +435,51 @@ int mask_gray_image(
     return MASKER_COLOR_TYPE_ERROR;
   }
 
-  for (int y=0; y<HEIGHT; y++) {
-    png_byte *mask_row = mask.image[y];
-    png_byte *image_row = res.image[y];
-    for (int x=0; x<WIDTH; x++) {
-      if (mask_row[x * mask.bytes_per_pixel] == 0)
-        data_ptr[y * HEIGHT + x] = 0.0;
-      else
-        data_ptr[y * HEIGHT + x] = 0.25 * (float)image_row[x];
-    }
-  }
+  unsigned long long start = STATS_START();
+  gray_bands_t bands = {&mask, res, data_ptr};
+  bands_run(0, HEIGHT - 1, mask_gray_band, &bands);
+  stats_record(MASKER_STAGE_MASK, start, WIDTH * HEIGHT, WIDTH * HEIGHT);
   free_image_memory(&res);
+  stats_frame(frame_start);
   return MASKER_SUCCESS;
 }
 
 
+static void mask_split_gray_band(void *arg, int band, int y_start, int y_end)
+{
+  gray_bands_t *bands = arg;
+  const masker_mask_t *mask = bands->mask;
+  float *data_ptr = bands->data_ptr;
+
+  /* Zero the band's rows in every channel first. */
+  for (int channel=0; channel<8; channel++) {
+    for (int y=y_start; y<=y_end; y++) {
+      for (int x=0; x<WIDTH; x++) data_ptr[(channel * WIDTH + y) * HEIGHT + x] = 0.0;
+    }
+  }
+
+  /* Split the data among channels for neural net, inside the mask's box */
+  int y_first = y_start > mask->y_min ? y_start : mask->y_min;
+  int y_last = y_end < mask->y_max ? y_end : mask->y_max;
+  for (int y=y_first; y<=y_last; y++) {
+    png_byte *mask_row = mask->image[y];
+    png_byte *image_row = bands->image.image[y];
+    for (int x=mask->x_min; x<=mask->x_max; x++) {
+      if (mask_row[x] == 0) continue;
+      if (image_row[x] == 0) continue;
+      int channel = gray_to_channel(image_row[x]);
+      data_ptr[(channel * WIDTH + y) * HEIGHT + x] = 1.0;
+    }
+  }
+}
+
 int mask_split_gray_image(
   float *data_ptr, masker_mask_t mask, const char *file_name)
 {
+  unsigned long long frame_start = STATS_START();
   masker_image_t image;
-  int error_bit = read_png_file(&image, file_name);
+  int error_bit = read_frame_region(&image, file_name,
+    mask.x_min, mask.x_max, mask.y_min, mask.y_max);
   if (error_bit != MASKER_SUCCESS) return error_bit;
 
   if (image.bytes_per_pixel != 1) {
@@ -206,24 +487,58 @@ int mask_split_gray_image(
     return MASKER_COLOR_TYPE_ERROR;
   }
 
-  /* Zero the object first. */
-  for (int z=0; z<8*HEIGHT*WIDTH; z++) {
-    data_ptr[z] = 0.0;
-  }
+  unsigned long long start = STATS_START();
+  gray_bands_t bands = {&mask, image, data_ptr};
+  bands_run(0, HEIGHT - 1, mask_split_gray_band, &bands);
+  stats_record(MASKER_STAGE_MASK, start, WIDTH * HEIGHT, WIDTH * HEIGHT);
 
-  /* Split the data among channels for neural net */
-  for (int y=0; y<HEIGHT; y++) {
-    png_byte *mask_row = mask.image[y];
-    png_byte *image_row = image.image[y];
-    for (int x=0; x<WIDTH; x++) {
-      if (mask_row[x * mask.bytes_per_pixel] == 0) continue;
-      if (image_row[x] == 0) continue;
-      int channel = gray_to_channel(image_row[x]);
-      data_ptr[(channel * WIDTH + y) * HEIGHT + x] = 1.0;
-    }
+  free_image_memory(&image);
+  stats_frame(frame_start);
+  return MASKER_SUCCESS;
+}
+
+
+int met_to_gray_row(png_byte *res, const png_byte *met_row)
+{
+  int error_bit = MASKER_SUCCESS;
+  for (int x=0; x<WIDTH; x++) {
+    error_bit |= met_to_gray(&res[x], &met_row[x * 4]);
   }
+  return error_bit == MASKER_SUCCESS ? MASKER_SUCCESS : MASKER_MET_COLOR_ERROR;
+}
 
-  free_image_memory(&image);
+
+typedef struct classify_bands {
+  masker_image_t *gray;
+  masker_image_t image;
+  int errors[MAX_BANDS];
+  unsigned long counts[MAX_BANDS][MASKER_RAIN_CLASSES + 1];
+} classify_bands_t;
+
+static void met_to_gray_band(void *arg, int band, int y_start, int y_end)
+{
+  classify_bands_t *bands = arg;
+  bands->errors[band] = MASKER_SUCCESS;
+  for (int y=y_start; y<=y_end; y++)
+    bands->errors[band] |= met_to_gray_row(bands->gray->image[y], bands->image.image[y]);
+}
+
+int met_to_gray_image(masker_image_t *res, masker_image_t met_image)
+{
+  if (met_image.bytes_per_pixel != 4) return MASKER_MET_COLOR_ERROR;
+
+  int error_bit = acquire_image_memory(res, 1, 0);
+  if (error_bit != MASKER_SUCCESS) return error_bit;
+
+  unsigned long long start = STATS_START();
+  classify_bands_t bands = {res, met_image};
+  bands_run(0, HEIGHT - 1, met_to_gray_band, &bands);
+  for (int b=0; b<bands_count(0, HEIGHT - 1); b++) error_bit |= bands.errors[b];
+  if (error_bit != MASKER_SUCCESS) {
+    free_image_memory(res);
+    return MASKER_MET_COLOR_ERROR;
+  }
+  stats_record(MASKER_STAGE_CLASSIFY, start, 4 * WIDTH * HEIGHT, WIDTH * HEIGHT);
   return MASKER_SUCCESS;
 }
 
@@ -231,52 +546,83 @@ int mask_split_gray_image(
 int met_image_to_gray(
   masker_image_t *res, const char *file_name)
 {
+  unsigned long long frame_start = STATS_START();
   masker_image_t met_image;
-  int error_bit = read_png_file(&met_image, file_name);
+  int error_bit = read_frame_file(&met_image, file_name);
   if (error_bit != MASKER_SUCCESS) return error_bit;
 
-  if (met_image.bytes_per_pixel != 4) {
-    free_image_memory(&met_image);
-    return MASKER_MET_COLOR_ERROR;
-  }
+  error_bit = met_to_gray_image(res, met_image);
+  free_image_memory(&met_image);
+  if (error_bit == MASKER_SUCCESS) stats_frame(frame_start);
+  return error_bit;
+}
 
-  res->image = malloc(HEIGHT * sizeof(png_bytep));
-  if (res->image == NULL) {
-    free_image_memory(&met_image);
-    return MASKER_MEMORY_ERROR;
-  }
-  res->bytes_per_pixel = 1;
-  res->color_type = 0;
-  res->is_freed = 0;
-
-  for (int y=0; y<HEIGHT; y++) {
-    res->image[y] = malloc(WIDTH * sizeof(png_byte));
-    if (res->image[y] == NULL) {
-      for (int w=0; w<y; w++) {free(res->image[w]);}
-      free(res->image);
-      free_image_memory(&met_image);
-      return MASKER_MEMORY_ERROR;
-    }
-    png_byte *in_row = met_image.image[y];
-    png_byte *out_row = res->image[y];
+PIXEL_KERNEL void class_counts_rows(classify_bands_t *bands, int band,
+  int y_start, int y_end, const int bytes_per_pixel)
+{
+  masker_image_t image = bands->image;
+  unsigned long *counts = bands->counts[band];
+  memset(counts, 0, sizeof(bands->counts[band]));
+  bands->errors[band] = MASKER_SUCCESS;
+  for (int y=y_start; y<=y_end; y++) {
+    png_byte *row = image.image[y];
     for (int x=0; x<WIDTH; x++) {
-      error_bit |= met_to_gray(
-        &(out_row[x]), &(in_row[x * met_image.bytes_per_pixel]));
+      png_byte value = row[x];
+      if (bytes_per_pixel == 4
+          && met_to_gray(&value, &row[x * 4]) != MASKER_SUCCESS) {
+        bands->errors[band] = MASKER_MET_COLOR_ERROR;
+        continue;
+      }
+      if (value == 0) counts[0]++;
+      else counts[1 + gray_to_channel(value)]++;
     }
   }
-  if (error_bit != MASKER_SUCCESS) {
-    free_image_memory(res);
-    free_image_memory(&met_image);
-    return MASKER_MET_COLOR_ERROR;
+}
+
+static void class_counts_band_gray(void *arg, int band, int y_start, int y_end) {
+  class_counts_rows(arg, band, y_start, y_end, 1);
+}
+
+static void class_counts_band_met(void *arg, int band, int y_start, int y_end) {
+  class_counts_rows(arg, band, y_start, y_end, 4);
+}
+
+int frame_class_counts(unsigned long *counts, masker_image_t image)
+{
+  if (image.bytes_per_pixel != 1 && image.bytes_per_pixel != 4)
+    return MASKER_COLOR_TYPE_ERROR;
+
+  unsigned long long start = STATS_START();
+  classify_bands_t bands = {NULL, image};
+  bands_run(0, HEIGHT - 1, image.bytes_per_pixel == 1
+    ? class_counts_band_gray : class_counts_band_met, &bands);
+
+  int error_bit = MASKER_SUCCESS;
+  for (int c=0; c<=MASKER_RAIN_CLASSES; c++) counts[c] = 0;
+  for (int b=0; b<bands_count(0, HEIGHT - 1); b++) {
+    for (int c=0; c<=MASKER_RAIN_CLASSES; c++) counts[c] += bands.counts[b][c];
+    if (bands.errors[b] != MASKER_SUCCESS) error_bit = bands.errors[b];
   }
+  stats_record(MASKER_STAGE_CLASSIFY, start,
+    (unsigned long long)WIDTH * HEIGHT * image.bytes_per_pixel, WIDTH * HEIGHT);
+  return error_bit;
+}
 
-  free_image_memory(&met_image);
-  return MASKER_SUCCESS;
+static void load_gray_band(void *arg, int band, int y_start, int y_end)
+{
+  gray_bands_t *bands = arg;
+  for (int y=y_start; y<=y_end; y++) {
+    png_byte *row = bands->image.image[y];
+    for (int x=0; x<WIDTH; x++) {
+      bands->data_ptr[y * HEIGHT + x] = 0.25 * (float)row[x];
+    }
+  }
 }
 
 int load_gray_to_array(float *data_ptr, const char *file_name) {
+  unsigned long long frame_start = STATS_START();
   masker_image_t image;
-  int error_bit = read_png_file(&image, file_name);
+  int error_bit = read_frame_file(&image, file_name);
   if (error_bit != MASKER_SUCCESS) return error_bit;
 
   if (image.bytes_per_pixel != 1) {
@@ -284,13 +630,12 @@ int load_gray_to_array(float *data_ptr, const char *file_name) {
     return MASKER_MET_COLOR_ERROR;
   }
 
-  for (int y=0; y<HEIGHT; y++) {
-    png_byte *row = image.image[y];
-    for (int x=0; x<WIDTH; x++) {
-      data_ptr[y * HEIGHT + x] = 0.25 * (float)row[x];
-    }
-  }
+  unsigned long long start = STATS_START();
+  gray_bands_t bands = {NULL, image, data_ptr};
+  bands_run(0, HEIGHT - 1, load_gray_band, &bands);
+  stats_record(MASKER_STAGE_MASK, start, WIDTH * HEIGHT, WIDTH * HEIGHT);
 
   free_image_memory(&image);
+  stats_frame(frame_start);
   return MASKER_SUCCESS;
 }
@@ -4,6 +4,8 @@
 #include <stdlib.h>
 #include <png.h>
 
+#define MASKER_RAIN_CLASSES 8
+
 
 /* ===== MASKING FUNCTIONS ===== */
 int mask_total_met_image(
@@ -18,9 +20,42 @@ int mask_gray_image(
 int mask_split_gray_image(
   float *data_ptr, masker_mask_t mask, const char *file_name);
 
+/* Totals for several masks from one decode, in grayscale units (4x rain).
+ * Accepts grayscale or met RGBA frames. */
+int mask_totals_image(
+  long *res, const masker_mask_t *masks, int n_masks, masker_image_t image);
+
+int mask_totals_file(
+  long *res, const masker_mask_t *masks, int n_masks, const char *file_name);
+
+/* As mask_totals_*, weighting each pixel by its mask value over 255, as
+ * for masks holding fractional coverage */
+int mask_weighted_totals_image(
+  double *res, const masker_mask_t *masks, int n_masks, masker_image_t image);
+
+int mask_weighted_totals_file(
+  double *res, const masker_mask_t *masks, int n_masks, const char *file_name);
+
+void masks_bounding_box(const masker_mask_t *masks, int n_masks,
+  int *x_min, int *x_max, int *y_min, int *y_max);
+
 /* ===== MISCELANEOUS OTHER FUNCTIONS ===== */
 int met_image_to_gray(masker_image_t *res, const char *file_name);
 
+int met_to_gray_image(masker_image_t *res, masker_image_t met_image);
+
+/* Rain class channel, 0 to 7, of a wet grayscale value */
+int gray_to_channel(png_byte pixel);
+
+/* One met RGBA pixel to grayscale */
+int met_to_gray(png_byte *result, const png_byte *pixel);
+
+/* One row of met RGBA pixels to grayscale, WIDTH pixels */
+int met_to_gray_row(png_byte *res, const png_byte *met_row);
+
 int load_gray_to_array(float *data_ptr, const char *file_name);
 
+/* Pixel counts per rain class: counts[0] is dry, counts[1 + c] channel c */
+int frame_class_counts(unsigned long *counts, masker_image_t image);
+
 #endif
@@ -0,0 +1,190 @@
+#define _POSIX_C_SOURCE 200809L
+#include "bands.h"
+#include "loader.h"
+#include "workers.h"
+#include <pthread.h>
+
+static masker_workers_t helpers;
+static int n_helpers = 0;   // threads besides the caller
+// Held for reading by frames in flight, for writing to resize the pool
+static pthread_rwlock_t helpers_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+
+/* One frame's bands. Each calling thread keeps its runs for reuse, and
+ * one is free again once the caller and every helper submitted for it
+ * have released it */
+typedef struct band_run {
+  masker_band_fn fn;
+  void *arg;
+  int y_min, y_max, n_bands;
+  int next;                 // next band to claim, atomically
+  int done, refs;
+  int orphaned;             // owner has exited, the last release frees it
+  pthread_mutex_t lock;
+  pthread_cond_t finished;
+  struct band_run *next_run;   // the owner's other runs
+} band_run_t;
+
+static pthread_key_t runs_key;
+static pthread_once_t runs_once = PTHREAD_ONCE_INIT;
+
+
+int bands_count(int y_min, int y_max)
+{
+  if (y_max < y_min) return 0;
+  return (y_max - y_min) / MASKER_BAND_ROWS + 1;
+}
+
+
+static void claim_bands(band_run_t *run)
+{
+  int n_done = 0;
+  for (;;) {
+    int band = __sync_fetch_and_add(&run->next, 1);
+    if (band >= run->n_bands) break;
+    int y_start = run->y_min + band * MASKER_BAND_ROWS;
+    int y_end = y_start + MASKER_BAND_ROWS - 1;
+    run->fn(run->arg, band, y_start, y_end < run->y_max ? y_end : run->y_max);
+    n_done++;
+  }
+
+  pthread_mutex_lock(&run->lock);
+  run->done += n_done;
+  if (run->done == run->n_bands) pthread_cond_broadcast(&run->finished);
+  pthread_mutex_unlock(&run->lock);
+}
+
+static void free_run(band_run_t *run)
+{
+  pthread_mutex_destroy(&run->lock);
+  pthread_cond_destroy(&run->finished);
+  free(run);
+}
+
+static void release_run(band_run_t *run)
+{
+  pthread_mutex_lock(&run->lock);
+  int last = --run->refs == 0 && run->orphaned;
+  pthread_mutex_unlock(&run->lock);
+  if (last) free_run(run);
+}
+
+/* Runs a helper still holds are left for it to free */
+static void thread_runs_free(void *arg)
+{
+  band_run_t *run = arg;
+  while (run != NULL) {
+    band_run_t *next = run->next_run;
+    pthread_mutex_lock(&run->lock);
+    run->orphaned = 1;
+    int idle = run->refs == 0;
+    pthread_mutex_unlock(&run->lock);
+    if (idle) free_run(run);
+    run = next;
+  }
+}
+
+static void make_runs_key(void) {
+  pthread_key_create(&runs_key, thread_runs_free);
+}
+
+/* An idle run of this thread's, allocating one only when a helper is
+ * still finishing with every run it has */
+static band_run_t *acquire_run(void)
+{
+  pthread_once(&runs_once, make_runs_key);
+  band_run_t *first = pthread_getspecific(runs_key);
+  for (band_run_t *run=first; run!=NULL; run=run->next_run) {
+    pthread_mutex_lock(&run->lock);
+    int idle = run->refs == 0;
+    pthread_mutex_unlock(&run->lock);
+    if (idle) return run;
+  }
+
+  band_run_t *run = malloc(sizeof(band_run_t));
+  if (run == NULL) return NULL;
+  run->refs = 0;
+  run->orphaned = 0;
+  pthread_mutex_init(&run->lock, NULL);
+  pthread_cond_init(&run->finished, NULL);
+  run->next_run = first;
+  pthread_setspecific(runs_key, run);
+  return run;
+}
+
+static void help(void *arg)
+{
+  claim_bands(arg);
+  release_run(arg);
+}
+
+
+void bands_run(int y_min, int y_max, masker_band_fn fn, void *arg)
+{
+  int n_bands = bands_count(y_min, y_max);
+  pthread_rwlock_rdlock(&helpers_lock);
+  band_run_t *run = n_helpers > 0 && n_bands > 1 ? acquire_run() : NULL;
+  if (run == NULL) {
+    pthread_rwlock_unlock(&helpers_lock);
+    // Serial, in band order
+    for (int band=0; band<n_bands; band++) {
+      int y_start = y_min + band * MASKER_BAND_ROWS;
+      int y_end = y_start + MASKER_BAND_ROWS - 1;
+      fn(arg, band, y_start, y_end < y_max ? y_end : y_max);
+    }
+    return;
+  }
+
+  run->fn = fn;
+  run->arg = arg;
+  run->y_min = y_min;
+  run->y_max = y_max;
+  run->n_bands = n_bands;
+  run->next = 0;
+  run->done = 0;
+  run->refs = 1;
+
+  // Helpers busy with other frames are skipped rather than waited for
+  int wanted = n_bands - 1 < n_helpers ? n_bands - 1 : n_helpers;
+  for (int h=0; h<wanted; h++) {
+    pthread_mutex_lock(&run->lock);
+    run->refs++;
+    pthread_mutex_unlock(&run->lock);
+    if (workers_try_submit(&helpers, help, run) != MASKER_SUCCESS) {
+      release_run(run);
+      break;
+    }
+  }
+
+  claim_bands(run);
+  pthread_mutex_lock(&run->lock);
+  while (run->done < run->n_bands)
+    pthread_cond_wait(&run->finished, &run->lock);
+  pthread_mutex_unlock(&run->lock);
+  release_run(run);
+  pthread_rwlock_unlock(&helpers_lock);
+}
+
+
+int bands_set_threads(int n_threads)
+{
+  if (n_threads <= 0) n_threads = workers_default_threads();
+  pthread_rwlock_wrlock(&helpers_lock);
+  if (n_helpers > 0) workers_destroy(&helpers);
+  n_helpers = 0;
+
+  int error_bit = MASKER_SUCCESS;
+  if (n_threads > 1) error_bit = workers_create(&helpers, n_threads - 1, 0);
+  if (n_threads > 1 && error_bit == MASKER_SUCCESS) n_helpers = helpers.n_threads;
+  pthread_rwlock_unlock(&helpers_lock);
+  return error_bit;
+}
+
+
+int bands_threads(void)
+{
+  pthread_rwlock_rdlock(&helpers_lock);
+  int n_threads = n_helpers + 1;
+  pthread_rwlock_unlock(&helpers_lock);
+  return n_threads;
+}
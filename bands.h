@@ -0,0 +1,27 @@
+#ifndef MASKER_BANDS_H
+#  define MASKER_BANDS_H
+
+/* Row bands of a single frame shared among helper threads.
+ *
+ * A range of rows is cut into bands of MASKER_BAND_ROWS, independent of
+ * the thread count, and the calling thread plus any idle helpers claim
+ * them from a shared counter until none are left. Kernels keep a partial
+ * result per band and merge them in band order afterwards, so the result
+ * is the same for any number of threads. With one thread, the default,
+ * every band runs in order on the caller. */
+
+#  define MASKER_BAND_ROWS 32
+
+typedef void (*masker_band_fn)(void *arg, int band, int y_start, int y_end);
+
+/* Bands covering rows y_min to y_max inclusive, for sizing partials */
+int bands_count(int y_min, int y_max);
+
+/* Call fn for every band, returning once all have finished */
+void bands_run(int y_min, int y_max, masker_band_fn fn, void *arg);
+
+/* Threads per frame, 0 for every core. Waits for frames in flight. */
+int bands_set_threads(int n_threads);
+int bands_threads(void);
+
+#endif	// MASKER_BANDS_H
@@ -0,0 +1,462 @@
+/* Benchmarks for frame decoding, met classification and the masking kernels.
+ *
+ * usage: bench [-n reps] [-c coverage,...] [-t threads] [-r revision]
+ *        [-o results.jsonl]
+ *        bench -g DIR [-c coverage]
+ *
+ * Synthetic met, grayscale and mask frames are generated for each rain
+ * coverage (fraction of wet pixels) and every operation is timed on them.
+ * A table is printed to stdout and, with -o, one JSON object per result is
+ * appended to the given file so runs from different commits can be
+ * compared. -t splits each frame's kernels over that many threads (0 for
+ * every core). With -g the frames are only written to DIR, for bench.py. */
+#define _POSIX_C_SOURCE 200809L
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../algorithms.h"
+#include "../bands.h"
+#include "../buffers.h"
+#include "../tiles.h"
+
+#define N_MASKS 8
+#define MAX_COVERAGES 16
+#define N_CELLS 24
+
+
+static const png_byte met_colors[MASKER_RAIN_CLASSES][3] = {
+  {0, 0, 254}, {50, 101, 254}, {127, 127, 0}, {254, 203, 0},
+  {254, 152, 0}, {254, 0, 0}, {254, 0, 254}, {229, 254, 254}};
+
+static const png_byte gray_classes[MASKER_RAIN_CLASSES] = {
+  1, 3, 6, 12, 24, 48, 96, 192};
+
+
+typedef struct bench_files {
+  char met[512], gray[512], tiled[512], mask[512], out[512];
+  char masks[N_MASKS][512];
+} bench_files_t;
+
+typedef struct bench_run {
+  const char *revision;
+  FILE *json;
+  int reps;
+  double coverage;
+  const bench_files_t *files;
+} bench_run_t;
+
+typedef int (*bench_fn)(const bench_files_t *files, void *state);
+
+
+/* ===== SYNTHETIC FRAMES ===== */
+static unsigned long rng_state = 12345;
+
+static double uniform(void)
+{
+  rng_state = rng_state * 6364136223846793005UL + 1442695040888963407UL;
+  return (double)(rng_state >> 11) / 9007199254740992.0;
+}
+
+/* Storm cells as gaussian blobs, thresholded so that coverage of the frame
+ * is wet. Intensity rises towards each cell's core, so heavy classes are
+ * rare and sit inside lighter ones as on real radar composites. */
+static void rain_field(float *field, double coverage)
+{
+  double cx[N_CELLS], cy[N_CELLS], radius[N_CELLS];
+  for (int c=0; c<N_CELLS; c++) {
+    cx[c] = uniform() * WIDTH;
+    cy[c] = uniform() * HEIGHT;
+    radius[c] = (0.02 + 0.1 * uniform()) * WIDTH;
+  }
+
+  for (int y=0; y<HEIGHT; y++) {
+    for (int x=0; x<WIDTH; x++) {
+      double value = 0.0;
+      for (int c=0; c<N_CELLS; c++) {
+        double dx = (x - cx[c]) / radius[c], dy = (y - cy[c]) / radius[c];
+        value += exp(-0.5 * (dx * dx + dy * dy));
+      }
+      field[y * WIDTH + x] = value + 0.05 * uniform();
+    }
+  }
+
+  // Normalise so the wet threshold is 1.0, using a histogram quantile
+  float max = 0.0;
+  for (int i=0; i<WIDTH * HEIGHT; i++) if (field[i] > max) max = field[i];
+  static unsigned long histogram[4096];
+  memset(histogram, 0, sizeof(histogram));
+  for (int i=0; i<WIDTH * HEIGHT; i++)
+    histogram[(int)(field[i] / max * 4095)]++;
+  unsigned long wet = coverage * WIDTH * HEIGHT, seen = 0;
+  int bin = 4095;
+  while (bin > 0 && seen + histogram[bin] <= wet) seen += histogram[bin--];
+  float threshold = coverage <= 0.0 ? max * 2 : (bin + 1) * max / 4095;
+  for (int i=0; i<WIDTH * HEIGHT; i++) field[i] /= threshold;
+}
+
+static int rain_class(float value)
+{
+  if (value < 1.0) return -1;
+  int c = (int)(log(value) / log(1.25));
+  return c < MASKER_RAIN_CLASSES ? c : MASKER_RAIN_CLASSES - 1;
+}
+
+static int write_frames(float *field, const bench_files_t *files)
+{
+  masker_image_t met, gray, mask;
+  int error_bit = alloc_image_memory(&met, 4, PNG_COLOR_TYPE_RGBA);
+  if (error_bit) return error_bit;
+  error_bit = alloc_image_memory(&gray, 1, PNG_COLOR_TYPE_GRAY);
+  if (error_bit) return error_bit;
+  error_bit = alloc_image_memory(&mask, 1, PNG_COLOR_TYPE_GRAY);
+  if (error_bit) return error_bit;
+
+  for (int y=0; y<HEIGHT; y++) {
+    for (int x=0; x<WIDTH; x++) {
+      int c = rain_class(field[y * WIDTH + x]);
+      png_byte *pixel = &met.image[y][4 * x];
+      if (c < 0) {
+        memset(pixel, 0, 4);
+        gray.image[y][x] = 0;
+      } else {
+        memcpy(pixel, met_colors[c], 3);
+        pixel[3] = 255;
+        gray.image[y][x] = gray_classes[c];
+      }
+    }
+  }
+  error_bit = write_png_file(met, files->met);
+  if (!error_bit) error_bit = write_png_file(gray, files->gray);
+  if (!error_bit) error_bit = write_tiled_file(gray, files->tiled);
+
+  // One large catchment plus several smaller ones spread over the frame
+  for (int m=0; m<=N_MASKS && !error_bit; m++) {
+    double cx = m == 0 ? 0.5 : 0.15 + 0.7 * (m % 3) / 2.0;
+    double cy = m == 0 ? 0.5 : 0.15 + 0.7 * ((m - 1) / 3) / 2.0;
+    double r = m == 0 ? 0.28 : 0.12;
+    for (int y=0; y<HEIGHT; y++) {
+      for (int x=0; x<WIDTH; x++) {
+        double dx = (double)x / WIDTH - cx, dy = (double)y / HEIGHT - cy;
+        mask.image[y][x] = dx * dx + dy * dy < r * r ? 255 : 0;
+      }
+    }
+    error_bit = write_png_file(mask, m == 0 ? files->mask : files->masks[m - 1]);
+  }
+
+  free_image_memory(&met);
+  free_image_memory(&gray);
+  free_image_memory(&mask);
+  return error_bit;
+}
+
+static void set_paths(bench_files_t *files, const char *dir)
+{
+  snprintf(files->met, sizeof(files->met), "%s/met.png", dir);
+  snprintf(files->gray, sizeof(files->gray), "%s/gray.png", dir);
+  snprintf(files->tiled, sizeof(files->tiled), "%s/gray.mtl", dir);
+  snprintf(files->mask, sizeof(files->mask), "%s/mask.png", dir);
+  snprintf(files->out, sizeof(files->out), "%s/out.png", dir);
+  for (int m=0; m<N_MASKS; m++)
+    snprintf(files->masks[m], sizeof(files->masks[m]), "%s/mask%i.png", dir, m);
+}
+
+
+/* ===== BENCHMARKED OPERATIONS ===== */
+typedef struct bench_state {
+  masker_mask_t mask;
+  masker_mask_t masks[N_MASKS];
+  masker_image_t met, gray;
+  float *floats;
+  long totals[N_MASKS];
+} bench_state_t;
+
+static int op_decode_met(const bench_files_t *files, void *arg)
+{
+  masker_image_t image;
+  int error_bit = read_png_file(&image, files->met);
+  if (!error_bit) free_image_memory(&image);
+  return error_bit;
+}
+
+static int op_decode_gray(const bench_files_t *files, void *arg)
+{
+  masker_image_t image;
+  int error_bit = read_png_file(&image, files->gray);
+  if (!error_bit) free_image_memory(&image);
+  return error_bit;
+}
+
+static int op_decode_tiled_region(const bench_files_t *files, void *arg)
+{
+  bench_state_t *state = arg;
+  masker_image_t image;
+  int error_bit = read_frame_region(&image, files->tiled, state->mask.x_min,
+    state->mask.x_max, state->mask.y_min, state->mask.y_max);
+  if (!error_bit) free_image_memory(&image);
+  return error_bit;
+}
+
+static int op_met_image_to_gray(const bench_files_t *files, void *arg)
+{
+  masker_image_t image;
+  int error_bit = met_image_to_gray(&image, files->met);
+  if (!error_bit) free_image_memory(&image);
+  return error_bit;
+}
+
+static int op_classify_met(const bench_files_t *files, void *arg)
+{
+  bench_state_t *state = arg;
+  masker_image_t image;
+  int error_bit = met_to_gray_image(&image, state->met);
+  if (!error_bit) free_image_memory(&image);
+  return error_bit;
+}
+
+static int op_class_counts(const bench_files_t *files, void *arg)
+{
+  bench_state_t *state = arg;
+  unsigned long counts[MASKER_RAIN_CLASSES + 1];
+  return frame_class_counts(counts, state->met);
+}
+
+static int op_write_gray(const bench_files_t *files, void *arg)
+{
+  bench_state_t *state = arg;
+  return write_png_file(state->gray, files->out);
+}
+
+static int op_write_tiled(const bench_files_t *files, void *arg)
+{
+  bench_state_t *state = arg;
+  return write_tiled_file(state->gray, files->out);
+}
+
+static int op_total_met(const bench_files_t *files, void *arg)
+{
+  bench_state_t *state = arg;
+  float total;
+  return mask_total_met_image(&total, state->mask, files->met);
+}
+
+static int op_total_gray(const bench_files_t *files, void *arg)
+{
+  bench_state_t *state = arg;
+  float total;
+  return mask_total_gray_image(&total, state->mask, files->gray);
+}
+
+static int op_mask_gray(const bench_files_t *files, void *arg)
+{
+  bench_state_t *state = arg;
+  return mask_gray_image(state->floats, state->mask, files->gray);
+}
+
+static int op_mask_split_gray(const bench_files_t *files, void *arg)
+{
+  bench_state_t *state = arg;
+  return mask_split_gray_image(state->floats, state->mask, files->gray);
+}
+
+static int op_load_gray(const bench_files_t *files, void *arg)
+{
+  bench_state_t *state = arg;
+  return load_gray_to_array(state->floats, files->gray);
+}
+
+static int op_totals_file(const bench_files_t *files, void *arg)
+{
+  bench_state_t *state = arg;
+  return mask_totals_file(state->totals, state->masks, N_MASKS, files->met);
+}
+
+static int op_totals_image(const bench_files_t *files, void *arg)
+{
+  bench_state_t *state = arg;
+  return mask_totals_image(state->totals, state->masks, N_MASKS, state->met);
+}
+
+
+typedef struct bench_case {
+  const char *name;
+  bench_fn fn;
+  int bytes_per_pixel;   // of the decoded frame, for MB/s
+} bench_case_t;
+
+static const bench_case_t cases[] = {
+  {"read_png_file/met", op_decode_met, 4},
+  {"read_png_file/gray", op_decode_gray, 1},
+  {"read_frame_region/tiled", op_decode_tiled_region, 1},
+  {"met_image_to_gray", op_met_image_to_gray, 4},
+  {"met_to_gray_image", op_classify_met, 4},
+  {"frame_class_counts", op_class_counts, 4},
+  {"write_png_file/gray", op_write_gray, 1},
+  {"write_tiled_file/gray", op_write_tiled, 1},
+  {"mask_total_met_image", op_total_met, 4},
+  {"mask_total_gray_image", op_total_gray, 1},
+  {"mask_gray_image", op_mask_gray, 1},
+  {"mask_split_gray_image", op_mask_split_gray, 1},
+  {"load_gray_to_array", op_load_gray, 1},
+  {"mask_totals_file/8", op_totals_file, 4},
+  {"mask_totals_image/8", op_totals_image, 4},
+};
+
+
+/* ===== TIMING AND REPORTING ===== */
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static int run_case(const bench_run_t *run, const bench_case_t *bench,
+  bench_state_t *state)
+{
+  // One untimed call warms the buffer pool and page cache
+  int error_bit = bench->fn(run->files, state);
+  if (error_bit) {
+    printf("%-26s failed with code %i\n", bench->name, error_bit);
+    return error_bit;
+  }
+
+  double best = 1e30, total = 0.0;
+  for (int i=0; i<run->reps; i++) {
+    double start = now();
+    bench->fn(run->files, state);
+    double elapsed = now() - start;
+    total += elapsed;
+    if (elapsed < best) best = elapsed;
+  }
+
+  double mean = total / run->reps;
+  double frames_per_s = 1.0 / mean;
+  double mb_per_s = bench->bytes_per_pixel * (double)WIDTH * HEIGHT / mean / 1e6;
+  double ns_per_pixel = mean * 1e9 / ((double)WIDTH * HEIGHT);
+  printf("%-26s %5.2f %10.1f %10.1f %9.2f %9.2f\n", bench->name,
+    run->coverage, frames_per_s, mb_per_s, ns_per_pixel,
+    best * 1e9 / ((double)WIDTH * HEIGHT));
+
+  if (run->json != NULL) {
+    fprintf(run->json, "{\"revision\": \"%s\", \"bench\": \"%s\", "
+      "\"language\": \"c\", \"width\": %i, \"height\": %i, \"threads\": %i, "
+      "\"coverage\": %.3f, \"reps\": %i, \"mean_s\": %.9f, \"best_s\": %.9f, "
+      "\"frames_per_s\": %.3f, \"mb_per_s\": %.3f, \"ns_per_pixel\": %.4f}\n",
+      run->revision, bench->name, WIDTH, HEIGHT, bands_threads(), run->coverage,
+      run->reps, mean, best, frames_per_s, mb_per_s, ns_per_pixel);
+  }
+  return MASKER_SUCCESS;
+}
+
+static int bench_coverage(bench_run_t *run, float *field)
+{
+  bench_state_t state;
+  const bench_files_t *files = run->files;
+  rain_field(field, run->coverage);
+  int error_bit = write_frames(field, files);
+  if (error_bit) {
+    printf("Got code %i writing synthetic frames\n", error_bit);
+    return error_bit;
+  }
+
+  state.floats = malloc(8 * sizeof(float) * WIDTH * HEIGHT);
+  error_bit = state.floats == NULL ? MASKER_MEMORY_ERROR : MASKER_SUCCESS;
+  if (!error_bit) error_bit = read_mask_file(&state.mask, files->mask);
+  for (int m=0; m<N_MASKS && !error_bit; m++)
+    error_bit = read_mask_file(&state.masks[m], files->masks[m]);
+  if (!error_bit) error_bit = read_png_file(&state.met, files->met);
+  if (!error_bit) error_bit = read_png_file(&state.gray, files->gray);
+  if (error_bit) {
+    printf("Got code %i loading synthetic frames\n", error_bit);
+    return error_bit;
+  }
+
+  int failures = 0;
+  for (size_t c=0; c<sizeof(cases) / sizeof(cases[0]); c++) {
+    if (run_case(run, &cases[c], &state) != MASKER_SUCCESS) failures++;
+  }
+
+  free_mask_memory(&state.mask);
+  for (int m=0; m<N_MASKS; m++) free_mask_memory(&state.masks[m]);
+  free_image_memory(&state.met);
+  free_image_memory(&state.gray);
+  free(state.floats);
+  return failures ? MASKER_FAILURE : MASKER_SUCCESS;
+}
+
+
+int main(int argc, char **argv)
+{
+  bench_run_t run = {.revision = "unknown", .json = NULL, .reps = 20};
+  const char *json_path = NULL, *generate_dir = NULL;
+  double coverages[MAX_COVERAGES] = {0.05, 0.25, 0.6};
+  int n_coverages = 3;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "n:c:t:r:o:g:")) != -1) {
+    switch (opt) {
+      case 'n': run.reps = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+      case 't':
+        if (bands_set_threads(atoi(optarg)) != MASKER_SUCCESS) return 1;
+        break;
+      case 'r': run.revision = optarg; break;
+      case 'o': json_path = optarg; break;
+      case 'g': generate_dir = optarg; break;
+      case 'c':
+        n_coverages = 0;
+        for (char *token=strtok(optarg, ","); token && n_coverages < MAX_COVERAGES;
+             token=strtok(NULL, ","))
+          coverages[n_coverages++] = atof(token);
+        break;
+      default:
+        fprintf(stderr, "usage: bench [-n reps] [-c coverage,...] [-t threads] "
+          "[-r revision] [-o results.jsonl] [-g dir]\n");
+        return 2;
+    }
+  }
+
+  float *field = malloc(sizeof(float) * WIDTH * HEIGHT);
+  if (field == NULL) return 1;
+  bench_files_t files;
+
+  if (generate_dir != NULL) {
+    set_paths(&files, generate_dir);
+    rain_field(field, coverages[0]);
+    int error_bit = write_frames(field, &files);
+    if (error_bit) printf("Got code %i writing synthetic frames\n", error_bit);
+    free(field);
+    return error_bit ? 1 : 0;
+  }
+
+  char dir[] = "/tmp/masker-bench-XXXXXX";
+  if (mkdtemp(dir) == NULL) {
+    perror("bench");
+    return 1;
+  }
+  set_paths(&files, dir);
+  run.files = &files;
+  if (json_path != NULL && (run.json = fopen(json_path, "a")) == NULL) {
+    perror(json_path);
+    return 1;
+  }
+
+  printf("%ix%i frames, %i reps, %i threads per frame\n", WIDTH, HEIGHT,
+    run.reps, bands_threads());
+  printf("%-26s %5s %10s %10s %9s %9s\n", "benchmark", "cover",
+    "frames/s", "MB/s", "ns/px", "best");
+  int failures = 0;
+  for (int c=0; c<n_coverages; c++) {
+    run.coverage = coverages[c];
+    if (bench_coverage(&run, field) != MASKER_SUCCESS) failures++;
+  }
+
+  if (run.json != NULL) fclose(run.json);
+  const char *names[] = {files.met, files.gray, files.tiled, files.mask, files.out};
+  for (size_t i=0; i<sizeof(names) / sizeof(names[0]); i++) unlink(names[i]);
+  for (int m=0; m<N_MASKS; m++) unlink(files.masks[m]);
+  rmdir(dir);
+  free(field);
+  return failures ? 1 : 0;
+}
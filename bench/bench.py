@@ -0,0 +1,93 @@
+#!/usr/bin/env python2
+"""Time the end-to-end Python forms of the masking kernels.
+
+usage: bench.py [-n reps] [-c coverage,...] [-r revision] [-o results.jsonl]
+
+Synthetic frames come from the C benchmark (``bench -g DIR``), so build it
+with ``bench/make.sh`` first and install the masker extension. Results use
+the same table and JSON fields as the C benchmark with "language": "python".
+"""
+from __future__ import print_function
+
+import json
+import optparse
+import os
+import shutil
+import subprocess
+import tempfile
+import timeit
+
+import masker
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+N_MASKS = 8
+
+
+def cases(d):
+    mask = masker.Mask(os.path.join(d, "mask.png"))
+    mask_set = masker.MaskSet(
+        [os.path.join(d, "mask%i.png" % m) for m in range(N_MASKS)])
+    met = os.path.join(d, "met.png")
+    gray = os.path.join(d, "gray.png")
+    out = os.path.join(d, "out.png")
+    return [
+        ("Mask.total_met", 4, lambda: mask.total_met(met)),
+        ("Mask.total_gray", 1, lambda: mask.total_gray(gray)),
+        ("Mask.load_gray", 1, lambda: mask.load_gray(gray)),
+        ("Mask.load_channels", 1, lambda: mask.load_channels(gray)),
+        ("masker.load_gray", 1, lambda: masker.load_gray(gray)),
+        ("masker.met_to_gray", 4, lambda: masker.met_to_gray(met, out)),
+        ("MaskSet.totals/8", 4, lambda: mask_set.totals(met)),
+        ("Mask(path)", 1, lambda: masker.Mask(os.path.join(d, "mask.png"))),
+    ]
+
+
+def main():
+    parser = optparse.OptionParser()
+    parser.add_option("-n", dest="reps", type="int", default=20)
+    parser.add_option("-c", dest="coverages", default="0.05,0.25,0.6")
+    parser.add_option("-r", dest="revision", default="unknown")
+    parser.add_option("-o", dest="output")
+    options, _ = parser.parse_args()
+
+    json_file = open(options.output, "a") if options.output else None
+    d = tempfile.mkdtemp(prefix="masker-bench-")
+    try:
+        pixels = width = height = None
+        print("%-26s %5s %10s %10s %9s %9s"
+              % ("benchmark", "cover", "frames/s", "MB/s", "ns/px", "best"))
+        for coverage in [float(c) for c in options.coverages.split(",")]:
+            subprocess.check_call(
+                [os.path.join(HERE, "bench"), "-g", d, "-c", str(coverage)])
+            if pixels is None:
+                width, height = masker.load_gray(
+                    os.path.join(d, "gray.png")).shape
+                pixels = float(width * height)
+
+            for name, bytes_per_pixel, fn in cases(d):
+                fn()
+                times = timeit.repeat(fn, number=1, repeat=options.reps)
+                mean = sum(times) / len(times)
+                result = {
+                    "revision": options.revision, "bench": name,
+                    "language": "python", "width": width, "height": height,
+                    "coverage": coverage, "reps": options.reps,
+                    "mean_s": mean, "best_s": min(times),
+                    "frames_per_s": 1.0 / mean,
+                    "mb_per_s": bytes_per_pixel * pixels / mean / 1e6,
+                    "ns_per_pixel": mean * 1e9 / pixels,
+                }
+                print("%-26s %5.2f %10.1f %10.1f %9.2f %9.2f" % (
+                    name, coverage, result["frames_per_s"],
+                    result["mb_per_s"], result["ns_per_pixel"],
+                    min(times) * 1e9 / pixels))
+                if json_file:
+                    json_file.write(json.dumps(result, sort_keys=True) + "\n")
+    finally:
+        shutil.rmtree(d)
+        if json_file:
+            json_file.close()
+
+
+if __name__ == "__main__":
+    main()
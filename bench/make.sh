@@ -0,0 +1,16 @@
+#!/bin/sh
+# Build the benchmark at the optimisation level used by setup.py.
+# Frames are 500x500 by default; SIZES="500 1000 2000" builds one binary
+# per square frame size as bench_<size>.
+set -e
+cd "$(dirname "$0")"
+
+SOURCES="bench.c ../loader.c ../algorithms.c ../tiles.c ../buffers.c
+  ../stats.c ../bands.c ../workers.c"
+CFLAGS="-Ofast -std=c99 -Wall"
+LIBS="-lpng -lz -lm -lpthread"
+
+gcc $CFLAGS -o bench $SOURCES $LIBS
+for size in $SIZES; do
+  gcc $CFLAGS -DWIDTH=$size -DHEIGHT=$size -o bench_$size $SOURCES $LIBS
+done
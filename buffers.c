@@ -0,0 +1,257 @@
+#define _POSIX_C_SOURCE 200809L
+#include "buffers.h"
+#include <pthread.h>
+#include <string.h>
+
+#define ARENA_SIZE (256 * 1024)
+#define ARENA_ALIGN 16
+
+
+typedef struct thread_pool {
+  masker_buffer_t *free_lists[MASKER_MAX_PIXEL_BYTES];   // by pixel size - 1
+  int n_free[MASKER_MAX_PIXEL_BYTES];
+  unsigned char *arena;
+  size_t arena_used;
+  int arena_live;      // a read struct currently owns the arena
+  void *scratch[MASKER_SCRATCH_SLOTS];
+  size_t scratch_size[MASKER_SCRATCH_SLOTS];
+  z_stream inflater;
+  int inflater_ready;
+  masker_buffer_stats_t counts;   // owner only, pooled and pool_size unused
+  unsigned long generation;       // reset the counts were last cleared for
+  struct thread_pool *prev, *next;
+} thread_pool_t;
+
+static pthread_key_t pool_key;
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static volatile int pool_size = MASKER_DEFAULT_POOL_SIZE;
+static pthread_mutex_t pools_lock = PTHREAD_MUTEX_INITIALIZER;
+static thread_pool_t *live = NULL;       // one per thread with a pool
+static masker_buffer_stats_t retired;    // folded in from exited threads
+static volatile unsigned long generation = 0;   // bumped by each reset
+
+
+static void counts_sum(masker_buffer_stats_t *total,
+  const masker_buffer_stats_t *part)
+{
+  total->frame_hits += part->frame_hits;
+  total->frame_misses += part->frame_misses;
+  total->frame_drops += part->frame_drops;
+  total->png_hits += part->png_hits;
+  total->png_misses += part->png_misses;
+}
+
+
+static void thread_pool_free(void *arg)
+{
+  thread_pool_t *pool = arg;
+  pthread_mutex_lock(&pools_lock);
+  if (pool->generation == generation) counts_sum(&retired, &pool->counts);
+  if (pool->prev != NULL) pool->prev->next = pool->next;
+  else live = pool->next;
+  if (pool->next != NULL) pool->next->prev = pool->prev;
+  pthread_mutex_unlock(&pools_lock);
+
+  for (int size=0; size<MASKER_MAX_PIXEL_BYTES; size++) {
+    while (pool->free_lists[size] != NULL) {
+      masker_buffer_t *buffer = pool->free_lists[size];
+      pool->free_lists[size] = buffer->next;
+      free(buffer);
+    }
+  }
+  if (pool->inflater_ready) inflateEnd(&pool->inflater);
+  free(pool->arena);
+  for (int slot=0; slot<MASKER_SCRATCH_SLOTS; slot++) free(pool->scratch[slot]);
+  free(pool);
+}
+
+static void make_pool_key(void) {
+  pthread_key_create(&pool_key, thread_pool_free);
+}
+
+static thread_pool_t *thread_pool(void)
+{
+  pthread_once(&pool_once, make_pool_key);
+  thread_pool_t *pool = pthread_getspecific(pool_key);
+  if (pool != NULL) {
+    // As in stats.c, only the owner clears its counts after a reset
+    unsigned long current = generation;
+    if (pool->generation != current) {
+      memset(&pool->counts, 0, sizeof(masker_buffer_stats_t));
+      __sync_synchronize();
+      pool->generation = current;
+    }
+    return pool;
+  }
+
+  pool = calloc(1, sizeof(thread_pool_t));
+  if (pool == NULL) return NULL;
+  pool->arena = malloc(ARENA_SIZE);
+  pthread_mutex_lock(&pools_lock);
+  pool->generation = generation;
+  pool->next = live;
+  if (live != NULL) live->prev = pool;
+  live = pool;
+  pthread_mutex_unlock(&pools_lock);
+  pthread_setspecific(pool_key, pool);
+  return pool;
+}
+
+
+/* ===== FRAME BUFFERS ===== */
+masker_buffer_t *buffer_acquire(int bytes_per_pixel)
+{
+  if (bytes_per_pixel < 1 || bytes_per_pixel > MASKER_MAX_PIXEL_BYTES)
+    return NULL;
+  thread_pool_t *pool = thread_pool();
+  int size = bytes_per_pixel - 1;
+  masker_buffer_t *buffer = NULL;
+  if (pool != NULL && pool->free_lists[size] != NULL) {
+    buffer = pool->free_lists[size];
+    pool->free_lists[size] = buffer->next;
+    pool->n_free[size]--;
+    pool->counts.frame_hits++;
+  } else {
+    buffer = malloc(sizeof(masker_buffer_t)
+      + (size_t)WIDTH * HEIGHT * bytes_per_pixel);
+    if (buffer == NULL) return NULL;
+    buffer->block = (png_byte*)(buffer + 1);
+    buffer->bytes_per_pixel = bytes_per_pixel;
+    for (int y=0; y<HEIGHT; y++) {
+      buffer->rows[y] = &buffer->block[(size_t)y * WIDTH * bytes_per_pixel];
+    }
+    if (pool != NULL) pool->counts.frame_misses++;
+  }
+  buffer->next = NULL;
+  return buffer;
+}
+
+
+void buffer_release(masker_buffer_t *buffer)
+{
+  thread_pool_t *pool = thread_pool();
+  int size = buffer->bytes_per_pixel - 1;
+  if (pool == NULL || pool->n_free[size] >= pool_size) {
+    free(buffer);
+    if (pool != NULL) pool->counts.frame_drops++;
+    return;
+  }
+  buffer->next = pool->free_lists[size];
+  pool->free_lists[size] = buffer;
+  pool->n_free[size]++;
+}
+
+
+/* ===== LIBPNG ARENA ===== */
+static png_voidp arena_malloc(png_structp png_ptr, png_alloc_size_t size)
+{
+  thread_pool_t *pool = png_get_mem_ptr(png_ptr);
+  size_t rounded = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+  if (pool != NULL && pool->arena_used + rounded <= ARENA_SIZE) {
+    png_voidp ptr = pool->arena + pool->arena_used;
+    pool->arena_used += rounded;
+    pool->counts.png_hits++;
+    return ptr;
+  }
+  if (pool != NULL) pool->counts.png_misses++;
+  return malloc(size);
+}
+
+static void arena_free(png_structp png_ptr, png_voidp ptr)
+{
+  thread_pool_t *pool = png_get_mem_ptr(png_ptr);
+  if (pool != NULL && (unsigned char*)ptr >= pool->arena
+      && (unsigned char*)ptr < pool->arena + ARENA_SIZE)
+    return;   // reclaimed wholesale when the read struct is destroyed
+  free(ptr);
+}
+
+
+png_structp buffers_create_read_struct(void)
+{
+  thread_pool_t *pool = thread_pool();
+  if (pool == NULL || pool->arena == NULL || pool->arena_live)
+    pool = NULL;
+  else {
+    pool->arena_live = 1;
+    pool->arena_used = 0;
+  }
+
+  png_structp png_ptr = png_create_read_struct_2(PNG_LIBPNG_VER_STRING,
+    NULL, NULL, NULL, pool, arena_malloc, arena_free);
+  if (png_ptr == NULL && pool != NULL) pool->arena_live = 0;
+  return png_ptr;
+}
+
+
+void buffers_destroy_read_struct(png_structpp png_ptr, png_infopp info_ptr)
+{
+  thread_pool_t *pool = png_get_mem_ptr(*png_ptr);
+  png_destroy_read_struct(png_ptr, info_ptr, NULL);
+  if (pool != NULL) {
+    pool->arena_live = 0;
+    pool->arena_used = 0;
+  }
+}
+
+
+/* ===== SCRATCH AND CONFIGURATION ===== */
+void *buffers_scratch(masker_scratch_slot_t slot, size_t size)
+{
+  thread_pool_t *pool = thread_pool();
+  if (pool == NULL) return NULL;
+  if (pool->scratch_size[slot] < size) {
+    void *grown = realloc(pool->scratch[slot], size);
+    if (grown == NULL) return NULL;
+    pool->scratch[slot] = grown;
+    pool->scratch_size[slot] = size;
+  }
+  return pool->scratch[slot];
+}
+
+
+z_stream *buffers_inflater(void)
+{
+  thread_pool_t *pool = thread_pool();
+  if (pool == NULL) return NULL;
+  if (!pool->inflater_ready) {
+    if (inflateInit(&pool->inflater) != Z_OK) return NULL;
+    pool->inflater_ready = 1;
+  } else if (inflateReset(&pool->inflater) != Z_OK) {
+    return NULL;
+  }
+  return &pool->inflater;
+}
+
+
+void buffers_set_pool_size(int size) {
+  pool_size = size > 0 ? size : 0;
+}
+
+
+/* Counts of running threads are read without stopping them, as in stats.c.
+ * Pools that have not been used since the last reset count as zero */
+void buffers_get_stats(masker_buffer_stats_t *stats)
+{
+  pthread_mutex_lock(&pools_lock);
+  memcpy(stats, &retired, sizeof(masker_buffer_stats_t));
+  stats->pooled = 0;
+  for (thread_pool_t *pool=live; pool!=NULL; pool=pool->next) {
+    for (int size=0; size<MASKER_MAX_PIXEL_BYTES; size++)
+      stats->pooled += pool->n_free[size];
+    if (pool->generation != generation) continue;
+    __sync_synchronize();
+    counts_sum(stats, &pool->counts);
+  }
+  pthread_mutex_unlock(&pools_lock);
+  stats->pool_size = pool_size;
+}
+
+
+void buffers_reset_stats(void)
+{
+  pthread_mutex_lock(&pools_lock);
+  memset(&retired, 0, sizeof(masker_buffer_stats_t));
+  __sync_fetch_and_add(&generation, 1);
+  pthread_mutex_unlock(&pools_lock);
+}
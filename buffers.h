@@ -0,0 +1,67 @@
+#ifndef MASKER_BUFFERS_H
+#  define MASKER_BUFFERS_H
+#  include <png.h>
+#  include <zlib.h>
+#  include "loader.h"
+
+/* Per-thread pools of frame buffers and libpng scratch memory, so the
+ * steady-state decode path makes no heap allocations.
+ *
+ * Frame buffers hold a whole frame of one pixel size plus its row
+ * pointers in one block, so gray frames take a quarter of an RGBA one.
+ * Released buffers are parked in the releasing thread's pool for their
+ * pixel size, up to the configured pool size each, and freed beyond that. libpng read structs
+ * allocate from a per-thread arena which is reset when they are
+ * destroyed; one decoder per thread may be live at a time, any others
+ * fall back to malloc. */
+
+#  define MASKER_DEFAULT_POOL_SIZE 4
+
+#  define MASKER_MAX_PIXEL_BYTES 4
+
+typedef struct masker_buffer {
+  png_bytep rows[HEIGHT];
+  png_byte *block;
+  int bytes_per_pixel;
+  struct masker_buffer *next;
+} masker_buffer_t;
+
+/* Scratch slots, one per user so nested users never share a block */
+typedef enum masker_scratch_slot {
+  MASKER_SCRATCH_PNG_READ,   // PNG decoder read buffer and row
+  MASKER_SCRATCH_TILES,      // raw and compressed tiles
+  MASKER_SCRATCH_VALIDATE,   // read buffer for validation scans
+  MASKER_SCRATCH_BANDS,      // per-band partial totals
+  MASKER_SCRATCH_SLOTS
+} masker_scratch_slot_t;
+
+typedef struct masker_buffer_stats {
+  unsigned long frame_hits;     // buffers served from a pool
+  unsigned long frame_misses;   // buffers that had to be allocated
+  unsigned long frame_drops;    // released buffers freed as the pool was full
+  unsigned long png_hits;       // libpng allocations served by the arena
+  unsigned long png_misses;     // libpng allocations that fell back to malloc
+  unsigned long pooled;         // buffers currently parked across all pools
+  int pool_size;
+} masker_buffer_stats_t;
+
+/* Rows are laid out contiguously for the given pixel size (1 to 4),
+ * uninitialised */
+masker_buffer_t *buffer_acquire(int bytes_per_pixel);
+void buffer_release(masker_buffer_t *buffer);
+
+png_structp buffers_create_read_struct(void);
+void buffers_destroy_read_struct(png_structpp png_ptr, png_infopp info_ptr);
+
+/* Thread-local scratch of at least size bytes in the slot, valid until the
+ * slot's next call */
+void *buffers_scratch(masker_scratch_slot_t slot, size_t size);
+
+/* Thread-local zlib inflater, reset and ready for a new stream */
+z_stream *buffers_inflater(void);
+
+void buffers_set_pool_size(int pool_size);
+void buffers_get_stats(masker_buffer_stats_t *stats);
+void buffers_reset_stats(void);
+
+#endif	// MASKER_BUFFERS_H
@@ -0,0 +1,530 @@
+#define _POSIX_C_SOURCE 200809L
+#include "metmasker.h"
+#include "workers.h"
+#include "store.h"
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#define OP_TOTALS 0
+#define OP_STATS 1
+#define OP_CONVERT 2
+#define OP_INGEST 3
+
+static const char *usage =
+  "usage: metmasker [options] <totals|stats|convert> [file|dir ...]\n"
+  "       metmasker [options] ingest dir\n"
+  "\n"
+  "  totals   rain total under each mask for every frame\n"
+  "  stats    per-class pixel counts and total rain for every frame\n"
+  "  convert  write each met frame as a grayscale png into -o DIR\n"
+  "  ingest   process the frames in dir, then watch it and process each\n"
+  "           new or changed frame as it lands, appending mask totals to\n"
+  "           the -s store until interrupted; a restart skips frames\n"
+  "           already in the store\n"
+  "\n"
+  "  -m FILE  mask image, repeat for several masks\n"
+  "  -f FILE  read frame paths from FILE, one per line (- for stdin)\n"
+  "  -o DIR   output directory for convert\n"
+  "  -s FILE  results store for ingest, created if missing\n"
+  "  -j N     worker threads, defaults to every core\n"
+  "  -b       binary output, one fixed-size record per frame in native\n"
+  "           byte order: an int32 status, then for totals a float32\n"
+  "           per mask, for stats a float32 total and a uint64 count\n"
+  "           for each of dry,r0.25,...,r48; values are 0 on failure\n"
+  "\n"
+  "Directories are expanded to the .png and .mtl files they contain.\n"
+  "Results are written in input order; failures go to stderr.\n";
+
+
+typedef struct path_list {
+  char **paths;
+  int count, capacity;
+} path_list_t;
+
+typedef struct cli_job {
+  const char *path;
+  char *out_path;
+  int status;
+  float *totals;
+  metmasker_stats stats;
+  int done;
+} cli_job_t;
+
+typedef struct cli_context {
+  int op;
+  const metmasker_maskset *masks;
+  int n_masks;
+  const char *out_dir;
+  int binary;
+  pthread_mutex_t lock;
+  pthread_cond_t done;
+} cli_context_t;
+
+typedef struct cli_task {
+  cli_context_t *context;
+  cli_job_t *job;
+} cli_task_t;
+
+
+static int add_path(path_list_t *list, const char *path)
+{
+  if (list->count == list->capacity) {
+    int capacity = list->capacity ? 2 * list->capacity : 256;
+    char **grown = realloc(list->paths, capacity * sizeof(char*));
+    if (grown == NULL) return -1;
+    list->paths = grown;
+    list->capacity = capacity;
+  }
+  list->paths[list->count] = strdup(path);
+  if (list->paths[list->count] == NULL) return -1;
+  list->count++;
+  return 0;
+}
+
+/* DIR/NAME, without doubling the slash when dir already ends in one */
+static char *join_path(const char *dir, const char *name)
+{
+  size_t dir_len = strlen(dir);
+  while (dir_len > 1 && dir[dir_len - 1] == '/') dir_len--;
+  const char *sep = dir_len == 1 && dir[0] == '/' ? "" : "/";
+  size_t len = dir_len + strlen(name) + 2;
+  char *path = malloc(len);
+  if (path != NULL) snprintf(path, len, "%.*s%s%s", (int)dir_len, dir, sep, name);
+  return path;
+}
+
+static void free_paths(path_list_t *list)
+{
+  for (int i=0; i<list->count; i++) free(list->paths[i]);
+  free(list->paths);
+  list->paths = NULL;
+  list->count = list->capacity = 0;
+}
+
+static int has_frame_suffix(const char *name)
+{
+  size_t len = strlen(name);
+  return len > 4 && (strcmp(name + len - 4, ".png") == 0
+                     || strcmp(name + len - 4, ".mtl") == 0);
+}
+
+static int compare_paths(const void *a, const void *b)
+{
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Add a file, or the sorted frames of a directory */
+static int add_input(path_list_t *list, const char *path)
+{
+  DIR *dir = opendir(path);
+  if (dir == NULL) return add_path(list, path);
+
+  int first = list->count;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (!has_frame_suffix(entry->d_name)) continue;
+    char *full = join_path(path, entry->d_name);
+    if (full == NULL) {
+      closedir(dir);
+      return -1;
+    }
+    int error = add_path(list, full);
+    free(full);
+    if (error) {
+      closedir(dir);
+      return -1;
+    }
+  }
+  closedir(dir);
+  qsort(list->paths + first, list->count - first, sizeof(char*), compare_paths);
+  return 0;
+}
+
+static int add_list_file(path_list_t *list, const char *list_file)
+{
+  FILE *fp = strcmp(list_file, "-") == 0 ? stdin : fopen(list_file, "r");
+  if (fp == NULL) return -1;
+
+  char *line = NULL;
+  size_t capacity = 0;
+  ssize_t len;
+  int error = 0;
+  while (!error && (len = getline(&line, &capacity, fp)) != -1) {
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+      line[--len] = '\0';
+    if (len > 0) error = add_input(list, line);
+  }
+  free(line);
+  if (fp != stdin) fclose(fp);
+  return error;
+}
+
+
+/* Output path for convert: DIR/<basename>.png */
+static char *convert_path(const char *out_dir, const char *path)
+{
+  const char *base = strrchr(path, '/');
+  base = base == NULL ? path : base + 1;
+  size_t stem = strlen(base);
+  if (has_frame_suffix(base)) stem -= 4;
+
+  char *name = malloc(stem + 5);
+  if (name == NULL) return NULL;
+  snprintf(name, stem + 5, "%.*s.png", (int)stem, base);
+  char *out_path = join_path(out_dir, name);
+  free(name);
+  return out_path;
+}
+
+static void run_job(void *arg)
+{
+  cli_task_t *task = arg;
+  cli_context_t *context = task->context;
+  cli_job_t *job = task->job;
+
+  switch (context->op) {
+    case OP_TOTALS:
+      job->totals = malloc((context->n_masks + 1) * sizeof(float));
+      job->status = job->totals == NULL ? METMASKER_MEMORY_ERROR
+        : metmasker_totals(job->totals, context->masks, job->path);
+      break;
+    case OP_STATS:
+      job->status = metmasker_stats_file(&job->stats, job->path);
+      break;
+    case OP_CONVERT:
+      job->out_path = convert_path(context->out_dir, job->path);
+      job->status = job->out_path == NULL ? METMASKER_MEMORY_ERROR
+        : metmasker_convert(job->path, job->out_path);
+      break;
+  }
+
+  pthread_mutex_lock(&context->lock);
+  job->done = 1;
+  pthread_cond_broadcast(&context->done);
+  pthread_mutex_unlock(&context->lock);
+  free(task);
+}
+
+
+static void emit_job(const cli_context_t *context, cli_job_t *job)
+{
+  if (job->status != METMASKER_SUCCESS)
+    fprintf(stderr, "metmasker: %s: %s\n", job->path,
+      metmasker_strerror(job->status));
+
+  if (context->binary) {
+    // Fixed widths, so the layout in the usage text holds on every platform
+    int32_t status = job->status;
+    fwrite(&status, sizeof(status), 1, stdout);
+    if (context->op == OP_TOTALS) {
+      for (int m=0; m<context->n_masks; m++) {
+        float value = status == METMASKER_SUCCESS ? job->totals[m] : 0.0;
+        fwrite(&value, sizeof(value), 1, stdout);
+      }
+    } else if (context->op == OP_STATS) {
+      float total = status == METMASKER_SUCCESS ? job->stats.total : 0.0;
+      fwrite(&total, sizeof(total), 1, stdout);
+      for (int c=0; c<=METMASKER_RAIN_CLASSES; c++) {
+        uint64_t count = status == METMASKER_SUCCESS ? job->stats.counts[c] : 0;
+        fwrite(&count, sizeof(count), 1, stdout);
+      }
+    }
+  } else if (job->status == METMASKER_SUCCESS) {
+    printf("%s", job->path);
+    if (context->op == OP_TOTALS) {
+      for (int m=0; m<context->n_masks; m++) printf(",%.2f", job->totals[m]);
+    } else if (context->op == OP_STATS) {
+      printf(",%.2f", job->stats.total);
+      for (int c=0; c<=METMASKER_RAIN_CLASSES; c++)
+        printf(",%lu", job->stats.counts[c]);
+    } else {
+      printf(",%s", job->out_path);
+    }
+    printf("\n");
+  }
+
+  free(job->totals);
+  free(job->out_path);
+  job->totals = NULL;
+  job->out_path = NULL;
+}
+
+static void emit_header(const cli_context_t *context, char **mask_names)
+{
+  if (context->binary) return;
+  printf("file");
+  if (context->op == OP_TOTALS) {
+    for (int m=0; m<context->n_masks; m++) printf(",%s", mask_names[m]);
+  } else if (context->op == OP_STATS) {
+    printf(",total,dry,r0.25,r0.75,r1.5,r3,r6,r12,r24,r48");
+  } else {
+    printf(",output");
+  }
+  printf("\n");
+}
+
+
+/* ===== INGEST ===== */
+static volatile sig_atomic_t ingest_stopping = 0;
+
+static void stop_ingest(int sig) {
+  ingest_stopping = 1;
+}
+
+/* Totals for one frame unless this version of it is already stored */
+static int ingest_file(const cli_context_t *context, masker_store_t *store,
+  const char *path)
+{
+  masker_store_record_t record;
+  // A file that vanished before we got to it is simply skipped
+  if (store_file_key(&record.key, path) != MASKER_SUCCESS
+      || store_has(store, &record.key))
+    return 0;
+
+  cli_job_t job = {.path = path};
+  job.totals = malloc((context->n_masks + 1) * sizeof(float));
+  if (job.totals == NULL) return -1;
+  job.status = metmasker_totals(job.totals, context->masks, path);
+
+  record.timestamp = store_frame_time(path, &record.key);
+  record.status = job.status;
+  int error_bit = store_append(store, &record, job.totals);
+  emit_job(context, &job);
+  fflush(stdout);
+  if (error_bit != MASKER_SUCCESS) {
+    fprintf(stderr, "metmasker: cannot append to store: %s\n",
+      metmasker_strerror(error_bit));
+    return -1;
+  }
+  return 0;
+}
+
+static int ingest_dir(const cli_context_t *context, masker_store_t *store,
+  const char *dir)
+{
+  path_list_t frames = {NULL, 0, 0};
+  int error = add_input(&frames, dir);
+  for (int i=0; i<frames.count && !error; i++)
+    error = ingest_file(context, store, frames.paths[i]);
+  free_paths(&frames);
+  return error;
+}
+
+static int run_ingest(const cli_context_t *context, char **mask_names,
+  const char *store_path, const char *dir)
+{
+  masker_store_t store;
+  int error_bit = store_open(&store, store_path,
+    (const char *const *)mask_names, context->n_masks);
+  if (error_bit != MASKER_SUCCESS) {
+    fprintf(stderr, "metmasker: %s: %s\n", store_path,
+      error_bit == MASKER_FAILURE ? "store holds different masks"
+      : metmasker_strerror(error_bit));
+    return 1;
+  }
+
+  // Watch before the catch-up scan so nothing landing meanwhile is missed
+  int fd = inotify_init1(IN_CLOEXEC);
+  if (fd < 0 || inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    fprintf(stderr, "metmasker: cannot watch %s: %s\n", dir, strerror(errno));
+    if (fd >= 0) close(fd);
+    store_close(&store);
+    return 1;
+  }
+
+  // No SA_RESTART, so a signal interrupts the blocking read below
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = stop_ingest;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+
+  emit_header(context, mask_names);
+  fflush(stdout);
+  int error = ingest_dir(context, &store, dir);
+
+  char events[64 * (sizeof(struct inotify_event) + NAME_MAX + 1)]
+    __attribute__((aligned(__alignof__(struct inotify_event))));
+  while (!error && !ingest_stopping) {
+    ssize_t len = read(fd, events, sizeof(events));
+    if (len < 0) {
+      if (errno == EINTR) continue;
+      error = -1;
+      break;
+    }
+    for (char *p=events; p<events + len && !error; ) {
+      const struct inotify_event *event = (const struct inotify_event *)p;
+      p += sizeof(struct inotify_event) + event->len;
+      if (event->mask & IN_Q_OVERFLOW) {
+        // Dropped events: fall back to a rescan, the store skips repeats
+        error = ingest_dir(context, &store, dir);
+      } else if (event->len > 0 && has_frame_suffix(event->name)) {
+        char *path = join_path(dir, event->name);
+        if (path == NULL) {
+          error = -1;
+          break;
+        }
+        error = ingest_file(context, &store, path);
+        free(path);
+      }
+    }
+  }
+
+  close(fd);
+  store_close(&store);
+  return error ? 1 : 0;
+}
+
+
+int main(int argc, char **argv)
+{
+  path_list_t masks = {NULL, 0, 0};
+  path_list_t frames = {NULL, 0, 0};
+  const char *out_dir = NULL;
+  const char *store_path = NULL;
+  int n_threads = 0;
+  int binary = 0;
+  metmasker_maskset *mask_set = NULL;
+  cli_job_t *jobs = NULL;
+  int status = 2;   // usage errors until the options are accepted
+
+  int opt;
+  while ((opt = getopt(argc, argv, "m:f:o:s:j:bh")) != -1) {
+    switch (opt) {
+      case 'm':
+        if (add_path(&masks, optarg)) goto done;
+        break;
+      case 'f':
+        if (add_list_file(&frames, optarg)) {
+          fprintf(stderr, "metmasker: cannot read list %s\n", optarg);
+          goto done;
+        }
+        break;
+      case 'o': out_dir = optarg; break;
+      case 's': store_path = optarg; break;
+      case 'j': n_threads = atoi(optarg); break;
+      case 'b': binary = 1; break;
+      case 'h':
+        fputs(usage, stdout);
+        status = 0;
+        goto done;
+      default:
+        fputs(usage, stderr);
+        goto done;
+    }
+  }
+  if (optind >= argc) {
+    fputs(usage, stderr);
+    goto done;
+  }
+
+  int op;
+  const char *op_name = argv[optind++];
+  if (strcmp(op_name, "totals") == 0) op = OP_TOTALS;
+  else if (strcmp(op_name, "stats") == 0) op = OP_STATS;
+  else if (strcmp(op_name, "convert") == 0) op = OP_CONVERT;
+  else if (strcmp(op_name, "ingest") == 0) op = OP_INGEST;
+  else {
+    fprintf(stderr, "metmasker: unknown operation %s\n", op_name);
+    goto done;
+  }
+  if ((op == OP_TOTALS || op == OP_INGEST) && masks.count == 0) {
+    fprintf(stderr, "metmasker: %s needs at least one -m mask\n", op_name);
+    goto done;
+  }
+  if (op == OP_INGEST && (store_path == NULL || argc - optind != 1)) {
+    fprintf(stderr, "metmasker: ingest needs an -s store and one directory\n");
+    goto done;
+  }
+  if (op == OP_CONVERT && out_dir == NULL) {
+    fprintf(stderr, "metmasker: convert needs an -o output directory\n");
+    goto done;
+  }
+  for (int i=optind; i<argc && op != OP_INGEST; i++) {
+    if (add_input(&frames, argv[i])) goto done;
+  }
+
+  status = 1;
+  cli_context_t context = {.op = op, .masks = NULL, .n_masks = 0,
+    .out_dir = out_dir, .binary = binary};
+  if (masks.count > 0) {
+    int failed_index = 0;
+    int error_bit = metmasker_maskset_open(&mask_set,
+      (const char *const *)masks.paths, masks.count, &failed_index);
+    if (error_bit != METMASKER_SUCCESS) {
+      fprintf(stderr, "metmasker: %s: %s\n", masks.paths[failed_index],
+        metmasker_strerror(error_bit));
+      goto done;
+    }
+    context.masks = mask_set;
+    context.n_masks = masks.count;
+  }
+  if (op == OP_INGEST) {
+    // Results are emitted exactly like totals
+    context.op = OP_TOTALS;
+    status = run_ingest(&context, masks.paths, store_path, argv[optind]);
+    goto done;
+  }
+
+  jobs = calloc(frames.count + 1, sizeof(cli_job_t));
+  masker_workers_t workers;
+  if (jobs == NULL || workers_create(&workers, n_threads, 0) != METMASKER_SUCCESS) {
+    fprintf(stderr, "metmasker: unable to start workers\n");
+    goto done;
+  }
+  pthread_mutex_init(&context.lock, NULL);
+  pthread_cond_init(&context.done, NULL);
+  emit_header(&context, masks.paths);
+
+  // Submit in order and stream each result as soon as its turn comes up.
+  // Running out of memory stops submitting but still drains what was sent
+  int n_jobs = frames.count, next = 0, failures = 0;
+  for (int i=0; i<=n_jobs; i++) {
+    if (i < n_jobs) {
+      cli_task_t *task = malloc(sizeof(cli_task_t));
+      if (task == NULL) {
+        fprintf(stderr, "metmasker: out of memory\n");
+        n_jobs = i;
+        failures++;
+      } else {
+        jobs[i].path = frames.paths[i];
+        task->context = &context;
+        task->job = &jobs[i];
+        workers_submit(&workers, run_job, task);
+      }
+    }
+
+    pthread_mutex_lock(&context.lock);
+    while (next < n_jobs && (jobs[next].done || i == n_jobs)) {
+      while (!jobs[next].done)
+        pthread_cond_wait(&context.done, &context.lock);
+      pthread_mutex_unlock(&context.lock);
+      emit_job(&context, &jobs[next]);
+      if (jobs[next].status != METMASKER_SUCCESS) failures++;
+      next++;
+      pthread_mutex_lock(&context.lock);
+    }
+    pthread_mutex_unlock(&context.lock);
+  }
+
+  workers_destroy(&workers);
+  pthread_mutex_destroy(&context.lock);
+  pthread_cond_destroy(&context.done);
+  status = failures > 0 ? 1 : 0;
+
+done:
+  if (mask_set != NULL) metmasker_maskset_close(mask_set);
+  free_paths(&frames);
+  free_paths(&masks);
+  free(jobs);
+  return status;
+}
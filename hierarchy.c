@@ -0,0 +1,144 @@
+#include "hierarchy.h"
+#include "algorithms.h"
+#include "stats.h"
+#include "workers.h"
+#include <string.h>
+
+
+/* ===== BUILDING ===== */
+int hierarchy_create(masker_hierarchy_t *hierarchy, const masker_mask_t *leaves,
+  int n_leaves, const int *parents, int n_regions)
+{
+  hierarchy->parents = NULL;
+  hierarchy->labels = NULL;
+  if (n_leaves < 0 || n_leaves > MASKER_HIERARCHY_MAX_LEAVES || n_regions < n_leaves)
+    return MASKER_FAILURE;
+  for (int r=0; r<n_regions; r++) {
+    if (parents[r] != -1 && (parents[r] <= r || parents[r] >= n_regions))
+      return MASKER_FAILURE;
+  }
+
+  hierarchy->parents = malloc((n_regions + 1) * sizeof(int));
+  hierarchy->labels = calloc((size_t)WIDTH * HEIGHT, sizeof(uint16_t));
+  if (hierarchy->parents == NULL || hierarchy->labels == NULL) {
+    hierarchy_free(hierarchy);
+    return MASKER_MEMORY_ERROR;
+  }
+  memcpy(hierarchy->parents, parents, n_regions * sizeof(int));
+  hierarchy->n_leaves = n_leaves;
+  hierarchy->n_regions = n_regions;
+  hierarchy->x_min = WIDTH - 1;
+  hierarchy->x_max = 0;
+  hierarchy->y_min = HEIGHT - 1;
+  hierarchy->y_max = 0;
+
+  for (int l=0; l<n_leaves; l++) {
+    const masker_mask_t *mask = &leaves[l];
+    for (int y=mask->y_min; y<=mask->y_max; y++) {
+      png_byte *mask_row = mask->image[y];
+      uint16_t *labels = &hierarchy->labels[(size_t)y * WIDTH];
+      for (int x=mask->x_min; x<=mask->x_max; x++) {
+        if (mask_row[x] == 0) continue;
+        if (labels[x] != 0) {
+          hierarchy_free(hierarchy);
+          return MASKER_FAILURE;
+        }
+        labels[x] = l + 1;
+        if (x < hierarchy->x_min) hierarchy->x_min = x;
+        if (x > hierarchy->x_max) hierarchy->x_max = x;
+        if (y < hierarchy->y_min) hierarchy->y_min = y;
+        if (y > hierarchy->y_max) hierarchy->y_max = y;
+      }
+    }
+  }
+  return MASKER_SUCCESS;
+}
+
+
+void hierarchy_free(masker_hierarchy_t *hierarchy)
+{
+  free(hierarchy->parents);
+  free(hierarchy->labels);
+  hierarchy->parents = NULL;
+  hierarchy->labels = NULL;
+  hierarchy->n_leaves = 0;
+  hierarchy->n_regions = 0;
+}
+
+
+/* ===== TOTALS ===== */
+int hierarchy_totals_image(const masker_hierarchy_t *hierarchy, long *res,
+  masker_image_t image)
+{
+  if (image.bytes_per_pixel != 1 && image.bytes_per_pixel != 4)
+    return MASKER_COLOR_TYPE_ERROR;
+
+  unsigned long long start = STATS_START();
+  int error_bit = MASKER_SUCCESS;
+  memset(res, 0, hierarchy->n_regions * sizeof(long));
+  for (int y=hierarchy->y_min; y<=hierarchy->y_max; y++) {
+    const uint16_t *labels = &hierarchy->labels[(size_t)y * WIDTH];
+    png_byte *image_row = image.image[y];
+    for (int x=hierarchy->x_min; x<=hierarchy->x_max; x++) {
+      if (labels[x] == 0) continue;
+      png_byte value = image_row[x];
+      if (image.bytes_per_pixel == 4
+          && met_to_gray(&value, &image_row[x * 4]) != MASKER_SUCCESS) {
+        error_bit = MASKER_MET_COLOR_ERROR;
+        continue;
+      }
+      res[labels[x] - 1] += value;
+    }
+  }
+
+  // Children come before their parents, so one sweep completes each level
+  for (int r=0; r<hierarchy->n_regions; r++) {
+    if (hierarchy->parents[r] >= 0) res[hierarchy->parents[r]] += res[r];
+  }
+
+  unsigned long long pixels = hierarchy->x_max < hierarchy->x_min ? 0
+    : (unsigned long long)(hierarchy->x_max - hierarchy->x_min + 1)
+      * (hierarchy->y_max - hierarchy->y_min + 1);
+  stats_record(MASKER_STAGE_MASK, start,
+    (image.bytes_per_pixel + sizeof(uint16_t)) * pixels, pixels);
+  return error_bit;
+}
+
+
+int hierarchy_totals_file(const masker_hierarchy_t *hierarchy, long *res,
+  const char *file_name)
+{
+  unsigned long long frame_start = STATS_START();
+  masker_image_t image;
+  int error_bit = read_frame_region(&image, file_name,
+    hierarchy->x_min, hierarchy->x_max, hierarchy->y_min, hierarchy->y_max);
+  if (error_bit != MASKER_SUCCESS) return error_bit;
+
+  error_bit = hierarchy_totals_image(hierarchy, res, image);
+  free_image_memory(&image);
+  if (error_bit == MASKER_SUCCESS) stats_frame(frame_start);
+  return error_bit;
+}
+
+
+typedef struct hierarchy_batch {
+  const masker_hierarchy_t *hierarchy;
+  long *res;
+  const char *const *file_names;
+} hierarchy_batch_t;
+
+static int hierarchy_item(void *ctx, int i)
+{
+  hierarchy_batch_t *batch = ctx;
+  return hierarchy_totals_file(batch->hierarchy,
+    &batch->res[(size_t)i * batch->hierarchy->n_regions], batch->file_names[i]);
+}
+
+
+int hierarchy_totals_files(const masker_hierarchy_t *hierarchy, long *res,
+  const char *const *file_names, int n_files, int n_threads, int *failed_index)
+{
+  hierarchy_batch_t batch = {hierarchy, res, file_names};
+  return workers_map(n_threads, n_files, hierarchy_item, &batch, NULL,
+    failed_index);
+}
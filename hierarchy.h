@@ -0,0 +1,38 @@
+#ifndef MASKER_HIERARCHY_H
+#  define MASKER_HIERARCHY_H
+#  include <stdint.h>
+#  include "loader.h"
+
+/* Nested regions totalled from one pass over the finest level.
+ *
+ * The finest regions (leaves) are disjoint masks compiled into a label
+ * per pixel, so each frame pixel is read once whatever the depth. Regions
+ * are numbered leaves first; every region's parent comes after it, or is
+ * -1 at the top, so parents are totalled by a single forward sweep. */
+
+#  define MASKER_HIERARCHY_MAX_LEAVES 65535
+
+typedef struct masker_hierarchy {
+  int n_leaves, n_regions;
+  int *parents;           // n_regions entries
+  uint16_t *labels;       // HEIGHT x WIDTH, leaf + 1 or 0 outside
+  int x_min, x_max;       // inclusive box of the labelled pixels
+  int y_min, y_max;
+} masker_hierarchy_t;
+
+/* MASKER_FAILURE if leaves overlap, a parent does not follow its child or
+ * there are too many leaves */
+int hierarchy_create(masker_hierarchy_t *hierarchy, const masker_mask_t *leaves,
+  int n_leaves, const int *parents, int n_regions);
+void hierarchy_free(masker_hierarchy_t *hierarchy);
+
+/* Totals for every region, in grayscale units, n_regions longs */
+int hierarchy_totals_image(const masker_hierarchy_t *hierarchy, long *res,
+  masker_image_t image);
+int hierarchy_totals_file(const masker_hierarchy_t *hierarchy, long *res,
+  const char *file_name);
+/* One frame per file on n_threads threads (0 for every core) */
+int hierarchy_totals_files(const masker_hierarchy_t *hierarchy, long *res,
+  const char *const *file_names, int n_files, int n_threads, int *failed_index);
+
+#endif	// MASKER_HIERARCHY_H
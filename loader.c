@@ -1,4 +1,13 @@
+#define _POSIX_C_SOURCE 200809L
 #include "loader.h"
+#include "buffers.h"
+#include "stats.h"
+#include "tiles.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 
 /* Translate abstract PNG color codes to bytes per pixel */
@@ -22,31 +31,113 @@ static int translate_color_type(int* result, png_byte color_type) {
 }
 
 
-/* Read file into memory and return pointer to image */
-int read_png_file(masker_image_t *result, const char *file_name)
+/* Buffered reads from a file descriptor, so decoding avoids stdio's
+ * per-stream allocations */
+#define READ_CHUNK (64 * 1024)
+
+typedef struct fd_source {
+  int fd;
+  unsigned char *buffer;
+  size_t pos, len;
+  unsigned long long io_ns, io_bytes;   // only kept while stats are on
+} fd_source_t;
+
+static void read_fd_data(png_structp png_ptr, png_bytep data, png_size_t length)
 {
-  FILE *fp = fopen(file_name, "rb");
-  if (fp == NULL) {
+  fd_source_t *source = png_get_io_ptr(png_ptr);
+  while (length > 0) {
+    if (source->pos == source->len) {
+      unsigned long long start = STATS_START();
+      ssize_t got = read(source->fd, source->buffer, READ_CHUNK);
+      if (got <= 0) png_error(png_ptr, "Read error");
+      source->pos = 0;
+      source->len = got;
+      if (start) {
+        source->io_ns += stats_now() - start;
+        source->io_bytes += got;
+      }
+    }
+    size_t n = source->len - source->pos;
+    if (n > length) n = length;
+    memcpy(data, source->buffer + source->pos, n);
+    source->pos += n;
+    data += n;
+    length -= n;
+  }
+}
+
+
+/* An open PNG decoder positioned at the first row */
+typedef struct png_reader {
+  fd_source_t source;
+  png_structp png_ptr;
+  png_infop info_ptr;
+  int pixel_size;
+  int color_type;
+  int interlaced;
+  unsigned long long start;
+} png_reader_t;
+
+static void png_reader_close(png_reader_t *reader)
+{
+  buffers_destroy_read_struct(&reader->png_ptr, &reader->info_ptr);
+  close(reader->source.fd);
+}
+
+/* Record IO and decode time for a finished read, less time spent in
+ * callers' row handlers, which is counted by their own stages */
+static void png_reader_stats(png_reader_t *reader, unsigned long long other_ns)
+{
+  if (!reader->start) return;
+  unsigned long long elapsed = stats_now() - reader->start;
+  stats_add(MASKER_STAGE_IO, reader->source.io_ns, reader->source.io_bytes, 0);
+  stats_add(MASKER_STAGE_DECODE, elapsed - reader->source.io_ns - other_ns,
+    (unsigned long long)WIDTH * HEIGHT * reader->pixel_size, WIDTH * HEIGHT);
+}
+
+/* Open file_name and read its first 8 bytes, enough to tell a PNG from a
+ * tiled frame. Files too short for either are not PNGs. */
+static int open_frame(int *fd, unsigned char *sig, const char *file_name)
+{
+  *fd = open(file_name, O_RDONLY);
+  if (*fd < 0) {
     return MASKER_IO_ERROR;
   }
+  if (read(*fd, sig, 8) < 8) {
+    close(*fd);
+    return MASKER_NOT_PNG_ERROR;
+  }
+  return MASKER_SUCCESS;
+}
 
+/* Read up to the image data of the PNG open on fd, its signature already
+ * read into sig. The scratch block holds the read buffer followed by
+ * extra_scratch bytes for the caller. The reader owns fd from here on;
+ * set reader->start before calling. */
+static int png_reader_begin(png_reader_t *reader, int fd,
+  const unsigned char *sig, size_t extra_scratch)
+{
   // Check file is png
-  unsigned char sig[8];
-  if (fread(sig, 1, 8, fp) < 8) {
-	fclose(fp);
-	return MASKER_NOT_PNG_ERROR;
+  fd_source_t source = {fd, buffers_scratch(MASKER_SCRATCH_PNG_READ,
+    READ_CHUNK + extra_scratch),
+    0, 0, 0, 8};
+  if (source.buffer == NULL) {
+    close(fd);
+    return MASKER_MEMORY_ERROR;
   }
-  if (!png_check_sig(sig, 8)) {
-    fclose(fp);
+  if (!png_check_sig((png_bytep)sig, 8)) {
+    close(fd);
     return MASKER_NOT_PNG_ERROR;
   }
+  if (reader->start) source.io_ns = stats_now() - reader->start;   // open and signature
+  reader->source = source;
 
 
   // Initialise png structs
   png_structp png_ptr;
-  png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  png_ptr = buffers_create_read_struct();
   if (png_ptr == NULL) {
-    fclose(fp);
+    close(fd);
     return MASKER_MEMORY_ERROR;
   }
 
@@ -54,18 +145,19 @@ int read_png_file(masker_image_t *result, const char *file_name)
   png_infop info_ptr;
   info_ptr = png_create_info_struct(png_ptr);
   if (info_ptr == NULL) {
-    fclose(fp);
-    png_destroy_read_struct(&png_ptr, NULL, NULL);
+    close(fd);
+    buffers_destroy_read_struct(&png_ptr, NULL);
     return MASKER_MEMORY_ERROR;
   }
+  reader->png_ptr = png_ptr;
+  reader->info_ptr = info_ptr;
 
   // Initialise IO, read png info bytes
   if (setjmp(png_jmpbuf(png_ptr))) {
-    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-    fclose(fp);
+    png_reader_close(reader);
     return MASKER_INIT_IO_ERROR;
   }
-  png_init_io(png_ptr, fp);
+  png_set_read_fn(png_ptr, &reader->source, read_fd_data);
   png_set_sig_bytes(png_ptr, 8);
   png_read_info(png_ptr, info_ptr);
 
@@ -74,78 +166,386 @@ int read_png_file(masker_image_t *result, const char *file_name)
   int height = png_get_image_height(png_ptr, info_ptr);
   int depth = png_get_bit_depth(png_ptr, info_ptr);
   if ((width != WIDTH) || (height != HEIGHT) || (depth != DEPTH)) {
-    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-    fclose(fp);
+    png_reader_close(reader);
     return MASKER_IMAGE_SIZE_DEPTH_ERROR;
   }
 
-  // Allocate memory and read image
-  int color_type = png_get_color_type(png_ptr, info_ptr);
-  int pixel_size;
-  if (translate_color_type(&pixel_size, color_type) != MASKER_SUCCESS) {
-    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-    fclose(fp);
+  reader->color_type = png_get_color_type(png_ptr, info_ptr);
+  if (translate_color_type(&reader->pixel_size, reader->color_type) != MASKER_SUCCESS) {
+    png_reader_close(reader);
     return MASKER_COLOR_TYPE_ERROR;
   }
-  if (setjmp(png_jmpbuf(png_ptr))) {
-    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-    fclose(fp);
-    return MASKER_READ_ERROR;
-  }
-  png_bytep *image = malloc(sizeof(png_bytep) * HEIGHT);
-  if (image == NULL) {
-    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-    fclose(fp);
+  reader->interlaced =
+    png_get_interlace_type(png_ptr, info_ptr) != PNG_INTERLACE_NONE;
+  return MASKER_SUCCESS;
+}
+
+/* Open file_name and read up to the image data */
+static int png_reader_open(png_reader_t *reader, const char *file_name,
+  size_t extra_scratch)
+{
+  reader->start = STATS_START();
+  int fd;
+  unsigned char sig[8];
+  int error_bit = open_frame(&fd, sig, file_name);
+  if (error_bit != MASKER_SUCCESS) return error_bit;
+  return png_reader_begin(reader, fd, sig, extra_scratch);
+}
+
+
+/* Decode the rest of an open reader's frame, then close it */
+static int png_reader_image(masker_image_t *result, png_reader_t *reader)
+{
+  // Take a pooled frame buffer and read image
+  masker_buffer_t *volatile buffer = buffer_acquire(reader->pixel_size);
+  if (buffer == NULL) {
+    png_reader_close(reader);
     return MASKER_MEMORY_ERROR;
   }
-  for (int y=0; y<HEIGHT; y++) {
-    image[y] = (png_byte*) malloc(png_get_rowbytes(png_ptr, info_ptr));
-    if (image[y] == NULL) {
-      for (int z=0; z<y; z++) {
-        free(image[y]);
-      }
-      png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-      fclose(fp);
-      return MASKER_MEMORY_ERROR;
-    }
+  if (setjmp(png_jmpbuf(reader->png_ptr))) {
+    png_reader_close(reader);
+    buffer_release(buffer);
+    return MASKER_READ_ERROR;
   }
-  png_read_image(png_ptr, image);
+  png_read_image(reader->png_ptr, buffer->rows);
 
   // Clean up and return image
-  fclose(fp);
-  png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+  png_reader_close(reader);
+  png_reader_stats(reader, 0);
 
-  result->image = image;
-  result->bytes_per_pixel = pixel_size;
-  result->color_type = color_type;
+  result->image = buffer->rows;
+  result->buffer = buffer;
+  result->bytes_per_pixel = reader->pixel_size;
+  result->color_type = reader->color_type;
   result->is_freed = 0;
   return MASKER_SUCCESS;
 }
 
 
+/* Read file into memory and return pointer to image */
+int read_png_file(masker_image_t *result, const char *file_name)
+{
+  png_reader_t reader;
+  int error_bit = png_reader_open(&reader, file_name, 0);
+  if (error_bit != MASKER_SUCCESS) return error_bit;
+  return png_reader_image(result, &reader);
+}
+
+
+/* Hand each row of a decoded frame to fn */
+static int frame_rows(masker_image_t image, masker_row_fn fn, void *arg)
+{
+  int error_bit = MASKER_SUCCESS;
+  for (int y=0; y<HEIGHT && error_bit == MASKER_SUCCESS; y++)
+    error_bit = fn(arg, y, image.image[y], image.bytes_per_pixel);
+  free_image_memory(&image);
+  return error_bit;
+}
+
+int read_frame_rows(const char *file_name, masker_row_fn fn, void *arg)
+{
+  png_reader_t reader;
+  reader.start = STATS_START();
+  unsigned char sig[8];
+  int fd;
+  int error_bit = open_frame(&fd, sig, file_name);
+  if (error_bit != MASKER_SUCCESS) return error_bit;
+
+  masker_image_t image;
+  if (is_tiled_sig(sig)) {
+    error_bit = read_tiled_region_fd(&image, fd, 0, WIDTH - 1, 0, HEIGHT - 1);
+    close(fd);
+    return error_bit == MASKER_SUCCESS ? frame_rows(image, fn, arg) : error_bit;
+  }
+
+  error_bit = png_reader_begin(&reader, fd, sig, (size_t)WIDTH * 4);
+  if (error_bit != MASKER_SUCCESS) return error_bit;
+  if (reader.interlaced) {
+    // Rows of an interlaced image are only final after the last pass
+    error_bit = png_reader_image(&image, &reader);
+    return error_bit == MASKER_SUCCESS ? frame_rows(image, fn, arg) : error_bit;
+  }
+
+  png_bytep row = reader.source.buffer + READ_CHUNK;
+  volatile unsigned long long handler_ns = 0;
+  volatile int y = 0;
+  error_bit = MASKER_SUCCESS;
+  if (setjmp(png_jmpbuf(reader.png_ptr))) {
+    png_reader_close(&reader);
+    return MASKER_READ_ERROR;
+  }
+  for (; y<HEIGHT && error_bit == MASKER_SUCCESS; y++) {
+    png_read_row(reader.png_ptr, row, NULL);
+    unsigned long long start = reader.start ? stats_now() : 0;
+    error_bit = fn(arg, y, row, reader.pixel_size);
+    if (start) handler_ns += stats_now() - start;
+  }
+  if (error_bit == MASKER_SUCCESS) png_read_end(reader.png_ptr, NULL);
+
+  png_reader_close(&reader);
+  if (error_bit == MASKER_SUCCESS) png_reader_stats(&reader, handler_ns);
+  return error_bit;
+}
+
+
+/* ===== PROGRESSIVE DECODING ===== */
+static void push_info(png_structp png_ptr, png_infop info_ptr)
+{
+  masker_push_t *push = png_get_progressive_ptr(png_ptr);
+  if (png_get_image_width(png_ptr, info_ptr) != WIDTH
+      || png_get_image_height(png_ptr, info_ptr) != HEIGHT
+      || png_get_bit_depth(png_ptr, info_ptr) != DEPTH) {
+    push->error_bit = MASKER_IMAGE_SIZE_DEPTH_ERROR;
+    png_error(png_ptr, "Unexpected frame size or depth");
+  }
+  int color_type = png_get_color_type(png_ptr, info_ptr);
+  if (translate_color_type(&push->bytes_per_pixel, color_type) != MASKER_SUCCESS) {
+    push->error_bit = MASKER_COLOR_TYPE_ERROR;
+    png_error(png_ptr, "Unexpected color type");
+  }
+
+  push->interlaced =
+    png_get_interlace_type(png_ptr, info_ptr) != PNG_INTERLACE_NONE;
+  if (push->interlaced) {
+    // Passes are combined into a zeroed frame
+    png_set_interlace_handling(png_ptr);
+    push->error_bit = alloc_image_memory(&push->image, push->bytes_per_pixel,
+      color_type);
+    if (push->error_bit != MASKER_SUCCESS) png_error(png_ptr, "Out of memory");
+    push->has_image = 1;
+  }
+  png_read_update_info(png_ptr, info_ptr);
+}
+
+static void push_handle_row(masker_push_t *push, int y, png_bytep row)
+{
+  unsigned long long start = STATS_START();
+  int error_bit = push->fn(push->arg, y, row, push->bytes_per_pixel);
+  if (start) push->handler_ns += stats_now() - start;
+  if (error_bit != MASKER_SUCCESS) {
+    push->error_bit = error_bit;
+    png_error(push->png_ptr, "Row handler failed");
+  }
+  push->n_rows++;
+}
+
+static void push_row(png_structp png_ptr, png_bytep new_row,
+  png_uint_32 row_num, int pass)
+{
+  masker_push_t *push = png_get_progressive_ptr(png_ptr);
+  if (new_row == NULL || row_num >= HEIGHT) return;
+  if (push->interlaced) {
+    png_progressive_combine_row(png_ptr, push->image.image[row_num], new_row);
+  } else {
+    push_handle_row(push, row_num, new_row);
+  }
+}
+
+static void push_end_info(png_structp png_ptr, png_infop info_ptr)
+{
+  masker_push_t *push = png_get_progressive_ptr(png_ptr);
+  for (int y=0; push->interlaced && y<HEIGHT; y++)
+    push_handle_row(push, y, push->image.image[y]);
+  push->finished = 1;
+}
+
+
+int push_begin(masker_push_t *push, masker_row_fn fn, void *arg)
+{
+  memset(push, 0, sizeof(masker_push_t));
+  push->fn = fn;
+  push->arg = arg;
+  push->error_bit = MASKER_SUCCESS;
+
+  // Decoders outlive a call and move between threads, so skip the arenas
+  push->png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  if (push->png_ptr == NULL) return MASKER_MEMORY_ERROR;
+  push->info_ptr = png_create_info_struct(push->png_ptr);
+  if (push->info_ptr == NULL) {
+    png_destroy_read_struct(&push->png_ptr, NULL, NULL);
+    return MASKER_MEMORY_ERROR;
+  }
+  if (setjmp(png_jmpbuf(push->png_ptr))) {
+    png_destroy_read_struct(&push->png_ptr, &push->info_ptr, NULL);
+    return MASKER_INIT_IO_ERROR;
+  }
+  png_set_progressive_read_fn(push->png_ptr, push, push_info, push_row,
+    push_end_info);
+  return MASKER_SUCCESS;
+}
+
+
+int push_data(masker_push_t *push, const void *data, size_t length)
+{
+  if (push->error_bit != MASKER_SUCCESS || push->finished)
+    return push->error_bit;   // anything after IEND is ignored
+
+  // Collect the signature first, so other input is reported as not PNG
+  const png_byte *bytes = data;
+  int had_sig = push->sig_len == 8;
+  while (push->sig_len < 8 && length > 0) {
+    push->sig[push->sig_len++] = *bytes++;
+    length--;
+  }
+  if (push->sig_len < 8) return MASKER_SUCCESS;
+  if (!had_sig && !png_check_sig(push->sig, 8)) {
+    push->error_bit = MASKER_NOT_PNG_ERROR;
+    return push->error_bit;
+  }
+
+  unsigned long long start = STATS_START();
+  if (setjmp(png_jmpbuf(push->png_ptr))) {
+    if (push->error_bit == MASKER_SUCCESS) push->error_bit = MASKER_READ_ERROR;
+    return push->error_bit;
+  }
+  if (!had_sig) png_process_data(push->png_ptr, push->info_ptr, push->sig, 8);
+  if (length > 0)
+    png_process_data(push->png_ptr, push->info_ptr, (png_bytep)bytes, length);
+  if (start) push->decode_ns += stats_now() - start;
+  return MASKER_SUCCESS;
+}
+
+
+int push_fd(masker_push_t *push, int fd, int *eof)
+{
+  *eof = 0;
+  if (push->chunk == NULL && (push->chunk = malloc(READ_CHUNK)) == NULL)
+    return MASKER_MEMORY_ERROR;
+
+  while (push->error_bit == MASKER_SUCCESS) {
+    unsigned long long start = STATS_START();
+    ssize_t got = read(fd, push->chunk, READ_CHUNK);
+    if (got == 0) {
+      *eof = 1;
+      break;
+    } else if (got < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+      push->error_bit = MASKER_IO_ERROR;
+      break;
+    }
+    if (start) {
+      push->io_ns += stats_now() - start;
+      push->io_bytes += got;
+    }
+    push_data(push, push->chunk, got);
+  }
+  return push->error_bit;
+}
+
+
+int push_end(masker_push_t *push)
+{
+  int error_bit = push->error_bit;
+  if (error_bit == MASKER_SUCCESS && !push->finished) error_bit = MASKER_READ_ERROR;
+
+  if (push->png_ptr != NULL)
+    png_destroy_read_struct(&push->png_ptr, &push->info_ptr, NULL);
+  if (push->has_image) free_image_memory(&push->image);
+  push->has_image = 0;
+  free(push->chunk);
+  push->chunk = NULL;
+
+  if (masker_stats_enabled && error_bit == MASKER_SUCCESS) {
+    stats_add(MASKER_STAGE_IO, push->io_ns, push->io_bytes, 0);
+    stats_add(MASKER_STAGE_DECODE, push->decode_ns - push->handler_ns,
+      (unsigned long long)WIDTH * HEIGHT * push->bytes_per_pixel, WIDTH * HEIGHT);
+  }
+  return error_bit;
+}
+
+
 void free_image_memory(masker_image_t *image)
 {
   if (image->is_freed != 0) return;
-  for (int y=0; y<HEIGHT; y++) {
-    free(image->image[y]);
+  if (image->buffer != NULL) {
+    buffer_release(image->buffer);
+  } else {
+    for (int y=0; y<HEIGHT; y++) {
+      free(image->image[y]);
+    }
+    free(image->image);
   }
-  free(image->image);
   image->is_freed = 1;
 }
 
 void free_mask_memory(masker_mask_t *image)
 {
   if (image->is_freed != 0) return;
-  for (int y=0; y<HEIGHT; y++) {
-    free(image->image[y]);
+  if (image->mapped != NULL) {
+    free(image->image);   // only the row pointers are ours
+    munmap(image->mapped, image->mapped_len);
+  } else if (image->block != NULL) {
+    free(image->image);
+    free(image->block);
+  } else if (image->buffer != NULL) {
+    buffer_release(image->buffer);
+  } else {
+    for (int y=0; y<HEIGHT; y++) {
+      free(image->image[y]);
+    }
+    free(image->image);
   }
-  free(image->image);
   image->is_freed = 1;
 }
 
+/* Take a pooled frame buffer, contents are uninitialised */
+int acquire_image_memory(masker_image_t *image, int bytes_per_pixel, int color_type)
+{
+  masker_buffer_t *buffer = buffer_acquire(bytes_per_pixel);
+  if (buffer == NULL) return MASKER_MEMORY_ERROR;
+
+  image->image = buffer->rows;
+  image->buffer = buffer;
+  image->bytes_per_pixel = bytes_per_pixel;
+  image->color_type = color_type;
+  image->is_freed = 0;
+  return MASKER_SUCCESS;
+}
+
+
+/* As acquire_image_memory, with every pixel zeroed */
+int alloc_image_memory(masker_image_t *image, int bytes_per_pixel, int color_type)
+{
+  int error_bit = acquire_image_memory(image, bytes_per_pixel, color_type);
+  if (error_bit != MASKER_SUCCESS) return error_bit;
+
+  memset(image->image[0], 0, (size_t)WIDTH * HEIGHT * bytes_per_pixel);
+  return MASKER_SUCCESS;
+}
+
+
+int read_frame_region(masker_image_t *result, const char *file_name,
+  int x_min, int x_max, int y_min, int y_max)
+{
+  png_reader_t reader;
+  reader.start = STATS_START();
+  unsigned char sig[8];
+  int fd;
+  int error_bit = open_frame(&fd, sig, file_name);
+  if (error_bit != MASKER_SUCCESS) return error_bit;
+
+  if (is_tiled_sig(sig)) {
+    error_bit = read_tiled_region_fd(result, fd, x_min, x_max, y_min, y_max);
+    close(fd);
+    return error_bit;
+  }
+  error_bit = png_reader_begin(&reader, fd, sig, 0);
+  if (error_bit != MASKER_SUCCESS) return error_bit;
+  return png_reader_image(result, &reader);
+}
+
+
+int read_frame_file(masker_image_t *result, const char *file_name)
+{
+  return read_frame_region(result, file_name, 0, WIDTH - 1, 0, HEIGHT - 1);
+}
+
+
 /* Write image to file - possibly free memory */
 int write_png_file(masker_image_t image, const char *file_name)
 {
+  unsigned long long start = STATS_START();
   FILE *fp = fopen(file_name, "wb");
   if (fp == NULL) {
     return MASKER_IO_ERROR;
@@ -187,11 +587,14 @@ int write_png_file(masker_image_t image, const char *file_name)
 
   png_destroy_write_struct(&png_ptr, &info_ptr);
   fclose(fp);
+  stats_record(MASKER_STAGE_WRITE, start,
+    (unsigned long long)WIDTH * HEIGHT * image.bytes_per_pixel, WIDTH * HEIGHT);
   return MASKER_SUCCESS;
 }
 
 
-/* Read png file to mask struct */
+/* Read png file to mask struct, keeping the first channel of each pixel
+ * so kernels can step through masks one byte at a time */
 int read_mask_file(masker_mask_t* result, const char *file_name)
 {
   int x_min = WIDTH - 1;
@@ -200,15 +603,26 @@ int read_mask_file(masker_mask_t* result, const char *file_name)
   int y_max = 0;
 
   masker_image_t image;
-  int error_bit = read_png_file(&image, file_name);
+  int error_bit = read_frame_file(&image, file_name);
   if (error_bit != MASKER_SUCCESS)
     return error_bit;
 
+  png_bytep *rows = malloc(HEIGHT * sizeof(png_bytep));
+  png_byte *block = malloc((size_t)WIDTH * HEIGHT);
+  if (rows == NULL || block == NULL) {
+    free(rows);
+    free(block);
+    free_image_memory(&image);
+    return MASKER_MEMORY_ERROR;
+  }
+
+  int stride = image.bytes_per_pixel;
   for (int y=0; y<HEIGHT; y++) {
     png_byte *row = image.image[y];
+    png_byte *mask_row = rows[y] = &block[(size_t)y * WIDTH];
     for (int x=0; x<WIDTH; x++) {
-      png_byte *pixel =  &row[x * image.bytes_per_pixel];
-      if (pixel[0] > 0) {
+      mask_row[x] = row[x * stride];
+      if (mask_row[x] > 0) {
         if (x < x_min) x_min = x;
         if (x > x_max) x_max = x;
         if (y < y_min) y_min = y;
@@ -216,14 +630,19 @@ int read_mask_file(masker_mask_t* result, const char *file_name)
       }
     }
   }
+  free_image_memory(&image);
 
-  result->image = image.image,
-  result->bytes_per_pixel = image.bytes_per_pixel,
-  result->color_type = image.color_type,
+  result->image = rows;
+  result->buffer = NULL;
+  result->bytes_per_pixel = 1;
+  result->color_type = PNG_COLOR_TYPE_GRAY;
   result->is_freed = 0;
   result->x_min = x_min;
   result->x_max = x_max;
   result->y_min = y_min;
   result->y_max = y_max;
+  result->mapped = NULL;
+  result->mapped_len = 0;
+  result->block = block;
   return MASKER_SUCCESS;
 }
@@ -16,28 +16,39 @@
 #  include <stdlib.h>
 #  include <png.h>
 
-#  define WIDTH 500
-#  define HEIGHT 500
+/* Frame geometry is fixed at build time; override with -DWIDTH=... */
+#  ifndef WIDTH
+#    define WIDTH 500
+#  endif
+#  ifndef HEIGHT
+#    define HEIGHT 500
+#  endif
 #  define DEPTH 8
 
 
 /* Image plus metadata */
 typedef struct masker_image {
   png_bytep *image;
+  struct masker_buffer *buffer;   // pooled backing for the rows, or NULL
   int bytes_per_pixel;
   int color_type;
   int is_freed;   // prevent double frees
 } masker_image_t;
 
 
-/* Image plus more metadata */
+/* Image plus more metadata. Mask pixels are always a single byte,
+ * whatever the colour type of the file they came from. */
 typedef struct masker_mask {
   png_bytep *image;
-  int bytes_per_pixel;
+  struct masker_buffer *buffer;
+  int bytes_per_pixel;  // 1
   int color_type;
   int is_freed;
   int x_min, x_max;
   int y_min, y_max;
+  void *mapped;         // shared-memory mapping holding the pixels, or NULL
+  size_t mapped_len;
+  png_byte *block;      // single allocation holding the pixels, or NULL
 } masker_mask_t;
 
 /* Functions for IO operations */
@@ -46,6 +57,53 @@ int read_mask_file(masker_mask_t *result, const char *file_name);
 void free_image_memory(masker_image_t *image);
 void free_mask_memory(masker_mask_t *image);
 int write_png_file(masker_image_t image, const char *file_name);
+int acquire_image_memory(masker_image_t *image, int bytes_per_pixel, int color_type);
+int alloc_image_memory(masker_image_t *image, int bytes_per_pixel, int color_type);
+
+/* Read either a PNG or a tiled frame, dispatching on the file signature */
+int read_frame_file(masker_image_t *result, const char *file_name);
+
+/* As read_frame_file, but tiled frames only decode tiles in the inclusive
+ * box and leave other pixels undefined, so only read inside the box. PNG
+ * frames are decoded in full. */
+int read_frame_region(masker_image_t *result, const char *file_name,
+  int x_min, int x_max, int y_min, int y_max);
+
+/* Stream a frame's rows to fn in order, holding one row at a time for
+ * non-interlaced PNGs (other frames are decoded whole first). The row is
+ * only valid during the call; a non-zero return stops decoding and is
+ * returned. */
+typedef int (*masker_row_fn)(void *arg, int y, png_bytep row, int bytes_per_pixel);
+int read_frame_rows(const char *file_name, masker_row_fn fn, void *arg);
+
+/* A PNG frame pushed in pieces as it arrives, each row going to fn as
+ * soon as it is decoded (interlaced frames only after the last pass).
+ * Any chunking of the bytes is fine. The first error sticks: later calls
+ * return it without decoding, and push_end reports it. Tiled frames are
+ * not supported. */
+typedef struct masker_push {
+  png_structp png_ptr;
+  png_infop info_ptr;
+  masker_row_fn fn;
+  void *arg;
+  png_byte sig[8];
+  int sig_len;
+  int bytes_per_pixel;
+  masker_image_t image;    // interlaced frames are assembled here
+  int interlaced, has_image;
+  int n_rows, finished;
+  int error_bit;
+  unsigned char *chunk;    // push_fd's read buffer
+  unsigned long long decode_ns, io_ns, io_bytes, handler_ns;
+} masker_push_t;
+
+int push_begin(masker_push_t *push, masker_row_fn fn, void *arg);
+int push_data(masker_push_t *push, const void *data, size_t length);
+/* Push everything readable from fd, until end of file (setting *eof) or,
+ * for a non-blocking fd, until it would block */
+int push_fd(masker_push_t *push, int fd, int *eof);
+/* MASKER_READ_ERROR if the frame is incomplete. Frees the decoder. */
+int push_end(masker_push_t *push);
 
 
 #endif	// MASKER_LOADER_H
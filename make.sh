@@ -0,0 +1,16 @@
+#!/bin/sh
+# Build libmetmasker.so and the metmasker command-line tool.
+# The Python extension is built separately by setup.py.
+set -e
+cd "$(dirname "$0")"
+
+LIB_SOURCES="metmasker.c loader.c algorithms.c tiles.c sequence.c rolling.c
+  buffers.c stats.c bands.c workers.c"
+CFLAGS="-Ofast -std=c99 -Wall"
+
+gcc $CFLAGS -fPIC -shared -fvisibility=hidden -DMETMASKER_BUILD \
+  -Wl,-soname,libmetmasker.so.1 -o libmetmasker.so.1 $LIB_SOURCES \
+  -lpng -lz -lm -lpthread
+ln -sf libmetmasker.so.1 libmetmasker.so
+gcc $CFLAGS -o metmasker cli.c workers.c store.c -L. -lmetmasker \
+  -Wl,-rpath,'$ORIGIN' -lpthread
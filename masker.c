@@ -1,8 +1,27 @@
 #include <Python.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
 #include "structmember.h"
 #include "numpy/arrayobject.h"
 #include "loader.h"
 #include "algorithms.h"
+#include "tiles.h"
+#include "sequence.h"
+#include "rolling.h"
+#include "buffers.h"
+#include "stats.h"
+#include "workers.h"
+#include "shm.h"
+#include "validate.h"
+#include "store.h"
+#include "regrid.h"
+#include "sinks.h"
+#include "raster.h"
+#include "hierarchy.h"
+#include "pyramid.h"
+#include "bands.h"
 
 
 /* ====== FUNCTION FOR ERROR HANDLING ===== */
@@ -55,15 +74,130 @@ static void masker_translate_error_codes(int code, const char* file_name) {
   PyErr_Format(exception, message, file_name);
 }
 
+
+/* New float array, timed as the alloc stage */
+static PyArrayObject* masker_new_float_array(int nd, npy_intp *dims)
+{
+  unsigned long long start = STATS_START();
+  PyArrayObject *array = (PyArrayObject*)PyArray_SimpleNew(nd, dims, NPY_FLOAT);
+  if (array != NULL && start) {
+    unsigned long long n = 1;
+    for (int d=0; d<nd; d++) n *= dims[d];
+    stats_record(MASKER_STAGE_ALLOC, start, n * sizeof(float), 0);
+  }
+  return array;
+}
+
+/* Sequence of (x, y) pairs as parallel coordinate arrays, in one block */
+static int masker_parse_points(PyObject *obj, double **x, double **y, int *n)
+{
+  PyObject *seq = PySequence_Fast(obj, "points must be a sequence of (x, y)");
+  if (seq == NULL) return -1;
+  *n = PySequence_Fast_GET_SIZE(seq);
+  *x = malloc((2 * *n + 1) * sizeof(double));
+  if (*x == NULL) {
+    Py_DECREF(seq);
+    PyErr_NoMemory();
+    return -1;
+  }
+  *y = *x + *n;
+  for (int p=0; p<*n; p++) {
+    PyObject *point = PySequence_Tuple(PySequence_Fast_GET_ITEM(seq, p));
+    int ok = point != NULL
+      && PyArg_ParseTuple(point, "dd;points are (x, y) pairs", &(*x)[p], &(*y)[p]);
+    Py_XDECREF(point);
+    if (!ok) {
+      free(*x);
+      Py_DECREF(seq);
+      return -1;
+    }
+  }
+  Py_DECREF(seq);
+  return 0;
+}
+
+/* A polygon as one ring of (x, y) pairs or a sequence of rings, mapped to
+ * pixels by an optional (x0, y0, dx, dy) grid transform */
+static int masker_parse_polygon(PyObject *obj, PyObject *transform_obj,
+  double **x, double **y, int **ring_ends, int *n_rings)
+{
+  double x0 = 0, y0 = 0, dx = 1, dy = 1;
+  if (transform_obj != Py_None) {
+    PyObject *tuple = PySequence_Tuple(transform_obj);
+    int ok = tuple != NULL && PyArg_ParseTuple(tuple,
+      "dddd;transform is (x0, y0, dx, dy)", &x0, &y0, &dx, &dy);
+    Py_XDECREF(tuple);
+    if (!ok) return -1;
+    if (dx == 0 || dy == 0) {
+      PyErr_SetString(PyExc_ValueError, "transform steps must be non-zero");
+      return -1;
+    }
+  }
+
+  // A single ring starts with a point whose first item is a number
+  PyObject *point = PySequence_Check(obj) ? PySequence_GetItem(obj, 0) : NULL;
+  PyObject *first = point != NULL ? PySequence_GetItem(point, 0) : NULL;
+  int single = first != NULL && PyNumber_Check(first);
+  Py_XDECREF(point);
+  Py_XDECREF(first);
+  PyErr_Clear();
+  PyObject *rings = single ? PyTuple_Pack(1, obj) : PySequence_Tuple(obj);
+  if (rings == NULL) return -1;
+
+  *n_rings = PyTuple_GET_SIZE(rings);
+  *ring_ends = malloc((*n_rings + 1) * sizeof(int));
+  *x = NULL;
+  *y = NULL;
+  if (*ring_ends == NULL) goto no_memory;
+
+  int n_points = 0;
+  for (int r=0; r<*n_rings; r++) {
+    double *ring_x, *ring_y;
+    int ring_n;
+    if (masker_parse_points(PyTuple_GET_ITEM(rings, r), &ring_x, &ring_y, &ring_n) < 0)
+      goto fail;
+    double *grown_x = realloc(*x, (n_points + ring_n + 1) * sizeof(double));
+    if (grown_x != NULL) *x = grown_x;
+    double *grown_y = realloc(*y, (n_points + ring_n + 1) * sizeof(double));
+    if (grown_y != NULL) *y = grown_y;
+    if (grown_x == NULL || grown_y == NULL) {
+      free(ring_x);
+      goto no_memory;
+    }
+    for (int p=0; p<ring_n; p++) {
+      (*x)[n_points + p] = (ring_x[p] - x0) / dx;
+      (*y)[n_points + p] = (ring_y[p] - y0) / dy;
+    }
+    free(ring_x);   // ring_y shares its block
+    n_points += ring_n;
+    (*ring_ends)[r] = n_points;
+  }
+  Py_DECREF(rings);
+  return 0;
+
+no_memory:
+  PyErr_NoMemory();
+fail:
+  free(*x);
+  free(*y);
+  free(*ring_ends);
+  Py_DECREF(rings);
+  return -1;
+}
+
 /* ====== MASK TYPE ====== */
 typedef struct {
     PyObject_HEAD
     masker_mask_t mask;
+    PyObject *shared_name;   // shared-memory copy the mask was written to
 } masker_MaskObject;
 
+static PyObject *masker_shared_mask_fn;   // masker.shared_mask, for pickling
+
 static void masker_MaskObject_dealloc(masker_MaskObject* self)
 {
   free_mask_memory(&(self->mask));
+  Py_XDECREF(self->shared_name);
   self->ob_type->tp_free((PyObject*)self);
 }
 
@@ -75,6 +209,7 @@ static PyObject* masker_MaskObject_new(
   if (self != NULL) {
     masker_mask_t mask = {.image = NULL, .is_freed=1};
     self->mask = mask;
+    self->shared_name = NULL;
   }
   return (PyObject*)self;
 }
@@ -143,7 +278,7 @@ static PyObject* masker_MaskObject_load_mask_gray(
     return NULL;
 
   static npy_intp dims[2] = {HEIGHT, WIDTH};
-  PyArrayObject *array = (PyArrayObject*)PyArray_SimpleNew(2, dims, NPY_FLOAT);
+  PyArrayObject *array = masker_new_float_array(2, dims);
   if (array == NULL) {
     return NULL;
   }
@@ -169,7 +304,7 @@ static PyObject* masker_MaskObject_mask_split_gray(
     return NULL;
 
   static npy_intp dims[3] = {8, HEIGHT, WIDTH};
-  PyArrayObject *array = (PyArrayObject*)PyArray_SimpleNew(3, dims, NPY_FLOAT);
+  PyArrayObject *array = masker_new_float_array(3, dims);
   if (array == NULL) {
     return NULL;
   }
@@ -185,6 +320,131 @@ static PyObject* masker_MaskObject_mask_split_gray(
   return PyArray_Return(array);
 }
 
+static PyObject* masker_MaskObject_total_sequence(
+  masker_MaskObject *self, PyObject *args, PyObject *kwargs)
+{
+  const char *file_name;
+  static char *kwlist[] = {"file_name", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s", kwlist, &file_name))
+    return NULL;
+
+  masker_sequence_reader_t reader;
+  int error_bit = sequence_reader_open(&reader, file_name, &(self->mask), 1);
+  if (error_bit != MASKER_SUCCESS) {
+    masker_translate_error_codes(error_bit, file_name);
+    return NULL;
+  }
+
+  PyObject *result = PyList_New(0);
+  if (result == NULL) {
+    sequence_reader_close(&reader);
+    return NULL;
+  }
+
+  int has_frame = 1;
+  while (has_frame) {
+    error_bit = sequence_reader_next(&reader, &has_frame);
+    if (error_bit != MASKER_SUCCESS) {
+      sequence_reader_close(&reader);
+      Py_DECREF(result);
+      masker_translate_error_codes(error_bit, file_name);
+      return NULL;
+    }
+    if (!has_frame) break;
+
+    float res;
+    sequence_reader_totals(&reader, &res);
+    PyObject *value = PyFloat_FromDouble(res);
+    if (value == NULL || PyList_Append(result, value) < 0) {
+      Py_XDECREF(value);
+      sequence_reader_close(&reader);
+      Py_DECREF(result);
+      return NULL;
+    }
+    Py_DECREF(value);
+  }
+
+  sequence_reader_close(&reader);
+  return result;
+}
+
+static PyObject* masker_MaskObject_to_shared(
+  masker_MaskObject *self, PyObject *args, PyObject *kwargs)
+{
+  PyObject *name;
+  static char *kwlist[] = {"name", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "S", kwlist, &name))
+    return NULL;
+
+  int error_bit = shm_mask_write(&self->mask, PyString_AS_STRING(name));
+  if (error_bit != MASKER_SUCCESS) {
+    masker_translate_error_codes(error_bit, PyString_AS_STRING(name));
+    return NULL;
+  }
+
+  Py_INCREF(name);
+  Py_XDECREF(self->shared_name);
+  self->shared_name = name;
+  Py_INCREF(name);
+  return name;
+}
+
+static PyObject* masker_MaskObject_reduce(masker_MaskObject *self)
+{
+  if (self->shared_name == NULL || masker_shared_mask_fn == NULL) {
+    PyErr_SetString(PyExc_TypeError,
+      "Mask can only be pickled after to_shared(), as a shared-memory name");
+    return NULL;
+  }
+  return Py_BuildValue("(O(O))", masker_shared_mask_fn, self->shared_name);
+}
+
+/* New Mask of the given type rasterized from a polygon */
+static PyObject* masker_mask_from_polygon(PyTypeObject *type,
+  PyObject *polygon, PyObject *transform, int coverage)
+{
+  double *x, *y;
+  int *ring_ends, n_rings;
+  if (masker_parse_polygon(polygon, transform, &x, &y, &ring_ends, &n_rings) < 0)
+    return NULL;
+
+  masker_MaskObject *mask = (masker_MaskObject*)masker_MaskObject_new(
+    type, NULL, NULL);
+  int error_bit = MASKER_MEMORY_ERROR;
+  if (mask != NULL) {
+    Py_BEGIN_ALLOW_THREADS
+    error_bit = raster_polygon(&mask->mask, x, y, ring_ends, n_rings,
+      coverage ? MASKER_RASTER_SUPERSAMPLE : 1);
+    Py_END_ALLOW_THREADS
+  }
+  free(x);
+  free(y);
+  free(ring_ends);
+
+  if (error_bit == MASKER_SUCCESS) return (PyObject*)mask;
+  Py_XDECREF(mask);
+  if (error_bit == MASKER_FAILURE) {
+    PyErr_SetString(PyExc_ValueError, "polygon coordinates must be finite");
+  } else if (error_bit == MASKER_MEMORY_ERROR) {
+    PyErr_NoMemory();
+  } else {
+    masker_translate_error_codes(error_bit, "polygon");
+  }
+  return NULL;
+}
+
+static PyObject* masker_MaskObject_from_polygon(
+  PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+  PyObject *polygon, *transform = Py_None;
+  int coverage = 0;
+  static char *kwlist[] = {"polygon", "coverage", "transform", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|iO", kwlist,
+        &polygon, &coverage, &transform))
+    return NULL;
+  return masker_mask_from_polygon(type, polygon, transform, coverage);
+}
+
 static PyMethodDef masker_MaskObject_methods[] = {
   {"total_met", (PyCFunction)masker_MaskObject_mask_total_met,
    METH_VARARGS | METH_KEYWORDS, "Mask met image and sum rain values."},
@@ -197,6 +457,23 @@ static PyMethodDef masker_MaskObject_methods[] = {
   {"load_channels", (PyCFunction)masker_MaskObject_mask_split_gray,
    METH_VARARGS | METH_KEYWORDS,
   "Load grayscale image to numpy arrays with channels for rain types."},
+  {"to_shared", (PyCFunction)masker_MaskObject_to_shared,
+   METH_VARARGS | METH_KEYWORDS,
+   "Copy the mask into named POSIX shared memory, e.g. \"/catchment\", for\n"
+   "other processes to map with masker.shared_mask(name). Once shared the\n"
+   "mask pickles as its name. Returns the name."},
+  {"__reduce__", (PyCFunction)masker_MaskObject_reduce, METH_NOARGS, NULL},
+  {"from_polygon", (PyCFunction)masker_MaskObject_from_polygon,
+   METH_VARARGS | METH_KEYWORDS | METH_CLASS,
+   "Rasterize a polygon straight into a mask. The polygon is a ring of\n"
+   "(x, y) points or a list of rings, inner rings cutting holes, in pixels\n"
+   "or mapped through transform=(x0, y0, dx, dy). Pixels are in when their\n"
+   "centre is, or with coverage=True hold their covered fraction for\n"
+   "MaskSet.totals(weighted=True)."},
+  {"total_sequence", (PyCFunction)masker_MaskObject_total_sequence,
+   METH_VARARGS | METH_KEYWORDS,
+  "Sum rain values for every frame of a sequence file, updating the total\n"
+  "from each frame's changed pixels only."},
   {NULL}
 };
 
@@ -242,85 +519,2396 @@ static PyTypeObject masker_MaskType = {
     masker_MaskObject_new,                 /* tp_new */
 };
 
-static PyObject* masker_save_met_to_gray(
-  PyObject *self, PyObject *args, PyObject *kwargs)
+/* ====== MASK SET TYPE ====== */
+typedef struct {
+    PyObject_HEAD
+    PyObject *items;    // tuple of Mask objects owning the mask memory
+    masker_mask_t *masks;
+    int n_masks;
+} masker_MaskSetObject;
+
+static PyTypeObject masker_MaskSetType;
+
+static void masker_MaskSetObject_dealloc(masker_MaskSetObject* self)
 {
-  const char *in_file;
-  const char *out_file;
-  static char *kwlist[] = {"in_file", "out_file", NULL};
-  if (!PyArg_ParseTupleAndKeywords(
-    args, kwargs, "ss", kwlist, &in_file, &out_file)) return NULL;
+  Py_XDECREF(self->items);
+  free(self->masks);
+  self->ob_type->tp_free((PyObject*)self);
+}
 
-  masker_image_t res;
-  int error_bit = met_image_to_gray(&res, in_file);
-  if (error_bit != MASKER_SUCCESS) {
-    masker_translate_error_codes(error_bit, in_file);
-    return NULL;
+static PyObject* masker_MaskSetObject_new(
+  PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+  masker_MaskSetObject *self;
+  self = (masker_MaskSetObject*)type->tp_alloc(type, 0);
+  if (self != NULL) {
+    self->items = NULL;
+    self->masks = NULL;
+    self->n_masks = 0;
   }
+  return (PyObject*)self;
+}
 
-  error_bit = write_png_file(res, out_file);
-  if (error_bit != MASKER_SUCCESS) {
-    masker_translate_error_codes(error_bit, out_file);
-    free_image_memory(&res);
-    return NULL;
+/* Fill the set from Mask objects, loading any image paths along the way */
+static int masker_MaskSetObject_fill(masker_MaskSetObject *self, PyObject *masks)
+{
+  PyObject *seq = PySequence_Fast(masks, "masks must be a sequence");
+  if (seq == NULL) return -1;
+
+  Py_ssize_t n_masks = PySequence_Fast_GET_SIZE(seq);
+  PyObject *items = PyTuple_New(n_masks);
+  masker_mask_t *array = malloc((n_masks + 1) * sizeof(masker_mask_t));
+  if (items == NULL || array == NULL) {
+    Py_XDECREF(items);
+    free(array);
+    Py_DECREF(seq);
+    PyErr_NoMemory();
+    return -1;
   }
 
-  free_image_memory(&res);
-  Py_INCREF(Py_None);
-  return Py_None;
+  for (Py_ssize_t i=0; i<n_masks; i++) {
+    PyObject *item = PySequence_Fast_GET_ITEM(seq, i);
+    if (PyObject_TypeCheck(item, &masker_MaskType)) {
+      Py_INCREF(item);
+    } else {
+      item = PyObject_CallFunctionObjArgs(
+        (PyObject*)&masker_MaskType, item, NULL);
+      if (item == NULL) {
+        Py_DECREF(items);
+        free(array);
+        Py_DECREF(seq);
+        return -1;
+      }
+    }
+    PyTuple_SET_ITEM(items, i, item);
+    array[i] = ((masker_MaskObject*)item)->mask;
+  }
+  Py_DECREF(seq);
+
+  Py_XDECREF(self->items);
+  free(self->masks);
+  self->items = items;
+  self->masks = array;
+  self->n_masks = n_masks;
+  return 0;
 }
 
-static PyObject* masker_load_gray(
-  masker_MaskObject *self, PyObject *args, PyObject *kwargs)
+static int masker_MaskSetObject_init(
+  masker_MaskSetObject *self, PyObject *args, PyObject *kwds)
+{
+  PyObject *masks;
+  static char *kwlist[] = {"masks", NULL};
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O", kwlist, &masks))
+    return -1;
+
+  return masker_MaskSetObject_fill(self, masks);
+}
+
+static PyObject* masker_MaskSetObject_totals(
+  masker_MaskSetObject *self, PyObject *args, PyObject *kwargs)
 {
   const char *file_name;
-  static char *kwlist[] = {"in_file", NULL};
-  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s", kwlist, &file_name))
+  int weighted = 0;
+  static char *kwlist[] = {"file_name", "weighted", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|i", kwlist,
+        &file_name, &weighted))
     return NULL;
 
-  npy_intp dims[2] = {HEIGHT, WIDTH};
-  PyArrayObject *array = (PyArrayObject*)PyArray_SimpleNew(2, dims, NPY_FLOAT);
-  if (array == NULL) {
-    return NULL;
+  long *totals = malloc((self->n_masks + 1) * sizeof(long));
+  double *weighted_totals = malloc((self->n_masks + 1) * sizeof(double));
+  if (totals == NULL || weighted_totals == NULL) {
+    free(totals);
+    free(weighted_totals);
+    return PyErr_NoMemory();
   }
 
-  float* data_ptr = (float*)array->data;
-  int error_bit = load_gray_to_array(data_ptr, file_name);
+  int error_bit = weighted
+    ? mask_weighted_totals_file(weighted_totals, self->masks, self->n_masks, file_name)
+    : mask_totals_file(totals, self->masks, self->n_masks, file_name);
   if (error_bit != MASKER_SUCCESS) {
-    Py_DECREF(array);
+    free(totals);
+    free(weighted_totals);
     masker_translate_error_codes(error_bit, file_name);
     return NULL;
   }
 
-  return PyArray_Return(array);
+  PyObject *result = PyList_New(self->n_masks);
+  for (int m=0; result != NULL && m<self->n_masks; m++) {
+    double total = weighted ? weighted_totals[m] : (float)totals[m];
+    PyList_SET_ITEM(result, m, PyFloat_FromDouble(0.25 * total));
+  }
+  free(totals);
+  free(weighted_totals);
+  return result;
+}
+
+static PyObject* masker_MaskSetObject_from_polygons(
+  PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+  PyObject *polygons, *transform = Py_None;
+  int coverage = 0;
+  static char *kwlist[] = {"polygons", "coverage", "transform", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|iO", kwlist,
+        &polygons, &coverage, &transform))
+    return NULL;
+
+  PyObject *seq = PySequence_Fast(polygons, "polygons must be a sequence");
+  if (seq == NULL) return NULL;
+  Py_ssize_t n_polygons = PySequence_Fast_GET_SIZE(seq);
+  PyObject *masks = PyList_New(n_polygons);
+  for (Py_ssize_t i=0; masks != NULL && i<n_polygons; i++) {
+    PyObject *mask = masker_mask_from_polygon(&masker_MaskType,
+      PySequence_Fast_GET_ITEM(seq, i), transform, coverage);
+    if (mask == NULL) {
+      Py_CLEAR(masks);
+      break;
+    }
+    PyList_SET_ITEM(masks, i, mask);
+  }
+  Py_DECREF(seq);
+  if (masks == NULL) return NULL;
+
+  PyObject *set = PyObject_CallFunctionObjArgs((PyObject*)type, masks, NULL);
+  Py_DECREF(masks);
+  return set;
 }
 
+static Py_ssize_t masker_MaskSetObject_len(masker_MaskSetObject *self)
+{
+  return self->n_masks;
+}
 
-static PyMethodDef masker_methods[] = {
-  {"met_to_gray", (PyCFunction)masker_save_met_to_gray,
+static PyMethodDef masker_MaskSetObject_methods[] = {
+  {"totals", (PyCFunction)masker_MaskSetObject_totals,
    METH_VARARGS | METH_KEYWORDS,
-   "Convert met image to grayscale.\nUsage: met_to_gray(in_file, out_file)."},
-  {"load_gray", (PyCFunction)masker_load_gray,
-   METH_VARARGS | METH_KEYWORDS, "Load grayscale image to numpy array."},
-  {NULL}  /* Sentinel */
+   "Sum rain values under every mask from a single decode of a met or\n"
+   "grayscale image. With weighted=True pixels count by their mask value\n"
+   "over 255, as for coverage masks."},
+  {"from_polygons", (PyCFunction)masker_MaskSetObject_from_polygons,
+   METH_VARARGS | METH_KEYWORDS | METH_CLASS,
+   "Build a set with one mask per polygon, as Mask.from_polygon."},
+  {NULL}
 };
 
-#ifndef PyMODINIT_FUNC	/* declarations for DLL import/export */
-#define PyMODINIT_FUNC void
-#endif
-PyMODINIT_FUNC initmasker(void)
+static PySequenceMethods masker_MaskSetObject_as_sequence = {
+  (lenfunc)masker_MaskSetObject_len,    /* sq_length */
+};
+
+static PyTypeObject masker_MaskSetType = {
+    PyObject_HEAD_INIT(NULL)
+    0,                         /*ob_size*/
+    "masker.MaskSet",          /*tp_name*/
+    sizeof(masker_MaskSetObject), /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    (destructor)masker_MaskSetObject_dealloc,               /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    &masker_MaskSetObject_as_sequence,     /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,  /*tp_flags*/
+    "Set of masks evaluated together",     /* tp_doc */
+    0,		               /* tp_traverse */
+    0,		               /* tp_clear */
+    0,		               /* tp_richcompare */
+    0,		               /* tp_weaklistoffset */
+    0,		               /* tp_iter */
+    0,		               /* tp_iternext */
+    masker_MaskSetObject_methods,          /* tp_methods */
+    0,                         /* tp_members */
+    0,                         /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    (initproc)masker_MaskSetObject_init,   /* tp_init */
+    0,                         /* tp_alloc */
+    masker_MaskSetObject_new,              /* tp_new */
+};
+
+/* New reference to a MaskSet built from a Mask, MaskSet or sequence */
+static masker_MaskSetObject* masker_as_mask_set(PyObject *obj)
 {
-  PyObject* m;
+  if (PyObject_TypeCheck(obj, &masker_MaskSetType)) {
+    Py_INCREF(obj);
+    return (masker_MaskSetObject*)obj;
+  }
+  if (PyObject_TypeCheck(obj, &masker_MaskType)) {
+    return (masker_MaskSetObject*)PyObject_CallFunction(
+      (PyObject*)&masker_MaskSetType, "((O))", obj);
+  }
+  return (masker_MaskSetObject*)PyObject_CallFunctionObjArgs(
+    (PyObject*)&masker_MaskSetType, obj, NULL);
+}
 
-  if (PyType_Ready(&masker_MaskType) < 0)
-      return;
+/* ====== WORKER POOL TYPE ====== */
+#define POOL_TOTAL_MET 0
+#define POOL_TOTAL_GRAY 1
+#define POOL_LOAD_GRAY 2
+#define POOL_LOAD_CHANNELS 3
+#define POOL_TOTALS 4
 
-  m = Py_InitModule3("masker", masker_methods,
-  "Utilities for masking/converting met office images.");
+static const char *masker_pool_ops[] = {
+  "total_met", "total_gray", "load_gray", "load_channels", "totals", NULL};
 
-  if (m == NULL) return;
+struct masker_PoolObject;
 
-  import_array();
-  Py_INCREF(&masker_MaskType);
-  PyModule_AddObject(m, "Mask", (PyObject *)&masker_MaskType);
+typedef struct masker_pool_job {
+  int op;
+  long ticket;
+  PyObject *owner;          // Mask or MaskSet kept alive while in flight
+  masker_mask_t *masks;
+  int n_masks;
+  char *file_name;
+  PyArrayObject *array;     // output of the array operations
+  long *totals;
+  float total;
+  int status;
+  struct masker_PoolObject *pool;
+  struct masker_pool_job *next;
+} masker_pool_job_t;
+
+/* Jobs run on native threads without the GIL. Finished jobs are queued on
+ * the done list and announced by a byte on a pipe, so an event loop can
+ * watch fileno() and collect results with completed(). */
+typedef struct masker_PoolObject {
+  PyObject_HEAD
+  masker_workers_t workers;
+  int running;
+  int wake_fds[2];
+  pthread_mutex_t lock;
+  masker_pool_job_t *done, *done_tail;
+  long next_ticket;
+  int in_flight;            // submitted and not yet collected
+} masker_PoolObject;
+
+static void masker_pool_job_free(masker_pool_job_t *job)
+{
+  Py_XDECREF(job->owner);
+  Py_XDECREF(job->array);
+  free(job->file_name);
+  free(job->totals);
+  free(job);
+}
+
+static void masker_pool_run(void *arg)
+{
+  masker_pool_job_t *job = arg;
+  switch (job->op) {
+    case POOL_TOTAL_MET:
+      job->status = mask_total_met_image(&job->total, job->masks[0], job->file_name);
+      break;
+    case POOL_TOTAL_GRAY:
+      job->status = mask_total_gray_image(&job->total, job->masks[0], job->file_name);
+      break;
+    case POOL_LOAD_GRAY:
+      job->status = mask_gray_image(
+        (float*)job->array->data, job->masks[0], job->file_name);
+      break;
+    case POOL_LOAD_CHANNELS:
+      job->status = mask_split_gray_image(
+        (float*)job->array->data, job->masks[0], job->file_name);
+      break;
+    case POOL_TOTALS:
+      job->status = mask_totals_file(
+        job->totals, job->masks, job->n_masks, job->file_name);
+      break;
+  }
+
+  masker_PoolObject *pool = job->pool;
+  pthread_mutex_lock(&pool->lock);
+  job->next = NULL;
+  if (pool->done_tail != NULL) pool->done_tail->next = job;
+  else pool->done = job;
+  pool->done_tail = job;
+  pthread_mutex_unlock(&pool->lock);
+
+  // A full pipe already has a wakeup pending, so a failed write is harmless
+  char byte = 1;
+  while (write(pool->wake_fds[1], &byte, 1) < 0 && errno == EINTR);
+}
+
+static void masker_PoolObject_stop(masker_PoolObject *self)
+{
+  if (!self->running) return;
+  self->running = 0;
+  Py_BEGIN_ALLOW_THREADS
+  workers_destroy(&self->workers);
+  Py_END_ALLOW_THREADS
+}
+
+static void masker_PoolObject_dealloc(masker_PoolObject* self)
+{
+  masker_PoolObject_stop(self);
+  while (self->done != NULL) {
+    masker_pool_job_t *job = self->done;
+    self->done = job->next;
+    masker_pool_job_free(job);
+  }
+  if (self->wake_fds[0] >= 0) {
+    close(self->wake_fds[0]);
+    close(self->wake_fds[1]);
+    pthread_mutex_destroy(&self->lock);
+  }
+  self->ob_type->tp_free((PyObject*)self);
+}
+
+static PyObject* masker_PoolObject_new(
+  PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+  masker_PoolObject *self = (masker_PoolObject*)type->tp_alloc(type, 0);
+  if (self != NULL) {
+    self->running = 0;
+    self->wake_fds[0] = self->wake_fds[1] = -1;
+    self->done = self->done_tail = NULL;
+    self->next_ticket = 0;
+    self->in_flight = 0;
+  }
+  return (PyObject*)self;
+}
+
+static int masker_PoolObject_init(
+  masker_PoolObject *self, PyObject *args, PyObject *kwds)
+{
+  int n_threads = 0, queue_depth = 0;
+  static char *kwlist[] = {"threads", "queue_depth", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|ii", kwlist,
+    &n_threads, &queue_depth)) return -1;
+
+  if (self->wake_fds[0] >= 0) {
+    PyErr_SetString(PyExc_RuntimeError, "WorkerPool is already initialised");
+    return -1;
+  }
+  if (pipe(self->wake_fds) != 0) {
+    self->wake_fds[0] = self->wake_fds[1] = -1;
+    PyErr_SetFromErrno(PyExc_OSError);
+    return -1;
+  }
+  for (int i=0; i<2; i++) {
+    fcntl(self->wake_fds[i], F_SETFL,
+      fcntl(self->wake_fds[i], F_GETFL) | O_NONBLOCK);
+    fcntl(self->wake_fds[i], F_SETFD, FD_CLOEXEC);
+  }
+  pthread_mutex_init(&self->lock, NULL);
+
+  if (workers_create(&self->workers, n_threads, queue_depth) != MASKER_SUCCESS) {
+    PyErr_SetString(PyExc_RuntimeError, "Unable to start worker threads");
+    return -1;
+  }
+  self->running = 1;
+  return 0;
+}
+
+static PyObject* masker_PoolObject_submit(
+  masker_PoolObject *self, PyObject *args, PyObject *kwargs)
+{
+  const char *op_name, *file_name;
+  PyObject *masks_obj;
+  static char *kwlist[] = {"op", "masks", "file_name", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "sOs", kwlist,
+    &op_name, &masks_obj, &file_name)) return NULL;
+
+  if (!self->running) {
+    PyErr_SetString(PyExc_ValueError, "WorkerPool is closed");
+    return NULL;
+  }
+  int op = 0;
+  while (masker_pool_ops[op] != NULL && strcmp(masker_pool_ops[op], op_name) != 0)
+    op++;
+  if (masker_pool_ops[op] == NULL) {
+    PyErr_Format(PyExc_ValueError, "Unknown operation %s", op_name);
+    return NULL;
+  }
+
+  masker_pool_job_t *job = calloc(1, sizeof(masker_pool_job_t));
+  if (job == NULL) return PyErr_NoMemory();
+  job->op = op;
+  job->pool = self;
+  job->file_name = strdup(file_name);
+  if (job->file_name == NULL) {
+    masker_pool_job_free(job);
+    return PyErr_NoMemory();
+  }
+
+  if (op == POOL_TOTALS) {
+    masker_MaskSetObject *set = masker_as_mask_set(masks_obj);
+    if (set == NULL) {
+      masker_pool_job_free(job);
+      return NULL;
+    }
+    job->owner = (PyObject*)set;
+    job->masks = set->masks;
+    job->n_masks = set->n_masks;
+    job->totals = malloc((set->n_masks + 1) * sizeof(long));
+    if (job->totals == NULL) {
+      masker_pool_job_free(job);
+      return PyErr_NoMemory();
+    }
+  } else {
+    if (!PyObject_TypeCheck(masks_obj, &masker_MaskType)) {
+      masker_pool_job_free(job);
+      PyErr_Format(PyExc_TypeError, "%s takes a Mask", op_name);
+      return NULL;
+    }
+    Py_INCREF(masks_obj);
+    job->owner = masks_obj;
+    job->masks = &((masker_MaskObject*)masks_obj)->mask;
+    job->n_masks = 1;
+  }
+
+  if (op == POOL_LOAD_GRAY || op == POOL_LOAD_CHANNELS) {
+    npy_intp dims[3] = {8, HEIGHT, WIDTH};
+    job->array = op == POOL_LOAD_GRAY ? masker_new_float_array(2, &dims[1])
+      : masker_new_float_array(3, dims);
+    if (job->array == NULL) {
+      masker_pool_job_free(job);
+      return NULL;
+    }
+  }
+
+  // A full queue is reported rather than waited on, the caller holds the GIL
+  job->ticket = self->next_ticket;
+  if (workers_try_submit(&self->workers, masker_pool_run, job) != MASKER_SUCCESS) {
+    masker_pool_job_free(job);
+    Py_INCREF(Py_None);
+    return Py_None;
+  }
+  self->next_ticket++;
+  self->in_flight++;
+  return PyInt_FromLong(job->ticket);
+}
+
+static PyObject* masker_pool_job_result(masker_pool_job_t *job)
+{
+  switch (job->op) {
+    case POOL_TOTAL_MET:
+    case POOL_TOTAL_GRAY:
+      return PyFloat_FromDouble(job->total);
+    case POOL_LOAD_GRAY:
+    case POOL_LOAD_CHANNELS:
+      Py_INCREF(job->array);
+      return PyArray_Return(job->array);
+    default: {
+      PyObject *result = PyList_New(job->n_masks);
+      for (int m=0; result != NULL && m<job->n_masks; m++) {
+        PyList_SET_ITEM(result, m, PyFloat_FromDouble(0.25 * (float)job->totals[m]));
+      }
+      return result;
+    }
+  }
+}
+
+static PyObject* masker_PoolObject_completed(masker_PoolObject *self)
+{
+  char drain[256];
+  while (read(self->wake_fds[0], drain, sizeof(drain)) > 0);
+
+  pthread_mutex_lock(&self->lock);
+  masker_pool_job_t *jobs = self->done;
+  self->done = self->done_tail = NULL;
+  pthread_mutex_unlock(&self->lock);
+
+  PyObject *results = PyList_New(0);
+  while (jobs != NULL) {
+    masker_pool_job_t *job = jobs;
+    jobs = job->next;
+    self->in_flight--;
+
+    PyObject *value = NULL, *error = NULL;
+    if (job->status == MASKER_SUCCESS) {
+      value = masker_pool_job_result(job);
+    } else {
+      PyObject *type, *traceback;
+      masker_translate_error_codes(job->status, job->file_name);
+      PyErr_Fetch(&type, &error, &traceback);
+      PyErr_NormalizeException(&type, &error, &traceback);
+      Py_XDECREF(type);
+      Py_XDECREF(traceback);
+    }
+
+    PyObject *item = NULL;
+    if (value != NULL || error != NULL) {
+      item = Py_BuildValue("(lOO)", job->ticket,
+        value ? value : Py_None, error ? error : Py_None);
+    }
+    Py_XDECREF(value);
+    Py_XDECREF(error);
+    if (results != NULL && (item == NULL || PyList_Append(results, item) < 0)) {
+      Py_CLEAR(results);
+    }
+    Py_XDECREF(item);
+    masker_pool_job_free(job);
+  }
+  return results;
+}
+
+static PyObject* masker_PoolObject_fileno(masker_PoolObject *self)
+{
+  return PyInt_FromLong(self->wake_fds[0]);
+}
+
+static PyObject* masker_PoolObject_close(masker_PoolObject *self)
+{
+  masker_PoolObject_stop(self);
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyMethodDef masker_PoolObject_methods[] = {
+  {"submit", (PyCFunction)masker_PoolObject_submit,
+   METH_VARARGS | METH_KEYWORDS,
+   "Queue an operation and return its ticket, or None if the queue is full.\n"
+   "Usage: submit(op, masks, file_name), where op is one of total_met,\n"
+   "total_gray, load_gray or load_channels with a Mask, or totals with a\n"
+   "MaskSet or list of Masks."},
+  {"completed", (PyCFunction)masker_PoolObject_completed, METH_NOARGS,
+   "Collect finished operations as a list of (ticket, result, error)\n"
+   "tuples, where error is the exception the synchronous call would raise."},
+  {"fileno", (PyCFunction)masker_PoolObject_fileno, METH_NOARGS,
+   "Descriptor that becomes readable when operations have completed."},
+  {"close", (PyCFunction)masker_PoolObject_close, METH_NOARGS,
+   "Finish queued operations and stop the worker threads."},
+  {NULL}
+};
+
+static PyMemberDef masker_PoolObject_members[] = {
+  {"in_flight", T_INT, offsetof(masker_PoolObject, in_flight), READONLY,
+   "Operations submitted and not yet collected"},
+  {"threads", T_INT, offsetof(masker_PoolObject, workers.n_threads), READONLY,
+   "Number of worker threads"},
+  {"queue_depth", T_INT, offsetof(masker_PoolObject, workers.queue_depth),
+   READONLY, "Operations that may wait for a thread before submit refuses"},
+  {NULL}
+};
+
+static PyTypeObject masker_PoolType = {
+    PyObject_HEAD_INIT(NULL)
+    0,                         /*ob_size*/
+    "masker.WorkerPool",       /*tp_name*/
+    sizeof(masker_PoolObject), /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    (destructor)masker_PoolObject_dealloc,               /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    0,                         /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
+    "Native threads running mask operations off the calling thread.\n"
+    "Usage: WorkerPool(threads=0, queue_depth=0), where 0 threads uses\n"
+    "every core and 0 depth allows 4 queued operations per thread.",
+    0,		               /* tp_traverse */
+    0,		               /* tp_clear */
+    0,		               /* tp_richcompare */
+    0,		               /* tp_weaklistoffset */
+    0,		               /* tp_iter */
+    0,		               /* tp_iternext */
+    masker_PoolObject_methods,             /* tp_methods */
+    masker_PoolObject_members,             /* tp_members */
+    0,                         /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    (initproc)masker_PoolObject_init,      /* tp_init */
+    0,                         /* tp_alloc */
+    masker_PoolObject_new,                 /* tp_new */
+};
+
+/* ====== SHARED MEMORY ====== */
+typedef struct {
+  PyObject_HEAD
+  masker_ring_t ring;
+  PyObject *name;
+} masker_RingObject;
+
+static void masker_RingObject_dealloc(masker_RingObject* self)
+{
+  ring_close(&self->ring);
+  Py_XDECREF(self->name);
+  self->ob_type->tp_free((PyObject*)self);
+}
+
+static PyObject* masker_RingObject_new(
+  PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+  masker_RingObject *self = (masker_RingObject*)type->tp_alloc(type, 0);
+  if (self != NULL) {
+    self->ring.header = NULL;
+    self->name = NULL;
+  }
+  return (PyObject*)self;
+}
+
+static int masker_RingObject_init(
+  masker_RingObject *self, PyObject *args, PyObject *kwds)
+{
+  PyObject *name;
+  int n_slots = 0, frames = 1;
+  static char *kwlist[] = {"name", "slots", "frames", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "S|ii", kwlist,
+    &name, &n_slots, &frames)) return -1;
+
+  ring_close(&self->ring);
+  int error_bit = n_slots > 0
+    ? ring_create(&self->ring, PyString_AS_STRING(name), n_slots, frames)
+    : ring_attach(&self->ring, PyString_AS_STRING(name));
+  if (error_bit != MASKER_SUCCESS) {
+    self->ring.header = NULL;
+    masker_translate_error_codes(error_bit, PyString_AS_STRING(name));
+    return -1;
+  }
+
+  Py_INCREF(name);
+  Py_XDECREF(self->name);
+  self->name = name;
+  return 0;
+}
+
+static int masker_ring_check_slot(masker_RingObject *self, int slot, int index)
+{
+  if (self->ring.header == NULL) {
+    PyErr_SetString(PyExc_ValueError, "SharedRing is not mapped");
+    return -1;
+  }
+  if (slot < 0 || slot >= self->ring.n_slots
+      || index < 0 || index >= self->ring.frames_per_slot) {
+    PyErr_SetString(PyExc_IndexError, "slot or frame index out of range");
+    return -1;
+  }
+  return 0;
+}
+
+static PyObject* masker_RingObject_acquire(masker_RingObject *self)
+{
+  if (masker_ring_check_slot(self, 0, 0) < 0) return NULL;
+  int slot = ring_acquire(&self->ring);
+  if (slot < 0) {
+    Py_INCREF(Py_None);
+    return Py_None;
+  }
+  return PyInt_FromLong(slot);
+}
+
+static PyObject* masker_ring_transition(
+  masker_RingObject *self, PyObject *args, int from, int to)
+{
+  int slot;
+  if (!PyArg_ParseTuple(args, "i", &slot)) return NULL;
+  if (masker_ring_check_slot(self, slot, 0) < 0) return NULL;
+  if (ring_transition(&self->ring, slot, from, to) != MASKER_SUCCESS) {
+    PyErr_Format(PyExc_ValueError, "slot %i is not %s", slot,
+      from == MASKER_SLOT_FILLING ? "being filled" : "ready");
+    return NULL;
+  }
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject* masker_RingObject_publish(masker_RingObject *self, PyObject *args) {
+  return masker_ring_transition(self, args, MASKER_SLOT_FILLING, MASKER_SLOT_READY);
+}
+
+static PyObject* masker_RingObject_release(masker_RingObject *self, PyObject *args) {
+  return masker_ring_transition(self, args, MASKER_SLOT_READY, MASKER_SLOT_FREE);
+}
+
+static PyObject* masker_RingObject_state(masker_RingObject *self, PyObject *args)
+{
+  int slot;
+  if (!PyArg_ParseTuple(args, "i", &slot)) return NULL;
+  if (masker_ring_check_slot(self, slot, 0) < 0) return NULL;
+  return PyInt_FromLong(self->ring.header->state[slot]);
+}
+
+static PyObject* masker_RingObject_view(masker_RingObject *self, PyObject *args)
+{
+  int slot;
+  if (!PyArg_ParseTuple(args, "i", &slot)) return NULL;
+  if (masker_ring_check_slot(self, slot, 0) < 0) return NULL;
+
+  npy_intp dims[4] = {self->ring.frames_per_slot, 8, HEIGHT, WIDTH};
+  PyArrayObject *array = (PyArrayObject*)PyArray_SimpleNewFromData(
+    4, dims, NPY_FLOAT, ring_frame(&self->ring, slot, 0));
+  if (array == NULL) return NULL;
+
+  // The array keeps the ring, and so the mapping, alive
+  Py_INCREF(self);
+  if (PyArray_SetBaseObject(array, (PyObject*)self) < 0) {
+    Py_DECREF(array);
+    return NULL;
+  }
+  return (PyObject*)array;
+}
+
+static PyObject* masker_ring_load(masker_RingObject *self, PyObject *args,
+  PyObject *kwargs, int channels)
+{
+  int slot, index;
+  PyObject *mask_obj;
+  const char *file_name;
+  static char *kwlist[] = {"slot", "index", "mask", "file_name", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "iiO!s", kwlist,
+    &slot, &index, &masker_MaskType, &mask_obj, &file_name)) return NULL;
+  if (masker_ring_check_slot(self, slot, index) < 0) return NULL;
+
+  masker_mask_t mask = ((masker_MaskObject*)mask_obj)->mask;
+  float *frame = ring_frame(&self->ring, slot, index);
+  int error_bit = channels ? mask_split_gray_image(frame, mask, file_name)
+    : mask_gray_image(frame, mask, file_name);
+  if (error_bit != MASKER_SUCCESS) {
+    masker_translate_error_codes(error_bit, file_name);
+    return NULL;
+  }
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject* masker_RingObject_load_channels(
+  masker_RingObject *self, PyObject *args, PyObject *kwargs) {
+  return masker_ring_load(self, args, kwargs, 1);
+}
+
+static PyObject* masker_RingObject_load_gray(
+  masker_RingObject *self, PyObject *args, PyObject *kwargs) {
+  return masker_ring_load(self, args, kwargs, 0);
+}
+
+static PyMethodDef masker_RingObject_methods[] = {
+  {"acquire", (PyCFunction)masker_RingObject_acquire, METH_NOARGS,
+   "Claim a free slot for filling, returning its index or None if all\n"
+   "slots are in use."},
+  {"publish", (PyCFunction)masker_RingObject_publish, METH_VARARGS,
+   "Mark a filled slot ready for the consumer."},
+  {"release", (PyCFunction)masker_RingObject_release, METH_VARARGS,
+   "Return a consumed slot to the free pool."},
+  {"state", (PyCFunction)masker_RingObject_state, METH_VARARGS,
+   "Slot state: 0 free, 1 filling, 2 ready."},
+  {"view", (PyCFunction)masker_RingObject_view, METH_VARARGS,
+   "Zero-copy float array of shape (frames, 8, height, width) over a slot."},
+  {"load_channels", (PyCFunction)masker_RingObject_load_channels,
+   METH_VARARGS | METH_KEYWORDS,
+   "As Mask.load_channels, written into frame index of a slot.\n"
+   "Usage: load_channels(slot, index, mask, file_name)."},
+  {"load_gray", (PyCFunction)masker_RingObject_load_gray,
+   METH_VARARGS | METH_KEYWORDS,
+   "As Mask.load_gray, written into the first plane of frame index of a\n"
+   "slot. Usage: load_gray(slot, index, mask, file_name)."},
+  {NULL}
+};
+
+static PyMemberDef masker_RingObject_members[] = {
+  {"name", T_OBJECT, offsetof(masker_RingObject, name), READONLY,
+   "Shared-memory object name"},
+  {"slots", T_INT, offsetof(masker_RingObject, ring.n_slots), READONLY,
+   "Number of batch slots"},
+  {"frames", T_INT, offsetof(masker_RingObject, ring.frames_per_slot), READONLY,
+   "Frames per slot"},
+  {NULL}
+};
+
+static PyTypeObject masker_RingType = {
+    PyObject_HEAD_INIT(NULL)
+    0,                         /*ob_size*/
+    "masker.SharedRing",       /*tp_name*/
+    sizeof(masker_RingObject), /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    (destructor)masker_RingObject_dealloc,               /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    0,                         /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
+    "Ring of batch slots in named POSIX shared memory, which loader\n"
+    "processes fill and the parent maps without copying.\n"
+    "Usage: SharedRing(name, slots=0, frames=1); slots > 0 creates the\n"
+    "ring, replacing any of the same name, while 0 attaches to it.",
+    0,		               /* tp_traverse */
+    0,		               /* tp_clear */
+    0,		               /* tp_richcompare */
+    0,		               /* tp_weaklistoffset */
+    0,		               /* tp_iter */
+    0,		               /* tp_iternext */
+    masker_RingObject_methods,             /* tp_methods */
+    masker_RingObject_members,             /* tp_members */
+    0,                         /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    (initproc)masker_RingObject_init,      /* tp_init */
+    0,                         /* tp_alloc */
+    masker_RingObject_new,                 /* tp_new */
+};
+
+/* ====== REGRIDDING ====== */
+typedef struct {
+  PyObject_HEAD
+  masker_regrid_t regrid;
+  int nd;
+  npy_intp dims[2];   // target shape, (ny, nx) or (points,)
+  int n_weights;
+} masker_RegridderObject;
+
+static void masker_RegridderObject_dealloc(masker_RegridderObject* self)
+{
+  regrid_free(&self->regrid);
+  self->ob_type->tp_free((PyObject*)self);
+}
+
+static PyObject* masker_RegridderObject_new(
+  PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+  masker_RegridderObject *self = (masker_RegridderObject*)type->tp_alloc(type, 0);
+  if (self != NULL) {
+    self->regrid.row_start = NULL;
+    self->regrid.cols = NULL;
+    self->regrid.weights = NULL;
+    self->regrid.n_rows = 0;
+  }
+  return (PyObject*)self;
+}
+
+static int masker_parse_grid(PyObject *obj, masker_grid_t *grid)
+{
+  PyObject *tuple = PySequence_Tuple(obj);
+  if (tuple == NULL) return -1;
+  int ok = PyArg_ParseTuple(tuple, "ddddii;grids are (x0, y0, dx, dy, nx, ny)",
+    &grid->x0, &grid->y0, &grid->dx, &grid->dy, &grid->nx, &grid->ny);
+  Py_DECREF(tuple);
+  return ok ? 0 : -1;
+}
+
+static int masker_RegridderObject_init(
+  masker_RegridderObject *self, PyObject *args, PyObject *kwds)
+{
+  PyObject *source_obj, *target_obj = Py_None, *points_obj = Py_None;
+  const char *method_name = "bilinear";
+  static char *kwlist[] = {"source", "target", "points", "method", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|OOs", kwlist,
+    &source_obj, &target_obj, &points_obj, &method_name)) return -1;
+
+  masker_grid_t source, target;
+  if (masker_parse_grid(source_obj, &source) < 0) return -1;
+  int method;
+  if (strcmp(method_name, "bilinear") == 0) method = MASKER_REGRID_BILINEAR;
+  else if (strcmp(method_name, "conservative") == 0) method = MASKER_REGRID_CONSERVATIVE;
+  else {
+    PyErr_SetString(PyExc_ValueError, "method must be 'bilinear' or 'conservative'");
+    return -1;
+  }
+  if ((target_obj == Py_None) == (points_obj == Py_None)) {
+    PyErr_SetString(PyExc_TypeError, "give exactly one of target and points");
+    return -1;
+  }
+
+  regrid_free(&self->regrid);
+  int error_bit;
+  if (target_obj != Py_None) {
+    if (masker_parse_grid(target_obj, &target) < 0) return -1;
+    Py_BEGIN_ALLOW_THREADS
+    error_bit = regrid_grids(&self->regrid, &source, &target, method);
+    Py_END_ALLOW_THREADS
+    self->nd = 2;
+    self->dims[0] = target.ny;
+    self->dims[1] = target.nx;
+  } else {
+    if (method != MASKER_REGRID_BILINEAR) {
+      PyErr_SetString(PyExc_ValueError, "points only support bilinear regridding");
+      return -1;
+    }
+    double *x, *y;
+    int n_points;
+    if (masker_parse_points(points_obj, &x, &y, &n_points) < 0) return -1;
+    Py_BEGIN_ALLOW_THREADS
+    error_bit = regrid_points(&self->regrid, &source, x, y, n_points);
+    Py_END_ALLOW_THREADS
+    free(x);
+    self->nd = 1;
+    self->dims[0] = n_points;
+  }
+
+  if (error_bit == MASKER_FAILURE) {
+    PyErr_SetString(PyExc_ValueError, "grids need non-zero steps and sizes");
+    return -1;
+  } else if (error_bit == MASKER_IMAGE_SIZE_DEPTH_ERROR) {
+    PyErr_Format(PyExc_ValueError, "source grid must be %i x %i", WIDTH, HEIGHT);
+    return -1;
+  } else if (error_bit != MASKER_SUCCESS) {
+    masker_translate_error_codes(error_bit, "regridder");
+    return -1;
+  }
+  self->n_weights = self->regrid.row_start[self->regrid.n_rows];
+  return 0;
+}
+
+static PyObject* masker_RegridderObject_load_gray(
+  masker_RegridderObject *self, PyObject *args, PyObject *kwds)
+{
+  PyObject *frames;
+  int n_threads = 0;
+  static char *kwlist[] = {"frames", "threads", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|i", kwlist,
+    &frames, &n_threads)) return NULL;
+  if (self->regrid.row_start == NULL) {
+    PyErr_SetString(PyExc_ValueError, "regridder is not initialised");
+    return NULL;
+  }
+
+  int error_bit;
+  PyArrayObject *array;
+  if (PyString_Check(frames)) {
+    const char *file_name = PyString_AsString(frames);
+    array = masker_new_float_array(self->nd, self->dims);
+    if (array == NULL) return NULL;
+    Py_BEGIN_ALLOW_THREADS
+    error_bit = regrid_file(&self->regrid, (float*)array->data, file_name);
+    Py_END_ALLOW_THREADS
+    if (error_bit != MASKER_SUCCESS) {
+      Py_DECREF(array);
+      masker_translate_error_codes(error_bit, file_name);
+      return NULL;
+    }
+    return PyArray_Return(array);
+  }
+
+  PyObject *files = PySequence_Fast(frames, "frames must be a file or a sequence");
+  if (files == NULL) return NULL;
+  int n_files = PySequence_Fast_GET_SIZE(files);
+  const char **file_names = malloc((n_files + 1) * sizeof(char*));
+  if (file_names == NULL) {
+    Py_DECREF(files);
+    return PyErr_NoMemory();
+  }
+  for (int i=0; i<n_files; i++) {
+    file_names[i] = PyString_AsString(PySequence_Fast_GET_ITEM(files, i));
+    if (file_names[i] == NULL) {
+      free(file_names);
+      Py_DECREF(files);
+      return NULL;
+    }
+  }
+
+  npy_intp dims[3] = {n_files, self->dims[0], self->dims[1]};
+  array = masker_new_float_array(self->nd + 1, dims);
+  if (array != NULL) {
+    int failed_index = 0;
+    Py_BEGIN_ALLOW_THREADS
+    error_bit = regrid_files(&self->regrid, (float*)array->data, file_names,
+      n_files, n_threads, &failed_index);
+    Py_END_ALLOW_THREADS
+    if (error_bit != MASKER_SUCCESS) {
+      Py_DECREF(array);
+      array = NULL;
+      masker_translate_error_codes(error_bit, file_names[failed_index]);
+    }
+  }
+  free(file_names);
+  Py_DECREF(files);
+  if (array == NULL) return NULL;
+  return PyArray_Return(array);
+}
+
+static PyMethodDef masker_RegridderObject_methods[] = {
+  {"load_gray", (PyCFunction)masker_RegridderObject_load_gray,
+   METH_VARARGS | METH_KEYWORDS,
+   "Rain on the target grid straight from a grayscale frame.\n"
+   "Usage: load_gray(frames, threads=0), where frames is one file, giving\n"
+   "the target shape, or a list of files, giving (files,) + that shape\n"
+   "with the files spread over threads (0 for every core)."},
+  {NULL}  /* Sentinel */
+};
+
+static PyMemberDef masker_RegridderObject_members[] = {
+  {"size", T_INT, offsetof(masker_RegridderObject, regrid.n_rows), READONLY,
+   "Number of target cells"},
+  {"n_weights", T_INT, offsetof(masker_RegridderObject, n_weights), READONLY,
+   "Stored (source pixel, weight) pairs"},
+  {NULL}
+};
+
+static PyTypeObject masker_RegridderType = {
+    PyObject_HEAD_INIT(NULL)
+    0,                         /*ob_size*/
+    "masker.Regridder",        /*tp_name*/
+    sizeof(masker_RegridderObject), /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    (destructor)masker_RegridderObject_dealloc,          /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    0,                         /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
+    "Precomputed sparse weights from the radar frame to another grid.\n"
+    "Usage: Regridder(source, target=None, points=None, method='bilinear').\n"
+    "Grids are (x0, y0, dx, dy, nx, ny) in one coordinate system, with\n"
+    "(x0, y0) the outer corner of cell (0, 0) and negative steps for axes\n"
+    "that run backwards; the source is the frame grid. Either give a\n"
+    "regular target grid, regridded 'bilinear' at cell centres or\n"
+    "'conservative' as the area average over each cell, or a sequence of\n"
+    "(x, y) points in source coordinates for bilinear sampling, e.g. model\n"
+    "cell centres in another projection. Uncovered cells are NaN.",
+    0,		               /* tp_traverse */
+    0,		               /* tp_clear */
+    0,		               /* tp_richcompare */
+    0,		               /* tp_weaklistoffset */
+    0,		               /* tp_iter */
+    0,		               /* tp_iternext */
+    masker_RegridderObject_methods,        /* tp_methods */
+    masker_RegridderObject_members,        /* tp_members */
+    0,                         /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    (initproc)masker_RegridderObject_init, /* tp_init */
+    0,                         /* tp_alloc */
+    masker_RegridderObject_new,            /* tp_new */
+};
+
+/* ====== HIERARCHY ====== */
+typedef struct {
+  PyObject_HEAD
+  masker_hierarchy_t hierarchy;
+} masker_HierarchyObject;
+
+static void masker_HierarchyObject_dealloc(masker_HierarchyObject* self)
+{
+  hierarchy_free(&self->hierarchy);
+  self->ob_type->tp_free((PyObject*)self);
+}
+
+static PyObject* masker_HierarchyObject_new(
+  PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+  masker_HierarchyObject *self = (masker_HierarchyObject*)type->tp_alloc(type, 0);
+  if (self != NULL) {
+    self->hierarchy.parents = NULL;
+    self->hierarchy.labels = NULL;
+    self->hierarchy.n_leaves = 0;
+    self->hierarchy.n_regions = 0;
+  }
+  return (PyObject*)self;
+}
+
+static int masker_HierarchyObject_init(
+  masker_HierarchyObject *self, PyObject *args, PyObject *kwds)
+{
+  PyObject *leaves_obj, *parents_obj;
+  static char *kwlist[] = {"leaves", "parents", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO", kwlist,
+    &leaves_obj, &parents_obj)) return -1;
+
+  masker_MaskSetObject *set = masker_as_mask_set(leaves_obj);
+  if (set == NULL) return -1;
+  PyObject *seq = PySequence_Fast(parents_obj, "parents must be a sequence of ints");
+  if (seq == NULL) {
+    Py_DECREF(set);
+    return -1;
+  }
+  int n_regions = PySequence_Fast_GET_SIZE(seq);
+  int *parents = malloc((n_regions + 1) * sizeof(int));
+  if (parents == NULL) {
+    Py_DECREF(seq);
+    Py_DECREF(set);
+    PyErr_NoMemory();
+    return -1;
+  }
+  for (int r=0; r<n_regions; r++) {
+    PyObject *parent = PySequence_Fast_GET_ITEM(seq, r);
+    parents[r] = parent == Py_None ? -1 : (int)PyInt_AsLong(parent);
+  }
+  Py_DECREF(seq);
+  if (PyErr_Occurred()) {
+    free(parents);
+    Py_DECREF(set);
+    return -1;
+  }
+
+  hierarchy_free(&self->hierarchy);
+  int error_bit;
+  Py_BEGIN_ALLOW_THREADS
+  error_bit = hierarchy_create(&self->hierarchy, set->masks, set->n_masks,
+    parents, n_regions);
+  Py_END_ALLOW_THREADS
+  free(parents);
+  Py_DECREF(set);
+
+  if (error_bit == MASKER_FAILURE) {
+    PyErr_Format(PyExc_ValueError, "leaves must be disjoint, at most %i, with "
+      "a parent for each region that comes after it or is None",
+      MASKER_HIERARCHY_MAX_LEAVES);
+    return -1;
+  } else if (error_bit != MASKER_SUCCESS) {
+    masker_translate_error_codes(error_bit, "hierarchy");
+    return -1;
+  }
+  return 0;
+}
+
+static PyObject* masker_HierarchyObject_totals(
+  masker_HierarchyObject *self, PyObject *args, PyObject *kwds)
+{
+  PyObject *frames;
+  int n_threads = 0;
+  static char *kwlist[] = {"frames", "threads", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|i", kwlist,
+    &frames, &n_threads)) return NULL;
+  if (self->hierarchy.labels == NULL) {
+    PyErr_SetString(PyExc_ValueError, "hierarchy is not initialised");
+    return NULL;
+  }
+
+  int n_regions = self->hierarchy.n_regions;
+  int single = PyString_Check(frames);
+  PyObject *files = single ? PyTuple_Pack(1, frames)
+    : PySequence_Fast(frames, "frames must be a file or a sequence");
+  if (files == NULL) return NULL;
+  int n_files = PySequence_Fast_GET_SIZE(files);
+  const char **file_names = malloc((n_files + 1) * sizeof(char*));
+  long *totals = malloc(((size_t)n_files * n_regions + 1) * sizeof(long));
+  if (file_names == NULL || totals == NULL) {
+    free(file_names);
+    free(totals);
+    Py_DECREF(files);
+    return PyErr_NoMemory();
+  }
+  for (int i=0; i<n_files; i++) {
+    file_names[i] = PyString_AsString(PySequence_Fast_GET_ITEM(files, i));
+    if (file_names[i] == NULL) {
+      free(file_names);
+      free(totals);
+      Py_DECREF(files);
+      return NULL;
+    }
+  }
+
+  int error_bit, failed_index = 0;
+  Py_BEGIN_ALLOW_THREADS
+  error_bit = single
+    ? hierarchy_totals_file(&self->hierarchy, totals, file_names[0])
+    : hierarchy_totals_files(&self->hierarchy, totals, file_names, n_files,
+        n_threads, &failed_index);
+  Py_END_ALLOW_THREADS
+
+  PyArrayObject *array = NULL;
+  if (error_bit != MASKER_SUCCESS) {
+    masker_translate_error_codes(error_bit, file_names[failed_index]);
+  } else {
+    npy_intp dims[2] = {n_files, n_regions};
+    array = single ? masker_new_float_array(1, &dims[1])
+      : masker_new_float_array(2, dims);
+    for (size_t i=0; array != NULL && i<(size_t)n_files * n_regions; i++)
+      ((float*)array->data)[i] = 0.25 * (float)totals[i];
+  }
+  free(file_names);
+  free(totals);
+  Py_DECREF(files);
+  if (array == NULL) return NULL;
+  return PyArray_Return(array);
+}
+
+static PyMethodDef masker_HierarchyObject_methods[] = {
+  {"totals", (PyCFunction)masker_HierarchyObject_totals,
+   METH_VARARGS | METH_KEYWORDS,
+   "Rain totals for every region from one pass over the leaves.\n"
+   "Usage: totals(frames, threads=0), where frames is one met or grayscale\n"
+   "file, giving (regions,), or a list of files, giving (files, regions)\n"
+   "with the files spread over threads (0 for every core)."},
+  {NULL}  /* Sentinel */
+};
+
+static PyMemberDef masker_HierarchyObject_members[] = {
+  {"n_leaves", T_INT, offsetof(masker_HierarchyObject, hierarchy.n_leaves),
+   READONLY, "Number of finest-level regions"},
+  {"n_regions", T_INT, offsetof(masker_HierarchyObject, hierarchy.n_regions),
+   READONLY, "Number of regions at every level"},
+  {NULL}
+};
+
+static PyTypeObject masker_HierarchyType = {
+    PyObject_HEAD_INIT(NULL)
+    0,                         /*ob_size*/
+    "masker.Hierarchy",        /*tp_name*/
+    sizeof(masker_HierarchyObject), /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    (destructor)masker_HierarchyObject_dealloc,          /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    0,                         /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
+    "Nested regions totalled from the finest level only.\n"
+    "Usage: Hierarchy(leaves, parents). leaves are disjoint masks (a\n"
+    "MaskSet, Masks or paths) for the finest regions, which are regions\n"
+    "0 to len(leaves) - 1. parents has an entry for every region, leaves\n"
+    "first, giving the index of its parent, which must come after it, or\n"
+    "None at the top. E.g. two sub-catchments in one basin in a nation:\n"
+    "Hierarchy([a, b], [2, 2, 3, None]).",
+    0,		               /* tp_traverse */
+    0,		               /* tp_clear */
+    0,		               /* tp_richcompare */
+    0,		               /* tp_weaklistoffset */
+    0,		               /* tp_iter */
+    0,		               /* tp_iternext */
+    masker_HierarchyObject_methods,        /* tp_methods */
+    masker_HierarchyObject_members,        /* tp_members */
+    0,                         /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    (initproc)masker_HierarchyObject_init, /* tp_init */
+    0,                         /* tp_alloc */
+    masker_HierarchyObject_new,            /* tp_new */
+};
+
+/* ====== SINK OUTPUTS ====== */
+/* Outputs requested from one decode, as for process() */
+typedef struct {
+  masker_sinks_t sinks;
+  char *gray_file;
+  PyObject *mask_obj;             // owns the gray and channel mask
+  masker_MaskSetObject *set;
+  PyArrayObject *gray, *channels;
+  int want_stats;
+  long total;
+  unsigned long counts[MASKER_RAIN_CLASSES + 1];
+} masker_outputs_t;
+
+static void masker_outputs_clear(masker_outputs_t *outputs)
+{
+  Py_CLEAR(outputs->gray);
+  Py_CLEAR(outputs->channels);
+  Py_CLEAR(outputs->set);
+  Py_CLEAR(outputs->mask_obj);
+  free(outputs->sinks.totals);
+  free(outputs->gray_file);
+  outputs->sinks.totals = NULL;
+  outputs->gray_file = NULL;
+}
+
+static int masker_outputs_init(masker_outputs_t *outputs,
+  const char *gray_file, PyObject *masks_obj, int want_gray, int want_channels,
+  int want_stats, PyObject *mask_obj)
+{
+  memset(outputs, 0, sizeof(masker_outputs_t));
+  if (mask_obj != Py_None && !PyObject_TypeCheck(mask_obj, &masker_MaskType)) {
+    PyErr_SetString(PyExc_TypeError, "mask must be a Mask");
+    return -1;
+  }
+  if (masks_obj != Py_None && (outputs->set = masker_as_mask_set(masks_obj)) == NULL)
+    return -1;
+
+  masker_sinks_t *sinks = &outputs->sinks;
+  if (mask_obj != Py_None) {
+    Py_INCREF(mask_obj);
+    outputs->mask_obj = mask_obj;
+    sinks->gray_mask = &((masker_MaskObject*)mask_obj)->mask;
+    sinks->channel_mask = sinks->gray_mask;
+  }
+  if (gray_file != NULL && (outputs->gray_file = strdup(gray_file)) == NULL)
+    goto no_memory;
+  sinks->gray_file = outputs->gray_file;
+
+  if (outputs->set != NULL) {
+    sinks->masks = outputs->set->masks;
+    sinks->n_masks = outputs->set->n_masks;
+    sinks->totals = malloc((outputs->set->n_masks + 1) * sizeof(long));
+    if (sinks->totals == NULL) goto no_memory;
+  }
+  if (want_gray) {
+    npy_intp dims[2] = {HEIGHT, WIDTH};
+    if ((outputs->gray = masker_new_float_array(2, dims)) == NULL) goto fail;
+    sinks->gray = (float*)outputs->gray->data;
+  }
+  if (want_channels) {
+    npy_intp dims[3] = {8, HEIGHT, WIDTH};
+    if ((outputs->channels = masker_new_float_array(3, dims)) == NULL) goto fail;
+    sinks->channels = (float*)outputs->channels->data;
+  }
+  outputs->want_stats = want_stats;
+  if (want_stats) {
+    sinks->counts = outputs->counts;
+    sinks->total = &outputs->total;
+  }
+  return 0;
+
+no_memory:
+  PyErr_NoMemory();
+fail:
+  masker_outputs_clear(outputs);
+  return -1;
+}
+
+/* Dict of the filled outputs */
+static PyObject* masker_outputs_result(masker_outputs_t *outputs)
+{
+  PyObject *result = PyDict_New();
+  if (result == NULL) return NULL;
+  if (outputs->set != NULL) {
+    int n_masks = outputs->set->n_masks;
+    PyObject *totals = PyList_New(n_masks);
+    for (int m=0; totals != NULL && m<n_masks; m++) {
+      PyList_SET_ITEM(totals, m,
+        PyFloat_FromDouble(0.25 * (float)outputs->sinks.totals[m]));
+    }
+    PyDict_SetItemString(result, "totals", totals);
+    Py_XDECREF(totals);
+  }
+  if (outputs->gray != NULL)
+    PyDict_SetItemString(result, "gray", (PyObject*)outputs->gray);
+  if (outputs->channels != NULL)
+    PyDict_SetItemString(result, "channels", (PyObject*)outputs->channels);
+  if (outputs->want_stats) {
+    PyObject *count_list = PyList_New(MASKER_RAIN_CLASSES + 1);
+    for (int c=0; count_list != NULL && c<=MASKER_RAIN_CLASSES; c++)
+      PyList_SET_ITEM(count_list, c, PyLong_FromUnsignedLong(outputs->counts[c]));
+    PyDict_SetItemString(result, "counts", count_list);
+    Py_XDECREF(count_list);
+    PyObject *value = PyFloat_FromDouble(0.25 * (double)outputs->total);
+    PyDict_SetItemString(result, "total", value);
+    Py_XDECREF(value);
+  }
+  if (PyErr_Occurred()) Py_CLEAR(result);
+  return result;
+}
+
+/* ====== PUSH DECODER ====== */
+typedef struct {
+  PyObject_HEAD
+  masker_outputs_t outputs;
+  masker_sink_state_t state;
+  masker_push_t push;
+  int open;     // decoding, not yet finished or failed
+  int busy;     // a call is running without the GIL
+} masker_PushDecoderObject;
+
+/* Abandon the frame after error_bit, removing any partial gray file */
+static void masker_PushDecoderObject_close(masker_PushDecoderObject *self,
+  int error_bit)
+{
+  if (!self->open) return;
+  push_end(&self->push);
+  sinks_end(&self->state, error_bit);
+  self->open = 0;
+}
+
+static void masker_PushDecoderObject_dealloc(masker_PushDecoderObject* self)
+{
+  masker_PushDecoderObject_close(self, MASKER_FAILURE);
+  masker_outputs_clear(&self->outputs);
+  self->ob_type->tp_free((PyObject*)self);
+}
+
+static PyObject* masker_PushDecoderObject_new(
+  PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+  masker_PushDecoderObject *self =
+    (masker_PushDecoderObject*)type->tp_alloc(type, 0);
+  if (self != NULL) {
+    memset(&self->outputs, 0, sizeof(masker_outputs_t));
+    self->open = 0;
+    self->busy = 0;
+  }
+  return (PyObject*)self;
+}
+
+static int masker_PushDecoderObject_init(
+  masker_PushDecoderObject *self, PyObject *args, PyObject *kwds)
+{
+  const char *gray_file = NULL;
+  PyObject *masks_obj = Py_None, *mask_obj = Py_None;
+  int want_gray = 0, want_channels = 0, want_stats = 0;
+  static char *kwlist[] = {"gray_file", "masks", "gray", "channels", "stats",
+    "mask", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|zOiiiO", kwlist,
+    &gray_file, &masks_obj, &want_gray, &want_channels, &want_stats,
+    &mask_obj)) return -1;
+  if (self->open || self->busy) {
+    PyErr_SetString(PyExc_RuntimeError, "PushDecoder is already initialised");
+    return -1;
+  }
+
+  masker_outputs_clear(&self->outputs);
+  if (masker_outputs_init(&self->outputs, gray_file, masks_obj, want_gray,
+        want_channels, want_stats, mask_obj) < 0)
+    return -1;
+  int error_bit = sinks_begin(&self->state, &self->outputs.sinks);
+  if (error_bit != MASKER_SUCCESS) {
+    masker_translate_error_codes(error_bit, gray_file);
+    return -1;
+  }
+  error_bit = push_begin(&self->push, sinks_feed_row, &self->state);
+  if (error_bit != MASKER_SUCCESS) {
+    sinks_end(&self->state, error_bit);
+    masker_translate_error_codes(error_bit, "<stream>");
+    return -1;
+  }
+  self->open = 1;
+  return 0;
+}
+
+/* Claim the decoder for a call, or raise */
+static int masker_PushDecoderObject_claim(masker_PushDecoderObject *self)
+{
+  if (self->busy) {
+    PyErr_SetString(PyExc_RuntimeError, "PushDecoder is in use by another thread");
+    return -1;
+  }
+  if (!self->open) {
+    PyErr_SetString(PyExc_ValueError, "PushDecoder is finished or failed");
+    return -1;
+  }
+  self->busy = 1;
+  return 0;
+}
+
+/* Release after a call, closing the decoder and raising on failure */
+static int masker_PushDecoderObject_settle(masker_PushDecoderObject *self,
+  int error_bit)
+{
+  self->busy = 0;
+  if (error_bit == MASKER_SUCCESS) return 0;
+  masker_PushDecoderObject_close(self, error_bit);
+  masker_translate_error_codes(error_bit, error_bit == MASKER_WRITE_ERROR
+    ? self->outputs.gray_file : "<stream>");
+  return -1;
+}
+
+static PyObject* masker_PushDecoderObject_feed(
+  masker_PushDecoderObject *self, PyObject *args)
+{
+  const char *data;
+  int length;
+  if (!PyArg_ParseTuple(args, "s#", &data, &length)) return NULL;
+  if (masker_PushDecoderObject_claim(self) < 0) return NULL;
+
+  int error_bit;
+  Py_BEGIN_ALLOW_THREADS
+  error_bit = push_data(&self->push, data, length);
+  Py_END_ALLOW_THREADS
+  if (masker_PushDecoderObject_settle(self, error_bit) < 0) return NULL;
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject* masker_PushDecoderObject_feed_fd(
+  masker_PushDecoderObject *self, PyObject *args)
+{
+  PyObject *fd_obj;
+  if (!PyArg_ParseTuple(args, "O", &fd_obj)) return NULL;
+  int fd = PyObject_AsFileDescriptor(fd_obj);
+  if (fd < 0) return NULL;
+  if (masker_PushDecoderObject_claim(self) < 0) return NULL;
+
+  int error_bit, eof;
+  Py_BEGIN_ALLOW_THREADS
+  error_bit = push_fd(&self->push, fd, &eof);
+  Py_END_ALLOW_THREADS
+  if (masker_PushDecoderObject_settle(self, error_bit) < 0) return NULL;
+  return PyBool_FromLong(eof);
+}
+
+static PyObject* masker_PushDecoderObject_finish(masker_PushDecoderObject *self)
+{
+  if (masker_PushDecoderObject_claim(self) < 0) return NULL;
+  int error_bit = sinks_end(&self->state, push_end(&self->push));
+  self->open = 0;
+  if (masker_PushDecoderObject_settle(self, error_bit) < 0) return NULL;
+  return masker_outputs_result(&self->outputs);
+}
+
+static PyMethodDef masker_PushDecoderObject_methods[] = {
+  {"feed", (PyCFunction)masker_PushDecoderObject_feed, METH_VARARGS,
+   "Decode the next bytes of the frame, in pieces of any size."},
+  {"feed_fd", (PyCFunction)masker_PushDecoderObject_feed_fd, METH_VARARGS,
+   "Decode everything readable from a file descriptor or object with\n"
+   "fileno(), until end of file or, when non-blocking, until it would\n"
+   "block. Returns True at end of file."},
+  {"finish", (PyCFunction)masker_PushDecoderObject_finish, METH_NOARGS,
+   "Check the frame is complete and return the outputs, as process()."},
+  {NULL}  /* Sentinel */
+};
+
+static PyTypeObject masker_PushDecoderType = {
+    PyObject_HEAD_INIT(NULL)
+    0,                         /*ob_size*/
+    "masker.PushDecoder",      /*tp_name*/
+    sizeof(masker_PushDecoderObject), /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    (destructor)masker_PushDecoderObject_dealloc,        /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    0,                         /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
+    "PNG frame decoded as its bytes arrive, e.g. from a socket or pipe.\n"
+    "Usage: PushDecoder(gray_file=None, masks=None, gray=False,\n"
+    "channels=False, stats=False, mask=None), with the outputs of\n"
+    "process(). Each row goes to the outputs as soon as it is decoded, so\n"
+    "finish() has little left to do once the last byte is fed.",
+    0,		               /* tp_traverse */
+    0,		               /* tp_clear */
+    0,		               /* tp_richcompare */
+    0,		               /* tp_weaklistoffset */
+    0,		               /* tp_iter */
+    0,		               /* tp_iternext */
+    masker_PushDecoderObject_methods,      /* tp_methods */
+    0,                         /* tp_members */
+    0,                         /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    (initproc)masker_PushDecoderObject_init, /* tp_init */
+    0,                         /* tp_alloc */
+    masker_PushDecoderObject_new,          /* tp_new */
+};
+
+static PyObject* masker_shared_mask(
+  PyObject *self, PyObject *args, PyObject *kwargs)
+{
+  PyObject *name;
+  static char *kwlist[] = {"name", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "S", kwlist, &name))
+    return NULL;
+
+  masker_MaskObject *mask = (masker_MaskObject*)masker_MaskObject_new(
+    &masker_MaskType, NULL, NULL);
+  if (mask == NULL) return NULL;
+  int error_bit = shm_mask_attach(&mask->mask, PyString_AS_STRING(name));
+  if (error_bit != MASKER_SUCCESS) {
+    Py_DECREF(mask);
+    masker_translate_error_codes(error_bit, PyString_AS_STRING(name));
+    return NULL;
+  }
+  Py_INCREF(name);
+  mask->shared_name = name;
+  return (PyObject*)mask;
+}
+
+static PyObject* masker_unlink_shared(
+  PyObject *self, PyObject *args, PyObject *kwargs)
+{
+  const char *name;
+  static char *kwlist[] = {"name", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s", kwlist, &name))
+    return NULL;
+
+  if (shm_remove(name) != MASKER_SUCCESS) {
+    masker_translate_error_codes(MASKER_IO_ERROR, name);
+    return NULL;
+  }
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject* masker_validate(
+  PyObject *self, PyObject *args, PyObject *kwargs)
+{
+  PyObject *paths;
+  int level = MASKER_VALIDATE_CHUNKS, n_threads = 0;
+  static char *kwlist[] = {"paths", "level", "threads", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|ii", kwlist,
+    &paths, &level, &n_threads)) return NULL;
+  if (level < MASKER_VALIDATE_HEADER || level > MASKER_VALIDATE_COLORS) {
+    PyErr_SetString(PyExc_ValueError, "level must be 0, 1 or 2");
+    return NULL;
+  }
+
+  PyObject *files = PySequence_Fast(paths, "paths must be a sequence");
+  if (files == NULL) return NULL;
+  int n_files = PySequence_Fast_GET_SIZE(files);
+  const char **file_names = malloc((n_files + 1) * sizeof(char*));
+  int *codes = malloc((n_files + 1) * sizeof(int));
+  if (file_names == NULL || codes == NULL) {
+    free(file_names);
+    free(codes);
+    Py_DECREF(files);
+    return PyErr_NoMemory();
+  }
+  for (int i=0; i<n_files; i++) {
+    file_names[i] = PyString_AsString(PySequence_Fast_GET_ITEM(files, i));
+    if (file_names[i] == NULL) {
+      free(file_names);
+      free(codes);
+      Py_DECREF(files);
+      return NULL;
+    }
+  }
+
+  int error_bit;
+  Py_BEGIN_ALLOW_THREADS
+  error_bit = validate_frame_files(codes, file_names, n_files, level, n_threads);
+  Py_END_ALLOW_THREADS
+
+  PyObject *result = NULL;
+  if (error_bit != MASKER_SUCCESS) {
+    masker_translate_error_codes(error_bit, "validate");
+  } else if ((result = PyList_New(n_files)) != NULL) {
+    for (int i=0; i<n_files; i++)
+      PyList_SET_ITEM(result, i, PyInt_FromLong(codes[i]));
+  }
+  free(file_names);
+  free(codes);
+  Py_DECREF(files);
+  return result;
+}
+
+static PyObject* masker_build_tiles(
+  PyObject *self, PyObject *args, PyObject *kwargs)
+{
+  const char *file_name, *out_dir;
+  int tile_size = MASKER_PYRAMID_TILE, n_threads = 0;
+  static char *kwlist[] = {"file_name", "out_dir", "tile_size", "threads", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "ss|ii", kwlist,
+    &file_name, &out_dir, &tile_size, &n_threads)) return NULL;
+  if (tile_size <= 0) {
+    PyErr_SetString(PyExc_ValueError, "tile_size must be positive");
+    return NULL;
+  }
+
+  masker_pyramid_result_t result;
+  int error_bit;
+  Py_BEGIN_ALLOW_THREADS
+  error_bit = pyramid_build(&result, file_name, out_dir, tile_size, n_threads);
+  Py_END_ALLOW_THREADS
+  if (error_bit != MASKER_SUCCESS) {
+    masker_translate_error_codes(error_bit,
+      error_bit == MASKER_WRITE_ERROR ? out_dir : file_name);
+    return NULL;
+  }
+  return Py_BuildValue("(iii)", result.n_levels, result.n_tiles, result.n_written);
+}
+
+static PyObject* masker_read_store(
+  PyObject *self, PyObject *args, PyObject *kwargs)
+{
+  const char *file_name;
+  PyObject *start_obj = Py_None, *end_obj = Py_None;
+  int latest = 1;
+  static char *kwlist[] = {"file_name", "start", "end", "latest", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|OOi", kwlist,
+    &file_name, &start_obj, &end_obj, &latest)) return NULL;
+
+  PY_LONG_LONG start = LLONG_MIN, end = LLONG_MAX;
+  if (start_obj != Py_None) start = PyLong_AsLongLong(start_obj);
+  if (end_obj != Py_None) end = PyLong_AsLongLong(end_obj);
+  if (PyErr_Occurred()) return NULL;
+
+  masker_store_t store;
+  int error_bit = store_open_read(&store, file_name);
+  if (error_bit != MASKER_SUCCESS) {
+    masker_translate_error_codes(error_bit, file_name);
+    return NULL;
+  }
+  // Only the records in [start, end), found through the store's time index
+  int n_regions = store.n_regions;
+  long first = store_find_time(&store, start);
+  long last = store_find_time(&store, end);
+  long count = last > first ? last - first : 0;
+  long run_max = count < MASKER_STORE_BLOCK ? count : MASKER_STORE_BLOCK;
+  int64_t *times = malloc((count + 1) * sizeof(int64_t));
+  float *totals = malloc((count * n_regions + 1) * sizeof(float));
+  masker_store_record_t *records = malloc((run_max + 1) * sizeof(masker_store_record_t));
+  int *is_current = malloc((run_max + 1) * sizeof(int));
+  if (times == NULL || totals == NULL || records == NULL || is_current == NULL) {
+    free(times);
+    free(totals);
+    free(records);
+    free(is_current);
+    store_close(&store);
+    return PyErr_NoMemory();
+  }
+
+  // Records in time order are adjacent in the file, so each run of them is
+  // one block read. Failed frames are kept in the store only as checkpoints
+  long n = 0;
+  Py_BEGIN_ALLOW_THREADS
+  for (long at=first; at<last && error_bit == MASKER_SUCCESS;) {
+    long i = store.times[at].index;
+    long run = 1;
+    while (run < run_max && at + run < last && store.times[at + run].index == i + run)
+      run++;
+    long base = n;
+    error_bit = store_read_block(&store, i, run, records, &totals[base * n_regions],
+      is_current);
+    for (long j=0; j<run && error_bit == MASKER_SUCCESS; j++) {
+      if (records[j].status != MASKER_SUCCESS || !(is_current[j] || !latest))
+        continue;
+      memmove(&totals[n * n_regions], &totals[(base + j) * n_regions],
+        n_regions * sizeof(float));
+      times[n++] = records[j].timestamp;
+    }
+    at += run;
+  }
+  Py_END_ALLOW_THREADS
+
+  PyObject *result = NULL;
+  if (error_bit != MASKER_SUCCESS) {
+    masker_translate_error_codes(error_bit, file_name);
+    goto done;
+  }
+  npy_intp time_dims[1] = {n};
+  npy_intp total_dims[2] = {n, n_regions};
+  PyArrayObject *time_array = (PyArrayObject*)PyArray_SimpleNew(1, time_dims, NPY_INT64);
+  PyArrayObject *total_array = masker_new_float_array(2, total_dims);
+  PyObject *regions = PyList_New(n_regions);
+  if (time_array == NULL || total_array == NULL || regions == NULL) {
+    Py_XDECREF(time_array);
+    Py_XDECREF(total_array);
+    Py_XDECREF(regions);
+    goto done;
+  }
+  for (int r=0; r<n_regions; r++)
+    PyList_SET_ITEM(regions, r, PyString_FromString(store.regions[r]));
+  memcpy(time_array->data, times, n * sizeof(int64_t));
+  memcpy(total_array->data, totals, n * n_regions * sizeof(float));
+  result = Py_BuildValue("(NNN)", regions, PyArray_Return(time_array),
+    PyArray_Return(total_array));
+
+done:
+  free(times);
+  free(totals);
+  free(records);
+  free(is_current);
+  store_close(&store);
+  return result;
+}
+
+static PyObject* masker_rolling_totals(
+  PyObject *self, PyObject *args, PyObject *kwargs)
+{
+  PyObject *frames, *windows_obj, *masks_obj;
+  static char *kwlist[] = {"frames", "windows", "masks", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOO", kwlist,
+    &frames, &windows_obj, &masks_obj)) return NULL;
+
+  masker_MaskSetObject *set = masker_as_mask_set(masks_obj);
+  if (set == NULL) return NULL;
+  masker_mask_t *masks = set->masks;
+  int n_masks = set->n_masks;
+
+  PyObject *windows_seq = PySequence_Fast(windows_obj, "windows must be a sequence");
+  if (windows_seq == NULL) {
+    Py_DECREF(set);
+    return NULL;
+  }
+  int n_windows = PySequence_Fast_GET_SIZE(windows_seq);
+  int *windows = malloc((n_windows + 1) * sizeof(int));
+  if (windows == NULL) {
+    Py_DECREF(windows_seq);
+    Py_DECREF(set);
+    return PyErr_NoMemory();
+  }
+  for (int w=0; w<n_windows; w++) {
+    windows[w] = PyInt_AsLong(PySequence_Fast_GET_ITEM(windows_seq, w));
+    if (windows[w] < 1) {
+      if (!PyErr_Occurred())
+        PyErr_SetString(PyExc_ValueError, "windows must be positive frame counts");
+      free(windows);
+      Py_DECREF(windows_seq);
+      Py_DECREF(set);
+      return NULL;
+    }
+  }
+  Py_DECREF(windows_seq);
+
+  PyArrayObject *array = NULL;
+  const char *failed_name = NULL;
+  int error_bit = MASKER_SUCCESS;
+  size_t frame_size = (size_t)n_windows * n_masks;
+
+  if (PyString_Check(frames)) {
+    // A sequence store: stream it through the incremental reader
+    const char *file_name = PyString_AsString(frames);
+    masker_sequence_reader_t reader;
+    masker_rolling_t rolling;
+    error_bit = sequence_reader_open(&reader, file_name, masks, n_masks);
+    if (error_bit != MASKER_SUCCESS) {
+      failed_name = file_name;
+      goto done;
+    }
+    error_bit = rolling_init(&rolling, windows, n_windows, n_masks);
+    if (error_bit != MASKER_SUCCESS) {
+      sequence_reader_close(&reader);
+      failed_name = file_name;
+      goto done;
+    }
+
+    float *buffer = NULL;
+    int n_frames = 0, capacity = 0, has_frame = 1;
+    while (has_frame) {
+      error_bit = sequence_reader_next(&reader, &has_frame);
+      if (error_bit != MASKER_SUCCESS || !has_frame) break;
+      if (n_frames == capacity) {
+        capacity = capacity ? 2 * capacity : 64;
+        float *grown = realloc(buffer, capacity * frame_size * sizeof(float) + 1);
+        if (grown == NULL) {
+          error_bit = MASKER_MEMORY_ERROR;
+          break;
+        }
+        buffer = grown;
+      }
+      rolling_push(&rolling, reader.totals);
+      rolling_totals(&rolling, &buffer[n_frames * frame_size]);
+      n_frames++;
+    }
+    rolling_free(&rolling);
+    sequence_reader_close(&reader);
+
+    if (error_bit == MASKER_SUCCESS) {
+      npy_intp dims[3] = {n_frames, n_windows, n_masks};
+      array = masker_new_float_array(3, dims);
+      if (array != NULL)
+        memcpy(array->data, buffer, n_frames * frame_size * sizeof(float));
+    } else {
+      failed_name = file_name;
+    }
+    free(buffer);
+  } else {
+    PyObject *files = PySequence_Fast(frames, "frames must be a sequence");
+    if (files == NULL) goto done;
+    int n_files = PySequence_Fast_GET_SIZE(files);
+    const char **file_names = malloc((n_files + 1) * sizeof(char*));
+    if (file_names == NULL) {
+      Py_DECREF(files);
+      PyErr_NoMemory();
+      goto done;
+    }
+    for (int i=0; i<n_files; i++) {
+      file_names[i] = PyString_AsString(PySequence_Fast_GET_ITEM(files, i));
+      if (file_names[i] == NULL) {
+        free(file_names);
+        Py_DECREF(files);
+        goto done;
+      }
+    }
+
+    npy_intp dims[3] = {n_files, n_windows, n_masks};
+    array = masker_new_float_array(3, dims);
+    if (array != NULL) {
+      int failed_index = 0;
+      error_bit = rolling_totals_files((float*)array->data, file_names, n_files,
+        windows, n_windows, masks, n_masks, &failed_index);
+      if (error_bit != MASKER_SUCCESS) {
+        Py_DECREF(array);
+        array = NULL;
+        masker_translate_error_codes(error_bit, file_names[failed_index]);
+      }
+    }
+    free(file_names);
+    Py_DECREF(files);
+  }
+
+done:
+  if (failed_name != NULL) masker_translate_error_codes(error_bit, failed_name);
+  free(windows);
+  Py_DECREF(set);
+  if (array == NULL) return NULL;
+  return PyArray_Return(array);
+}
+
+static PyObject* masker_save_met_to_gray(
+  PyObject *self, PyObject *args, PyObject *kwargs)
+{
+  const char *in_file;
+  const char *out_file;
+  static char *kwlist[] = {"in_file", "out_file", NULL};
+  if (!PyArg_ParseTupleAndKeywords(
+    args, kwargs, "ss", kwlist, &in_file, &out_file)) return NULL;
+
+  masker_image_t res;
+  int error_bit = met_image_to_gray(&res, in_file);
+  if (error_bit != MASKER_SUCCESS) {
+    masker_translate_error_codes(error_bit, in_file);
+    return NULL;
+  }
+
+  error_bit = write_png_file(res, out_file);
+  if (error_bit != MASKER_SUCCESS) {
+    masker_translate_error_codes(error_bit, out_file);
+    free_image_memory(&res);
+    return NULL;
+  }
+
+  free_image_memory(&res);
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject* masker_process(
+  PyObject *self, PyObject *args, PyObject *kwargs)
+{
+  const char *file_name, *gray_file = NULL;
+  PyObject *masks_obj = Py_None, *mask_obj = Py_None;
+  int want_gray = 0, want_channels = 0, want_stats = 0;
+  static char *kwlist[] = {"file_name", "gray_file", "masks", "gray",
+    "channels", "stats", "mask", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|zOiiiO", kwlist,
+    &file_name, &gray_file, &masks_obj, &want_gray, &want_channels,
+    &want_stats, &mask_obj)) return NULL;
+
+  masker_outputs_t outputs;
+  if (masker_outputs_init(&outputs, gray_file, masks_obj, want_gray,
+        want_channels, want_stats, mask_obj) < 0)
+    return NULL;
+
+  int error_bit;
+  Py_BEGIN_ALLOW_THREADS
+  error_bit = sinks_process_file(&outputs.sinks, file_name);
+  Py_END_ALLOW_THREADS
+
+  PyObject *result = NULL;
+  if (error_bit != MASKER_SUCCESS) {
+    masker_translate_error_codes(error_bit,
+      error_bit == MASKER_WRITE_ERROR ? gray_file : file_name);
+  } else {
+    result = masker_outputs_result(&outputs);
+  }
+  masker_outputs_clear(&outputs);
+  return result;
+}
+
+static PyObject* masker_save_tiled(
+  PyObject *self, PyObject *args, PyObject *kwargs)
+{
+  const char *in_file;
+  const char *out_file;
+  static char *kwlist[] = {"in_file", "out_file", NULL};
+  if (!PyArg_ParseTupleAndKeywords(
+    args, kwargs, "ss", kwlist, &in_file, &out_file)) return NULL;
+
+  masker_image_t image;
+  int error_bit = read_frame_file(&image, in_file);
+  if (error_bit != MASKER_SUCCESS) {
+    masker_translate_error_codes(error_bit, in_file);
+    return NULL;
+  }
+
+  error_bit = write_tiled_file(image, out_file);
+  free_image_memory(&image);
+  if (error_bit != MASKER_SUCCESS) {
+    masker_translate_error_codes(error_bit, out_file);
+    return NULL;
+  }
+
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject* masker_write_sequence(
+  PyObject *self, PyObject *args, PyObject *kwargs)
+{
+  const char *out_file;
+  PyObject *in_files;
+  int keyframe_interval = 12;
+  static char *kwlist[] = {"out_file", "in_files", "keyframe_interval", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "sO|i", kwlist,
+    &out_file, &in_files, &keyframe_interval)) return NULL;
+
+  PyObject *files = PySequence_Fast(in_files, "in_files must be a sequence");
+  if (files == NULL) return NULL;
+
+  masker_sequence_writer_t writer;
+  int error_bit = sequence_writer_open(&writer, out_file, keyframe_interval);
+  if (error_bit != MASKER_SUCCESS) {
+    Py_DECREF(files);
+    masker_translate_error_codes(error_bit, out_file);
+    return NULL;
+  }
+
+  Py_ssize_t n_files = PySequence_Fast_GET_SIZE(files);
+  for (Py_ssize_t i=0; i<n_files; i++) {
+    const char *in_file = PyString_AsString(PySequence_Fast_GET_ITEM(files, i));
+    if (in_file == NULL) {
+      sequence_writer_close(&writer);
+      Py_DECREF(files);
+      return NULL;
+    }
+
+    masker_image_t image;
+    error_bit = read_frame_file(&image, in_file);
+    if (error_bit == MASKER_SUCCESS) {
+      error_bit = sequence_writer_append(&writer, image);
+      free_image_memory(&image);
+    }
+    if (error_bit != MASKER_SUCCESS) {
+      sequence_writer_close(&writer);
+      Py_DECREF(files);
+      masker_translate_error_codes(error_bit, in_file);
+      return NULL;
+    }
+  }
+
+  Py_DECREF(files);
+  error_bit = sequence_writer_close(&writer);
+  if (error_bit != MASKER_SUCCESS) {
+    masker_translate_error_codes(error_bit, out_file);
+    return NULL;
+  }
+  return Py_BuildValue("n", n_files);
+}
+
+static PyObject* masker_set_pool_size(
+  PyObject *self, PyObject *args, PyObject *kwargs)
+{
+  int pool_size;
+  static char *kwlist[] = {"pool_size", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "i", kwlist, &pool_size))
+    return NULL;
+
+  buffers_set_pool_size(pool_size);
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject* masker_pool_stats(PyObject *self, PyObject *args)
+{
+  masker_buffer_stats_t stats;
+  buffers_get_stats(&stats);
+  return Py_BuildValue("{s:k,s:k,s:k,s:k,s:k,s:k,s:i}",
+    "frame_hits", stats.frame_hits,
+    "frame_misses", stats.frame_misses,
+    "frame_drops", stats.frame_drops,
+    "png_hits", stats.png_hits,
+    "png_misses", stats.png_misses,
+    "pooled", stats.pooled,
+    "pool_size", stats.pool_size);
+}
+
+static PyObject* masker_load_gray(
+  masker_MaskObject *self, PyObject *args, PyObject *kwargs)
+{
+  const char *file_name;
+  static char *kwlist[] = {"in_file", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s", kwlist, &file_name))
+    return NULL;
+
+  npy_intp dims[2] = {HEIGHT, WIDTH};
+  PyArrayObject *array = masker_new_float_array(2, dims);
+  if (array == NULL) {
+    return NULL;
+  }
+
+  float* data_ptr = (float*)array->data;
+  int error_bit = load_gray_to_array(data_ptr, file_name);
+  if (error_bit != MASKER_SUCCESS) {
+    Py_DECREF(array);
+    masker_translate_error_codes(error_bit, file_name);
+    return NULL;
+  }
+
+  return PyArray_Return(array);
+}
+
+
+static PyObject* masker_enable_stats(
+  PyObject *self, PyObject *args, PyObject *kwargs)
+{
+  int enabled = 1;
+  static char *kwlist[] = {"enabled", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|i", kwlist, &enabled))
+    return NULL;
+
+  stats_enable(enabled);
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject* masker_set_threads(
+  PyObject *self, PyObject *args, PyObject *kwargs)
+{
+  int n_threads;
+  static char *kwlist[] = {"threads", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "i", kwlist, &n_threads))
+    return NULL;
+
+  int error_bit;
+  Py_BEGIN_ALLOW_THREADS
+  error_bit = bands_set_threads(n_threads);
+  Py_END_ALLOW_THREADS
+  if (error_bit != MASKER_SUCCESS) {
+    PyErr_SetString(PyExc_OSError, "could not start frame threads");
+    return NULL;
+  }
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject* masker_latency_list(const unsigned long *bins)
+{
+  PyObject *list = PyList_New(MASKER_LATENCY_BINS);
+  if (list == NULL) return NULL;
+  for (int b=0; b<MASKER_LATENCY_BINS; b++) {
+    PyObject *count = PyLong_FromUnsignedLong(bins[b]);
+    if (count == NULL) {
+      Py_DECREF(list);
+      return NULL;
+    }
+    PyList_SET_ITEM(list, b, count);
+  }
+  return list;
+}
+
+static PyObject* masker_stats(PyObject *self, PyObject *args)
+{
+  masker_stats_t stats;
+  stats_get(&stats);
+
+  PyObject *stages = PyDict_New();
+  if (stages == NULL) return NULL;
+  for (int s=0; s<MASKER_STAGES; s++) {
+    masker_stage_stats_t *stage = &stats.stages[s];
+    PyObject *latency = masker_latency_list(stage->latency);
+    PyObject *item = latency == NULL ? NULL
+      : Py_BuildValue("{s:k,s:d,s:K,s:K,s:N}",
+          "calls", stage->calls,
+          "seconds", 1e-9 * stage->ns,
+          "bytes", stage->bytes,
+          "pixels", stage->pixels,
+          "latency", latency);
+    if (item == NULL
+        || PyDict_SetItemString(stages, stats_stage_name(s), item) < 0) {
+      Py_XDECREF(item);
+      Py_DECREF(stages);
+      return NULL;
+    }
+    Py_DECREF(item);
+  }
+
+  PyObject *frame_latency = masker_latency_list(stats.frame_latency);
+  if (frame_latency == NULL) {
+    Py_DECREF(stages);
+    return NULL;
+  }
+  return Py_BuildValue("{s:O,s:k,s:d,s:N,s:N}",
+    "enabled", masker_stats_enabled ? Py_True : Py_False,
+    "frames", stats.frames,
+    "frame_seconds", 1e-9 * stats.frame_ns,
+    "frame_latency", frame_latency,
+    "stages", stages);
+}
+
+static PyObject* masker_reset_stats(PyObject *self, PyObject *args)
+{
+  stats_reset();
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+
+static PyMethodDef masker_methods[] = {
+  {"met_to_gray", (PyCFunction)masker_save_met_to_gray,
+   METH_VARARGS | METH_KEYWORDS,
+   "Convert met image to grayscale.\nUsage: met_to_gray(in_file, out_file)."},
+  {"load_gray", (PyCFunction)masker_load_gray,
+   METH_VARARGS | METH_KEYWORDS, "Load grayscale image to numpy array."},
+  {"to_tiled", (PyCFunction)masker_save_tiled,
+   METH_VARARGS | METH_KEYWORDS,
+   "Convert an image to the tiled layout, so masked reads only decode the\n"
+   "tiles a mask touches.\nUsage: to_tiled(in_file, out_file)."},
+  {"write_sequence", (PyCFunction)masker_write_sequence,
+   METH_VARARGS | METH_KEYWORDS,
+   "Store consecutive frames as keyframes plus per-pixel deltas.\n"
+   "Usage: write_sequence(out_file, in_files, keyframe_interval=12)."},
+  {"rolling_totals", (PyCFunction)masker_rolling_totals,
+   METH_VARARGS | METH_KEYWORDS,
+   "Rolling rain totals over several window lengths in one pass.\n"
+   "Usage: rolling_totals(frames, windows, masks), where frames is a list\n"
+   "of image files or a sequence file, windows are frame counts and masks\n"
+   "is a Mask, MaskSet or list of Masks. Returns a float array of shape\n"
+   "(frames, windows, masks), NaN until a window has filled."},
+  {"process", (PyCFunction)masker_process,
+   METH_VARARGS | METH_KEYWORDS,
+   "Decode a frame once and feed every requested output from it.\n"
+   "Usage: process(file_name, gray_file=None, masks=None, gray=False,\n"
+   "channels=False, stats=False, mask=None). gray_file writes the\n"
+   "grayscale PNG, masks (a Mask, MaskSet or list of Masks) gives rain\n"
+   "'totals' under each, gray and channels give the 'gray' and 'channels'\n"
+   "arrays of load_gray and load_channels, zeroed outside mask if given,\n"
+   "and stats gives the class 'counts' and the frame's rain 'total'.\n"
+   "Returns a dict of the requested results."},
+  {"read_store", (PyCFunction)masker_read_store,
+   METH_VARARGS | METH_KEYWORDS,
+   "Totals appended by `metmasker ingest` to a results store.\n"
+   "Usage: read_store(file_name, start=None, end=None, latest=True).\n"
+   "Returns (regions, times, totals): the mask names, an int64 array of\n"
+   "frame times in unix seconds and a float array of shape (frames,\n"
+   "regions), in time order and otherwise the order frames were ingested.\n"
+   "start and end select times in [start, end); latest drops results\n"
+   "superseded by a later version of the same file. Frames that failed\n"
+   "to load are left out."},
+  {"set_pool_size", (PyCFunction)masker_set_pool_size,
+   METH_VARARGS | METH_KEYWORDS,
+   "Set how many decoded frame buffers each thread keeps for reuse."},
+  {"pool_stats", (PyCFunction)masker_pool_stats, METH_NOARGS,
+   "Buffer pool counters: frame buffers reused/allocated/dropped, libpng\n"
+   "allocations served by the per-thread arena, and buffers parked."},
+  {"shared_mask", (PyCFunction)masker_shared_mask,
+   METH_VARARGS | METH_KEYWORDS,
+   "Map a mask written by Mask.to_shared(name) without copying it."},
+  {"unlink_shared", (PyCFunction)masker_unlink_shared,
+   METH_VARARGS | METH_KEYWORDS,
+   "Remove a shared mask or ring name; existing mappings stay valid."},
+  {"validate", (PyCFunction)masker_validate,
+   METH_VARARGS | METH_KEYWORDS,
+   "Check frame files without decoding them, returning one error code per\n"
+   "path (0 when the file would load). Level 0 checks the signature and\n"
+   "header; level 1, the default, also every chunk CRC and that the image\n"
+   "data inflates to exactly one frame; level 2 decodes fully and rejects\n"
+   "unknown met colours. Codes are the module's *_ERROR constants.\n"
+   "Usage: validate(paths, level=1, threads=0)."},
+  {"build_tiles", (PyCFunction)masker_build_tiles,
+   METH_VARARGS | METH_KEYWORDS,
+   "Write a met or grayscale frame as a web map tile pyramid,\n"
+   "out_dir/z/x/y.png, with zoom 0 the first level to fit one tile.\n"
+   "Coarser levels keep the heaviest rain class under each pixel and tiles\n"
+   "are met-coloured palette PNGs, transparent where dry. Dry tiles are not\n"
+   "written. Returns (levels, tiles, written).\n"
+   "Usage: build_tiles(file_name, out_dir, tile_size=256, threads=0)."},
+  {"enable_stats", (PyCFunction)masker_enable_stats,
+   METH_VARARGS | METH_KEYWORDS,
+   "Switch per-stage timing on or off, off by default.\n"
+   "Usage: enable_stats(enabled=True)."},
+  {"set_threads", (PyCFunction)masker_set_threads,
+   METH_VARARGS | METH_KEYWORDS,
+   "Split each frame's classification, masking and channel work into row\n"
+   "bands over this many threads, 0 for every core; 1, the default, keeps\n"
+   "it on the calling thread. Results are identical for any count.\n"
+   "Usage: set_threads(threads)."},
+  {"stats", masker_stats, METH_NOARGS,
+   "Counters summed over every thread, as a dict with 'frames',\n"
+   "'frame_seconds', 'frame_latency' and per-stage entries under 'stages'\n"
+   "(io, decode, classify, mask, write, alloc) holding calls, seconds,\n"
+   "bytes, pixels and latency. Latency lists are log2 histograms in\n"
+   "microseconds: entry 0 counts calls under 2us, entry b calls taking\n"
+   "[2**b, 2**(b+1)) us, and the last entry everything slower."},
+  {"reset_stats", masker_reset_stats, METH_NOARGS,
+   "Zero the counters reported by stats()."},
+  {NULL}  /* Sentinel */
+};
+
+#ifndef PyMODINIT_FUNC	/* declarations for DLL import/export */
+#define PyMODINIT_FUNC void
+#endif
+PyMODINIT_FUNC initmasker(void)
+{
+  PyObject* m;
+
+  if (PyType_Ready(&masker_MaskType) < 0)
+      return;
+  if (PyType_Ready(&masker_MaskSetType) < 0)
+      return;
+  if (PyType_Ready(&masker_PoolType) < 0)
+      return;
+  if (PyType_Ready(&masker_RingType) < 0)
+      return;
+  if (PyType_Ready(&masker_RegridderType) < 0)
+      return;
+  if (PyType_Ready(&masker_HierarchyType) < 0)
+      return;
+  if (PyType_Ready(&masker_PushDecoderType) < 0)
+      return;
+
+  m = Py_InitModule3("masker", masker_methods,
+  "Utilities for masking/converting met office images.");
+
+  if (m == NULL) return;
+
+  import_array();
+  Py_INCREF(&masker_MaskType);
+  PyModule_AddObject(m, "Mask", (PyObject *)&masker_MaskType);
+  Py_INCREF(&masker_MaskSetType);
+  PyModule_AddObject(m, "MaskSet", (PyObject *)&masker_MaskSetType);
+  Py_INCREF(&masker_PoolType);
+  PyModule_AddObject(m, "WorkerPool", (PyObject *)&masker_PoolType);
+  Py_INCREF(&masker_RingType);
+  PyModule_AddObject(m, "SharedRing", (PyObject *)&masker_RingType);
+  Py_INCREF(&masker_RegridderType);
+  PyModule_AddObject(m, "Regridder", (PyObject *)&masker_RegridderType);
+  Py_INCREF(&masker_HierarchyType);
+  PyModule_AddObject(m, "Hierarchy", (PyObject *)&masker_HierarchyType);
+  Py_INCREF(&masker_PushDecoderType);
+  PyModule_AddObject(m, "PushDecoder", (PyObject *)&masker_PushDecoderType);
+  masker_shared_mask_fn = PyObject_GetAttrString(m, "shared_mask");
+
+  // Error codes returned by validate()
+  PyModule_AddIntConstant(m, "SUCCESS", MASKER_SUCCESS);
+  PyModule_AddIntConstant(m, "FAILURE", MASKER_FAILURE);
+  PyModule_AddIntConstant(m, "IO_ERROR", MASKER_IO_ERROR);
+  PyModule_AddIntConstant(m, "MEMORY_ERROR", MASKER_MEMORY_ERROR);
+  PyModule_AddIntConstant(m, "INIT_IO_ERROR", MASKER_INIT_IO_ERROR);
+  PyModule_AddIntConstant(m, "COLOR_TYPE_ERROR", MASKER_COLOR_TYPE_ERROR);
+  PyModule_AddIntConstant(m, "READ_ERROR", MASKER_READ_ERROR);
+  PyModule_AddIntConstant(m, "WRITE_ERROR", MASKER_WRITE_ERROR);
+  PyModule_AddIntConstant(m, "IMAGE_SIZE_DEPTH_ERROR", MASKER_IMAGE_SIZE_DEPTH_ERROR);
+  PyModule_AddIntConstant(m, "MET_COLOR_ERROR", MASKER_MET_COLOR_ERROR);
+  PyModule_AddIntConstant(m, "NOT_PNG_ERROR", MASKER_NOT_PNG_ERROR);
 }
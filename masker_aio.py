@@ -0,0 +1,148 @@
+"""asyncio front end for masker.WorkerPool.
+
+Operations are queued on native threads and their results delivered to
+futures on the event loop, so decoding never blocks the loop and no Python
+thread is needed per request::
+
+    aio = masker_aio.get_masker()
+    total = yield From(aio.total_met(mask, "frame.png"))   # trollius
+    total = await aio.total_met(mask, "frame.png")          # asyncio
+
+Requests beyond the native queue depth wait in a backlog; ``drain()``
+gives producers a future to wait on until the backlog is clear.
+"""
+import collections
+
+try:
+    import asyncio
+except ImportError:
+    import trollius as asyncio
+
+import masker
+
+_maskers = {}
+
+
+def get_masker(loop=None):
+    """The AsyncMasker shared by every caller on the loop"""
+    loop = loop or asyncio.get_event_loop()
+    aio = _maskers.get(loop)
+    if aio is None or aio.closed:
+        aio = _maskers[loop] = AsyncMasker(loop=loop)
+    return aio
+
+
+class AsyncMasker(object):
+
+    def __init__(self, threads=0, queue_depth=0, loop=None):
+        self._loop = loop or asyncio.get_event_loop()
+        self._pool = masker.WorkerPool(threads, queue_depth)
+        self._futures = {}
+        self._backlog = collections.deque()
+        self._drain_waiters = []
+        self.closed = False
+        self._loop.add_reader(self._pool.fileno(), self._on_completed)
+
+    def total_met(self, mask, file_name):
+        return self._submit("total_met", mask, file_name)
+
+    def total_gray(self, mask, file_name):
+        return self._submit("total_gray", mask, file_name)
+
+    def load_gray(self, mask, file_name):
+        return self._submit("load_gray", mask, file_name)
+
+    def load_channels(self, mask, file_name):
+        return self._submit("load_channels", mask, file_name)
+
+    def totals(self, masks, file_name):
+        """Totals under each of a MaskSet or list of Masks"""
+        return self._submit("totals", masks, file_name)
+
+    @property
+    def backlog(self):
+        return len(self._backlog)
+
+    @property
+    def in_flight(self):
+        return self._pool.in_flight
+
+    def drain(self):
+        """Future resolved once every request has reached the native queue"""
+        future = self._create_future()
+        if self._backlog:
+            self._drain_waiters.append(future)
+        else:
+            future.set_result(None)
+        return future
+
+    def close(self):
+        """Finish queued work, then fail anything still in the backlog"""
+        if self.closed:
+            return
+        self.closed = True
+        self._loop.remove_reader(self._pool.fileno())
+        self._pool.close()
+        self._deliver(self._pool.completed())
+        while self._backlog:
+            future = self._backlog.popleft()[3]
+            if not future.done():
+                future.set_exception(ValueError("AsyncMasker is closed"))
+        self._release_drain_waiters()
+
+    def _create_future(self):
+        if hasattr(self._loop, "create_future"):
+            return self._loop.create_future()
+        return asyncio.Future(loop=self._loop)
+
+    def _submit(self, op, masks, file_name):
+        if self.closed:
+            raise ValueError("AsyncMasker is closed")
+        future = self._create_future()
+        ticket = None
+        if not self._backlog:
+            ticket = self._pool.submit(op, masks, file_name)
+        if ticket is None:
+            self._backlog.append((op, masks, file_name, future))
+        else:
+            self._futures[ticket] = future
+        return future
+
+    def _on_completed(self):
+        self._deliver(self._pool.completed())
+        self._feed()
+
+    def _deliver(self, completed):
+        for ticket, result, error in completed:
+            future = self._futures.pop(ticket)
+            if future.cancelled():
+                continue
+            if error is not None:
+                future.set_exception(error)
+            else:
+                future.set_result(result)
+
+    def _feed(self):
+        while self._backlog:
+            op, masks, file_name, future = self._backlog[0]
+            if future.cancelled():
+                self._backlog.popleft()
+                continue
+            try:
+                ticket = self._pool.submit(op, masks, file_name)
+            except Exception as error:
+                self._backlog.popleft()
+                future.set_exception(error)
+                continue
+            if ticket is None:
+                break
+            self._backlog.popleft()
+            self._futures[ticket] = future
+        if not self._backlog:
+            self._release_drain_waiters()
+
+    def _release_drain_waiters(self):
+        waiters, self._drain_waiters = self._drain_waiters, []
+        for future in waiters:
+            if not future.done():
+                future.set_result(None)
@@ -0,0 +1,130 @@
+#include "metmasker.h"
+#include "loader.h"
+#include "algorithms.h"
+
+#if METMASKER_NOT_PNG_ERROR != MASKER_NOT_PNG_ERROR \
+  || METMASKER_MET_COLOR_ERROR != MASKER_MET_COLOR_ERROR
+#  error "Public error codes must match loader.h"
+#endif
+
+
+struct metmasker_maskset {
+  masker_mask_t *masks;
+  int n_masks;
+};
+
+
+int metmasker_api_version(void) {
+  return METMASKER_API_VERSION;
+}
+
+
+const char *metmasker_strerror(int code) {
+  switch (code) {
+    case MASKER_SUCCESS: return "Success";
+    case MASKER_IO_ERROR: return "Error opening file";
+    case MASKER_MEMORY_ERROR: return "Memory error";
+    case MASKER_INIT_IO_ERROR: return "Error during png_init_io";
+    case MASKER_COLOR_TYPE_ERROR: return "Image has unrecognized color type";
+    case MASKER_READ_ERROR: return "Error reading file";
+    case MASKER_WRITE_ERROR: return "Error writing file";
+    case MASKER_IMAGE_SIZE_DEPTH_ERROR: return "Image has incorrect size/bit-depth";
+    case MASKER_MET_COLOR_ERROR: return "Image has unrecognized met-office color";
+    case MASKER_NOT_PNG_ERROR: return "File was not of type PNG";
+    default: return "MetMasker encountered a runtime error";
+  }
+}
+
+
+void metmasker_frame_size(int *width, int *height) {
+  *width = WIDTH;
+  *height = HEIGHT;
+}
+
+
+int metmasker_maskset_open(metmasker_maskset **result,
+  const char *const *file_names, int n_masks, int *failed_index)
+{
+  metmasker_maskset *set = malloc(sizeof(metmasker_maskset));
+  if (set == NULL) return MASKER_MEMORY_ERROR;
+  set->masks = malloc((n_masks + 1) * sizeof(masker_mask_t));
+  if (set->masks == NULL) {
+    free(set);
+    return MASKER_MEMORY_ERROR;
+  }
+
+  for (set->n_masks=0; set->n_masks<n_masks; set->n_masks++) {
+    int error_bit = read_mask_file(&set->masks[set->n_masks],
+      file_names[set->n_masks]);
+    if (error_bit != MASKER_SUCCESS) {
+      if (failed_index != NULL) *failed_index = set->n_masks;
+      metmasker_maskset_close(set);
+      return error_bit;
+    }
+  }
+
+  *result = set;
+  return MASKER_SUCCESS;
+}
+
+
+int metmasker_maskset_size(const metmasker_maskset *masks) {
+  return masks->n_masks;
+}
+
+
+void metmasker_maskset_close(metmasker_maskset *masks)
+{
+  for (int m=0; m<masks->n_masks; m++) free_mask_memory(&masks->masks[m]);
+  free(masks->masks);
+  free(masks);
+}
+
+
+int metmasker_totals(float *res,
+  const metmasker_maskset *masks, const char *file_name)
+{
+  long *totals = malloc((masks->n_masks + 1) * sizeof(long));
+  if (totals == NULL) return MASKER_MEMORY_ERROR;
+
+  int error_bit = mask_totals_file(totals, masks->masks, masks->n_masks,
+    file_name);
+  for (int m=0; error_bit == MASKER_SUCCESS && m<masks->n_masks; m++) {
+    res[m] = 0.25 * (float)totals[m];   // Grayscale units are rain scaled by 4
+  }
+  free(totals);
+  return error_bit;
+}
+
+
+int metmasker_stats_file(metmasker_stats *res, const char *file_name)
+{
+  static const float class_rain[METMASKER_RAIN_CLASSES] = {
+    0.25, 0.75, 1.5, 3.0, 6.0, 12.0, 24.0, 48.0};
+
+  masker_image_t image;
+  int error_bit = read_frame_file(&image, file_name);
+  if (error_bit != MASKER_SUCCESS) return error_bit;
+
+  error_bit = frame_class_counts(res->counts, image);
+  free_image_memory(&image);
+  if (error_bit != MASKER_SUCCESS) return error_bit;
+
+  res->total = 0.0;
+  for (int c=0; c<METMASKER_RAIN_CLASSES; c++) {
+    res->total += class_rain[c] * (float)res->counts[1 + c];
+  }
+  return MASKER_SUCCESS;
+}
+
+
+int metmasker_convert(const char *in_file, const char *out_file)
+{
+  masker_image_t gray;
+  int error_bit = met_image_to_gray(&gray, in_file);
+  if (error_bit != MASKER_SUCCESS) return error_bit;
+
+  error_bit = write_png_file(gray, out_file);
+  free_image_memory(&gray);
+  return error_bit;
+}
@@ -0,0 +1,75 @@
+#ifndef METMASKER_H
+#  define METMASKER_H
+
+/* Public C API of libmetmasker.
+ *
+ * Only the declarations in this header are exported from the shared
+ * library. Handles are opaque, so their layout may change between
+ * releases; METMASKER_API_VERSION changes when a signature does.
+ * Functions return METMASKER_SUCCESS or one of the error codes below,
+ * which metmasker_strerror() describes.
+ * Mask sets are read-only after opening and safe to share between
+ * threads. */
+
+#  define METMASKER_API_VERSION 1
+#  define METMASKER_RAIN_CLASSES 8
+
+#  define METMASKER_SUCCESS 0
+#  define METMASKER_FAILURE 1
+#  define METMASKER_IO_ERROR 2
+#  define METMASKER_MEMORY_ERROR 3
+#  define METMASKER_INIT_IO_ERROR 4
+#  define METMASKER_COLOR_TYPE_ERROR 5
+#  define METMASKER_READ_ERROR 6
+#  define METMASKER_WRITE_ERROR 7
+#  define METMASKER_IMAGE_SIZE_DEPTH_ERROR 8
+#  define METMASKER_MET_COLOR_ERROR 9
+#  define METMASKER_NOT_PNG_ERROR 10
+
+#  if defined(METMASKER_BUILD) && defined(__GNUC__)
+#    define METMASKER_EXPORT __attribute__((visibility("default")))
+#  else
+#    define METMASKER_EXPORT
+#  endif
+
+#  ifdef __cplusplus
+extern "C" {
+#  endif
+
+typedef struct metmasker_maskset metmasker_maskset;
+
+/* Per-frame summary: counts[0] is dry pixels, counts[1 + c] pixels in rain
+ * class c (0.25, 0.75, 1.5, 3, 6, 12, 24 and 48 mm/h), total the summed
+ * rain over the frame. */
+typedef struct metmasker_stats {
+  unsigned long counts[METMASKER_RAIN_CLASSES + 1];
+  float total;
+} metmasker_stats;
+
+METMASKER_EXPORT int metmasker_api_version(void);
+METMASKER_EXPORT const char *metmasker_strerror(int code);
+METMASKER_EXPORT void metmasker_frame_size(int *width, int *height);
+
+/* Load mask images. On failure *failed_index names the offending path */
+METMASKER_EXPORT int metmasker_maskset_open(metmasker_maskset **result,
+  const char *const *file_names, int n_masks, int *failed_index);
+METMASKER_EXPORT int metmasker_maskset_size(const metmasker_maskset *masks);
+METMASKER_EXPORT void metmasker_maskset_close(metmasker_maskset *masks);
+
+/* Rain totals under each mask, res holds metmasker_maskset_size() floats.
+ * Frames may be met RGBA or grayscale PNGs, or tiled frames. */
+METMASKER_EXPORT int metmasker_totals(float *res,
+  const metmasker_maskset *masks, const char *file_name);
+
+METMASKER_EXPORT int metmasker_stats_file(metmasker_stats *res,
+  const char *file_name);
+
+/* Convert a met frame to the grayscale PNG layout */
+METMASKER_EXPORT int metmasker_convert(const char *in_file,
+  const char *out_file);
+
+#  ifdef __cplusplus
+}
+#  endif
+
+#endif	// METMASKER_H
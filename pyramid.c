@@ -0,0 +1,246 @@
+#define _POSIX_C_SOURCE 200809L
+#include "pyramid.h"
+#include "algorithms.h"
+#include "stats.h"
+#include "workers.h"
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#define MAX_LEVELS 32
+
+/* Met colours by rain class, after transparent dry */
+static const png_color met_palette[MASKER_RAIN_CLASSES + 1] = {
+  {0, 0, 0}, {0, 0, 254}, {50, 101, 254}, {127, 127, 0}, {254, 203, 0},
+  {254, 152, 0}, {254, 0, 0}, {254, 0, 254}, {229, 254, 254}};
+static const png_byte met_alpha[1] = {0};
+
+typedef struct pyramid_level {
+  int width, height;
+  png_byte *pixels;     // grayscale, rows contiguous
+} pyramid_level_t;
+
+typedef struct pyramid_task {
+  const pyramid_level_t *level;
+  const char *out_dir;
+  int z, x, y, tile_size;
+  int written;
+  int status;
+} pyramid_task_t;
+
+
+/* ===== LEVELS ===== */
+/* Halve a level, keeping the heaviest class: gray values rise with the
+ * class, so that is the largest value */
+static void downsample_max(pyramid_level_t *coarse, const pyramid_level_t *fine)
+{
+  for (int y=0; y<coarse->height; y++) {
+    const png_byte *top = &fine->pixels[(size_t)2 * y * fine->width];
+    const png_byte *bottom = 2 * y + 1 < fine->height ? top + fine->width : top;
+    png_byte *out = &coarse->pixels[(size_t)y * coarse->width];
+    for (int x=0; x<coarse->width; x++) {
+      int right = 2 * x + 1 < fine->width ? 2 * x + 1 : 2 * x;
+      png_byte value = top[2 * x];
+      if (top[right] > value) value = top[right];
+      if (bottom[2 * x] > value) value = bottom[2 * x];
+      if (bottom[right] > value) value = bottom[right];
+      out[x] = value;
+    }
+  }
+}
+
+
+/* ===== TILES ===== */
+/* Output failures are write errors, so callers can tell them from the input */
+static int make_dir(const char *path)
+{
+  if (mkdir(path, 0777) == 0 || errno == EEXIST) return MASKER_SUCCESS;
+  return MASKER_WRITE_ERROR;
+}
+
+static int write_tile(const char *file_name, png_bytep *rows, int tile_size)
+{
+  FILE *fp = fopen(file_name, "wb");
+  if (fp == NULL) return MASKER_WRITE_ERROR;
+
+  png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  png_infop info_ptr = png_ptr != NULL ? png_create_info_struct(png_ptr) : NULL;
+  if (info_ptr == NULL) {
+    png_destroy_write_struct(&png_ptr, NULL);
+    fclose(fp);
+    remove(file_name);
+    return MASKER_MEMORY_ERROR;
+  }
+  if (setjmp(png_jmpbuf(png_ptr))) {
+    png_destroy_write_struct(&png_ptr, &info_ptr);
+    fclose(fp);
+    remove(file_name);
+    return MASKER_WRITE_ERROR;
+  }
+  png_init_io(png_ptr, fp);
+
+  // Long runs of one index: unfiltered RLE at low effort compresses well
+  png_set_compression_level(png_ptr, 1);
+  png_set_compression_strategy(png_ptr, Z_RLE);
+  png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, PNG_FILTER_NONE);
+  png_set_IHDR(png_ptr, info_ptr, tile_size, tile_size, DEPTH,
+    PNG_COLOR_TYPE_PALETTE, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE,
+    PNG_FILTER_TYPE_BASE);
+  png_set_PLTE(png_ptr, info_ptr, met_palette, MASKER_RAIN_CLASSES + 1);
+  png_set_tRNS(png_ptr, info_ptr, met_alpha, 1, NULL);
+  png_write_info(png_ptr, info_ptr);
+  png_write_image(png_ptr, rows);
+  png_write_end(png_ptr, NULL);
+
+  png_destroy_write_struct(&png_ptr, &info_ptr);
+  if (fclose(fp) != 0) {
+    remove(file_name);
+    return MASKER_WRITE_ERROR;
+  }
+  return MASKER_SUCCESS;
+}
+
+static void run_tile(void *arg)
+{
+  pyramid_task_t *task = arg;
+  const pyramid_level_t *level = task->level;
+  int size = task->tile_size;
+  int x0 = task->x * size, y0 = task->y * size;
+  int width = level->width - x0 < size ? level->width - x0 : size;
+  int height = level->height - y0 < size ? level->height - y0 : size;
+  task->written = 0;
+  task->status = MASKER_SUCCESS;
+
+  int wet = 0;
+  for (int y=0; y<height && !wet; y++) {
+    const png_byte *row = &level->pixels[(size_t)(y0 + y) * level->width + x0];
+    for (int x=0; x<width && !wet; x++) wet = row[x] != 0;
+  }
+  if (!wet) return;
+
+  unsigned long long start = STATS_START();
+  png_byte *pixels = calloc((size_t)size * size, 1);
+  png_bytep *rows = malloc(size * sizeof(png_bytep));
+  if (pixels == NULL || rows == NULL) {
+    free(pixels);
+    free(rows);
+    task->status = MASKER_MEMORY_ERROR;
+    return;
+  }
+  for (int y=0; y<size; y++) {
+    rows[y] = &pixels[(size_t)y * size];
+    if (y >= height) continue;
+    const png_byte *row = &level->pixels[(size_t)(y0 + y) * level->width + x0];
+    for (int x=0; x<width; x++)
+      rows[y][x] = row[x] == 0 ? 0 : 1 + gray_to_channel(row[x]);
+  }
+
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/%i", task->out_dir, task->z);
+  task->status = make_dir(path);
+  snprintf(path, sizeof(path), "%s/%i/%i", task->out_dir, task->z, task->x);
+  if (task->status == MASKER_SUCCESS) task->status = make_dir(path);
+  snprintf(path, sizeof(path), "%s/%i/%i/%i.png", task->out_dir, task->z,
+    task->x, task->y);
+  if (task->status == MASKER_SUCCESS) task->status = write_tile(path, rows, size);
+  task->written = task->status == MASKER_SUCCESS;
+
+  free(pixels);
+  free(rows);
+  stats_record(MASKER_STAGE_WRITE, start, (size_t)size * size, (size_t)size * size);
+}
+
+static int tile_item(void *ctx, int i)
+{
+  pyramid_task_t *task = &((pyramid_task_t*)ctx)[i];
+  run_tile(task);
+  return task->status;
+}
+
+
+/* ===== PYRAMID ===== */
+int pyramid_build(masker_pyramid_result_t *result, const char *file_name,
+  const char *out_dir, int tile_size, int n_threads)
+{
+  unsigned long long frame_start = STATS_START();
+  if (tile_size <= 0) tile_size = MASKER_PYRAMID_TILE;
+  result->n_levels = 0;
+  result->n_tiles = 0;
+  result->n_written = 0;
+
+  masker_image_t image, gray;
+  int error_bit = read_frame_file(&image, file_name);
+  if (error_bit != MASKER_SUCCESS) return error_bit;
+  if (image.bytes_per_pixel == 4) {
+    error_bit = met_to_gray_image(&gray, image);
+    free_image_memory(&image);
+    if (error_bit != MASKER_SUCCESS) return error_bit;
+  } else if (image.bytes_per_pixel == 1) {
+    gray = image;
+  } else {
+    free_image_memory(&image);
+    return MASKER_COLOR_TYPE_ERROR;
+  }
+
+  // Finest level first, until one fits in a tile
+  pyramid_level_t levels[MAX_LEVELS];
+  int n_levels = 1;
+  levels[0].width = WIDTH;
+  levels[0].height = HEIGHT;
+  levels[0].pixels = gray.image[0];
+  while (n_levels < MAX_LEVELS && (levels[n_levels - 1].width > tile_size
+      || levels[n_levels - 1].height > tile_size)) {
+    pyramid_level_t *fine = &levels[n_levels - 1], *coarse = &levels[n_levels];
+    coarse->width = (fine->width + 1) / 2;
+    coarse->height = (fine->height + 1) / 2;
+    coarse->pixels = malloc((size_t)coarse->width * coarse->height);
+    if (coarse->pixels == NULL) {
+      error_bit = MASKER_MEMORY_ERROR;
+      break;
+    }
+    downsample_max(coarse, fine);
+    n_levels++;
+  }
+
+  int n_tiles = 0;
+  for (int l=0; l<n_levels; l++) {
+    n_tiles += ((levels[l].width + tile_size - 1) / tile_size)
+      * ((levels[l].height + tile_size - 1) / tile_size);
+  }
+  pyramid_task_t *tasks = malloc((n_tiles + 1) * sizeof(pyramid_task_t));
+  if (tasks == NULL) error_bit = MASKER_MEMORY_ERROR;
+  if (error_bit == MASKER_SUCCESS) error_bit = make_dir(out_dir);
+
+  if (error_bit == MASKER_SUCCESS) {
+    int t = 0;
+    for (int l=0; l<n_levels; l++) {
+      int nx = (levels[l].width + tile_size - 1) / tile_size;
+      int ny = (levels[l].height + tile_size - 1) / tile_size;
+      for (int ty=0; ty<ny; ty++) {
+        for (int tx=0; tx<nx; tx++, t++) {
+          pyramid_task_t *task = &tasks[t];
+          task->level = &levels[l];
+          task->out_dir = out_dir;
+          task->z = n_levels - 1 - l;
+          task->x = tx;
+          task->y = ty;
+          task->tile_size = tile_size;
+        }
+      }
+    }
+    error_bit = workers_map(n_threads, n_tiles, tile_item, tasks, NULL, NULL);
+
+    result->n_levels = n_levels;
+    result->n_tiles = n_tiles;
+    for (t=0; t<n_tiles; t++) result->n_written += tasks[t].written;
+  }
+
+  free(tasks);
+  for (int l=1; l<n_levels; l++) free(levels[l].pixels);
+  free_image_memory(&gray);
+  if (error_bit == MASKER_SUCCESS) stats_frame(frame_start);
+  return error_bit;
+}
@@ -0,0 +1,29 @@
+#ifndef MASKER_PYRAMID_H
+#  define MASKER_PYRAMID_H
+#  include "loader.h"
+
+/* Web map tile pyramid of one frame, as out_dir/z/x/y.png.
+ *
+ * The frame is the finest zoom level; each coarser level halves it, every
+ * output pixel taking the heaviest rain class of the 2 x 2 pixels under
+ * it, so showers survive zooming out. Zoom 0 is the first level to fit
+ * in a single tile. Tiles are palette PNGs in the met colours with dry
+ * pixels transparent, encoded for speed over size on worker threads.
+ * Entirely dry tiles are not written, so clients should treat a missing
+ * tile as dry. */
+
+#  define MASKER_PYRAMID_TILE 256
+
+typedef struct masker_pyramid_result {
+  int n_levels;
+  int n_tiles;          // tiles covering every level
+  int n_written;        // the wet ones
+} masker_pyramid_result_t;
+
+/* Met or grayscale frame, tile_size 0 for MASKER_PYRAMID_TILE and
+ * n_threads 0 for every core. Existing tiles are overwritten, but stale
+ * ones from an earlier frame are left for the caller to clear. */
+int pyramid_build(masker_pyramid_result_t *result, const char *file_name,
+  const char *out_dir, int tile_size, int n_threads);
+
+#endif	// MASKER_PYRAMID_H
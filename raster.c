@@ -0,0 +1,194 @@
+#include "raster.h"
+#include <math.h>
+#include <string.h>
+
+typedef struct raster_edge {
+  double y_top, y_bottom;
+  double x_top, slope;   // x at y_top, change in x per row
+} raster_edge_t;
+
+
+static int compare_edges(const void *a, const void *b)
+{
+  double ya = ((const raster_edge_t*)a)->y_top;
+  double yb = ((const raster_edge_t*)b)->y_top;
+  return (ya > yb) - (ya < yb);
+}
+
+
+/* Non-horizontal edges sorted by their top, plus the polygon's extent */
+static int build_edges(raster_edge_t *edges, int *n_edges,
+  const double *x, const double *y, const int *ring_ends, int n_rings,
+  double *x_min, double *x_max, double *y_min, double *y_max)
+{
+  *n_edges = 0;
+  *x_min = *y_min = INFINITY;
+  *x_max = *y_max = -INFINITY;
+  int first = 0;
+  for (int r=0; r<n_rings; r++) {
+    int end = ring_ends[r];
+    for (int p=first; p<end; p++) {
+      if (!isfinite(x[p]) || !isfinite(y[p])) return MASKER_FAILURE;
+      if (x[p] < *x_min) *x_min = x[p];
+      if (x[p] > *x_max) *x_max = x[p];
+      if (y[p] < *y_min) *y_min = y[p];
+      if (y[p] > *y_max) *y_max = y[p];
+
+      int q = p + 1 < end ? p + 1 : first;
+      if (y[p] == y[q]) continue;
+      int top = y[p] < y[q] ? p : q, bottom = top == p ? q : p;
+      raster_edge_t *edge = &edges[(*n_edges)++];
+      edge->y_top = y[top];
+      edge->y_bottom = y[bottom];
+      edge->x_top = x[top];
+      edge->slope = (x[bottom] - x[top]) / (y[bottom] - y[top]);
+    }
+    first = end;
+  }
+  qsort(edges, *n_edges, sizeof(raster_edge_t), compare_edges);
+  return MASKER_SUCCESS;
+}
+
+
+/* Crossings of the scanline at sample_y, sorted. Sample heights must not
+ * decrease between calls, as edges leave the active list for good. */
+typedef struct raster_scan {
+  const raster_edge_t *edges;
+  int n_edges, next;
+  int *active;
+  int n_active;
+  double *xs;
+} raster_scan_t;
+
+static int scan_crossings(raster_scan_t *scan, double sample_y)
+{
+  while (scan->next < scan->n_edges && scan->edges[scan->next].y_top <= sample_y)
+    scan->active[scan->n_active++] = scan->next++;
+
+  int n_xs = 0, kept = 0;
+  for (int a=0; a<scan->n_active; a++) {
+    const raster_edge_t *edge = &scan->edges[scan->active[a]];
+    if (edge->y_bottom <= sample_y) continue;   // half open, so vertices count once
+    scan->active[kept++] = scan->active[a];
+    if (edge->y_top > sample_y) continue;
+    double cross = edge->x_top + (sample_y - edge->y_top) * edge->slope;
+    int i = n_xs++;
+    while (i > 0 && scan->xs[i - 1] > cross) {
+      scan->xs[i] = scan->xs[i - 1];
+      i--;
+    }
+    scan->xs[i] = cross;
+  }
+  scan->n_active = kept;
+  return n_xs;
+}
+
+
+int raster_polygon(masker_mask_t *mask, const double *x, const double *y,
+  const int *ring_ends, int n_rings, int supersample)
+{
+  int n_points = n_rings > 0 ? ring_ends[n_rings - 1] : 0;
+  raster_edge_t *edges = malloc((n_points + 1) * sizeof(raster_edge_t));
+  int *active = malloc((n_points + 1) * sizeof(int));
+  double *xs = malloc((n_points + 1) * sizeof(double));
+  float *coverage = calloc(WIDTH, sizeof(float));
+  png_bytep *rows = malloc(HEIGHT * sizeof(png_bytep));
+  png_byte *block = NULL;
+  int error_bit = MASKER_MEMORY_ERROR;
+  if (edges == NULL || active == NULL || xs == NULL || coverage == NULL
+      || rows == NULL)
+    goto done;
+
+  int n_edges;
+  double px_min, px_max, py_min, py_max;
+  error_bit = build_edges(edges, &n_edges, x, y, ring_ends, n_rings,
+    &px_min, &px_max, &py_min, &py_max);
+  if (error_bit != MASKER_SUCCESS) goto done;
+
+  // Rows the polygon can touch get their own pixels, after one zero row
+  int row_lo = n_edges > 0 && py_min > 0 ? (int)floor(py_min) : 0;
+  int row_hi = n_edges > 0 && py_max < HEIGHT ? (int)ceil(py_max) - 1 : HEIGHT - 1;
+  if (n_edges == 0 || px_max <= 0 || px_min >= WIDTH) row_hi = row_lo - 1;
+  int n_rows = row_hi >= row_lo ? row_hi - row_lo + 1 : 0;
+  block = calloc((size_t)(n_rows + 1) * WIDTH, 1);
+  if (block == NULL) {
+    error_bit = MASKER_MEMORY_ERROR;
+    goto done;
+  }
+  for (int row=0; row<HEIGHT; row++) {
+    rows[row] = row >= row_lo && row <= row_hi
+      ? &block[(size_t)(row - row_lo + 1) * WIDTH] : block;
+  }
+
+  int x_min = WIDTH - 1, x_max = 0, y_min = HEIGHT - 1, y_max = 0;
+  raster_scan_t scan = {edges, n_edges, 0, active, 0, xs};
+  int samples = supersample > 1 ? supersample : 1;
+  for (int row=row_lo; row<=row_hi; row++) {
+    png_byte *pixels = rows[row];
+    int lo = WIDTH, hi = -1;   // columns touched in this row
+
+    for (int k=0; k<samples; k++) {
+      int n_xs = scan_crossings(&scan, row + (k + 0.5) / samples);
+      for (int c=0; c + 1<n_xs; c+=2) {
+        double a = xs[c], b = xs[c + 1];
+        if (samples == 1) {
+          // Pixels whose centres fall in [a, b)
+          int start = (int)fmax(ceil(a - 0.5), 0);
+          int end = (int)fmin(ceil(b - 0.5), WIDTH);
+          if (start < end) memset(&pixels[start], 255, end - start);
+          if (start < end && start < lo) lo = start;
+          if (start < end && end - 1 > hi) hi = end - 1;
+          continue;
+        }
+        a = fmax(a, 0);
+        b = fmin(b, WIDTH);
+        for (int i=(int)a; i<b; i++) {
+          coverage[i] += (fmin(b, i + 1) - fmax(a, i)) / samples;
+          if (i < lo) lo = i;
+          if (i > hi) hi = i;
+        }
+      }
+    }
+
+    if (samples > 1) {
+      for (int i=lo; i<=hi; i++) {
+        int value = (int)(255 * coverage[i] + 0.5);
+        pixels[i] = value > 255 ? 255 : value;
+        coverage[i] = 0;
+      }
+      // Slivers can round down to nothing
+      while (lo <= hi && pixels[lo] == 0) lo++;
+      while (hi >= lo && pixels[hi] == 0) hi--;
+    }
+    if (lo <= hi) {
+      if (lo < x_min) x_min = lo;
+      if (hi > x_max) x_max = hi;
+      if (row < y_min) y_min = row;
+      if (row > y_max) y_max = row;
+    }
+  }
+
+  mask->image = rows;
+  mask->buffer = NULL;
+  mask->bytes_per_pixel = 1;
+  mask->color_type = PNG_COLOR_TYPE_GRAY;
+  mask->is_freed = 0;
+  mask->x_min = x_min;
+  mask->x_max = x_max;
+  mask->y_min = y_min;
+  mask->y_max = y_max;
+  mask->mapped = NULL;
+  mask->mapped_len = 0;
+  mask->block = block;
+  rows = NULL;
+  block = NULL;
+
+done:
+  free(edges);
+  free(active);
+  free(xs);
+  free(coverage);
+  free(rows);
+  free(block);
+  return error_bit;
+}
@@ -0,0 +1,23 @@
+#ifndef MASKER_RASTER_H
+#  define MASKER_RASTER_H
+#  include "loader.h"
+
+/* Scanline polygon fill straight into a mask.
+ *
+ * Coordinates are in pixels: pixel (x, y) covers [x, x + 1) x [y, y + 1)
+ * with y running down the frame. A polygon is one or more rings, ring r
+ * ending before point ring_ends[r], filled with the even-odd rule so
+ * inner rings cut holes. Rings close themselves.
+ *
+ * Without supersampling a pixel is in when its centre is (value 255).
+ * With it, each row is sampled on that many sub-scanlines, each span's
+ * horizontal coverage is exact, and pixels hold their covered fraction
+ * of 255. Only the rows the polygon spans are allocated; the rest share
+ * one zero row. */
+
+#  define MASKER_RASTER_SUPERSAMPLE 16
+
+int raster_polygon(masker_mask_t *mask, const double *x, const double *y,
+  const int *ring_ends, int n_rings, int supersample);
+
+#endif	// MASKER_RASTER_H
@@ -0,0 +1,276 @@
+#include "regrid.h"
+#include "stats.h"
+#include "workers.h"
+#include <math.h>
+#include <string.h>
+
+#define GRAY_SCALE 0.25   // gray value to rain
+
+
+/* ===== BUILDING ===== */
+typedef struct regrid_builder {
+  masker_regrid_t *regrid;
+  size_t capacity, n_entries;
+} regrid_builder_t;
+
+static int builder_init(regrid_builder_t *builder, masker_regrid_t *regrid,
+  int n_rows)
+{
+  regrid->n_rows = n_rows;
+  regrid->cols = NULL;
+  regrid->weights = NULL;
+  regrid->x_min = WIDTH;
+  regrid->x_max = -1;
+  regrid->y_min = HEIGHT;
+  regrid->y_max = -1;
+  regrid->row_start = malloc((n_rows + 1) * sizeof(int32_t));
+  if (regrid->row_start == NULL) return MASKER_MEMORY_ERROR;
+  regrid->row_start[0] = 0;
+
+  builder->regrid = regrid;
+  builder->capacity = 0;
+  builder->n_entries = 0;
+  return MASKER_SUCCESS;
+}
+
+static int builder_push(regrid_builder_t *builder, int x, int y, double weight)
+{
+  masker_regrid_t *regrid = builder->regrid;
+  if (builder->n_entries == builder->capacity) {
+    size_t capacity = builder->capacity ? 2 * builder->capacity : 4096;
+    if (capacity > INT32_MAX) return MASKER_MEMORY_ERROR;
+    int32_t *cols = realloc(regrid->cols, capacity * sizeof(int32_t));
+    if (cols == NULL) return MASKER_MEMORY_ERROR;
+    regrid->cols = cols;
+    float *weights = realloc(regrid->weights, capacity * sizeof(float));
+    if (weights == NULL) return MASKER_MEMORY_ERROR;
+    regrid->weights = weights;
+    builder->capacity = capacity;
+  }
+  regrid->cols[builder->n_entries] = y * WIDTH + x;
+  regrid->weights[builder->n_entries] = GRAY_SCALE * weight;
+  builder->n_entries++;
+
+  if (x < regrid->x_min) regrid->x_min = x;
+  if (x > regrid->x_max) regrid->x_max = x;
+  if (y < regrid->y_min) regrid->y_min = y;
+  if (y > regrid->y_max) regrid->y_max = y;
+  return MASKER_SUCCESS;
+}
+
+static void builder_end_row(regrid_builder_t *builder, int row) {
+  builder->regrid->row_start[row + 1] = builder->n_entries;
+}
+
+
+/* Bilinear sample at (u, v) in pixel units, pixel centres on integers.
+ * Points within half a pixel of the edge take the edge value. */
+static int push_bilinear(regrid_builder_t *builder, double u, double v)
+{
+  if (!(u >= -0.5 && u <= WIDTH - 0.5 && v >= -0.5 && v <= HEIGHT - 0.5))
+    return MASKER_SUCCESS;   // outside, or NaN
+  u = u < 0 ? 0 : u > WIDTH - 1 ? WIDTH - 1 : u;
+  v = v < 0 ? 0 : v > HEIGHT - 1 ? HEIGHT - 1 : v;
+  int x = (int)u, y = (int)v;
+  if (x == WIDTH - 1 && x > 0) x--;
+  if (y == HEIGHT - 1 && y > 0) y--;
+  double tx = u - x, ty = v - y;
+
+  double weights[4] = {(1 - tx) * (1 - ty), tx * (1 - ty), (1 - tx) * ty, tx * ty};
+  int error_bit = MASKER_SUCCESS;
+  for (int k=0; k<4 && error_bit == MASKER_SUCCESS; k++) {
+    if (weights[k] > 0)
+      error_bit = builder_push(builder, x + (k & 1), y + (k >> 1), weights[k]);
+  }
+  return error_bit;
+}
+
+
+/* Overlap of [a, b] in cell units with each of n cells, returning the
+ * first overlapped cell and how many follow */
+static int axis_overlaps(double *lengths, int *first, double a, double b, int n)
+{
+  if (a > b) {
+    double swap = a;
+    a = b;
+    b = swap;
+  }
+  a = a < 0 ? 0 : a;
+  b = b > n ? n : b;
+  if (!(b > a)) return 0;
+
+  *first = (int)floor(a);
+  int count = 0;
+  for (int i=*first; i<n && i<b; i++) {
+    lengths[count++] = (b < i + 1 ? b : i + 1) - (a > i ? a : i);
+  }
+  return count;
+}
+
+
+static int check_source(const masker_grid_t *source)
+{
+  if (source->nx != WIDTH || source->ny != HEIGHT)
+    return MASKER_IMAGE_SIZE_DEPTH_ERROR;
+  if (source->dx == 0 || source->dy == 0) return MASKER_FAILURE;
+  return MASKER_SUCCESS;
+}
+
+
+int regrid_grids(masker_regrid_t *regrid, const masker_grid_t *source,
+  const masker_grid_t *target, int method)
+{
+  int error_bit = check_source(source);
+  if (error_bit != MASKER_SUCCESS) return error_bit;
+  if (target->nx <= 0 || target->ny <= 0 || target->dx == 0 || target->dy == 0
+      || (method != MASKER_REGRID_BILINEAR && method != MASKER_REGRID_CONSERVATIVE))
+    return MASKER_FAILURE;
+
+  regrid_builder_t builder;
+  error_bit = builder_init(&builder, regrid, target->nx * target->ny);
+  double *x_lengths = malloc((WIDTH + HEIGHT) * sizeof(double));
+  if (error_bit != MASKER_SUCCESS || x_lengths == NULL) {
+    free(x_lengths);
+    regrid_free(regrid);
+    return MASKER_MEMORY_ERROR;
+  }
+  double *y_lengths = x_lengths + WIDTH;
+
+  for (int j=0; j<target->ny && error_bit == MASKER_SUCCESS; j++) {
+    for (int i=0; i<target->nx && error_bit == MASKER_SUCCESS; i++) {
+      if (method == MASKER_REGRID_BILINEAR) {
+        double x = target->x0 + (i + 0.5) * target->dx;
+        double y = target->y0 + (j + 0.5) * target->dy;
+        error_bit = push_bilinear(&builder,
+          (x - source->x0) / source->dx - 0.5, (y - source->y0) / source->dy - 0.5);
+      } else {
+        // Target cell edges in source cell units
+        double a = (target->x0 + i * target->dx - source->x0) / source->dx;
+        double b = (target->x0 + (i + 1) * target->dx - source->x0) / source->dx;
+        double c = (target->y0 + j * target->dy - source->y0) / source->dy;
+        double d = (target->y0 + (j + 1) * target->dy - source->y0) / source->dy;
+        int x_first, y_first;
+        int n_x = axis_overlaps(x_lengths, &x_first, a, b, WIDTH);
+        int n_y = axis_overlaps(y_lengths, &y_first, c, d, HEIGHT);
+
+        // Average over the covered part of the cell
+        double x_covered = 0, y_covered = 0;
+        for (int k=0; k<n_x; k++) x_covered += x_lengths[k];
+        for (int k=0; k<n_y; k++) y_covered += y_lengths[k];
+        for (int l=0; l<n_y && error_bit == MASKER_SUCCESS; l++) {
+          for (int k=0; k<n_x && error_bit == MASKER_SUCCESS; k++) {
+            double weight = x_lengths[k] * y_lengths[l] / (x_covered * y_covered);
+            if (weight > 0)
+              error_bit = builder_push(&builder, x_first + k, y_first + l, weight);
+          }
+        }
+      }
+      builder_end_row(&builder, j * target->nx + i);
+    }
+  }
+
+  free(x_lengths);
+  if (error_bit != MASKER_SUCCESS) regrid_free(regrid);
+  return error_bit;
+}
+
+
+int regrid_points(masker_regrid_t *regrid, const masker_grid_t *source,
+  const double *x, const double *y, int n_points)
+{
+  int error_bit = check_source(source);
+  if (error_bit != MASKER_SUCCESS) return error_bit;
+
+  regrid_builder_t builder;
+  error_bit = builder_init(&builder, regrid, n_points);
+  for (int p=0; p<n_points && error_bit == MASKER_SUCCESS; p++) {
+    error_bit = push_bilinear(&builder,
+      (x[p] - source->x0) / source->dx - 0.5, (y[p] - source->y0) / source->dy - 0.5);
+    builder_end_row(&builder, p);
+  }
+  if (error_bit != MASKER_SUCCESS) regrid_free(regrid);
+  return error_bit;
+}
+
+
+void regrid_free(masker_regrid_t *regrid)
+{
+  free(regrid->row_start);
+  free(regrid->cols);
+  free(regrid->weights);
+  regrid->row_start = NULL;
+  regrid->cols = NULL;
+  regrid->weights = NULL;
+  regrid->n_rows = 0;
+}
+
+
+/* ===== APPLYING ===== */
+void regrid_apply(const masker_regrid_t *regrid, float *res,
+  masker_image_t image)
+{
+  // Frame rows are contiguous, so a flat index addresses any pixel
+  const png_byte *pixels = image.image[0];
+  const int32_t *cols = regrid->cols;
+  const float *weights = regrid->weights;
+  for (int r=0; r<regrid->n_rows; r++) {
+    int32_t start = regrid->row_start[r], end = regrid->row_start[r + 1];
+    if (start == end) {
+      res[r] = NAN;
+      continue;
+    }
+    float sum = 0;
+    for (int32_t k=start; k<end; k++) sum += weights[k] * pixels[cols[k]];
+    res[r] = sum;
+  }
+}
+
+
+int regrid_file(const masker_regrid_t *regrid, float *res,
+  const char *file_name)
+{
+  unsigned long long frame_start = STATS_START();
+  masker_image_t image;
+  // Tiled frames only decode the tiles the weights reach
+  int error_bit = regrid->x_max < 0
+    ? read_frame_file(&image, file_name)
+    : read_frame_region(&image, file_name,
+        regrid->x_min, regrid->x_max, regrid->y_min, regrid->y_max);
+  if (error_bit != MASKER_SUCCESS) return error_bit;
+
+  if (image.bytes_per_pixel != 1) {
+    free_image_memory(&image);
+    return MASKER_COLOR_TYPE_ERROR;
+  }
+
+  unsigned long long start = STATS_START();
+  regrid_apply(regrid, res, image);
+  stats_record(MASKER_STAGE_MASK, start,
+    regrid->row_start[regrid->n_rows] * sizeof(float), regrid->n_rows);
+
+  free_image_memory(&image);
+  stats_frame(frame_start);
+  return MASKER_SUCCESS;
+}
+
+
+typedef struct regrid_batch {
+  const masker_regrid_t *regrid;
+  float *res;
+  const char *const *file_names;
+} regrid_batch_t;
+
+static int regrid_item(void *ctx, int i)
+{
+  regrid_batch_t *batch = ctx;
+  return regrid_file(batch->regrid, &batch->res[(size_t)i * batch->regrid->n_rows],
+    batch->file_names[i]);
+}
+
+
+int regrid_files(const masker_regrid_t *regrid, float *res,
+  const char *const *file_names, int n_files, int n_threads, int *failed_index)
+{
+  regrid_batch_t batch = {regrid, res, file_names};
+  return workers_map(n_threads, n_files, regrid_item, &batch, NULL, failed_index);
+}
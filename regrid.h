@@ -0,0 +1,54 @@
+#ifndef MASKER_REGRID_H
+#  define MASKER_REGRID_H
+#  include <stdint.h>
+#  include "loader.h"
+
+/* Regridding from the radar frame onto another grid as a sparse matrix.
+ *
+ * Grids are regular: cell (i, j) spans x0 + i * dx to x0 + (i + 1) * dx
+ * and y0 + j * dy to y0 + (j + 1) * dy, with negative steps for axes that
+ * run backwards, all in one coordinate system. Targets that are not
+ * regular in the source coordinates (another projection) are given as
+ * cell centre points instead, computed once by the caller.
+ *
+ * Each target cell is a CSR row of (source pixel, weight) pairs, with the
+ * gray to rain scale folded into the weights, so applying it reads the
+ * decoded gray bytes directly. Cells the source does not cover are NaN. */
+
+#  define MASKER_REGRID_BILINEAR 0
+#  define MASKER_REGRID_CONSERVATIVE 1
+
+typedef struct masker_grid {
+  double x0, y0;
+  double dx, dy;
+  int nx, ny;
+} masker_grid_t;
+
+typedef struct masker_regrid {
+  int n_rows;             // target cells
+  int32_t *row_start;     // n_rows + 1 offsets into cols and weights
+  int32_t *cols;          // source pixel, y * WIDTH + x
+  float *weights;
+  int x_min, x_max;       // inclusive box of the source pixels used
+  int y_min, y_max;
+} masker_regrid_t;
+
+/* Source must be WIDTH x HEIGHT. Bilinear samples target cell centres,
+ * conservative averages the source over each target cell's area. */
+int regrid_grids(masker_regrid_t *regrid, const masker_grid_t *source,
+  const masker_grid_t *target, int method);
+/* Bilinear at n points given in source coordinates */
+int regrid_points(masker_regrid_t *regrid, const masker_grid_t *source,
+  const double *x, const double *y, int n_points);
+void regrid_free(masker_regrid_t *regrid);
+
+/* Rain on the target grid from a grayscale frame, n_rows floats */
+void regrid_apply(const masker_regrid_t *regrid, float *res,
+  masker_image_t image);
+int regrid_file(const masker_regrid_t *regrid, float *res,
+  const char *file_name);
+/* One frame per file on n_threads threads (0 for every core) */
+int regrid_files(const masker_regrid_t *regrid, float *res,
+  const char *const *file_names, int n_files, int n_threads, int *failed_index);
+
+#endif	// MASKER_REGRID_H
@@ -0,0 +1,107 @@
+#include "rolling.h"
+#include "algorithms.h"
+#include <math.h>
+
+
+int rolling_init(masker_rolling_t *rolling,
+  const int *windows, int n_windows, int n_masks)
+{
+  int max_window = 1;
+  for (int w=0; w<n_windows; w++) {
+    if (windows[w] < 1) return MASKER_FAILURE;
+    if (windows[w] > max_window) max_window = windows[w];
+  }
+
+  rolling->windows = malloc(n_windows * sizeof(int));
+  rolling->history = calloc((size_t)max_window * n_masks + 1, sizeof(long));
+  rolling->sums = calloc((size_t)n_windows * n_masks + 1, sizeof(long));
+  if (rolling->windows == NULL || rolling->history == NULL
+      || rolling->sums == NULL) {
+    free(rolling->windows);
+    free(rolling->history);
+    free(rolling->sums);
+    return MASKER_MEMORY_ERROR;
+  }
+
+  for (int w=0; w<n_windows; w++) rolling->windows[w] = windows[w];
+  rolling->n_windows = n_windows;
+  rolling->max_window = max_window;
+  rolling->n_masks = n_masks;
+  rolling->n_frames = 0;
+  return MASKER_SUCCESS;
+}
+
+
+void rolling_push(masker_rolling_t *rolling, const long *frame_totals)
+{
+  int n_masks = rolling->n_masks;
+  int n = rolling->n_frames;
+
+  for (int w=0; w<rolling->n_windows; w++) {
+    long *sums = &rolling->sums[w * n_masks];
+    int window = rolling->windows[w];
+    const long *leaving = NULL;
+    if (n >= window)
+      leaving = &rolling->history[((n - window) % rolling->max_window) * n_masks];
+    for (int m=0; m<n_masks; m++) {
+      sums[m] += frame_totals[m];
+      if (leaving != NULL) sums[m] -= leaving[m];
+    }
+  }
+
+  // Only overwrite the oldest slot once every window is done with it
+  long *slot = &rolling->history[(n % rolling->max_window) * n_masks];
+  for (int m=0; m<n_masks; m++) slot[m] = frame_totals[m];
+  rolling->n_frames++;
+}
+
+
+void rolling_totals(const masker_rolling_t *rolling, float *res)
+{
+  int n_masks = rolling->n_masks;
+  for (int w=0; w<rolling->n_windows; w++) {
+    int full = rolling->n_frames >= rolling->windows[w];
+    for (int m=0; m<n_masks; m++) {
+      res[w * n_masks + m] = full
+        ? 0.25 * (float)rolling->sums[w * n_masks + m] : NAN;
+    }
+  }
+}
+
+
+void rolling_free(masker_rolling_t *rolling)
+{
+  free(rolling->windows);
+  free(rolling->history);
+  free(rolling->sums);
+}
+
+
+int rolling_totals_files(float *res, const char **file_names, int n_files,
+  const int *windows, int n_windows, const masker_mask_t *masks, int n_masks,
+  int *failed_index)
+{
+  masker_rolling_t rolling;
+  int error_bit = rolling_init(&rolling, windows, n_windows, n_masks);
+  if (error_bit != MASKER_SUCCESS) return error_bit;
+
+  long *frame_totals = malloc((n_masks + 1) * sizeof(long));
+  if (frame_totals == NULL) {
+    rolling_free(&rolling);
+    return MASKER_MEMORY_ERROR;
+  }
+
+  for (int i=0; i<n_files; i++) {
+    error_bit = mask_totals_file(frame_totals, masks, n_masks, file_names[i]);
+    if (error_bit != MASKER_SUCCESS) {
+      *failed_index = i;
+      break;
+    }
+    rolling_push(&rolling, frame_totals);
+    rolling_totals(&rolling, &res[(size_t)i * n_windows * n_masks]);
+  }
+
+  free(frame_totals);
+  rolling_free(&rolling);
+  return error_bit;
+}
@@ -0,0 +1,31 @@
+#ifndef MASKER_ROLLING_H
+#  define MASKER_ROLLING_H
+#  include "loader.h"
+
+/* Rolling sums over several window lengths, updated once per frame by
+ * adding the newest frame and subtracting the one leaving each window.
+ * Totals are kept in integer grayscale units so the updates are exact. */
+typedef struct masker_rolling {
+  int *windows;
+  int n_windows;
+  int max_window;
+  int n_masks;
+  long *history;   // ring of the last max_window frame totals, per mask
+  long *sums;      // n_windows x n_masks running sums
+  int n_frames;
+} masker_rolling_t;
+
+int rolling_init(masker_rolling_t *rolling,
+  const int *windows, int n_windows, int n_masks);
+void rolling_push(masker_rolling_t *rolling, const long *frame_totals);
+
+/* n_windows x n_masks rain totals, NaN while a window is still filling */
+void rolling_totals(const masker_rolling_t *rolling, float *res);
+void rolling_free(masker_rolling_t *rolling);
+
+/* Decode each file once and emit n_files x n_windows x n_masks totals */
+int rolling_totals_files(float *res, const char **file_names, int n_files,
+  const int *windows, int n_windows, const masker_mask_t *masks, int n_masks,
+  int *failed_index);
+
+#endif	// MASKER_ROLLING_H
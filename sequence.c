@@ -0,0 +1,279 @@
+#include "sequence.h"
+#include "algorithms.h"
+#include <string.h>
+#include <zlib.h>
+
+#define FRAME_BYTES (WIDTH * HEIGHT)
+#define RECORD_HEADER_LEN 9
+#define DELTA_ENTRY_LEN 5
+
+
+static void put_u32(unsigned char *buf, unsigned long value) {
+  for (int i=0; i<4; i++) buf[i] = (value >> (8 * i)) & 0xff;
+}
+
+static unsigned long get_u32(const unsigned char *buf) {
+  unsigned long value = 0;
+  for (int i=3; i>=0; i--) value = (value << 8) | buf[i];
+  return value;
+}
+
+
+/* ===== WRITING ===== */
+int sequence_writer_open(masker_sequence_writer_t *writer,
+  const char *file_name, int keyframe_interval)
+{
+  writer->frame = malloc(FRAME_BYTES);
+  writer->buffer = malloc(FRAME_BYTES);
+  writer->packed = malloc(compressBound(FRAME_BYTES));
+  if (writer->frame == NULL || writer->buffer == NULL
+      || writer->packed == NULL) {
+    free(writer->frame);
+    free(writer->buffer);
+    free(writer->packed);
+    return MASKER_MEMORY_ERROR;
+  }
+
+  writer->fp = fopen(file_name, "wb");
+  if (writer->fp == NULL) {
+    free(writer->frame);
+    free(writer->buffer);
+    free(writer->packed);
+    return MASKER_IO_ERROR;
+  }
+
+  unsigned char header[MASKER_SEQUENCE_SIG_LEN + 4];
+  memcpy(header, MASKER_SEQUENCE_SIG, MASKER_SEQUENCE_SIG_LEN);
+  header[8] = WIDTH & 0xff;
+  header[9] = (WIDTH >> 8) & 0xff;
+  header[10] = HEIGHT & 0xff;
+  header[11] = (HEIGHT >> 8) & 0xff;
+  if (fwrite(header, 1, sizeof(header), writer->fp) != sizeof(header)) {
+    sequence_writer_close(writer);
+    return MASKER_WRITE_ERROR;
+  }
+
+  writer->keyframe_interval = keyframe_interval > 0 ? keyframe_interval : 1;
+  writer->n_frames = 0;
+  return MASKER_SUCCESS;
+}
+
+
+static int write_record(masker_sequence_writer_t *writer,
+  int kind, unsigned long n_changed, unsigned long raw_len)
+{
+  uLongf packed_len = compressBound(FRAME_BYTES);
+  if (compress2(writer->packed, &packed_len, writer->buffer, raw_len,
+      Z_DEFAULT_COMPRESSION) != Z_OK)
+    return MASKER_WRITE_ERROR;
+
+  unsigned char header[RECORD_HEADER_LEN];
+  header[0] = kind;
+  put_u32(header + 1, n_changed);
+  put_u32(header + 5, packed_len);
+  if (fwrite(header, 1, sizeof(header), writer->fp) != sizeof(header)
+      || fwrite(writer->packed, 1, packed_len, writer->fp) != packed_len)
+    return MASKER_WRITE_ERROR;
+  return MASKER_SUCCESS;
+}
+
+
+int sequence_writer_append(masker_sequence_writer_t *writer,
+  masker_image_t image)
+{
+  masker_image_t gray = image;
+  int error_bit;
+  if (image.bytes_per_pixel == 4) {
+    error_bit = met_to_gray_image(&gray, image);
+    if (error_bit != MASKER_SUCCESS) return error_bit;
+  } else if (image.bytes_per_pixel != 1) {
+    return MASKER_COLOR_TYPE_ERROR;
+  }
+
+  // Collect changes, falling back to a keyframe once a delta stops paying
+  unsigned long n_changed = 0;
+  int kind = MASKER_SEQUENCE_KEY;
+  if (writer->n_frames % writer->keyframe_interval != 0) {
+    kind = MASKER_SEQUENCE_DELTA;
+    for (int y=0; y<HEIGHT && kind == MASKER_SEQUENCE_DELTA; y++) {
+      png_byte *row = gray.image[y];
+      png_byte *prev = &writer->frame[y * WIDTH];
+      for (int x=0; x<WIDTH; x++) {
+        if (row[x] == prev[x]) continue;
+        if ((n_changed + 1) * DELTA_ENTRY_LEN >= FRAME_BYTES) {
+          kind = MASKER_SEQUENCE_KEY;
+          break;
+        }
+        unsigned char *entry = &writer->buffer[n_changed * DELTA_ENTRY_LEN];
+        put_u32(entry, y * WIDTH + x);
+        entry[4] = row[x];
+        n_changed++;
+      }
+    }
+  }
+
+  for (int y=0; y<HEIGHT; y++)
+    memcpy(&writer->frame[y * WIDTH], gray.image[y], WIDTH);
+  if (gray.image != image.image) free_image_memory(&gray);
+
+  if (kind == MASKER_SEQUENCE_KEY) {
+    memcpy(writer->buffer, writer->frame, FRAME_BYTES);
+    error_bit = write_record(writer, kind, 0, FRAME_BYTES);
+  } else {
+    error_bit = write_record(writer, kind, n_changed,
+      n_changed * DELTA_ENTRY_LEN);
+  }
+  if (error_bit == MASKER_SUCCESS) writer->n_frames++;
+  return error_bit;
+}
+
+
+int sequence_writer_close(masker_sequence_writer_t *writer)
+{
+  int error_bit = MASKER_SUCCESS;
+  if (fclose(writer->fp) != 0) error_bit = MASKER_WRITE_ERROR;
+  free(writer->frame);
+  free(writer->buffer);
+  free(writer->packed);
+  return error_bit;
+}
+
+
+/* ===== READING ===== */
+static int mask_covers(const masker_mask_t *mask, int x, int y) {
+  if (x < mask->x_min || x > mask->x_max) return 0;
+  if (y < mask->y_min || y > mask->y_max) return 0;
+  return mask->image[y][x] != 0;
+}
+
+
+static void rescan_totals(masker_sequence_reader_t *reader) {
+  for (int m=0; m<reader->n_masks; m++) {
+    const masker_mask_t *mask = &reader->masks[m];
+    long total = 0;
+    for (int y=mask->y_min; y<=mask->y_max; y++) {
+      png_byte *mask_row = mask->image[y];
+      png_byte *frame_row = &reader->frame[y * WIDTH];
+      for (int x=mask->x_min; x<=mask->x_max; x++) {
+        if (mask_row[x] == 0) continue;
+        total += frame_row[x];
+      }
+    }
+    reader->totals[m] = total;
+  }
+}
+
+
+int sequence_reader_open(masker_sequence_reader_t *reader,
+  const char *file_name, const masker_mask_t *masks, int n_masks)
+{
+  FILE *fp = fopen(file_name, "rb");
+  if (fp == NULL) {
+    return MASKER_IO_ERROR;
+  }
+
+  unsigned char header[MASKER_SEQUENCE_SIG_LEN + 4];
+  if (fread(header, 1, sizeof(header), fp) < sizeof(header)
+      || memcmp(header, MASKER_SEQUENCE_SIG, MASKER_SEQUENCE_SIG_LEN) != 0) {
+    fclose(fp);
+    return MASKER_NOT_PNG_ERROR;
+  }
+  if ((header[8] | (header[9] << 8)) != WIDTH
+      || (header[10] | (header[11] << 8)) != HEIGHT) {
+    fclose(fp);
+    return MASKER_IMAGE_SIZE_DEPTH_ERROR;
+  }
+
+  reader->frame = calloc(FRAME_BYTES, 1);
+  reader->buffer = malloc(FRAME_BYTES);
+  reader->packed = malloc(compressBound(FRAME_BYTES));
+  reader->totals = calloc(n_masks > 0 ? n_masks : 1, sizeof(long));
+  if (reader->frame == NULL || reader->buffer == NULL
+      || reader->packed == NULL || reader->totals == NULL) {
+    free(reader->frame);
+    free(reader->buffer);
+    free(reader->packed);
+    free(reader->totals);
+    fclose(fp);
+    return MASKER_MEMORY_ERROR;
+  }
+
+  reader->fp = fp;
+  reader->masks = masks;
+  reader->n_masks = masks != NULL ? n_masks : 0;
+  reader->n_frames = 0;
+  reader->kind = MASKER_SEQUENCE_KEY;
+  reader->n_changed = 0;
+  return MASKER_SUCCESS;
+}
+
+
+int sequence_reader_next(masker_sequence_reader_t *reader, int *has_frame)
+{
+  unsigned char header[RECORD_HEADER_LEN];
+  size_t header_len = fread(header, 1, sizeof(header), reader->fp);
+  if (header_len == 0 && feof(reader->fp)) {
+    *has_frame = 0;
+    return MASKER_SUCCESS;
+  }
+
+  int kind = header[0];
+  unsigned long n_changed = get_u32(header + 1);
+  unsigned long packed_len = get_u32(header + 5);
+  if (header_len < sizeof(header)
+      || (kind != MASKER_SEQUENCE_KEY && kind != MASKER_SEQUENCE_DELTA)
+      || (kind == MASKER_SEQUENCE_DELTA && n_changed * DELTA_ENTRY_LEN > FRAME_BYTES)
+      || packed_len > compressBound(FRAME_BYTES)
+      || fread(reader->packed, 1, packed_len, reader->fp) < packed_len)
+    return MASKER_READ_ERROR;
+
+  uLongf raw_len = FRAME_BYTES;
+  unsigned long expected = kind == MASKER_SEQUENCE_KEY
+    ? FRAME_BYTES : n_changed * DELTA_ENTRY_LEN;
+  if (uncompress(reader->buffer, &raw_len, reader->packed, packed_len) != Z_OK
+      || raw_len != expected)
+    return MASKER_READ_ERROR;
+
+  if (kind == MASKER_SEQUENCE_KEY) {
+    memcpy(reader->frame, reader->buffer, FRAME_BYTES);
+    rescan_totals(reader);
+    n_changed = FRAME_BYTES;
+  } else {
+    if (reader->n_frames == 0) return MASKER_READ_ERROR;
+    for (unsigned long i=0; i<n_changed; i++) {
+      unsigned char *entry = &reader->buffer[i * DELTA_ENTRY_LEN];
+      unsigned long idx = get_u32(entry);
+      if (idx >= FRAME_BYTES) return MASKER_READ_ERROR;
+      int x = idx % WIDTH, y = idx / WIDTH;
+      int diff = (int)entry[4] - (int)reader->frame[idx];
+      for (int m=0; m<reader->n_masks; m++) {
+        if (mask_covers(&reader->masks[m], x, y)) reader->totals[m] += diff;
+      }
+      reader->frame[idx] = entry[4];
+    }
+  }
+
+  reader->kind = kind;
+  reader->n_changed = n_changed;
+  reader->n_frames++;
+  *has_frame = 1;
+  return MASKER_SUCCESS;
+}
+
+
+void sequence_reader_totals(const masker_sequence_reader_t *reader, float *res)
+{
+  for (int m=0; m<reader->n_masks; m++) {
+    res[m] = 0.25 * (float)reader->totals[m];   // Grayscale is rain scaled by 4
+  }
+}
+
+
+void sequence_reader_close(masker_sequence_reader_t *reader)
+{
+  fclose(reader->fp);
+  free(reader->frame);
+  free(reader->buffer);
+  free(reader->packed);
+  free(reader->totals);
+}
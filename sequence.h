@@ -0,0 +1,57 @@
+#ifndef MASKER_SEQUENCE_H
+#  define MASKER_SEQUENCE_H
+#  include <stdio.h>
+#  include "loader.h"
+
+/* Frame sequence layout (all integers little-endian):
+ *
+ *   8 bytes   signature, see MASKER_SEQUENCE_SIG
+ *   u16 x 2   width, height
+ *   records   one per frame, in time order
+ *
+ * Each record is a u8 kind, a u32 count of changed pixels and a u32 length
+ * followed by that many zlib-compressed bytes. Keyframes hold the whole
+ * grayscale frame; deltas hold (u32 pixel index, u8 new value) pairs
+ * against the previous frame. */
+#  define MASKER_SEQUENCE_SIG "\x89MSQ\r\n\x1a\n"
+#  define MASKER_SEQUENCE_SIG_LEN 8
+#  define MASKER_SEQUENCE_KEY 0
+#  define MASKER_SEQUENCE_DELTA 1
+
+typedef struct masker_sequence_writer {
+  FILE *fp;
+  png_byte *frame;        // previous frame, HEIGHT * WIDTH bytes
+  unsigned char *buffer;  // raw record scratch
+  unsigned char *packed;  // compressed record scratch
+  int keyframe_interval;
+  int n_frames;
+} masker_sequence_writer_t;
+
+typedef struct masker_sequence_reader {
+  FILE *fp;
+  png_byte *frame;        // running frame, HEIGHT * WIDTH bytes
+  unsigned char *buffer;
+  unsigned char *packed;
+  const masker_mask_t *masks;
+  int n_masks;
+  long *totals;           // running masked totals, in grayscale units
+  int n_frames;           // frames read so far
+  int kind;               // kind of the last record read
+  int n_changed;          // pixels changed by the last record
+} masker_sequence_reader_t;
+
+/* Writing: frames may be grayscale or met RGBA, the latter are converted */
+int sequence_writer_open(masker_sequence_writer_t *writer,
+  const char *file_name, int keyframe_interval);
+int sequence_writer_append(masker_sequence_writer_t *writer,
+  masker_image_t image);
+int sequence_writer_close(masker_sequence_writer_t *writer);
+
+/* Reading: masks may be NULL when only the running frame is wanted */
+int sequence_reader_open(masker_sequence_reader_t *reader,
+  const char *file_name, const masker_mask_t *masks, int n_masks);
+int sequence_reader_next(masker_sequence_reader_t *reader, int *has_frame);
+void sequence_reader_totals(const masker_sequence_reader_t *reader, float *res);
+void sequence_reader_close(masker_sequence_reader_t *reader);
+
+#endif	// MASKER_SEQUENCE_H
@@ -3,10 +3,15 @@
 from setuptools import setup, Extension
 import numpy
 
-setup(name="masker", version="1.0", ext_modules=[Extension(
+setup(name="masker", version="1.0", py_modules=["masker_aio"],
+      ext_modules=[Extension(
     name="masker",
-    sources=["masker.c", "loader.c", "algorithms.c"],
+    sources=["masker.c", "loader.c", "algorithms.c", "tiles.c",
+             "sequence.c", "rolling.c", "buffers.c", "stats.c", "workers.c",
+             "shm.c", "validate.c", "store.c", "regrid.c",
+             "sinks.c", "raster.c", "hierarchy.c",
+             "pyramid.c", "bands.c"],
     include_dirs=[numpy.get_include()],
-    libraries=["png"],
+    libraries=["png", "z", "pthread", "rt"],
     extra_compile_args=['-Ofast', '-std=c99']
 )])
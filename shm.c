@@ -0,0 +1,233 @@
+#define _POSIX_C_SOURCE 200809L
+#include "shm.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MASK_MAGIC "MSKMASK1"
+#define RING_MAGIC "MSKRING1"
+
+typedef struct mask_header {
+  char magic[8];
+  uint32_t width, height;
+  int32_t x_min, x_max, y_min, y_max;
+} mask_header_t;
+
+
+/* Map a whole named object, created at len bytes or opened at its size.
+ * Creating replaces any object of that name rather than rewriting it, so
+ * processes that have the old one mapped keep an intact copy */
+static int map_object(void **addr, size_t *len, const char *name,
+  int create, int writable)
+{
+  if (create) shm_unlink(name);
+  int flags = create ? O_RDWR | O_CREAT | O_EXCL : writable ? O_RDWR : O_RDONLY;
+  int fd = shm_open(name, flags, 0600);
+  if (fd < 0) return MASKER_IO_ERROR;
+
+  if (create) {
+    if (ftruncate(fd, *len) != 0) {
+      close(fd);
+      shm_unlink(name);
+      return MASKER_WRITE_ERROR;
+    }
+  } else {
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      close(fd);
+      return MASKER_IO_ERROR;
+    }
+    *len = st.st_size;
+  }
+
+  *addr = mmap(NULL, *len, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+    MAP_SHARED, fd, 0);
+  close(fd);
+  if (*addr == MAP_FAILED) {
+    if (create) shm_unlink(name);
+    return MASKER_MEMORY_ERROR;
+  }
+  return MASKER_SUCCESS;
+}
+
+
+int shm_remove(const char *name) {
+  return shm_unlink(name) == 0 ? MASKER_SUCCESS : MASKER_IO_ERROR;
+}
+
+
+/* ===== SHARED MASKS ===== */
+int shm_mask_write(const masker_mask_t *mask, const char *name)
+{
+  void *addr;
+  size_t len = sizeof(mask_header_t) + (size_t)WIDTH * HEIGHT;
+  int error_bit = map_object(&addr, &len, name, 1, 1);
+  if (error_bit != MASKER_SUCCESS) return error_bit;
+
+  mask_header_t *header = addr;
+  header->width = WIDTH;
+  header->height = HEIGHT;
+  header->x_min = mask->x_min;
+  header->x_max = mask->x_max;
+  header->y_min = mask->y_min;
+  header->y_max = mask->y_max;
+
+  png_byte *pixels = (png_byte*)(header + 1);
+  for (int y=0; y<HEIGHT; y++) {
+    png_byte *row = mask->image[y];
+    for (int x=0; x<WIDTH; x++) {
+      pixels[y * WIDTH + x] = row[x];   // coverage masks keep their weights
+    }
+  }
+  // Publish the magic last, as for rings
+  __sync_synchronize();
+  memcpy(header->magic, MASK_MAGIC, 8);
+  munmap(addr, len);
+  return MASKER_SUCCESS;
+}
+
+
+int shm_mask_attach(masker_mask_t *mask, const char *name)
+{
+  void *addr;
+  size_t len;
+  int error_bit = map_object(&addr, &len, name, 0, 0);
+  if (error_bit != MASKER_SUCCESS) return error_bit;
+
+  mask_header_t *header = addr;
+  if (len < sizeof(mask_header_t) || memcmp(header->magic, MASK_MAGIC, 8) != 0) {
+    munmap(addr, len);
+    return MASKER_READ_ERROR;
+  }
+  if (header->width != WIDTH || header->height != HEIGHT
+      || len < sizeof(mask_header_t) + (size_t)WIDTH * HEIGHT) {
+    munmap(addr, len);
+    return MASKER_IMAGE_SIZE_DEPTH_ERROR;
+  }
+
+  png_bytep *rows = malloc(HEIGHT * sizeof(png_bytep));
+  if (rows == NULL) {
+    munmap(addr, len);
+    return MASKER_MEMORY_ERROR;
+  }
+  png_byte *pixels = (png_byte*)(header + 1);
+  for (int y=0; y<HEIGHT; y++) rows[y] = &pixels[(size_t)y * WIDTH];
+
+  mask->image = rows;
+  mask->buffer = NULL;
+  mask->bytes_per_pixel = 1;
+  mask->color_type = PNG_COLOR_TYPE_GRAY;
+  mask->is_freed = 0;
+  mask->x_min = header->x_min;
+  mask->x_max = header->x_max;
+  mask->y_min = header->y_min;
+  mask->y_max = header->y_max;
+  mask->mapped = addr;
+  mask->mapped_len = len;
+  mask->block = NULL;
+  return MASKER_SUCCESS;
+}
+
+
+/* ===== BATCH RING ===== */
+static void ring_init(masker_ring_t *ring, void *addr, size_t len)
+{
+  ring->header = addr;
+  ring->len = len;
+  ring->n_slots = ring->header->n_slots;
+  ring->frames_per_slot = ring->header->frames_per_slot;
+}
+
+
+int ring_create(masker_ring_t *ring, const char *name,
+  int n_slots, int frames_per_slot)
+{
+  if (n_slots <= 0 || frames_per_slot <= 0) return MASKER_FAILURE;
+
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t header_len = sizeof(masker_ring_header_t) + n_slots * sizeof(int32_t);
+  size_t data_offset = (header_len + page - 1) / page * page;
+  size_t slot_bytes = frames_per_slot * MASKER_RING_FRAME_FLOATS * sizeof(float);
+  slot_bytes = (slot_bytes + page - 1) / page * page;
+
+  void *addr;
+  size_t len = data_offset + n_slots * slot_bytes;
+  int error_bit = map_object(&addr, &len, name, 1, 1);
+  if (error_bit != MASKER_SUCCESS) return error_bit;
+
+  masker_ring_header_t *header = addr;
+  header->width = WIDTH;
+  header->height = HEIGHT;
+  header->n_slots = n_slots;
+  header->frames_per_slot = frames_per_slot;
+  header->slot_bytes = slot_bytes;
+  header->data_offset = data_offset;
+  for (int s=0; s<n_slots; s++) header->state[s] = MASKER_SLOT_FREE;
+  // Publish the magic last, so attaching never sees a half-built header
+  __sync_synchronize();
+  memcpy(header->magic, RING_MAGIC, 8);
+
+  ring_init(ring, addr, len);
+  return MASKER_SUCCESS;
+}
+
+
+int ring_attach(masker_ring_t *ring, const char *name)
+{
+  void *addr;
+  size_t len;
+  int error_bit = map_object(&addr, &len, name, 0, 1);
+  if (error_bit != MASKER_SUCCESS) return error_bit;
+
+  masker_ring_header_t *header = addr;
+  if (len < sizeof(masker_ring_header_t)
+      || memcmp(header->magic, RING_MAGIC, 8) != 0
+      || len < header->data_offset + header->n_slots * header->slot_bytes) {
+    munmap(addr, len);
+    return MASKER_READ_ERROR;
+  }
+  if (header->width != WIDTH || header->height != HEIGHT) {
+    munmap(addr, len);
+    return MASKER_IMAGE_SIZE_DEPTH_ERROR;
+  }
+
+  ring_init(ring, addr, len);
+  return MASKER_SUCCESS;
+}
+
+
+void ring_close(masker_ring_t *ring)
+{
+  if (ring->header == NULL) return;
+  munmap(ring->header, ring->len);
+  ring->header = NULL;
+}
+
+
+int ring_acquire(masker_ring_t *ring)
+{
+  for (int s=0; s<ring->n_slots; s++) {
+    if (__sync_bool_compare_and_swap(&ring->header->state[s],
+        MASKER_SLOT_FREE, MASKER_SLOT_FILLING))
+      return s;
+  }
+  return -1;
+}
+
+
+int ring_transition(masker_ring_t *ring, int slot, int from, int to)
+{
+  if (slot < 0 || slot >= ring->n_slots) return MASKER_FAILURE;
+  return __sync_bool_compare_and_swap(&ring->header->state[slot], from, to)
+    ? MASKER_SUCCESS : MASKER_FAILURE;
+}
+
+
+float *ring_frame(masker_ring_t *ring, int slot, int index)
+{
+  char *data = (char*)ring->header + ring->header->data_offset;
+  return (float*)(data + slot * ring->header->slot_bytes)
+    + index * MASKER_RING_FRAME_FLOATS;
+}
@@ -0,0 +1,57 @@
+#ifndef MASKER_SHM_H
+#  define MASKER_SHM_H
+#  include <stdint.h>
+#  include "loader.h"
+
+/* Named POSIX shared memory for handing frames and masks between
+ * processes without copying.
+ *
+ * A shared mask holds a header (magic, frame size, bounding box) followed
+ * by one byte per pixel. Attaching maps it read-only and points the mask
+ * rows into the mapping, so any number of processes share one copy.
+ *
+ * A ring is a set of batch slots, each holding frames_per_slot float frames
+ * of 8 x HEIGHT x WIDTH (room for load_channels output, load_gray uses the
+ * first plane). Every slot has a state word cycled with atomic compare and
+ * swap: a producer acquires a FREE slot, fills it and publishes it as
+ * READY; the consumer releases it back to FREE once done. */
+
+#  define MASKER_SLOT_FREE 0
+#  define MASKER_SLOT_FILLING 1
+#  define MASKER_SLOT_READY 2
+
+#  define MASKER_RING_FRAME_FLOATS (8 * (size_t)HEIGHT * WIDTH)
+
+typedef struct masker_ring_header {
+  char magic[8];
+  uint32_t width, height;
+  uint32_t n_slots, frames_per_slot;
+  uint64_t slot_bytes, data_offset;
+  volatile int32_t state[];
+} masker_ring_header_t;
+
+typedef struct masker_ring {
+  masker_ring_header_t *header;
+  size_t len;
+  int n_slots, frames_per_slot;
+} masker_ring_t;
+
+/* Masks: write replaces any existing object of the same name, leaving
+ * masks already attached to it unchanged */
+int shm_mask_write(const masker_mask_t *mask, const char *name);
+int shm_mask_attach(masker_mask_t *mask, const char *name);
+
+int ring_create(masker_ring_t *ring, const char *name,
+  int n_slots, int frames_per_slot);
+int ring_attach(masker_ring_t *ring, const char *name);
+void ring_close(masker_ring_t *ring);
+
+/* Slot index moved from FREE to FILLING, or -1 if none is free */
+int ring_acquire(masker_ring_t *ring);
+/* Move slot from one state to another, failing if it is not in `from` */
+int ring_transition(masker_ring_t *ring, int slot, int from, int to);
+float *ring_frame(masker_ring_t *ring, int slot, int index);
+
+int shm_remove(const char *name);
+
+#endif	// MASKER_SHM_H
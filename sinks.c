@@ -0,0 +1,182 @@
+#include "sinks.h"
+#include "stats.h"
+#include <string.h>
+
+#define N_CHANNELS 8
+
+
+static int mask_covers(const masker_mask_t *mask, int y, int x) {
+  return mask == NULL || mask->image[y][x] != 0;
+}
+
+
+int sinks_begin(masker_sink_state_t *state, const masker_sinks_t *sinks)
+{
+  state->sinks = sinks;
+  state->fp = NULL;
+  state->png_ptr = NULL;
+  state->info_ptr = NULL;
+  state->n_rows = 0;
+  state->bytes_per_pixel = 1;
+  state->classify_ns = 0;
+  state->mask_ns = 0;
+  state->write_ns = 0;
+
+  for (int m=0; sinks->totals != NULL && m<sinks->n_masks; m++) sinks->totals[m] = 0;
+  for (int c=0; sinks->counts != NULL && c<=MASKER_RAIN_CLASSES; c++) sinks->counts[c] = 0;
+  if (sinks->total != NULL) *sinks->total = 0;
+  if (sinks->gray_file == NULL) return MASKER_SUCCESS;
+
+  // Reported as a write error, so callers can tell it from the input
+  state->fp = fopen(sinks->gray_file, "wb");
+  if (state->fp == NULL) return MASKER_WRITE_ERROR;
+  state->png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  if (state->png_ptr != NULL)
+    state->info_ptr = png_create_info_struct(state->png_ptr);
+  if (state->info_ptr == NULL) {
+    sinks_end(state, MASKER_MEMORY_ERROR);
+    return MASKER_MEMORY_ERROR;
+  }
+
+  if (setjmp(png_jmpbuf(state->png_ptr))) {
+    sinks_end(state, MASKER_INIT_IO_ERROR);
+    return MASKER_INIT_IO_ERROR;
+  }
+  png_init_io(state->png_ptr, state->fp);
+  png_set_IHDR(state->png_ptr, state->info_ptr, WIDTH, HEIGHT, DEPTH,
+    PNG_COLOR_TYPE_GRAY, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE,
+    PNG_FILTER_TYPE_BASE);
+  png_write_info(state->png_ptr, state->info_ptr);
+  return MASKER_SUCCESS;
+}
+
+
+static int write_row(masker_sink_state_t *state, const png_byte *gray)
+{
+  if (setjmp(png_jmpbuf(state->png_ptr))) return MASKER_WRITE_ERROR;
+  png_write_row(state->png_ptr, (png_bytep)gray);
+  return MASKER_SUCCESS;
+}
+
+
+int sinks_row(masker_sink_state_t *state, int y, const png_byte *row,
+  int bytes_per_pixel)
+{
+  const masker_sinks_t *sinks = state->sinks;
+  if (y != state->n_rows) return MASKER_READ_ERROR;
+  state->bytes_per_pixel = bytes_per_pixel;
+
+  const png_byte *gray = row;
+  unsigned long long start = STATS_START();
+  if (bytes_per_pixel == 4) {
+    if (met_to_gray_row(state->gray_row, row) != MASKER_SUCCESS)
+      return MASKER_MET_COLOR_ERROR;
+    gray = state->gray_row;
+  } else if (bytes_per_pixel != 1) {
+    return MASKER_COLOR_TYPE_ERROR;
+  }
+  if (sinks->counts != NULL || sinks->total != NULL) {
+    long total = 0;
+    for (int x=0; x<WIDTH; x++) {
+      total += gray[x];
+      if (sinks->counts == NULL) continue;
+      if (gray[x] == 0) sinks->counts[0]++;
+      else sinks->counts[1 + gray_to_channel(gray[x])]++;
+    }
+    if (sinks->total != NULL) *sinks->total += total;
+  }
+  unsigned long long split = start ? stats_now() : 0;
+  if (start) state->classify_ns += split - start;
+
+  for (int m=0; sinks->totals != NULL && m<sinks->n_masks; m++) {
+    const masker_mask_t *mask = &sinks->masks[m];
+    if (y < mask->y_min || y > mask->y_max) continue;
+    png_byte *mask_row = mask->image[y];
+    long total = 0;
+    for (int x=mask->x_min; x<=mask->x_max; x++) {
+      if (mask_row[x] != 0) total += gray[x];
+    }
+    sinks->totals[m] += total;
+  }
+
+  if (sinks->gray != NULL) {
+    float *out = &sinks->gray[(size_t)y * WIDTH];
+    for (int x=0; x<WIDTH; x++)
+      out[x] = mask_covers(sinks->gray_mask, y, x) ? 0.25 * (float)gray[x] : 0.0;
+  }
+
+  if (sinks->channels != NULL) {
+    for (int c=0; c<N_CHANNELS; c++)
+      memset(&sinks->channels[((size_t)c * HEIGHT + y) * WIDTH], 0, WIDTH * sizeof(float));
+    for (int x=0; x<WIDTH; x++) {
+      if (gray[x] == 0 || !mask_covers(sinks->channel_mask, y, x)) continue;
+      int channel = gray_to_channel(gray[x]);
+      sinks->channels[((size_t)channel * HEIGHT + y) * WIDTH + x] = 1.0;
+    }
+  }
+
+  if (start) {
+    unsigned long long now = stats_now();
+    state->mask_ns += now - split;
+    split = now;
+  }
+  if (state->png_ptr != NULL) {
+    int error_bit = write_row(state, gray);
+    if (error_bit != MASKER_SUCCESS) return error_bit;
+    if (start) state->write_ns += stats_now() - split;
+  }
+
+  state->n_rows++;
+  return MASKER_SUCCESS;
+}
+
+
+int sinks_end(masker_sink_state_t *state, int error_bit)
+{
+  if (error_bit == MASKER_SUCCESS && state->n_rows != HEIGHT)
+    error_bit = MASKER_READ_ERROR;
+
+  if (state->png_ptr != NULL) {
+    if (error_bit == MASKER_SUCCESS) {
+      if (setjmp(png_jmpbuf(state->png_ptr))) {
+        error_bit = MASKER_WRITE_ERROR;
+      } else {
+        png_write_end(state->png_ptr, NULL);
+      }
+    }
+    png_destroy_write_struct(&state->png_ptr, &state->info_ptr);
+  }
+  if (state->fp != NULL) {
+    if (fclose(state->fp) != 0 && error_bit == MASKER_SUCCESS)
+      error_bit = MASKER_WRITE_ERROR;
+    if (error_bit != MASKER_SUCCESS) remove(state->sinks->gray_file);
+    state->fp = NULL;
+  }
+
+  if (masker_stats_enabled && error_bit == MASKER_SUCCESS) {
+    unsigned long long pixels = (unsigned long long)WIDTH * HEIGHT;
+    stats_add(MASKER_STAGE_CLASSIFY, state->classify_ns,
+      state->bytes_per_pixel * pixels, pixels);
+    stats_add(MASKER_STAGE_MASK, state->mask_ns, pixels, pixels);
+    if (state->sinks->gray_file != NULL)
+      stats_add(MASKER_STAGE_WRITE, state->write_ns, pixels, pixels);
+  }
+  return error_bit;
+}
+
+
+int sinks_feed_row(void *state, int y, png_bytep row, int bytes_per_pixel) {
+  return sinks_row(state, y, row, bytes_per_pixel);
+}
+
+int sinks_process_file(const masker_sinks_t *sinks, const char *file_name)
+{
+  unsigned long long frame_start = STATS_START();
+  masker_sink_state_t state;
+  int error_bit = sinks_begin(&state, sinks);
+  if (error_bit != MASKER_SUCCESS) return error_bit;
+
+  error_bit = sinks_end(&state, read_frame_rows(file_name, sinks_feed_row, &state));
+  if (error_bit == MASKER_SUCCESS) stats_frame(frame_start);
+  return error_bit;
+}
@@ -0,0 +1,49 @@
+#ifndef MASKER_SINKS_H
+#  define MASKER_SINKS_H
+#  include <stdio.h>
+#  include "loader.h"
+#  include "algorithms.h"
+
+/* One decode of a frame feeding several outputs row by row.
+ *
+ * Met RGBA rows are converted to grayscale once and every requested sink
+ * reads that row, so the frame is never held whole. Unused sinks are
+ * NULL. */
+typedef struct masker_sinks {
+  const char *gray_file;           // grayscale PNG written here
+  const masker_mask_t *masks;      // totals under each mask...
+  int n_masks;
+  long *totals;                    // ...in grayscale units, n_masks longs
+  float *gray;                     // HEIGHT x WIDTH rain
+  const masker_mask_t *gray_mask;  // zero gray outside this mask
+  float *channels;                 // 8 x HEIGHT x WIDTH one-hot rain classes
+  const masker_mask_t *channel_mask;
+  unsigned long *counts;           // as frame_class_counts
+  long *total;                     // whole frame, in grayscale units
+} masker_sinks_t;
+
+typedef struct masker_sink_state {
+  const masker_sinks_t *sinks;
+  FILE *fp;
+  png_structp png_ptr;
+  png_infop info_ptr;
+  png_byte gray_row[WIDTH];
+  int n_rows;
+  int bytes_per_pixel;             // of the frame being fed
+  unsigned long long classify_ns, mask_ns, write_ns;
+} masker_sink_state_t;
+
+/* Zero the outputs and open the gray writer */
+int sinks_begin(masker_sink_state_t *state, const masker_sinks_t *sinks);
+/* Feed row y, rows must arrive in order. Stops at the first error. */
+int sinks_row(masker_sink_state_t *state, int y, const png_byte *row,
+  int bytes_per_pixel);
+/* Finish after error_bit (MASKER_SUCCESS if every row went in), removing
+ * a partial gray file on failure. Returns the final status. */
+int sinks_end(masker_sink_state_t *state, int error_bit);
+/* sinks_row for a masker_sink_state_t, as a masker_row_fn */
+int sinks_feed_row(void *state, int y, png_bytep row, int bytes_per_pixel);
+
+int sinks_process_file(const masker_sinks_t *sinks, const char *file_name);
+
+#endif	// MASKER_SINKS_H
@@ -0,0 +1,182 @@
+#define _POSIX_C_SOURCE 200809L
+#include "stats.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+typedef struct thread_stats {
+  masker_stats_t stats;
+  unsigned long generation;   // reset the counters were last cleared for
+  struct thread_stats *prev, *next;
+} thread_stats_t;
+
+volatile int masker_stats_enabled = 0;
+
+static pthread_key_t stats_key;
+static pthread_once_t stats_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static thread_stats_t *live = NULL;   // one per thread that has recorded
+static masker_stats_t retired;        // folded in from exited threads
+static volatile unsigned long generation = 0;   // bumped by each reset
+
+static const char *stage_names[MASKER_STAGES] = {
+  "io", "decode", "classify", "mask", "write", "alloc"};
+
+
+static void stats_sum(masker_stats_t *total, const masker_stats_t *part)
+{
+  for (int s=0; s<MASKER_STAGES; s++) {
+    masker_stage_stats_t *to = &total->stages[s];
+    const masker_stage_stats_t *from = &part->stages[s];
+    to->calls += from->calls;
+    to->ns += from->ns;
+    to->bytes += from->bytes;
+    to->pixels += from->pixels;
+    for (int b=0; b<MASKER_LATENCY_BINS; b++) to->latency[b] += from->latency[b];
+  }
+  total->frames += part->frames;
+  total->frame_ns += part->frame_ns;
+  for (int b=0; b<MASKER_LATENCY_BINS; b++)
+    total->frame_latency[b] += part->frame_latency[b];
+}
+
+
+static void thread_stats_free(void *arg)
+{
+  thread_stats_t *stats = arg;
+  pthread_mutex_lock(&stats_lock);
+  if (stats->generation == generation) stats_sum(&retired, &stats->stats);
+  if (stats->prev != NULL) stats->prev->next = stats->next;
+  else live = stats->next;
+  if (stats->next != NULL) stats->next->prev = stats->prev;
+  pthread_mutex_unlock(&stats_lock);
+  free(stats);
+}
+
+static void make_stats_key(void) {
+  pthread_key_create(&stats_key, thread_stats_free);
+}
+
+static masker_stats_t *thread_stats(void)
+{
+  pthread_once(&stats_once, make_stats_key);
+  thread_stats_t *stats = pthread_getspecific(stats_key);
+  if (stats != NULL) {
+    // Only the owner clears its counters, publishing the new generation
+    // once they are zero so readers never see a half-cleared set
+    unsigned long current = generation;
+    if (stats->generation != current) {
+      memset(&stats->stats, 0, sizeof(masker_stats_t));
+      __sync_synchronize();
+      stats->generation = current;
+    }
+    return &stats->stats;
+  }
+
+  stats = calloc(1, sizeof(thread_stats_t));
+  if (stats == NULL) return NULL;
+  pthread_mutex_lock(&stats_lock);
+  stats->generation = generation;
+  stats->next = live;
+  if (live != NULL) live->prev = stats;
+  live = stats;
+  pthread_mutex_unlock(&stats_lock);
+  pthread_setspecific(stats_key, stats);
+  return &stats->stats;
+}
+
+
+static int latency_bin(unsigned long long ns)
+{
+  unsigned long long us = ns / 1000;
+  int bin = 0;
+  while (us > 1 && bin < MASKER_LATENCY_BINS - 1) {
+    us >>= 1;
+    bin++;
+  }
+  return bin;
+}
+
+
+/* ===== RECORDING ===== */
+unsigned long long stats_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  // Never 0, which marks an unstarted section
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec + 1;
+}
+
+
+void stats_add(int stage, unsigned long long ns,
+  unsigned long long bytes, unsigned long long pixels)
+{
+  masker_stats_t *stats = thread_stats();
+  if (stats == NULL) return;
+  masker_stage_stats_t *counters = &stats->stages[stage];
+  counters->calls++;
+  counters->ns += ns;
+  counters->bytes += bytes;
+  counters->pixels += pixels;
+  counters->latency[latency_bin(ns)]++;
+}
+
+
+void stats_record(int stage, unsigned long long start,
+  unsigned long long bytes, unsigned long long pixels)
+{
+  if (start == 0) return;
+  stats_add(stage, stats_now() - start, bytes, pixels);
+}
+
+
+void stats_frame(unsigned long long start)
+{
+  if (start == 0) return;
+  masker_stats_t *stats = thread_stats();
+  if (stats == NULL) return;
+  unsigned long long ns = stats_now() - start;
+  stats->frames++;
+  stats->frame_ns += ns;
+  stats->frame_latency[latency_bin(ns)]++;
+}
+
+
+/* ===== CONTROL AND AGGREGATION ===== */
+void stats_enable(int enabled) {
+  masker_stats_enabled = enabled != 0;
+}
+
+
+/* Counters of running threads are read without stopping them, so a total
+ * taken mid-batch may be a few updates behind. Threads that have not
+ * recorded since the last reset still hold old counters and count as zero */
+void stats_get(masker_stats_t *stats)
+{
+  pthread_mutex_lock(&stats_lock);
+  memcpy(stats, &retired, sizeof(masker_stats_t));
+  for (thread_stats_t *t=live; t!=NULL; t=t->next) {
+    if (t->generation != generation) continue;
+    __sync_synchronize();
+    stats_sum(stats, &t->stats);
+  }
+  pthread_mutex_unlock(&stats_lock);
+}
+
+
+/* Other threads' counters are never written here: each owner clears its
+ * own on its next record once it sees the generation change */
+void stats_reset(void)
+{
+  pthread_mutex_lock(&stats_lock);
+  memset(&retired, 0, sizeof(masker_stats_t));
+  __sync_fetch_and_add(&generation, 1);
+  pthread_mutex_unlock(&stats_lock);
+}
+
+
+const char *stats_stage_name(int stage) {
+  return stage >= 0 && stage < MASKER_STAGES ? stage_names[stage] : "unknown";
+}
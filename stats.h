@@ -0,0 +1,56 @@
+#ifndef MASKER_STATS_H
+#  define MASKER_STATS_H
+
+/* Per-stage timing and counters for the decode and masking paths.
+ *
+ * Each thread records into its own counters, which are summed when read.
+ * Recording is off by default; while off every probe is a single load of
+ * masker_stats_enabled. Latency histograms have log2 bins in microseconds:
+ * bin 0 counts calls under 2us and bin b counts [2^b, 2^(b+1)) us, with the
+ * last bin open-ended. */
+
+#  define MASKER_STAGE_IO 0         // file reads, including libpng's
+#  define MASKER_STAGE_DECODE 1     // inflate and unfiltering, less IO
+#  define MASKER_STAGE_CLASSIFY 2   // met colour to rain class
+#  define MASKER_STAGE_MASK 3       // mask kernels on decoded frames
+#  define MASKER_STAGE_WRITE 4      // encoding and writing frames
+#  define MASKER_STAGE_ALLOC 5      // numpy array allocation
+#  define MASKER_STAGES 6
+
+#  define MASKER_LATENCY_BINS 24
+
+typedef struct masker_stage_stats {
+  unsigned long calls;
+  unsigned long long ns;
+  unsigned long long bytes;
+  unsigned long long pixels;
+  unsigned long latency[MASKER_LATENCY_BINS];
+} masker_stage_stats_t;
+
+typedef struct masker_stats {
+  masker_stage_stats_t stages[MASKER_STAGES];
+  unsigned long frames;     // completed per-frame operations
+  unsigned long long frame_ns;
+  unsigned long frame_latency[MASKER_LATENCY_BINS];
+} masker_stats_t;
+
+extern volatile int masker_stats_enabled;
+
+/* Start of a timed section, 0 when recording is off */
+#  define STATS_START() (masker_stats_enabled ? stats_now() : 0ULL)
+
+unsigned long long stats_now(void);
+
+/* Charge the time since start, skipped when start is 0 */
+void stats_record(int stage, unsigned long long start,
+  unsigned long long bytes, unsigned long long pixels);
+void stats_add(int stage, unsigned long long ns,
+  unsigned long long bytes, unsigned long long pixels);
+void stats_frame(unsigned long long start);
+
+void stats_enable(int enabled);
+void stats_get(masker_stats_t *stats);
+void stats_reset(void);
+const char *stats_stage_name(int stage);
+
+#endif	// MASKER_STATS_H
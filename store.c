@@ -0,0 +1,442 @@
+#define _POSIX_C_SOURCE 200809L
+#include "store.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define HEADER_FIXED_LEN (MASKER_STORE_SIG_LEN + 8)
+#define RECORD_FIXED_LEN 36
+
+
+static void put_u32(unsigned char *buf, uint32_t value) {
+  for (int i=0; i<4; i++) buf[i] = (value >> (8 * i)) & 0xff;
+}
+
+static uint32_t get_u32(const unsigned char *buf) {
+  uint32_t value = 0;
+  for (int i=3; i>=0; i--) value = (value << 8) | buf[i];
+  return value;
+}
+
+static void put_u64(unsigned char *buf, uint64_t value) {
+  for (int i=0; i<8; i++) buf[i] = (value >> (8 * i)) & 0xff;
+}
+
+static uint64_t get_u64(const unsigned char *buf) {
+  uint64_t value = 0;
+  for (int i=7; i>=0; i--) value = (value << 8) | buf[i];
+  return value;
+}
+
+
+static const char *base_name(const char *file_name) {
+  const char *base = strrchr(file_name, '/');
+  return base == NULL ? file_name : base + 1;
+}
+
+/* FNV-1a, base name only so a moved archive keeps its checkpoint */
+static uint64_t name_hash(const char *file_name)
+{
+  uint64_t hash = 14695981039346656037ULL;
+  for (const unsigned char *c=(const unsigned char*)base_name(file_name); *c; c++) {
+    hash ^= *c;
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+
+/* ===== CHECKPOINT INDEX ===== */
+static masker_store_entry_t *index_slot(const masker_store_t *store, uint64_t hash)
+{
+  size_t mask = store->index_capacity - 1;
+  size_t i = hash & mask;
+  while (store->index[i].index >= 0 && store->index[i].key.name_hash != hash)
+    i = (i + 1) & mask;
+  return &store->index[i];
+}
+
+static int index_grow(masker_store_t *store)
+{
+  masker_store_entry_t *old = store->index;
+  size_t old_capacity = store->index_capacity;
+  size_t capacity = old_capacity ? 2 * old_capacity : 1024;
+
+  store->index = malloc(capacity * sizeof(masker_store_entry_t));
+  if (store->index == NULL) {
+    store->index = old;
+    return MASKER_MEMORY_ERROR;
+  }
+  store->index_capacity = capacity;
+  for (size_t i=0; i<capacity; i++) store->index[i].index = -1;
+  for (size_t i=0; i<old_capacity; i++) {
+    if (old[i].index >= 0) *index_slot(store, old[i].key.name_hash) = old[i];
+  }
+  free(old);
+  return MASKER_SUCCESS;
+}
+
+static int index_put(masker_store_t *store, const masker_store_key_t *key, long index)
+{
+  if (2 * (store->index_count + 1) > store->index_capacity) {
+    int error_bit = index_grow(store);
+    if (error_bit != MASKER_SUCCESS) return error_bit;
+  }
+  masker_store_entry_t *entry = index_slot(store, key->name_hash);
+  if (entry->index < 0) store->index_count++;
+  entry->key = *key;
+  entry->index = index;
+  return MASKER_SUCCESS;
+}
+
+
+/* ===== TIME INDEX ===== */
+static int compare_times(const void *a, const void *b)
+{
+  const masker_store_time_t *x = a, *y = b;
+  if (x->timestamp != y->timestamp) return x->timestamp < y->timestamp ? -1 : 1;
+  return (x->index > y->index) - (x->index < y->index);
+}
+
+/* Room for count records in the time index */
+static int times_reserve(masker_store_t *store, size_t count)
+{
+  if (count <= store->times_capacity) return MASKER_SUCCESS;
+  size_t capacity = store->times_capacity ? 2 * store->times_capacity : 1024;
+  while (capacity < count) capacity *= 2;
+  masker_store_time_t *times = realloc(store->times,
+    capacity * sizeof(masker_store_time_t));
+  if (times == NULL) return MASKER_MEMORY_ERROR;
+  store->times = times;
+  store->times_capacity = capacity;
+  return MASKER_SUCCESS;
+}
+
+/* Appends are nearly always the latest frame, so this rarely moves any */
+static void times_insert(masker_store_t *store, int64_t timestamp, long index)
+{
+  masker_store_time_t entry = {timestamp, index};
+  long at = timestamp == INT64_MAX
+    ? store->n_records : store_find_time(store, timestamp + 1);
+  memmove(&store->times[at + 1], &store->times[at],
+    (store->n_records - at) * sizeof(masker_store_time_t));
+  store->times[at] = entry;
+}
+
+
+/* ===== OPENING ===== */
+static int read_header(masker_store_t *store)
+{
+  unsigned char header[HEADER_FIXED_LEN];
+  if (fread(header, 1, sizeof(header), store->fp) != sizeof(header)
+      || memcmp(header, MASKER_STORE_SIG, MASKER_STORE_SIG_LEN) != 0)
+    return MASKER_NOT_PNG_ERROR;
+
+  store->n_regions = get_u32(header + 8);
+  uint32_t names_len = get_u32(header + 12);
+  store->names = malloc(names_len + 1);
+  store->regions = malloc((store->n_regions + 1) * sizeof(char*));
+  if (store->names == NULL || store->regions == NULL) return MASKER_MEMORY_ERROR;
+  if (fread(store->names, 1, names_len, store->fp) != names_len)
+    return MASKER_READ_ERROR;
+  store->names[names_len] = '\0';
+
+  char *name = store->names;
+  for (int r=0; r<store->n_regions; r++) {
+    if (name >= store->names + names_len) return MASKER_READ_ERROR;
+    store->regions[r] = name;
+    name += strlen(name) + 1;
+  }
+  store->header_len = HEADER_FIXED_LEN + names_len;
+  return MASKER_SUCCESS;
+}
+
+static int write_header(masker_store_t *store,
+  const char *const *regions, int n_regions)
+{
+  size_t names_len = 0;
+  for (int r=0; r<n_regions; r++) names_len += strlen(regions[r]) + 1;
+
+  unsigned char header[HEADER_FIXED_LEN];
+  memcpy(header, MASKER_STORE_SIG, MASKER_STORE_SIG_LEN);
+  put_u32(header + 8, n_regions);
+  put_u32(header + 12, names_len);
+  if (fwrite(header, 1, sizeof(header), store->fp) != sizeof(header))
+    return MASKER_WRITE_ERROR;
+  for (int r=0; r<n_regions; r++) {
+    if (fwrite(regions[r], 1, strlen(regions[r]) + 1, store->fp)
+        != strlen(regions[r]) + 1)
+      return MASKER_WRITE_ERROR;
+  }
+  if (fflush(store->fp) != 0) return MASKER_WRITE_ERROR;
+
+  // Read it back so both paths fill the region table the same way
+  rewind(store->fp);
+  return read_header(store);
+}
+
+static void decode_record(const masker_store_t *store, const unsigned char *buf,
+  masker_store_record_t *record, float *totals)
+{
+  record->timestamp = (int64_t)get_u64(buf);
+  record->key.name_hash = get_u64(buf + 8);
+  record->key.mtime_ns = (int64_t)get_u64(buf + 16);
+  record->key.size = (int64_t)get_u64(buf + 24);
+  record->status = (int32_t)get_u32(buf + 32);
+  for (int r=0; r<store->n_regions && totals != NULL; r++) {
+    union { float f; uint32_t u; } value;
+    value.u = get_u32(buf + RECORD_FIXED_LEN + 4 * r);
+    totals[r] = value.f;
+  }
+}
+
+/* Count whole records and index them, dropping a torn tail if writable */
+static int load_records(masker_store_t *store, int writable)
+{
+  store->record_len = RECORD_FIXED_LEN + 4 * (size_t)store->n_regions;
+  store->buffer = malloc(store->record_len);
+  if (store->buffer == NULL) return MASKER_MEMORY_ERROR;
+
+  struct stat st;
+  if (fstat(fileno(store->fp), &st) != 0) return MASKER_IO_ERROR;
+  long data_len = st.st_size - store->header_len;
+  store->n_records = data_len / (long)store->record_len;
+  long whole_len = store->n_records * (long)store->record_len;
+  if (writable && whole_len != data_len
+      && ftruncate(fileno(store->fp), store->header_len + whole_len) != 0)
+    return MASKER_WRITE_ERROR;
+
+  store->block = malloc(MASKER_STORE_BLOCK * store->record_len);
+  if (store->block == NULL) return MASKER_MEMORY_ERROR;
+  int error_bit = index_grow(store);
+  if (error_bit == MASKER_SUCCESS) error_bit = times_reserve(store, store->n_records);
+  if (fseek(store->fp, store->header_len, SEEK_SET) != 0) return MASKER_IO_ERROR;
+
+  // Whole blocks at a time, the checkpoint needs every record
+  masker_store_record_t record;
+  int ordered = 1;
+  for (long i=0; i<store->n_records && error_bit == MASKER_SUCCESS;) {
+    long n = store->n_records - i < MASKER_STORE_BLOCK
+      ? store->n_records - i : MASKER_STORE_BLOCK;
+    if (fread(store->block, 1, n * store->record_len, store->fp)
+        != n * store->record_len)
+      return MASKER_READ_ERROR;
+    for (long j=0; j<n && error_bit == MASKER_SUCCESS; j++, i++) {
+      decode_record(store, &store->block[j * store->record_len], &record, NULL);
+      store->times[i].timestamp = record.timestamp;
+      store->times[i].index = i;
+      if (i > 0 && record.timestamp < store->times[i - 1].timestamp) ordered = 0;
+      error_bit = index_put(store, &record.key, i);
+    }
+  }
+  if (!ordered)
+    qsort(store->times, store->n_records, sizeof(masker_store_time_t), compare_times);
+  return error_bit;
+}
+
+static void store_init(masker_store_t *store)
+{
+  store->fp = NULL;
+  store->n_regions = 0;
+  store->names = NULL;
+  store->regions = NULL;
+  store->n_records = 0;
+  store->index = NULL;
+  store->index_capacity = 0;
+  store->index_count = 0;
+  store->times = NULL;
+  store->times_capacity = 0;
+  store->buffer = NULL;
+  store->block = NULL;
+}
+
+
+int store_open(masker_store_t *store, const char *file_name,
+  const char *const *regions, int n_regions)
+{
+  store_init(store);
+  int error_bit;
+  store->fp = fopen(file_name, "r+b");
+  if (store->fp != NULL) {
+    error_bit = read_header(store);
+    if (error_bit == MASKER_SUCCESS && store->n_regions != n_regions)
+      error_bit = MASKER_FAILURE;
+    for (int r=0; r<n_regions && error_bit == MASKER_SUCCESS; r++) {
+      if (strcmp(store->regions[r], regions[r]) != 0) error_bit = MASKER_FAILURE;
+    }
+  } else if (errno == ENOENT && (store->fp = fopen(file_name, "w+b")) != NULL) {
+    error_bit = write_header(store, regions, n_regions);
+  } else {
+    return MASKER_IO_ERROR;
+  }
+
+  if (error_bit == MASKER_SUCCESS) error_bit = load_records(store, 1);
+  if (error_bit != MASKER_SUCCESS) store_close(store);
+  return error_bit;
+}
+
+
+int store_open_read(masker_store_t *store, const char *file_name)
+{
+  store_init(store);
+  store->fp = fopen(file_name, "rb");
+  if (store->fp == NULL) return MASKER_IO_ERROR;
+
+  int error_bit = read_header(store);
+  if (error_bit == MASKER_SUCCESS) error_bit = load_records(store, 0);
+  if (error_bit != MASKER_SUCCESS) store_close(store);
+  return error_bit;
+}
+
+
+void store_close(masker_store_t *store)
+{
+  if (store->fp != NULL) fclose(store->fp);
+  free(store->names);
+  free(store->regions);
+  free(store->index);
+  free(store->times);
+  free(store->buffer);
+  free(store->block);
+  store_init(store);
+}
+
+
+/* ===== FILES ===== */
+int store_file_key(masker_store_key_t *key, const char *file_name)
+{
+  struct stat st;
+  if (stat(file_name, &st) != 0) return MASKER_IO_ERROR;
+  key->name_hash = name_hash(file_name);
+  key->mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+  key->size = st.st_size;
+  return MASKER_SUCCESS;
+}
+
+
+/* Days since 1970-01-01 of a proleptic Gregorian date */
+static int64_t days_from_civil(int64_t y, int m, int d)
+{
+  y -= m <= 2;
+  int64_t era = (y >= 0 ? y : y - 399) / 400;
+  int64_t yoe = y - era * 400;
+  int64_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 719468;
+}
+
+int64_t store_frame_time(const char *file_name, const masker_store_key_t *key)
+{
+  const char *c = base_name(file_name);
+  while (*c) {
+    int run = 0;
+    while (c[run] >= '0' && c[run] <= '9') run++;
+    if (run >= 12) {
+      int v[5];
+      int widths[5] = {4, 2, 2, 2, 2};
+      for (int f=0, pos=0; f<5; pos+=widths[f++]) {
+        v[f] = 0;
+        for (int i=0; i<widths[f]; i++) v[f] = 10 * v[f] + c[pos + i] - '0';
+      }
+      if (v[1] >= 1 && v[1] <= 12 && v[2] >= 1 && v[2] <= 31
+          && v[3] < 24 && v[4] < 60)
+        return days_from_civil(v[0], v[1], v[2]) * 86400 + v[3] * 3600 + v[4] * 60;
+    }
+    c += run > 0 ? run : 1;
+  }
+  return key->mtime_ns / 1000000000;
+}
+
+
+/* ===== RECORDS ===== */
+int store_has(const masker_store_t *store, const masker_store_key_t *key)
+{
+  const masker_store_entry_t *entry = index_slot(store, key->name_hash);
+  return entry->index >= 0 && entry->key.mtime_ns == key->mtime_ns
+    && entry->key.size == key->size;
+}
+
+
+int store_append(masker_store_t *store, const masker_store_record_t *record,
+  const float *totals)
+{
+  int error_bit = times_reserve(store, store->n_records + 1);
+  if (error_bit != MASKER_SUCCESS) return error_bit;
+
+  unsigned char *buf = store->buffer;
+  put_u64(buf, record->timestamp);
+  put_u64(buf + 8, record->key.name_hash);
+  put_u64(buf + 16, record->key.mtime_ns);
+  put_u64(buf + 24, record->key.size);
+  put_u32(buf + 32, record->status);
+  for (int r=0; r<store->n_regions; r++) {
+    union { float f; uint32_t u; } value;
+    value.f = record->status == MASKER_SUCCESS ? totals[r] : 0.0;
+    put_u32(buf + RECORD_FIXED_LEN + 4 * r, value.u);
+  }
+
+  // Seek every time, reads may have moved the position
+  if (fseek(store->fp, store->header_len + store->n_records * (long)store->record_len,
+        SEEK_SET) != 0
+      || fwrite(buf, 1, store->record_len, store->fp) != store->record_len
+      || fflush(store->fp) != 0)
+    return MASKER_WRITE_ERROR;
+
+  times_insert(store, record->timestamp, store->n_records);
+  error_bit = index_put(store, &record->key, store->n_records);
+  store->n_records++;
+  return error_bit;
+}
+
+
+int store_read(masker_store_t *store, long i, masker_store_record_t *record,
+  float *totals, int *is_current)
+{
+  if (i < 0 || i >= store->n_records) return MASKER_FAILURE;
+  if (fseek(store->fp, store->header_len + i * (long)store->record_len, SEEK_SET) != 0
+      || fread(store->buffer, 1, store->record_len, store->fp) != store->record_len)
+    return MASKER_READ_ERROR;
+
+  decode_record(store, store->buffer, record, totals);
+  if (is_current != NULL)
+    *is_current = index_slot(store, record->key.name_hash)->index == i;
+  return MASKER_SUCCESS;
+}
+
+
+int store_read_block(masker_store_t *store, long i, long n,
+  masker_store_record_t *records, float *totals, int *is_current)
+{
+  if (i < 0 || n < 0 || i + n > store->n_records) return MASKER_FAILURE;
+  if (n > 0
+      && fseek(store->fp, store->header_len + i * (long)store->record_len, SEEK_SET) != 0)
+    return MASKER_READ_ERROR;
+
+  for (long done=0; done<n;) {
+    long count = n - done < MASKER_STORE_BLOCK ? n - done : MASKER_STORE_BLOCK;
+    if (fread(store->block, 1, count * store->record_len, store->fp)
+        != count * store->record_len)
+      return MASKER_READ_ERROR;
+    for (long j=0; j<count; j++, done++) {
+      masker_store_record_t *record = &records[done];
+      decode_record(store, &store->block[j * store->record_len], record,
+        &totals[done * store->n_regions]);
+      if (is_current != NULL)
+        is_current[done] = index_slot(store, record->key.name_hash)->index == i + done;
+    }
+  }
+  return MASKER_SUCCESS;
+}
+
+
+long store_find_time(const masker_store_t *store, int64_t timestamp)
+{
+  long low = 0, high = store->n_records;
+  while (low < high) {
+    long mid = low + (high - low) / 2;
+    if (store->times[mid].timestamp < timestamp) low = mid + 1;
+    else high = mid;
+  }
+  return low;
+}
@@ -0,0 +1,101 @@
+#ifndef MASKER_STORE_H
+#  define MASKER_STORE_H
+#  include <stdint.h>
+#  include <stdio.h>
+#  include "loader.h"
+
+/* Results store layout (all integers little-endian):
+ *
+ *   8 bytes   signature, see MASKER_STORE_SIG
+ *   u32 x 2   region count, length of the region name block
+ *   names     region names, each NUL terminated
+ *   records   fixed size, appended as frames are processed
+ *
+ * Each record is an i64 frame time (unix seconds), the u64 hash of the
+ * frame's file name, its i64 mtime (ns) and i64 size, an i32 status and
+ * one f32 total per region (zero when the status is an error).
+ *
+ * The file identity in each record is the ingest checkpoint: reopening a
+ * store indexes which files are done, so a restart only processes files
+ * that are new or have changed since. A torn trailing record left by a
+ * crash is cut off on reopening for append.
+ *
+ * Records are kept in append order, which is usually but not always time
+ * order, so an open store also holds every record's time sorted in memory
+ * for range queries. */
+#  define MASKER_STORE_SIG "\x89MRS\r\n\x1a\n"
+#  define MASKER_STORE_SIG_LEN 8
+
+typedef struct masker_store_key {
+  uint64_t name_hash;
+  int64_t mtime_ns;
+  int64_t size;
+} masker_store_key_t;
+
+typedef struct masker_store_record {
+  int64_t timestamp;
+  masker_store_key_t key;
+  int32_t status;
+} masker_store_record_t;
+
+/* Latest record for each file name, open addressing on the name hash */
+typedef struct masker_store_entry {
+  masker_store_key_t key;
+  long index;             // record index, -1 for an empty slot
+} masker_store_entry_t;
+
+/* Position of a record in time order, ties in append order */
+typedef struct masker_store_time {
+  int64_t timestamp;
+  long index;
+} masker_store_time_t;
+
+typedef struct masker_store {
+  FILE *fp;
+  int n_regions;
+  char *names;            // region name block
+  char **regions;         // pointers into names
+  long header_len;
+  size_t record_len;
+  long n_records;
+  masker_store_entry_t *index;
+  size_t index_capacity, index_count;
+  masker_store_time_t *times;   // n_records, sorted
+  size_t times_capacity;
+  unsigned char *buffer;  // one record
+  unsigned char *block;   // MASKER_STORE_BLOCK records, for block reads
+} masker_store_t;
+
+#  define MASKER_STORE_BLOCK 4096
+
+/* Open for append, creating the store with the given regions if missing.
+ * An existing store must hold the same regions in the same order. */
+int store_open(masker_store_t *store, const char *file_name,
+  const char *const *regions, int n_regions);
+/* Open read only, taking the regions from the file */
+int store_open_read(masker_store_t *store, const char *file_name);
+void store_close(masker_store_t *store);
+
+/* Identity of a frame file from its base name and stat() */
+int store_file_key(masker_store_key_t *key, const char *file_name);
+/* Frame time from the first YYYYMMDDHHMM run in the base name, else mtime */
+int64_t store_frame_time(const char *file_name, const masker_store_key_t *key);
+
+/* Whether this exact file version already has a record */
+int store_has(const masker_store_t *store, const masker_store_key_t *key);
+/* Append and flush one record, totals holds n_regions floats */
+int store_append(masker_store_t *store, const masker_store_record_t *record,
+  const float *totals);
+
+/* Read record i. A record is current unless a later one has the same name */
+int store_read(masker_store_t *store, long i, masker_store_record_t *record,
+  float *totals, int *is_current);
+/* Read the n records from i on, totals holds n * n_regions floats and
+ * is_current n flags or NULL */
+int store_read_block(masker_store_t *store, long i, long n,
+  masker_store_record_t *records, float *totals, int *is_current);
+
+/* First position in store->times at or after timestamp, n_records if none */
+long store_find_time(const masker_store_t *store, int64_t timestamp);
+
+#endif	// MASKER_STORE_H
@@ -1,3 +1,20 @@
-gcc -O0 -std=c11 -o test_loader test_loader.c ../loader.c -lpng
-gcc -O0 -std=c11 -o test_algorithms test_algorithms.c ../loader.c ../algorithms.c -lpng
-gcc -O0 -std=c11 -o test_np test_np.c ../loader.c ../algorithms.c -lpng
+CORE="../loader.c ../tiles.c ../buffers.c ../stats.c ../bands.c ../workers.c"
+LIBS="-lpng -lz -lpthread"
+gcc -O0 -std=c11 -o test_loader test_loader.c $CORE $LIBS
+gcc -O0 -std=c11 -o test_algorithms test_algorithms.c ../algorithms.c $CORE $LIBS
+gcc -O0 -std=c11 -o test_np test_np.c ../algorithms.c $CORE $LIBS
+gcc -O0 -std=c11 -o test_tiles test_tiles.c ../algorithms.c $CORE $LIBS
+gcc -O0 -std=c11 -o test_sequence test_sequence.c ../algorithms.c ../sequence.c $CORE $LIBS
+gcc -O0 -std=c11 -o test_rolling test_rolling.c ../algorithms.c ../rolling.c $CORE $LIBS -lm
+gcc -O0 -std=c11 -o test_buffers test_buffers.c ../algorithms.c $CORE $LIBS
+gcc -O0 -std=c11 -o test_stats test_stats.c ../algorithms.c $CORE $LIBS
+gcc -O0 -std=c11 -o test_shm test_shm.c ../algorithms.c ../shm.c ../raster.c $CORE $LIBS -lrt -lm
+gcc -O0 -std=c11 -o test_validate test_validate.c ../validate.c ../algorithms.c $CORE $LIBS
+gcc -O0 -std=c11 -o test_store test_store.c ../store.c
+gcc -O0 -std=c11 -o test_regrid test_regrid.c ../regrid.c ../algorithms.c $CORE $LIBS -lm
+gcc -O0 -std=c11 -o test_sinks test_sinks.c ../sinks.c ../algorithms.c $CORE $LIBS
+gcc -O0 -std=c11 -o test_raster test_raster.c ../raster.c ../algorithms.c $CORE $LIBS -lm
+gcc -O0 -std=c11 -o test_hierarchy test_hierarchy.c ../hierarchy.c ../raster.c ../algorithms.c $CORE $LIBS -lm
+gcc -O0 -std=c11 -o test_pyramid test_pyramid.c ../pyramid.c ../algorithms.c $CORE $LIBS
+gcc -O0 -std=c11 -o test_bands test_bands.c ../algorithms.c $CORE $LIBS
+gcc -O0 -std=c11 -o test_push test_push.c ../sinks.c ../algorithms.c $CORE $LIBS
@@ -1,5 +1,6 @@
 #include "../algorithms.h"
 #include <stdio.h>
+#include <string.h>
 
 
 void test_met_to_gray(const char *in_file) {
@@ -58,6 +59,61 @@ void test_gray_total_image(const char *mask_file, const char *in_file) {
 }
 
 
+/* Frame of one pixel value, RGBA when met is given */
+int write_flat_frame(const char *file_name, png_byte gray, const png_byte *met) {
+  masker_image_t image;
+  int err_code = alloc_image_memory(&image, met ? 4 : 1,
+    met ? PNG_COLOR_TYPE_RGBA : PNG_COLOR_TYPE_GRAY);
+  if (err_code) return err_code;
+  for (int y=0; y<HEIGHT; y++) {
+    for (int x=0; x<WIDTH; x++) {
+      if (met) memcpy(&image.image[y][x * 4], met, 4);
+      else image.image[y][x] = gray;
+    }
+  }
+  err_code = write_png_file(image, file_name);
+  free_image_memory(&image);
+  return err_code;
+}
+
+/* A block in the bottom right corner, so the mask's last row and column
+ * are the frame's. Every kernel must count them. */
+void test_edge_totals(void) {
+  static const png_byte light[4] = {0, 0, 254, 255};
+  if (write_flat_frame("edge_gray.png", 12, NULL)
+      || write_flat_frame("edge_met.png", 0, light)) {
+    printf("Could not write edge frames\n");
+    return;
+  }
+
+  png_bytep *rows = malloc(HEIGHT * sizeof(png_bytep));
+  png_byte *block = calloc((size_t)WIDTH * HEIGHT, 1);
+  for (int y=0; y<HEIGHT; y++) {
+    rows[y] = &block[(size_t)y * WIDTH];
+    if (y >= HEIGHT - 11) memset(&rows[y][WIDTH - 11], 255, 11);
+  }
+  masker_mask_t mask = {rows, NULL, 1, PNG_COLOR_TYPE_GRAY, 0,
+    WIDTH - 11, WIDTH - 1, HEIGHT - 11, HEIGHT - 1, NULL, 0, block};
+
+  float gray_total, met_total;
+  long totals[2];
+  int codes[4] = {
+    mask_total_gray_image(&gray_total, mask, "edge_gray.png"),
+    mask_total_met_image(&met_total, mask, "edge_met.png"),
+    mask_totals_file(&totals[0], &mask, 1, "edge_gray.png"),
+    mask_totals_file(&totals[1], &mask, 1, "edge_met.png")};
+  printf("edge block: codes %i %i %i %i, gray %.2f, met %.2f, totals %li %li\n",
+    codes[0], codes[1], codes[2], codes[3], gray_total, met_total,
+    totals[0], totals[1]);
+  printf("  gray agrees %i, met agrees %i\n",
+    4 * gray_total == totals[0] && totals[0] == 121 * 12,
+    4 * met_total == totals[1] && totals[1] == 121);
+  free_mask_memory(&mask);
+  remove("edge_gray.png");
+  remove("edge_met.png");
+}
+
+
 int main() {
   // Test met to gray
   test_met_to_gray("error0.png");
@@ -88,4 +144,6 @@ int main() {
   test_gray_total_image("mask.png", "gray.png");
   test_gray_total_image("white.png", "gray.png");
   test_gray_total_image("image.png", "gray.png");
+
+  test_edge_totals();
 }
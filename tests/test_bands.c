@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <string.h>
+#include "../algorithms.h"
+#include "../bands.h"
+
+#define N_FLOATS (9 * WIDTH * HEIGHT)
+
+
+/* Every banded kernel on one frame, outputs packed for comparison */
+typedef struct outputs {
+  float floats[N_FLOATS];       // gray, then 8 channels
+  png_byte classified[WIDTH * HEIGHT];
+  unsigned long counts[MASKER_RAIN_CLASSES + 1];
+  long totals[2];
+  float gray_total;
+  int codes[6];
+} outputs_t;
+
+void run_kernels(outputs_t *out, masker_mask_t *masks) {
+  masker_image_t met, classified;
+  memset(out, 0, sizeof(outputs_t));
+  out->codes[0] = mask_gray_image(out->floats, masks[0], "gray.png");
+  out->codes[1] = mask_split_gray_image(&out->floats[WIDTH * HEIGHT], masks[0], "gray.png");
+  out->codes[2] = mask_total_gray_image(&out->gray_total, masks[0], "gray.png");
+  out->codes[3] = read_png_file(&met, "image.png");
+  if (!out->codes[3]) {
+    out->codes[3] = mask_totals_image(out->totals, masks, 2, met);
+    out->codes[4] = frame_class_counts(out->counts, met);
+    out->codes[5] = met_to_gray_image(&classified, met);
+    if (!out->codes[5]) {
+      memcpy(out->classified, classified.image[0], WIDTH * HEIGHT);
+      free_image_memory(&classified);
+    }
+    free_image_memory(&met);
+  }
+}
+
+int main(void) {
+  static outputs_t serial, banded;
+  masker_mask_t masks[2];
+  int err_code = read_mask_file(&masks[0], "white.png");
+  if (!err_code) err_code = read_mask_file(&masks[1], "mask.png");
+  if (err_code) {
+    printf("Got code %i loading masks\n", err_code);
+    return 0;
+  }
+
+  run_kernels(&serial, masks);
+  for (int n_threads=2; n_threads<=4; n_threads+=2) {
+    err_code = bands_set_threads(n_threads);
+    run_kernels(&banded, masks);
+    // The white mask reaches the last row and column, gray.png is image.png
+    printf("%i threads (code %i, running %i): identical %i, totals %li %li, "
+      "gray total %f, gray matches totals %i\n", n_threads, err_code,
+      bands_threads(), memcmp(&serial, &banded, sizeof(outputs_t)) == 0,
+      banded.totals[0], banded.totals[1], banded.gray_total,
+      4 * banded.gray_total == banded.totals[0]);
+  }
+  bands_set_threads(1);
+  free_mask_memory(&masks[0]);
+  free_mask_memory(&masks[1]);
+  return 0;
+}
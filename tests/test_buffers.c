@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include "../algorithms.h"
+#include "../buffers.h"
+
+
+void print_stats(const char *label) {
+  masker_buffer_stats_t stats;
+  buffers_get_stats(&stats);
+  printf("%s: frames %lu reused, %lu allocated, %lu dropped; "
+    "png %lu arena, %lu malloc; %lu pooled\n", label,
+    stats.frame_hits, stats.frame_misses, stats.frame_drops,
+    stats.png_hits, stats.png_misses, stats.pooled);
+}
+
+void test_repeated_reads(const char *file_name, int n) {
+  buffers_reset_stats();
+  for (int i=0; i<n; i++) {
+    masker_image_t image;
+    int err_code = read_png_file(&image, file_name);
+    if (err_code) {
+      printf("Got code %i reading %s\n", err_code, file_name);
+      return;
+    }
+    free_image_memory(&image);
+  }
+  print_stats(file_name);
+}
+
+void test_met_to_gray(const char *file_name, int n) {
+  buffers_reset_stats();
+  for (int i=0; i<n; i++) {
+    masker_image_t gray;
+    int err_code = met_image_to_gray(&gray, file_name);
+    if (err_code) {
+      printf("Got code %i converting %s\n", err_code, file_name);
+      return;
+    }
+    free_image_memory(&gray);
+  }
+  print_stats(file_name);
+}
+
+/* Buffers are sized for their pixels, so sizes never share a pool */
+void test_pixel_sizes(void) {
+  buffers_reset_stats();
+  for (int i=0; i<3; i++) {
+    masker_buffer_t *gray = buffer_acquire(1);
+    masker_buffer_t *met = buffer_acquire(4);
+    printf("gray rows %li bytes apart, met rows %li bytes apart\n",
+      (long)(gray->rows[1] - gray->rows[0]), (long)(met->rows[1] - met->rows[0]));
+    buffer_release(gray);
+    buffer_release(met);
+  }
+  printf("bad size gives NULL %i\n", buffer_acquire(5) == NULL);
+  print_stats("pixel sizes");
+}
+
+
+int main() {
+  test_repeated_reads("gray.png", 10);
+  test_repeated_reads("image.png", 10);
+  test_met_to_gray("image.png", 10);
+  test_repeated_reads("error2.png", 1);
+  test_pixel_sizes();
+
+  buffers_set_pool_size(0);
+  test_repeated_reads("gray.png", 3);
+}
@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include "../algorithms.h"
+#include "../raster.h"
+#include "../hierarchy.h"
+
+
+int make_quadrants(masker_mask_t *masks) {
+  // Four quadrants of the frame, overlapping nothing
+  int err_code = MASKER_SUCCESS;
+  for (int q=0; q<4 && !err_code; q++) {
+    double x0 = (q & 1) * WIDTH / 2, y0 = (q >> 1) * HEIGHT / 2;
+    double x[4] = {x0, x0 + WIDTH / 2, x0 + WIDTH / 2, x0};
+    double y[4] = {y0, y0, y0 + HEIGHT / 2, y0 + HEIGHT / 2};
+    int ring_ends[1] = {4};
+    err_code = raster_polygon(&masks[q], x, y, ring_ends, 1, 1);
+  }
+  return err_code;
+}
+
+void test_roll_up(const char *file_name) {
+  // Quadrants into top and bottom halves into the whole frame
+  masker_mask_t masks[5];
+  int parents[7] = {4, 4, 5, 5, 6, 6, -1};
+  long independent[5], totals[7];
+  masker_hierarchy_t hierarchy;
+  int err_code = make_quadrants(masks);
+  if (!err_code) err_code = read_mask_file(&masks[4], "white.png");
+  if (!err_code) err_code = mask_totals_file(independent, masks, 5, file_name);
+  if (!err_code) err_code = hierarchy_create(&hierarchy, masks, 4, parents, 7);
+  if (!err_code) err_code = hierarchy_totals_file(&hierarchy, totals, file_name);
+  if (err_code) {
+    printf("Got code %i rolling up %s\n", err_code, file_name);
+    return;
+  }
+  printf("Roll-up %s: leaves %li %li %li %li (masks %li %li %li %li), "
+    "halves %li %li, frame %li (white %li)\n", file_name,
+    totals[0], totals[1], totals[2], totals[3], independent[0],
+    independent[1], independent[2], independent[3], totals[4], totals[5],
+    totals[6], independent[4]);
+  hierarchy_free(&hierarchy);
+  for (int m=0; m<5; m++) free_mask_memory(&masks[m]);
+}
+
+void test_invalid(void) {
+  masker_mask_t masks[4];
+  masker_hierarchy_t hierarchy;
+  int backwards[5] = {4, 4, 4, -1, 3};
+  int overlap[2] = {-1, -1};
+  if (make_quadrants(masks)) return;
+  printf("Parent before child: code %i\n",
+    hierarchy_create(&hierarchy, masks, 4, backwards, 5));
+  masker_mask_t same[2] = {masks[0], masks[0]};
+  printf("Overlapping leaves: code %i\n",
+    hierarchy_create(&hierarchy, same, 2, overlap, 2));
+  for (int m=0; m<4; m++) free_mask_memory(&masks[m]);
+}
+
+void test_batch(int n_threads) {
+  masker_mask_t masks[4];
+  int parents[7] = {4, 4, 5, 5, 6, 6, -1};
+  masker_hierarchy_t hierarchy;
+  if (make_quadrants(masks)) return;
+  if (hierarchy_create(&hierarchy, masks, 4, parents, 7)) return;
+
+  const char *files[4] = {"image.png", "gray.png", "image.png", "nosuch.png"};
+  long totals[4 * 7], single[7];
+  int failed_index = -1;
+  int err_code = hierarchy_totals_files(&hierarchy, totals, files, 3, n_threads,
+    &failed_index);
+  int same = 1;
+  for (int f=0; f<3 && !err_code; f++) {
+    hierarchy_totals_file(&hierarchy, single, files[f]);
+    for (int r=0; r<7; r++) same &= single[r] == totals[f * 7 + r];
+  }
+  printf("Batch on %i threads: code %i, failed index %i, matches single %i",
+    n_threads, err_code, failed_index, same);
+  err_code = hierarchy_totals_files(&hierarchy, totals, files, 4, n_threads,
+    &failed_index);
+  printf(", with a missing file code %i at %i\n", err_code, failed_index);
+  hierarchy_free(&hierarchy);
+  for (int m=0; m<4; m++) free_mask_memory(&masks[m]);
+}
+
+int main(void) {
+  test_roll_up("image.png");
+  test_roll_up("gray.png");
+  test_invalid();
+  test_batch(1);
+  test_batch(3);
+  return 0;
+}
@@ -24,7 +24,18 @@ void read_mask_test(const char *file_name) {
 		return;
 	}
 
-	printf("Successfully loaded %s \n", file_name);
+	// Masks keep only the first channel, whatever the file held
+	masker_image_t image;
+	int loaded = read_png_file(&image, file_name) == MASKER_SUCCESS;
+	int matches = loaded;
+	for (int y=0; matches && y<HEIGHT; y++) {
+		for (int x=0; x<WIDTH; x++)
+			matches &= mask.image[y][x] == image.image[y][x * image.bytes_per_pixel];
+	}
+	if (loaded) free_image_memory(&image);
+
+	printf("Successfully loaded %s, %i byte pixels, first channel matches %i \n",
+		file_name, mask.bytes_per_pixel, matches);
 	free_mask_memory(&mask);
 	return;
 }
@@ -46,4 +57,5 @@ int main() {
 	read_mask_test("error3.png");
 	read_mask_test("error4.png");
 	read_mask_test("mask.png");
+	read_mask_test("image.png");	// RGBA frame as a mask
 }
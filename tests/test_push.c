@@ -0,0 +1,110 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "../sinks.h"
+
+
+/* Whole file into memory */
+unsigned char *slurp(const char *file_name, size_t *length) {
+  FILE *fp = fopen(file_name, "rb");
+  if (fp == NULL) return NULL;
+  fseek(fp, 0, SEEK_END);
+  *length = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  unsigned char *data = malloc(*length + 1);
+  if (data != NULL && fread(data, 1, *length, fp) != *length) {
+    free(data);
+    data = NULL;
+  }
+  fclose(fp);
+  return data;
+}
+
+
+/* Push length bytes of data in pieces of chunk, totalling under the mask */
+int push_totals(long *totals, unsigned long *counts, masker_mask_t *mask,
+  const unsigned char *data, size_t length, size_t chunk)
+{
+  masker_sinks_t sinks = {NULL, mask, 1, totals, NULL, NULL, NULL, NULL,
+    counts, NULL};
+  masker_sink_state_t state;
+  masker_push_t push;
+  int err_code = sinks_begin(&state, &sinks);
+  if (err_code) return err_code;
+  err_code = push_begin(&push, sinks_feed_row, &state);
+  for (size_t at=0; !err_code && at<length; at+=chunk)
+    err_code = push_data(&push, &data[at], length - at < chunk ? length - at : chunk);
+  int end_code = push_end(&push);
+  return sinks_end(&state, err_code ? err_code : end_code);
+}
+
+
+void compare(const char *file_name, masker_mask_t *mask) {
+  size_t length;
+  unsigned char *data = slurp(file_name, &length);
+  if (data == NULL) {
+    printf("Could not read %s\n", file_name);
+    return;
+  }
+
+  long expected;
+  unsigned long expected_counts[MASKER_RAIN_CLASSES + 1];
+  masker_sinks_t sinks = {NULL, mask, 1, &expected, NULL, NULL, NULL, NULL,
+    expected_counts, NULL};
+  int err_code = sinks_process_file(&sinks, file_name);
+  printf("%s: code %i, total %li\n", file_name, err_code, expected);
+
+  size_t chunks[] = {1, 7, 4096, length};
+  for (int c=0; c<4; c++) {
+    long total;
+    unsigned long counts[MASKER_RAIN_CLASSES + 1];
+    err_code = push_totals(&total, counts, mask, data, length, chunks[c]);
+    printf("  chunks of %zu: code %i, total matches %i, counts match %i\n",
+      chunks[c], err_code, total == expected,
+      memcmp(counts, expected_counts, sizeof(counts)) == 0);
+  }
+
+  // Cut short, and not a PNG at all
+  long total;
+  unsigned long counts[MASKER_RAIN_CLASSES + 1];
+  printf("  truncated: code %i\n",
+    push_totals(&total, counts, mask, data, length / 2, 4096));
+  printf("  not png: code %i\n",
+    push_totals(&total, counts, mask, (const unsigned char *)"GIF89a..", 8, 3));
+
+  // Through a pipe, as from a socket
+  int fds[2];
+  if (length < 65536 && pipe(fds) == 0) {
+    masker_sinks_t piped = {NULL, mask, 1, &total, NULL, NULL, NULL, NULL,
+      counts, NULL};
+    masker_sink_state_t state;
+    masker_push_t push;
+    sinks_begin(&state, &piped);
+    push_begin(&push, sinks_feed_row, &state);
+    int eof = 0;
+    ssize_t written = write(fds[1], data, length);
+    close(fds[1]);
+    err_code = push_fd(&push, fds[0], &eof);
+    close(fds[0]);
+    int end_code = push_end(&push);
+    err_code = sinks_end(&state, err_code ? err_code : end_code);
+    printf("  pipe: code %i, wrote all %i, eof %i, total matches %i\n",
+      err_code, written == (ssize_t)length, eof, total == expected);
+  }
+  free(data);
+}
+
+
+int main(void) {
+  masker_mask_t mask;
+  int err_code = read_mask_file(&mask, "white.png");
+  if (err_code) {
+    printf("Got code %i reading mask\n", err_code);
+    return 0;
+  }
+  compare("image.png", &mask);
+  compare("gray.png", &mask);
+  free_mask_memory(&mask);
+  return 0;
+}
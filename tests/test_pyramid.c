@@ -0,0 +1,26 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "../pyramid.h"
+
+
+void test_pyramid(const char *file_name, int tile_size) {
+  masker_pyramid_result_t result;
+  int err_code = pyramid_build(&result, file_name, "pyramid_tiles", tile_size, 2);
+  if (err_code) {
+    printf("Got code %i building tiles from %s\n", err_code, file_name);
+  } else {
+    FILE *fp = fopen("pyramid_tiles/0/0/0.png", "rb");
+    printf("Pyramid %s at %i: %i levels, %i tiles, %i written, top tile %s\n",
+      file_name, tile_size, result.n_levels, result.n_tiles, result.n_written,
+      fp != NULL ? "present" : "missing");
+    if (fp != NULL) fclose(fp);
+  }
+  system("rm -rf pyramid_tiles");
+}
+
+int main(void) {
+  test_pyramid("image.png", 0);
+  test_pyramid("gray.png", 64);
+  test_pyramid("missing.png", 0);
+  return 0;
+}
@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include "../algorithms.h"
+#include "../raster.h"
+
+
+long count_pixels(masker_mask_t *mask, long *value_sum) {
+  long count = 0;
+  *value_sum = 0;
+  for (int y=0; y<HEIGHT; y++) {
+    for (int x=0; x<WIDTH; x++) {
+      if (mask->image[y][x] == 0) continue;
+      count++;
+      *value_sum += mask->image[y][x];
+    }
+  }
+  return count;
+}
+
+void test_square(int with_hole, int supersample) {
+  // 10 x 10 square on pixel edges, with a 4 x 4 hole in the middle
+  double x[8] = {10, 20, 20, 10, 13, 17, 17, 13};
+  double y[8] = {30, 30, 40, 40, 33, 33, 37, 37};
+  int ring_ends[2] = {4, 8};
+  masker_mask_t mask;
+  int err_code = raster_polygon(&mask, x, y, ring_ends, with_hole ? 2 : 1, supersample);
+  if (err_code) {
+    printf("Got code %i rasterizing square\n", err_code);
+    return;
+  }
+  long value_sum;
+  long count = count_pixels(&mask, &value_sum);
+  printf("Square hole %i supersample %i: %li pixels (value sum %li), "
+    "bbox x %i-%i y %i-%i\n", with_hole, supersample, count, value_sum,
+    mask.x_min, mask.x_max, mask.y_min, mask.y_max);
+  free_mask_memory(&mask);
+}
+
+void test_coverage(void) {
+  // Unit square shifted by half a pixel covers two pixels by half
+  double x[4] = {0.5, 1.5, 1.5, 0.5};
+  double y[4] = {0, 0, 1, 1};
+  int ring_ends[1] = {4};
+  masker_mask_t mask;
+  int err_code = raster_polygon(&mask, x, y, ring_ends, 1, MASKER_RASTER_SUPERSAMPLE);
+  if (err_code) {
+    printf("Got code %i rasterizing coverage\n", err_code);
+    return;
+  }
+  printf("Coverage: %i %i %i, bbox x %i-%i y %i-%i\n", mask.image[0][0],
+    mask.image[0][1], mask.image[1][0], mask.x_min, mask.x_max, mask.y_min,
+    mask.y_max);
+  free_mask_memory(&mask);
+}
+
+void test_frame_totals(const char *white_name, const char *file_name) {
+  // A polygon hanging over the frame matches the all-white mask
+  double x[4] = {-5, WIDTH + 5, WIDTH + 5, -5};
+  double y[4] = {-5, -5, HEIGHT + 5, HEIGHT + 5};
+  int ring_ends[1] = {4};
+  masker_mask_t masks[2];
+  long totals[2];
+  double weighted[2];
+  int err_code = read_mask_file(&masks[0], white_name);
+  if (!err_code) err_code = raster_polygon(&masks[1], x, y, ring_ends, 1, MASKER_RASTER_SUPERSAMPLE);
+  if (!err_code) err_code = mask_totals_file(totals, masks, 2, file_name);
+  if (!err_code) err_code = mask_weighted_totals_file(weighted, masks, 2, file_name);
+  if (err_code) {
+    printf("Got code %i totalling %s\n", err_code, file_name);
+    return;
+  }
+  printf("Frame %s: white %li, polygon %li, weighted %f %f\n", file_name,
+    totals[0], totals[1], weighted[0], weighted[1]);
+  free_mask_memory(&masks[0]);
+  free_mask_memory(&masks[1]);
+}
+
+void test_bad_polygon(void) {
+  double x[3] = {0, 1, 0.0 / 0.0};
+  double y[3] = {0, 0, 1};
+  int ring_ends[1] = {3};
+  masker_mask_t mask;
+  printf("Non-finite polygon: code %i\n", raster_polygon(&mask, x, y, ring_ends, 1, 1));
+}
+
+int main(void) {
+  test_square(0, 1);
+  test_square(1, 1);
+  test_square(1, MASKER_RASTER_SUPERSAMPLE);
+  test_coverage();
+  test_frame_totals("white.png", "image.png");
+  test_frame_totals("white.png", "gray.png");
+  test_bad_polygon();
+  return 0;
+}
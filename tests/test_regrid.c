@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <math.h>
+#include "../algorithms.h"
+#include "../regrid.h"
+
+
+void compare_identity(const char *file_name, int method) {
+  masker_grid_t source = {0, 0, 1, 1, WIDTH, HEIGHT};
+  masker_regrid_t regrid;
+  float *gray = malloc(WIDTH * HEIGHT * sizeof(float));
+  float *res = malloc(WIDTH * HEIGHT * sizeof(float));
+  int err_code = regrid_grids(&regrid, &source, &source, method);
+  if (!err_code) err_code = load_gray_to_array(gray, file_name);
+  if (!err_code) err_code = regrid_file(&regrid, res, file_name);
+  if (err_code) {
+    printf("Got code %i regridding %s\n", err_code, file_name);
+  } else {
+    float max_diff = 0;
+    for (int i=0; i<WIDTH * HEIGHT; i++) {
+      float diff = fabsf(res[i] - gray[i]);
+      if (diff > max_diff) max_diff = diff;
+    }
+    printf("Identity %i on %s: %i weights, max diff %f\n", method, file_name,
+      regrid.row_start[regrid.n_rows], max_diff);
+    regrid_free(&regrid);
+  }
+  free(gray);
+  free(res);
+}
+
+void compare_blocks(const char *file_name) {
+  // 5x5 block means, on a flipped y axis, with the last row hanging off
+  masker_grid_t source = {0, HEIGHT, 1, -1, WIDTH, HEIGHT};
+  masker_grid_t target = {0, HEIGHT, 5, -5, WIDTH / 5, HEIGHT / 5 + 1};
+  masker_regrid_t regrid;
+  float *gray = malloc(WIDTH * HEIGHT * sizeof(float));
+  float *res = malloc(target.nx * target.ny * sizeof(float));
+  int err_code = regrid_grids(&regrid, &source, &target, MASKER_REGRID_CONSERVATIVE);
+  if (!err_code) err_code = load_gray_to_array(gray, file_name);
+  if (!err_code) err_code = regrid_file(&regrid, res, file_name);
+  if (err_code) {
+    printf("Got code %i regridding %s\n", err_code, file_name);
+  } else {
+    float max_diff = 0;
+    for (int j=0; j<HEIGHT / 5; j++) {
+      for (int i=0; i<WIDTH / 5; i++) {
+        float sum = 0;
+        for (int y=0; y<5; y++) {
+          for (int x=0; x<5; x++) sum += gray[(5 * j + y) * WIDTH + 5 * i + x];
+        }
+        float diff = fabsf(res[j * target.nx + i] - sum / 25);
+        if (diff > max_diff) max_diff = diff;
+      }
+    }
+    printf("Blocks on %s: max diff %f, uncovered row nan %i\n", file_name,
+      max_diff, isnan(res[(target.ny - 1) * target.nx]));
+    regrid_free(&regrid);
+  }
+  free(gray);
+  free(res);
+}
+
+void sample_points(const char *file_name) {
+  // Centre of the first wet pixel, halfway to its right neighbour, outside
+  float *gray = malloc(WIDTH * HEIGHT * sizeof(float));
+  int err_code = load_gray_to_array(gray, file_name);
+  int wet = 0;
+  while (!err_code && wet < WIDTH * HEIGHT - 1 && gray[wet] == 0) wet++;
+  int px = wet % WIDTH, py = wet / WIDTH;
+
+  masker_grid_t source = {0, 0, 1, 1, WIDTH, HEIGHT};
+  double x[3] = {px + 0.5, px + 1.0, -3};
+  double y[3] = {py + 0.5, py + 0.5, 10};
+  float res[3];
+  masker_regrid_t regrid;
+  if (!err_code) err_code = regrid_points(&regrid, &source, x, y, 3);
+  if (!err_code) err_code = regrid_file(&regrid, res, file_name);
+  if (err_code) {
+    printf("Got code %i sampling %s\n", err_code, file_name);
+  } else {
+    printf("Points on %s: %f (pixel %f), %f (mean %f), %f\n", file_name,
+      res[0], gray[wet], res[1], (gray[wet] + gray[wet + 1]) / 2, res[2]);
+    regrid_free(&regrid);
+  }
+  free(gray);
+}
+
+/* Met frames are refused with the same code as the gray mask kernels */
+void refuse_met(const char *file_name) {
+  masker_grid_t source = {0, 0, 1, 1, WIDTH, HEIGHT};
+  masker_regrid_t regrid;
+  masker_mask_t mask;
+  float res[1], total;
+  double x[1] = {10}, y[1] = {10};
+  int err_code = regrid_points(&regrid, &source, x, y, 1);
+  if (!err_code) err_code = read_mask_file(&mask, "white.png");
+  if (err_code) {
+    printf("Got code %i setting up %s\n", err_code, file_name);
+    return;
+  }
+  printf("Regrid %s: code %i, gray total code %i\n", file_name,
+    regrid_file(&regrid, res, file_name),
+    mask_total_gray_image(&total, mask, file_name));
+  regrid_free(&regrid);
+  free_mask_memory(&mask);
+}
+
+int main(void) {
+  compare_identity("gray.png", MASKER_REGRID_BILINEAR);
+  compare_identity("gray.png", MASKER_REGRID_CONSERVATIVE);
+  compare_blocks("gray.png");
+  sample_points("gray.png");
+  sample_points("image.png");
+  refuse_met("image.png");
+  return 0;
+}
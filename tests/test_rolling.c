@@ -0,0 +1,40 @@
+#include <stdio.h>
+#include "../loader.h"
+#include "../rolling.h"
+
+
+void test_rolling(const char **files, int n_files) {
+  masker_mask_t masks[2];
+  int err_code = read_mask_file(&masks[0], "white.png");
+  if (!err_code) err_code = read_mask_file(&masks[1], "mask.png");
+  if (err_code) {
+    printf("Got code %i loading masks\n", err_code);
+    return;
+  }
+
+  int windows[2] = {1, 3};
+  float res[4 * 2 * 2];
+  int failed_index;
+  err_code = rolling_totals_files(res, files, n_files, windows, 2,
+    masks, 2, &failed_index);
+  if (err_code) {
+    printf("Got code %i at %s\n", err_code, files[failed_index]);
+  } else {
+    for (int i=0; i<n_files; i++) {
+      float *row = &res[i * 4];
+      printf("Frame %i: 1-frame %f %f, 3-frame %f %f\n",
+        i, row[0], row[1], row[2], row[3]);
+    }
+  }
+
+  free_mask_memory(&masks[0]);
+  free_mask_memory(&masks[1]);
+}
+
+
+int main() {
+  const char *good[] = {"gray.png", "image.png", "mask.png", "gray.png"};
+  const char *bad[] = {"gray.png", "error4.png"};
+  test_rolling(good, 4);
+  test_rolling(bad, 2);
+}
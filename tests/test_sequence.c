@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include "../algorithms.h"
+#include "../sequence.h"
+
+
+void test_write_sequence(const char *out_file, const char **in_files, int n) {
+  masker_sequence_writer_t writer;
+  int err_code = sequence_writer_open(&writer, out_file, 4);
+  if (err_code) {
+    printf("Got code %i opening %s\n", err_code, out_file);
+    return;
+  }
+
+  for (int i=0; i<n; i++) {
+    masker_image_t image;
+    err_code = read_png_file(&image, in_files[i]);
+    if (!err_code) {
+      err_code = sequence_writer_append(&writer, image);
+      free_image_memory(&image);
+    }
+    if (err_code) printf("Got code %i appending %s\n", err_code, in_files[i]);
+  }
+
+  err_code = sequence_writer_close(&writer);
+  if (err_code) {
+    printf("Got code %i closing %s\n", err_code, out_file);
+    return;
+  }
+  printf("Wrote %i frames to %s\n", writer.n_frames, out_file);
+}
+
+void test_read_sequence(const char *mask_file, const char *in_file) {
+  masker_mask_t mask;
+  int err_code = read_mask_file(&mask, mask_file);
+  if (err_code) {
+    printf("Got code %i from mask file %s\n", err_code, mask_file);
+    return;
+  }
+
+  masker_sequence_reader_t reader;
+  err_code = sequence_reader_open(&reader, in_file, &mask, 1);
+  if (err_code) {
+    printf("Got code %i opening %s\n", err_code, in_file);
+    free_mask_memory(&mask);
+    return;
+  }
+
+  int has_frame = 1;
+  while (has_frame) {
+    err_code = sequence_reader_next(&reader, &has_frame);
+    if (err_code) {
+      printf("Got code %i reading %s\n", err_code, in_file);
+      break;
+    }
+    if (!has_frame) break;
+    float res;
+    sequence_reader_totals(&reader, &res);
+    printf("Frame %i (%s, %i changed) with %s: %f\n", reader.n_frames,
+      reader.kind == MASKER_SEQUENCE_KEY ? "key" : "delta",
+      reader.n_changed, mask_file, res);
+  }
+
+  sequence_reader_close(&reader);
+  free_mask_memory(&mask);
+}
+
+
+/* Frames whose only rain is on their last row and column, so incremental
+ * totals must agree with mask_total_gray_image on the box edges */
+void test_edge_sequence(void) {
+  masker_mask_t mask;
+  masker_sequence_writer_t writer;
+  int err_code = read_mask_file(&mask, "white.png");
+  if (!err_code) err_code = sequence_writer_open(&writer, "edges.msq", 2);
+  if (err_code) {
+    printf("Got code %i setting up edge sequence\n", err_code);
+    return;
+  }
+
+  float expected[3];
+  for (int f=0; f<3 && !err_code; f++) {
+    masker_image_t image;
+    err_code = alloc_image_memory(&image, 1, PNG_COLOR_TYPE_GRAY);
+    if (err_code) break;
+    for (int i=0; i<WIDTH; i++) image.image[HEIGHT - 1][i] = 12 * (f + 1);
+    for (int i=0; i<HEIGHT; i++) image.image[i][WIDTH - 1] = 24 * (f % 2 + 1);
+    err_code = sequence_writer_append(&writer, image);
+    if (!err_code) err_code = write_png_file(image, "edge_frame.png");
+    if (!err_code) err_code = mask_total_gray_image(&expected[f], mask, "edge_frame.png");
+    free_image_memory(&image);
+  }
+  int close_code = sequence_writer_close(&writer);
+  if (err_code || close_code) {
+    printf("Got code %i writing edge sequence\n", err_code ? err_code : close_code);
+    free_mask_memory(&mask);
+    return;
+  }
+
+  masker_sequence_reader_t reader;
+  int opened = (err_code = sequence_reader_open(&reader, "edges.msq", &mask, 1)) == 0;
+  int has_frame = 1;
+  for (int f=0; !err_code && has_frame; f++) {
+    err_code = sequence_reader_next(&reader, &has_frame);
+    if (err_code || !has_frame) break;
+    float res;
+    sequence_reader_totals(&reader, &res);
+    printf("Edge frame %i: %f, matches mask_total_gray_image %i\n",
+      reader.n_frames, res, res == expected[f]);
+  }
+  if (err_code) printf("Got code %i reading edge sequence\n", err_code);
+  if (opened) sequence_reader_close(&reader);
+  free_mask_memory(&mask);
+  remove("edges.msq");
+  remove("edge_frame.png");
+}
+
+
+int main() {
+  const char *frames[] = {"gray.png", "image.png", "gray.png", "mask.png",
+    "error1.png", "gray.png"};
+  test_write_sequence("frames.msq", frames, 6);
+
+  test_read_sequence("white.png", "frames.msq");
+  test_read_sequence("mask.png", "frames.msq");
+  test_read_sequence("white.png", "gray.png");
+
+  remove("frames.msq");
+
+  test_edge_sequence();
+}
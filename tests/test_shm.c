@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include "../algorithms.h"
+#include "../raster.h"
+#include "../shm.h"
+
+
+void test_shared_mask(const char *mask_file) {
+  masker_mask_t mask, shared;
+  int err_code = read_mask_file(&mask, mask_file);
+  if (!err_code) err_code = shm_mask_write(&mask, "/masker_test_mask");
+  if (!err_code) err_code = shm_mask_attach(&shared, "/masker_test_mask");
+  shm_remove("/masker_test_mask");
+  if (err_code) {
+    printf("Got code %i sharing %s\n", err_code, mask_file);
+    return;
+  }
+
+  float total, shared_total;
+  mask_total_gray_image(&total, mask, "gray.png");
+  mask_total_gray_image(&shared_total, shared, "gray.png");
+  printf("%s: own %f, shared %f, bbox %i-%i x %i-%i\n", mask_file, total,
+    shared_total, shared.x_min, shared.x_max, shared.y_min, shared.y_max);
+  free_mask_memory(&mask);
+  free_mask_memory(&shared);
+}
+
+/* Partial coverage must survive sharing for weighted totals */
+void test_shared_coverage(void) {
+  double x[] = {10.3, 480.7, 120.2}, y[] = {15.5, 60.1, 470.9};
+  int ring_ends[] = {3};
+  masker_mask_t mask, shared;
+  int err_code = raster_polygon(&mask, x, y, ring_ends, 1, MASKER_RASTER_SUPERSAMPLE);
+  if (!err_code) err_code = shm_mask_write(&mask, "/masker_test_coverage");
+  if (!err_code) err_code = shm_mask_attach(&shared, "/masker_test_coverage");
+  shm_remove("/masker_test_coverage");
+  if (err_code) {
+    printf("Got code %i sharing coverage mask\n", err_code);
+    return;
+  }
+
+  double total, shared_total;
+  mask_weighted_totals_file(&total, &mask, 1, "gray.png");
+  mask_weighted_totals_file(&shared_total, &shared, 1, "gray.png");
+  printf("coverage: own %f, shared %f, same %i\n", total, shared_total,
+    total == shared_total);
+  free_mask_memory(&mask);
+  free_mask_memory(&shared);
+}
+
+/* Writing a mask again under the same name leaves attached copies intact */
+void test_replace_mask(void) {
+  masker_mask_t white, mask, first, second;
+  int err_code = read_mask_file(&white, "white.png");
+  if (!err_code) err_code = read_mask_file(&mask, "mask.png");
+  if (!err_code) err_code = shm_mask_write(&white, "/masker_test_replace");
+  if (!err_code) err_code = shm_mask_attach(&first, "/masker_test_replace");
+  if (!err_code) err_code = shm_mask_write(&mask, "/masker_test_replace");
+  if (!err_code) err_code = shm_mask_attach(&second, "/masker_test_replace");
+  shm_remove("/masker_test_replace");
+  if (err_code) {
+    printf("Got code %i replacing mask\n", err_code);
+    return;
+  }
+
+  float white_total, mask_total, first_total, second_total;
+  mask_total_gray_image(&white_total, white, "gray.png");
+  mask_total_gray_image(&mask_total, mask, "gray.png");
+  mask_total_gray_image(&first_total, first, "gray.png");
+  mask_total_gray_image(&second_total, second, "gray.png");
+  printf("replaced: attached keeps old %i, new attach sees new %i\n",
+    first_total == white_total, second_total == mask_total);
+  free_mask_memory(&white);
+  free_mask_memory(&mask);
+  free_mask_memory(&first);
+  free_mask_memory(&second);
+}
+
+void test_ring(void) {
+  masker_ring_t producer, consumer;
+  int err_code = ring_create(&producer, "/masker_test_ring", 2, 1);
+  if (!err_code) err_code = ring_attach(&consumer, "/masker_test_ring");
+  shm_remove("/masker_test_ring");
+  if (err_code) {
+    printf("Got code %i creating ring\n", err_code);
+    return;
+  }
+
+  int first = ring_acquire(&producer);
+  int second = ring_acquire(&producer);
+  int third = ring_acquire(&producer);
+  printf("Acquired slots %i %i %i\n", first, second, third);
+
+  load_gray_to_array(ring_frame(&producer, first, 0), "gray.png");
+  ring_transition(&producer, first, MASKER_SLOT_FILLING, MASKER_SLOT_READY);
+  float sum = 0.0;
+  float *frame = ring_frame(&consumer, first, 0);
+  for (int i=0; i<WIDTH * HEIGHT; i++) sum += frame[i];
+  printf("Consumer sees slot %i state %i, sum %f\n", first,
+    consumer.header->state[first], sum);
+  int released = ring_transition(&consumer, first, MASKER_SLOT_READY, MASKER_SLOT_FREE);
+  int again = ring_transition(&consumer, first, MASKER_SLOT_READY, MASKER_SLOT_FREE);
+  printf("Release twice: %i %i\n", released, again);
+
+  ring_close(&producer);
+  ring_close(&consumer);
+}
+
+
+int main() {
+  test_shared_mask("white.png");
+  test_shared_mask("mask.png");
+  test_shared_coverage();
+  test_replace_mask();
+  test_ring();
+}
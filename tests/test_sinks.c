@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <string.h>
+#include "../sinks.h"
+
+
+void compare(const char *file_name, const char *mask_file) {
+  masker_mask_t masks[2];
+  int err_code = read_mask_file(&masks[0], mask_file);
+  if (!err_code) err_code = read_mask_file(&masks[1], "white.png");
+  if (err_code) {
+    printf("Got code %i reading masks\n", err_code);
+    return;
+  }
+
+  long totals[2], total;
+  unsigned long counts[MASKER_RAIN_CLASSES + 1];
+  float *gray = malloc(WIDTH * HEIGHT * sizeof(float));
+  float *channels = malloc(8 * WIDTH * HEIGHT * sizeof(float));
+  masker_sinks_t sinks = {"sinks_gray.png", masks, 2, totals, gray, NULL,
+    channels, &masks[0], counts, &total};
+  err_code = sinks_process_file(&sinks, file_name);
+  printf("%s: code %i, totals %li %li, frame total %li, dry %lu\n",
+    file_name, err_code, totals[0], totals[1], total, counts[0]);
+
+  if (!err_code) {
+    // Against the single-purpose kernels
+    long expected[2];
+    unsigned long expected_counts[MASKER_RAIN_CLASSES + 1];
+    float *expected_gray = malloc(WIDTH * HEIGHT * sizeof(float));
+    float *expected_channels = malloc(8 * WIDTH * HEIGHT * sizeof(float));
+    masker_image_t image;
+    mask_totals_file(expected, masks, 2, file_name);
+    read_frame_file(&image, file_name);
+    frame_class_counts(expected_counts, image);
+    free_image_memory(&image);
+    load_gray_to_array(expected_gray, "sinks_gray.png");
+    mask_split_gray_image(expected_channels, masks[0], "sinks_gray.png");
+    printf("  totals match %i, counts match %i, gray match %i, channels match %i\n",
+      expected[0] == totals[0] && expected[1] == totals[1],
+      memcmp(counts, expected_counts, sizeof(counts)) == 0,
+      memcmp(gray, expected_gray, WIDTH * HEIGHT * sizeof(float)) == 0,
+      memcmp(channels, expected_channels, 8 * WIDTH * HEIGHT * sizeof(float)) == 0);
+    free(expected_gray);
+    free(expected_channels);
+  }
+  remove("sinks_gray.png");
+  free(gray);
+  free(channels);
+  free_mask_memory(&masks[0]);
+  free_mask_memory(&masks[1]);
+}
+
+int main(void) {
+  compare("image.png", "mask.png");
+  compare("gray.png", "white.png");
+  compare("error4.png", "mask.png");
+
+  // Only a gray file, from a missing frame leaves nothing behind
+  masker_sinks_t sinks = {"sinks_gray.png"};
+  int err_code = sinks_process_file(&sinks, "missing.png");
+  FILE *fp = fopen("sinks_gray.png", "rb");
+  printf("Missing frame: code %i, gray file left %i\n", err_code, fp != NULL);
+  if (fp != NULL) fclose(fp);
+  return 0;
+}
@@ -0,0 +1,91 @@
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include <stdio.h>
+#include "../algorithms.h"
+#include "../stats.h"
+
+
+void print_stats(const char *label) {
+  masker_stats_t stats;
+  stats_get(&stats);
+  printf("%s: %lu frames\n", label, stats.frames);
+  for (int s=0; s<MASKER_STAGES; s++) {
+    masker_stage_stats_t *stage = &stats.stages[s];
+    unsigned long binned = 0;
+    for (int b=0; b<MASKER_LATENCY_BINS; b++) binned += stage->latency[b];
+    printf("  %-8s %lu calls, %llu bytes, %llu pixels, %lu binned\n",
+      stats_stage_name(s), stage->calls, stage->bytes, stage->pixels, binned);
+  }
+}
+
+void test_kernels(masker_mask_t mask) {
+  float total;
+  masker_image_t gray;
+  int err_code = mask_total_met_image(&total, mask, "image.png");
+  if (!err_code) err_code = mask_total_gray_image(&total, mask, "gray.png");
+  if (!err_code) err_code = met_image_to_gray(&gray, "image.png");
+  if (err_code) {
+    printf("Got code %i\n", err_code);
+    return;
+  }
+  free_image_memory(&gray);
+}
+
+
+/* A worker that records around a reset made by another thread */
+static pthread_barrier_t step;
+
+static void *record_twice(void *arg) {
+  (void)arg;
+  stats_add(MASKER_STAGE_IO, 1000, 10, 0);
+  pthread_barrier_wait(&step);   // recorded
+  pthread_barrier_wait(&step);   // reset
+  stats_add(MASKER_STAGE_IO, 1000, 3, 0);
+  pthread_barrier_wait(&step);   // recorded again
+  pthread_barrier_wait(&step);   // read
+  return NULL;
+}
+
+void test_thread_reset(void) {
+  pthread_t worker;
+  masker_stats_t stats;
+  stats_reset();
+  pthread_barrier_init(&step, NULL, 2);
+  pthread_create(&worker, NULL, record_twice, NULL);
+  pthread_barrier_wait(&step);
+  stats_get(&stats);
+  unsigned long long before = stats.stages[MASKER_STAGE_IO].bytes;
+  stats_reset();
+  stats_get(&stats);
+  unsigned long long reset = stats.stages[MASKER_STAGE_IO].bytes;
+  pthread_barrier_wait(&step);
+  pthread_barrier_wait(&step);
+  stats_get(&stats);
+  printf("thread reset: %llu bytes, %llu after reset, %llu after recording\n",
+    before, reset, stats.stages[MASKER_STAGE_IO].bytes);
+  pthread_barrier_wait(&step);
+  pthread_join(worker, NULL);
+  pthread_barrier_destroy(&step);
+}
+
+
+int main() {
+  masker_mask_t mask;
+  int err_code = read_mask_file(&mask, "mask.png");
+  if (err_code) {
+    printf("Got code %i loading mask\n", err_code);
+    return 0;
+  }
+
+  test_kernels(mask);
+  print_stats("disabled");
+
+  stats_enable(1);
+  test_kernels(mask);
+  print_stats("enabled");
+
+  stats_reset();
+  print_stats("reset");
+  test_thread_reset();
+  free_mask_memory(&mask);
+}
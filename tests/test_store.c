@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include "../store.h"
+
+
+void append_frame(masker_store_t *store, const char *file_name, float scale) {
+  masker_store_record_t record;
+  float totals[2] = {scale, 2 * scale};
+  int err_code = store_file_key(&record.key, file_name);
+  if (err_code) {
+    printf("Got code %i keying %s\n", err_code, file_name);
+    return;
+  }
+  record.timestamp = store_frame_time(file_name, &record.key);
+  record.status = MASKER_SUCCESS;
+  printf("%s: seen %i", file_name, store_has(store, &record.key));
+  err_code = store_append(store, &record, totals);
+  printf(", appended %i, seen %i\n", err_code, store_has(store, &record.key));
+}
+
+void print_store(const char *file_name) {
+  masker_store_t store;
+  int err_code = store_open_read(&store, file_name);
+  if (err_code) {
+    printf("Got code %i reading %s\n", err_code, file_name);
+    return;
+  }
+  printf("%li records, regions %s %s\n", store.n_records, store.regions[0],
+    store.regions[1]);
+  for (long i=0; i<store.n_records; i++) {
+    masker_store_record_t record;
+    float totals[2];
+    int is_current;
+    store_read(&store, i, &record, totals, &is_current);
+    printf("  %" PRId64 ": %f %f current %i\n", record.timestamp, totals[0],
+      totals[1], is_current);
+  }
+  store_close(&store);
+}
+
+/* Appended out of time order, then queried by time range */
+void test_time_range(const char *const *regions) {
+  masker_store_t store;
+  remove("times.mrs");
+  int err_code = store_open(&store, "times.mrs", regions, 2);
+  if (err_code) {
+    printf("Got code %i creating store\n", err_code);
+    return;
+  }
+  int64_t stamps[6] = {300, 100, 200, 200, 500, 400};
+  masker_store_record_t record = {0, {0, 0, 0}, MASKER_SUCCESS};
+  for (int i=0; i<6; i++) {
+    float totals[2] = {i, 10 * i};
+    record.timestamp = stamps[i];
+    record.key.name_hash = i;
+    store_append(&store, &record, totals);
+  }
+  store_close(&store);
+
+  // The index is rebuilt on reopening, and kept up to date by appends
+  for (int pass=0; pass<2; pass++) {
+    store_open_read(&store, "times.mrs");
+    long first = store_find_time(&store, 200), last = store_find_time(&store, 450);
+    printf("pass %i: times [200, 450) at %li..%li:", pass, first, last);
+    for (long at=first; at<last; at++) {
+      masker_store_record_t records[1];
+      float totals[2];
+      store_read_block(&store, store.times[at].index, 1, records, totals, NULL);
+      printf(" %" PRId64 "=%g", records[0].timestamp, totals[0]);
+    }
+    masker_store_record_t records[6];
+    float totals[12];
+    printf(", block %i", store_read_block(&store, 0, 6, records, totals, NULL));
+    printf(", past end %i\n",
+      store_read_block(&store, store.n_records - 1, 2, records, totals, NULL));
+    store_close(&store);
+    if (pass == 0) {
+      store_open(&store, "times.mrs", regions, 2);
+      float more[2] = {6, 60};
+      record.timestamp = 250;
+      record.key.name_hash = 6;
+      store_append(&store, &record, more);
+      store_close(&store);
+    }
+  }
+  remove("times.mrs");
+}
+
+int main(void) {
+  const char *regions[2] = {"north", "south"};
+  masker_store_t store;
+  remove("test.mrs");
+  int err_code = store_open(&store, "test.mrs", regions, 2);
+  if (err_code) {
+    printf("Got code %i creating store\n", err_code);
+    return 1;
+  }
+
+  FILE *fp = fopen("radar_202001020304.png", "wb");
+  fclose(fp);
+  append_frame(&store, "radar_202001020304.png", 1.0);
+  append_frame(&store, "gray.png", 3.0);
+  store_close(&store);
+
+  // Reopening keeps the checkpoint, a changed file is processed again
+  const char *other[2] = {"north", "east"};
+  printf("Different regions: %i\n", store_open(&store, "test.mrs", other, 2));
+  store_open(&store, "test.mrs", regions, 2);
+  append_frame(&store, "gray.png", 4.0);
+  fp = fopen("radar_202001020304.png", "wb");
+  fputs("changed", fp);
+  fclose(fp);
+  append_frame(&store, "radar_202001020304.png", 5.0);
+  store_close(&store);
+
+  // A torn record is dropped when reopening for append
+  fp = fopen("test.mrs", "ab");
+  fputs("torn", fp);
+  fclose(fp);
+  store_open(&store, "test.mrs", regions, 2);
+  store_close(&store);
+  print_store("test.mrs");
+  test_time_range(regions);
+
+  remove("test.mrs");
+  remove("radar_202001020304.png");
+  return 0;
+}
@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <string.h>
+#include "../algorithms.h"
+#include "../tiles.h"
+
+
+void test_roundtrip(const char *in_file, const char *out_file) {
+  masker_image_t image;
+  int err_code = read_png_file(&image, in_file);
+  if (err_code) {
+    printf("Got code %i reading %s\n", err_code, in_file);
+    return;
+  }
+
+  err_code = write_tiled_file(image, out_file);
+  free_image_memory(&image);
+  if (err_code) {
+    printf("Got code %i writing %s\n", err_code, out_file);
+    return;
+  }
+
+  printf("Tiled %s to %s\n", in_file, out_file);
+}
+
+void test_tiled_total(const char *mask_file, const char *png_file,
+  const char *tiled_file)
+{
+  masker_mask_t mask;
+  int err_code = read_mask_file(&mask, mask_file);
+  if (err_code) {
+    printf("Got code %i from mask file %s\n", err_code, mask_file);
+    return;
+  }
+
+  float png_res, tiled_res;
+  err_code = mask_total_gray_image(&png_res, mask, png_file);
+  if (!err_code) err_code = mask_total_gray_image(&tiled_res, mask, tiled_file);
+  free_mask_memory(&mask);
+  if (err_code) {
+    printf("Got code %i summing %s\n", err_code, tiled_file);
+    return;
+  }
+
+  if (png_res == tiled_res)
+    printf("Tiled total matches png for %s: %f\n", mask_file, tiled_res);
+  else
+    printf("Tiled total MISMATCH for %s: %f vs %f\n",
+      mask_file, tiled_res, png_res);
+}
+
+
+/* Region reads leave pixels outside the box as the pool had them, so
+ * dirty a pooled buffer first; masked outputs must not see it */
+void test_tiled_gray(const char *mask_file, const char *png_file,
+  const char *tiled_file)
+{
+  masker_mask_t mask;
+  masker_image_t dirty;
+  int err_code = read_mask_file(&mask, mask_file);
+  if (!err_code) err_code = read_png_file(&dirty, png_file);
+  if (err_code) {
+    printf("Got code %i setting up %s\n", err_code, mask_file);
+    return;
+  }
+  memset(dirty.image[0], 0xcb, (size_t)WIDTH * HEIGHT);
+  free_image_memory(&dirty);
+
+  float *tiled = malloc(9 * WIDTH * HEIGHT * sizeof(float));
+  float *png = malloc(9 * WIDTH * HEIGHT * sizeof(float));
+  int codes[4] = {
+    mask_gray_image(tiled, mask, tiled_file),
+    mask_split_gray_image(&tiled[WIDTH * HEIGHT], mask, tiled_file),
+    mask_gray_image(png, mask, png_file),
+    mask_split_gray_image(&png[WIDTH * HEIGHT], mask, png_file)};
+  printf("Tiled gray and channels for %s: codes %i %i %i %i, match %i\n",
+    mask_file, codes[0], codes[1], codes[2], codes[3],
+    memcmp(tiled, png, 9 * WIDTH * HEIGHT * sizeof(float)) == 0);
+  free(tiled);
+  free(png);
+  free_mask_memory(&mask);
+}
+
+
+int main() {
+  test_roundtrip("error4.png", "error4.mtl");
+  test_roundtrip("gray.png", "gray.mtl");
+
+  test_tiled_total("mask.png", "gray.png", "gray.mtl");
+  test_tiled_total("white.png", "gray.png", "gray.mtl");
+  test_tiled_total("mask.png", "gray.png", "image.png");
+  test_tiled_total("mask.png", "gray.png", "error1.png");
+  test_tiled_gray("mask.png", "gray.png", "gray.mtl");
+  test_tiled_gray("white.png", "gray.png", "gray.mtl");
+
+  remove("gray.mtl");
+}
@@ -0,0 +1,57 @@
+#include <stdio.h>
+#include "../validate.h"
+
+
+int main() {
+  const char *files[] = {"error0.png", "error1.png", "error2.png", "error3.png",
+    "error4.png", "mask.png", "gray.png", "image.png", "white.png",
+    "truncated.png", "badcrc.png", "badcolor.png", "noise.png", "noisecut.png"};
+  int n_files = sizeof(files) / sizeof(files[0]);
+
+  // Corrupt copies of a good frame: cut short, and one flipped pixel byte
+  FILE *in = fopen("gray.png", "rb");
+  unsigned char data[1 << 20];
+  size_t len = fread(data, 1, sizeof(data), in);
+  fclose(in);
+  FILE *out = fopen("truncated.png", "wb");
+  fwrite(data, 1, len - 40, out);
+  fclose(out);
+  data[len / 2] ^= 0x10;
+  out = fopen("badcrc.png", "wb");
+  fwrite(data, 1, len, out);
+  fclose(out);
+
+  // Well-formed RGBA frame with one colour outside the met palette
+  masker_image_t image;
+  alloc_image_memory(&image, 4, PNG_COLOR_TYPE_RGBA);
+  image.image[10][40] = 1;
+  image.image[10][43] = 255;
+  write_png_file(image, "badcolor.png");
+
+  // Noise compresses badly, so chunks span many reads of the scan buffer
+  srand(7);
+  for (int y=0; y<HEIGHT; y++)
+    for (int x=0; x<4 * WIDTH; x++) image.image[y][x] = rand() & 0xff;
+  write_png_file(image, "noise.png");
+  free_image_memory(&image);
+  static unsigned char noise[1 << 21];
+  in = fopen("noise.png", "rb");
+  len = fread(noise, 1, sizeof(noise), in);
+  fclose(in);
+  out = fopen("noisecut.png", "wb");
+  fwrite(noise, 1, len - 100000, out);
+  fclose(out);
+
+  for (int level=0; level<=2; level++) {
+    int codes[32];
+    validate_frame_files(codes, files, n_files, level, 2);
+    printf("Level %i:", level);
+    for (int i=0; i<n_files; i++) printf(" %s=%i", files[i], codes[i]);
+    printf("\n");
+  }
+  remove("truncated.png");
+  remove("badcrc.png");
+  remove("badcolor.png");
+  remove("noise.png");
+  remove("noisecut.png");
+}
@@ -0,0 +1,251 @@
+#define _POSIX_C_SOURCE 200809L
+#include "tiles.h"
+#include "buffers.h"
+#include "stats.h"
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define TILE_MAX_BYTES (MASKER_TILE_SIZE * MASKER_TILE_SIZE * 4)
+
+
+static void put_u16(unsigned char *buf, unsigned int value) {
+  buf[0] = value & 0xff;
+  buf[1] = (value >> 8) & 0xff;
+}
+
+static void put_u32(unsigned char *buf, unsigned long value) {
+  for (int i=0; i<4; i++) buf[i] = (value >> (8 * i)) & 0xff;
+}
+
+static unsigned int get_u16(const unsigned char *buf) {
+  return buf[0] | (buf[1] << 8);
+}
+
+static unsigned long get_u32(const unsigned char *buf) {
+  unsigned long value = 0;
+  for (int i=3; i>=0; i--) value = (value << 8) | buf[i];
+  return value;
+}
+
+
+/* Width and height in pixels of the tile at tile coordinates tx, ty */
+static void tile_extent(int *w, int *h, int tx, int ty) {
+  *w = WIDTH - tx * MASKER_TILE_SIZE;
+  if (*w > MASKER_TILE_SIZE) *w = MASKER_TILE_SIZE;
+  *h = HEIGHT - ty * MASKER_TILE_SIZE;
+  if (*h > MASKER_TILE_SIZE) *h = MASKER_TILE_SIZE;
+}
+
+
+/* Inflate one whole tile with the thread's reusable inflater */
+static int inflate_tile(unsigned char *raw, unsigned long raw_len,
+  unsigned char *packed, unsigned long packed_len)
+{
+  z_stream *stream = buffers_inflater();
+  if (stream == NULL) return MASKER_MEMORY_ERROR;
+
+  stream->next_in = packed;
+  stream->avail_in = packed_len;
+  stream->next_out = raw;
+  stream->avail_out = raw_len;
+  if (inflate(stream, Z_FINISH) != Z_STREAM_END || stream->avail_out != 0)
+    return MASKER_READ_ERROR;
+  return MASKER_SUCCESS;
+}
+
+
+int is_tiled_sig(const unsigned char *sig) {
+  return memcmp(sig, MASKER_TILED_SIG, MASKER_TILED_SIG_LEN) == 0;
+}
+
+
+int check_tiled_header(const unsigned char *header,
+  int *color_type, int *pixel_size)
+{
+  if (!is_tiled_sig(header)) return MASKER_NOT_PNG_ERROR;
+  if (get_u16(header + 8) != WIDTH || get_u16(header + 10) != HEIGHT
+      || get_u16(header + 12) != MASKER_TILE_SIZE)
+    return MASKER_IMAGE_SIZE_DEPTH_ERROR;
+
+  *color_type = header[14];
+  *pixel_size = header[15];
+  if (!((*color_type == 0 && *pixel_size == 1) || (*color_type == 2 && *pixel_size == 3)
+        || (*color_type == 4 && *pixel_size == 2) || (*color_type == 6 && *pixel_size == 4)))
+    return MASKER_COLOR_TYPE_ERROR;
+  return MASKER_SUCCESS;
+}
+
+
+int write_tiled_file(masker_image_t image, const char *file_name)
+{
+  unsigned long long start = STATS_START();
+  unsigned char *raw = malloc(TILE_MAX_BYTES);
+  uLongf bound = compressBound(TILE_MAX_BYTES);
+  unsigned char *packed = malloc(bound);
+  if (raw == NULL || packed == NULL) {
+    free(raw);
+    free(packed);
+    return MASKER_MEMORY_ERROR;
+  }
+
+  FILE *fp = fopen(file_name, "wb");
+  if (fp == NULL) {
+    free(raw);
+    free(packed);
+    return MASKER_IO_ERROR;
+  }
+
+  // Header, then a placeholder index which is filled in once sizes are known
+  unsigned char header[MASKER_TILED_HEADER_LEN];
+  unsigned char index[4 * (MASKER_TILE_COUNT + 1)];
+  memcpy(header, MASKER_TILED_SIG, MASKER_TILED_SIG_LEN);
+  put_u16(header + 8, WIDTH);
+  put_u16(header + 10, HEIGHT);
+  put_u16(header + 12, MASKER_TILE_SIZE);
+  header[14] = image.color_type;
+  header[15] = image.bytes_per_pixel;
+  memset(index, 0, sizeof(index));
+  int error_bit = MASKER_SUCCESS;
+  if (fwrite(header, 1, sizeof(header), fp) != sizeof(header)
+      || fwrite(index, 1, sizeof(index), fp) != sizeof(index))
+    error_bit = MASKER_WRITE_ERROR;
+
+  unsigned long offset = 0;
+  for (int t=0; t<MASKER_TILE_COUNT && error_bit == MASKER_SUCCESS; t++) {
+    int tx = t % MASKER_TILES_X, ty = t / MASKER_TILES_X;
+    int w, h;
+    tile_extent(&w, &h, tx, ty);
+    int row_bytes = w * image.bytes_per_pixel;
+    for (int y=0; y<h; y++) {
+      png_byte *row = image.image[ty * MASKER_TILE_SIZE + y];
+      memcpy(raw + y * row_bytes,
+        row + tx * MASKER_TILE_SIZE * image.bytes_per_pixel, row_bytes);
+    }
+
+    uLongf packed_len = bound;
+    if (compress2(packed, &packed_len, raw, row_bytes * h,
+        Z_DEFAULT_COMPRESSION) != Z_OK) {
+      error_bit = MASKER_WRITE_ERROR;
+      break;
+    }
+    if (fwrite(packed, 1, packed_len, fp) != packed_len) {
+      error_bit = MASKER_WRITE_ERROR;
+      break;
+    }
+    put_u32(index + 4 * t, offset);
+    offset += packed_len;
+  }
+  put_u32(index + 4 * MASKER_TILE_COUNT, offset);
+
+  if (error_bit == MASKER_SUCCESS
+      && (fseek(fp, MASKER_TILED_HEADER_LEN, SEEK_SET) != 0
+          || fwrite(index, 1, sizeof(index), fp) != sizeof(index)))
+    error_bit = MASKER_WRITE_ERROR;
+
+  if (fclose(fp) != 0 && error_bit == MASKER_SUCCESS)
+    error_bit = MASKER_WRITE_ERROR;
+  free(raw);
+  free(packed);
+  if (error_bit == MASKER_SUCCESS)
+    stats_record(MASKER_STAGE_WRITE, start,
+      (unsigned long long)WIDTH * HEIGHT * image.bytes_per_pixel, WIDTH * HEIGHT);
+  return error_bit;
+}
+
+
+int read_tiled_region(masker_image_t *result, const char *file_name,
+  int x_min, int x_max, int y_min, int y_max)
+{
+  int fd = open(file_name, O_RDONLY);
+  if (fd < 0) {
+    return MASKER_IO_ERROR;
+  }
+  int error_bit = read_tiled_region_fd(result, fd, x_min, x_max, y_min, y_max);
+  close(fd);
+  return error_bit;
+}
+
+
+int read_tiled_region_fd(masker_image_t *result, int fd,
+  int x_min, int x_max, int y_min, int y_max)
+{
+  unsigned long long read_start = STATS_START();
+  unsigned long long io_ns = 0, io_bytes = 0, pixels = 0;
+  unsigned char header[MASKER_TILED_HEADER_LEN];
+  int color_type, pixel_size;
+  if (pread(fd, header, sizeof(header), 0) < (ssize_t)sizeof(header))
+    return MASKER_NOT_PNG_ERROR;
+  int error_bit = check_tiled_header(header, &color_type, &pixel_size);
+  if (error_bit != MASKER_SUCCESS) return error_bit;
+
+  unsigned char index[4 * (MASKER_TILE_COUNT + 1)];
+  if (pread(fd, index, sizeof(index), sizeof(header)) < (ssize_t)sizeof(index))
+    return MASKER_READ_ERROR;
+
+  // Raw and compressed tiles share the thread's tile scratch block
+  uLong packed_max = compressBound(TILE_MAX_BYTES);
+  unsigned char *raw = buffers_scratch(MASKER_SCRATCH_TILES,
+    TILE_MAX_BYTES + packed_max);
+  if (raw == NULL) return MASKER_MEMORY_ERROR;
+  unsigned char *packed = raw + TILE_MAX_BYTES;
+
+  // Only the tiles decoded below are written, so nothing is cleared
+  error_bit = acquire_image_memory(result, pixel_size, color_type);
+  if (error_bit != MASKER_SUCCESS) return error_bit;
+
+  // Clamp the box to the frame, an empty mask has x_min > x_max
+  if (x_min < 0) x_min = 0;
+  if (y_min < 0) y_min = 0;
+  if (x_max > WIDTH - 1) x_max = WIDTH - 1;
+  if (y_max > HEIGHT - 1) y_max = HEIGHT - 1;
+
+  for (int ty=y_min / MASKER_TILE_SIZE;
+       ty<=y_max / MASKER_TILE_SIZE && x_min <= x_max && y_min <= y_max; ty++) {
+    for (int tx=x_min / MASKER_TILE_SIZE; tx<=x_max / MASKER_TILE_SIZE; tx++) {
+      int t = ty * MASKER_TILES_X + tx;
+      unsigned long start = get_u32(index + 4 * t);
+      unsigned long end = get_u32(index + 4 * (t + 1));
+      int w, h;
+      tile_extent(&w, &h, tx, ty);
+      int row_bytes = w * pixel_size;
+
+      if (end < start || end - start > packed_max) {
+        error_bit = MASKER_READ_ERROR;
+        goto done;
+      }
+      unsigned long long io_start = STATS_START();
+      if (pread(fd, packed, end - start, MASKER_TILED_HEADER_LEN + sizeof(index) + start)
+          < (ssize_t)(end - start)) {
+        error_bit = MASKER_READ_ERROR;
+        goto done;
+      }
+      if (io_start) {
+        io_ns += stats_now() - io_start;
+        io_bytes += end - start;
+        pixels += w * h;
+      }
+      if (inflate_tile(raw, row_bytes * h, packed, end - start) != MASKER_SUCCESS) {
+        error_bit = MASKER_READ_ERROR;
+        goto done;
+      }
+
+      for (int y=0; y<h; y++) {
+        png_byte *row = result->image[ty * MASKER_TILE_SIZE + y];
+        memcpy(row + tx * MASKER_TILE_SIZE * pixel_size,
+          raw + y * row_bytes, row_bytes);
+      }
+    }
+  }
+
+done:
+  if (error_bit != MASKER_SUCCESS) {
+    free_image_memory(result);
+  } else if (read_start) {
+    stats_add(MASKER_STAGE_IO, io_ns, io_bytes, 0);
+    stats_add(MASKER_STAGE_DECODE, stats_now() - read_start - io_ns,
+      pixels * pixel_size, pixels);
+  }
+  return error_bit;
+}
@@ -0,0 +1,39 @@
+#ifndef MASKER_TILES_H
+#  define MASKER_TILES_H
+#  include "loader.h"
+
+#  define MASKER_TILE_SIZE 64
+#  define MASKER_TILES_X ((WIDTH + MASKER_TILE_SIZE - 1) / MASKER_TILE_SIZE)
+#  define MASKER_TILES_Y ((HEIGHT + MASKER_TILE_SIZE - 1) / MASKER_TILE_SIZE)
+#  define MASKER_TILE_COUNT (MASKER_TILES_X * MASKER_TILES_Y)
+
+/* Tiled frame layout (all integers little-endian):
+ *
+ *   8 bytes   signature, see MASKER_TILED_SIG
+ *   u16 x 3   width, height, tile size
+ *   u8  x 2   png color type, bytes per pixel
+ *   u32       offsets[MASKER_TILE_COUNT + 1], relative to the tile data
+ *   ...       tile data, each tile zlib-compressed independently
+ *
+ * Tiles are stored row-major; edge tiles are cropped to the frame. */
+#  define MASKER_TILED_SIG "\x89MTL\r\n\x1a\n"
+#  define MASKER_TILED_SIG_LEN 8
+#  define MASKER_TILED_HEADER_LEN (MASKER_TILED_SIG_LEN + 8)
+
+int is_tiled_sig(const unsigned char *sig);
+
+/* Check the fixed header against the frame geometry */
+int check_tiled_header(const unsigned char *header,
+  int *color_type, int *pixel_size);
+int write_tiled_file(masker_image_t image, const char *file_name);
+
+/* Decode only tiles intersecting the inclusive box. Other pixels are left
+ * as the pooled buffer had them, so the cost follows the box, not the
+ * frame; callers must not read outside the tiles the box touches. */
+int read_tiled_region(masker_image_t *result, const char *file_name,
+  int x_min, int x_max, int y_min, int y_max);
+/* As read_tiled_region, for a frame already open on fd */
+int read_tiled_region_fd(masker_image_t *result, int fd,
+  int x_min, int x_max, int y_min, int y_max);
+
+#endif	// MASKER_TILES_H
@@ -0,0 +1,263 @@
+#define _POSIX_C_SOURCE 200809L
+#include "validate.h"
+#include "algorithms.h"
+#include "buffers.h"
+#include "tiles.h"
+#include "workers.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define PNG_SIG_LEN 8
+#define PNG_HEAD_LEN (PNG_SIG_LEN + 25)   // signature and IHDR chunk
+#define READ_BUFFER (64 * 1024)
+#define INFLATE_CHUNK (16 * 1024)
+
+
+static unsigned long get_u32_be(const unsigned char *buf) {
+  return ((unsigned long)buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3];
+}
+
+
+/* Sequential reads of a file through a fixed buffer, so memory and I/O
+ * stay at what the check needs rather than the file size */
+typedef struct file_stream {
+  int fd;
+  unsigned char *buffer;
+  size_t size, pos, len;
+} file_stream_t;
+
+/* Up to n bytes at the stream position, in place. Returns how many, 0 at
+ * end of file or on error. */
+static size_t stream_next(file_stream_t *stream, const unsigned char **data,
+  size_t n)
+{
+  if (stream->pos == stream->len) {
+    ssize_t got;
+    do {
+      got = read(stream->fd, stream->buffer, stream->size);
+    } while (got < 0 && errno == EINTR);
+    if (got <= 0) return 0;
+    stream->pos = 0;
+    stream->len = got;
+  }
+  if (n > stream->len - stream->pos) n = stream->len - stream->pos;
+  *data = stream->buffer + stream->pos;
+  stream->pos += n;
+  return n;
+}
+
+/* n bytes copied out, fewer only at end of file */
+static size_t stream_read(file_stream_t *stream, unsigned char *out, size_t n)
+{
+  size_t done = 0;
+  while (done < n) {
+    const unsigned char *data;
+    size_t got = stream_next(stream, &data, n - done);
+    if (got == 0) break;
+    memcpy(out + done, data, got);
+    done += got;
+  }
+  return done;
+}
+
+
+/* Filtered image bytes an IHDR promises, one filter byte per row of each
+ * interlace pass */
+static size_t expected_idat_bytes(int pixel_size, int interlace)
+{
+  if (!interlace)
+    return (size_t)HEIGHT * (1 + (size_t)WIDTH * pixel_size);
+
+  static const int x0[7] = {0, 4, 0, 2, 0, 1, 0}, dx[7] = {8, 8, 4, 4, 2, 2, 1};
+  static const int y0[7] = {0, 0, 4, 0, 2, 0, 1}, dy[7] = {8, 8, 8, 4, 4, 2, 2};
+  size_t total = 0;
+  for (int p=0; p<7; p++) {
+    size_t w = WIDTH > x0[p] ? (WIDTH - x0[p] + dx[p] - 1) / dx[p] : 0;
+    size_t h = HEIGHT > y0[p] ? (HEIGHT - y0[p] + dy[p] - 1) / dy[p] : 0;
+    if (w > 0 && h > 0) total += h * (1 + w * pixel_size);
+  }
+  return total;
+}
+
+
+static int check_ihdr(const unsigned char *ihdr, int *pixel_size, int *interlace)
+{
+  if (get_u32_be(ihdr) != WIDTH || get_u32_be(ihdr + 4) != HEIGHT
+      || ihdr[8] != DEPTH)
+    return MASKER_IMAGE_SIZE_DEPTH_ERROR;
+
+  switch (ihdr[9]) {
+    case 0: *pixel_size = 1; break;
+    case 2: *pixel_size = 3; break;
+    case 4: *pixel_size = 2; break;
+    case 6: *pixel_size = 4; break;
+    default: return MASKER_COLOR_TYPE_ERROR;
+  }
+  if (ihdr[10] != 0 || ihdr[11] != 0 || ihdr[12] > 1) return MASKER_READ_ERROR;
+  *interlace = ihdr[12];
+  return MASKER_SUCCESS;
+}
+
+
+/* Inflate part of the IDAT stream into a window that is thrown away */
+static int inflate_idat(z_stream *z, const unsigned char *data, size_t n,
+  size_t *inflated, size_t expected, int *ended)
+{
+  unsigned char window[INFLATE_CHUNK];
+  z->next_in = (Bytef*)data;
+  z->avail_in = n;
+  while (z->avail_in > 0 && !*ended) {
+    z->next_out = window;
+    z->avail_out = sizeof(window);
+    int ret = inflate(z, Z_NO_FLUSH);
+    if (ret != Z_OK && ret != Z_STREAM_END) return MASKER_READ_ERROR;
+    *inflated += sizeof(window) - z->avail_out;
+    if (*inflated > expected) return MASKER_READ_ERROR;
+    if (ret == Z_STREAM_END) *ended = 1;
+  }
+  return MASKER_SUCCESS;
+}
+
+
+/* Walk the chunks after the IHDR, checking CRCs and inflating IDAT data
+ * as it streams past. head holds the signature and the whole IHDR. */
+static int validate_chunks(file_stream_t *stream, const unsigned char *head,
+  int pixel_size, int interlace)
+{
+  const unsigned char *ihdr = head + PNG_SIG_LEN;
+  if (crc32(crc32(0L, Z_NULL, 0), ihdr + 4, 17) != get_u32_be(ihdr + 21))
+    return MASKER_READ_ERROR;
+
+  size_t expected = expected_idat_bytes(pixel_size, interlace), inflated = 0;
+  int seen_iend = 0, idat_done = 0, ended = 0;
+  z_stream *z = NULL;
+  while (!seen_iend) {
+    unsigned char chunk[8], crc_bytes[4];
+    if (stream_read(stream, chunk, 8) < 8) return MASKER_READ_ERROR;   // truncated
+    unsigned long length = get_u32_be(chunk);
+    if (length > 0x7fffffffUL) return MASKER_READ_ERROR;
+    int is_idat = memcmp(chunk + 4, "IDAT", 4) == 0;
+    if (is_idat && idat_done) return MASKER_READ_ERROR;   // IDAT chunks must be consecutive
+    if (!is_idat && z != NULL) idat_done = 1;
+    if (is_idat && z == NULL && (z = buffers_inflater()) == NULL)
+      return MASKER_MEMORY_ERROR;
+
+    uLong crc = crc32(crc32(0L, Z_NULL, 0), chunk + 4, 4);
+    for (unsigned long left=length; left>0; ) {
+      const unsigned char *body;
+      size_t got = stream_next(stream, &body, left);
+      if (got == 0) return MASKER_READ_ERROR;
+      crc = crc32(crc, body, got);
+      left -= got;
+      if (is_idat && inflate_idat(z, body, got, &inflated, expected, &ended)
+          != MASKER_SUCCESS)
+        return MASKER_READ_ERROR;
+    }
+    if (stream_read(stream, crc_bytes, 4) < 4 || get_u32_be(crc_bytes) != crc)
+      return MASKER_READ_ERROR;
+    if (is_idat && ended) idat_done = 1;
+    if (memcmp(chunk + 4, "IEND", 4) == 0) seen_iend = 1;
+  }
+
+  // The deflate stream may end at the last byte without reporting it yet
+  if (z != NULL && !ended && inflated == expected) {
+    unsigned char window[1];
+    z->next_out = window;
+    z->avail_out = sizeof(window);
+    z->avail_in = 0;
+    if (inflate(z, Z_FINISH) != Z_STREAM_END || z->avail_out != sizeof(window))
+      return MASKER_READ_ERROR;
+  }
+  if (z == NULL || inflated != expected) return MASKER_READ_ERROR;
+  return MASKER_SUCCESS;
+}
+
+
+static int validate_colors(const char *file_name)
+{
+  masker_image_t image;
+  int error_bit = read_frame_file(&image, file_name);
+  if (error_bit != MASKER_SUCCESS) return error_bit;
+
+  unsigned long counts[MASKER_RAIN_CLASSES + 1];
+  if (image.bytes_per_pixel == 4) error_bit = frame_class_counts(counts, image);
+  free_image_memory(&image);
+  return error_bit;
+}
+
+
+int validate_frame_file(const char *file_name, int level)
+{
+  int fd = open(file_name, O_RDONLY);
+  if (fd < 0) return MASKER_IO_ERROR;
+  // The header level reads no further than the header
+  unsigned char head_buffer[PNG_HEAD_LEN];
+  file_stream_t stream = {fd, head_buffer, PNG_HEAD_LEN, 0, 0};
+  if (level >= MASKER_VALIDATE_CHUNKS) {
+    stream.buffer = buffers_scratch(MASKER_SCRATCH_VALIDATE, READ_BUFFER);
+    stream.size = READ_BUFFER;
+    if (stream.buffer == NULL) {
+      close(fd);
+      return MASKER_MEMORY_ERROR;
+    }
+  }
+
+  // Signature and IHDR, or the tiled header
+  unsigned char head[PNG_HEAD_LEN];
+  size_t head_len = stream_read(&stream, head, PNG_HEAD_LEN);
+  int error_bit;
+  if (head_len >= MASKER_TILED_HEADER_LEN && is_tiled_sig(head)) {
+    // Tiles are plain deflate, so inflating them is the cheapest full check
+    close(fd);
+    int color_type, pixel_size;
+    error_bit = check_tiled_header(head, &color_type, &pixel_size);
+    if (error_bit != MASKER_SUCCESS || level == MASKER_VALIDATE_HEADER)
+      return error_bit;
+    if (level == MASKER_VALIDATE_CHUNKS) {
+      masker_image_t image;
+      error_bit = read_frame_file(&image, file_name);
+      if (error_bit == MASKER_SUCCESS) free_image_memory(&image);
+      return error_bit;
+    }
+    return validate_colors(file_name);
+  }
+
+  int pixel_size = 0, interlace = 0;
+  if (head_len < PNG_SIG_LEN || png_sig_cmp(head, 0, PNG_SIG_LEN) != 0)
+    error_bit = MASKER_NOT_PNG_ERROR;
+  else if (head_len < PNG_HEAD_LEN || get_u32_be(head + PNG_SIG_LEN) != 13
+      || memcmp(head + PNG_SIG_LEN + 4, "IHDR", 4) != 0)
+    error_bit = MASKER_READ_ERROR;
+  else
+    error_bit = check_ihdr(head + PNG_SIG_LEN + 8, &pixel_size, &interlace);
+  if (error_bit == MASKER_SUCCESS && level >= MASKER_VALIDATE_CHUNKS)
+    error_bit = validate_chunks(&stream, head, pixel_size, interlace);
+  close(fd);
+  if (error_bit != MASKER_SUCCESS || level < MASKER_VALIDATE_COLORS)
+    return error_bit;
+  return validate_colors(file_name);
+}
+
+
+typedef struct validate_batch {
+  const char *const *file_names;
+  int level;
+} validate_batch_t;
+
+static int validate_item(void *ctx, int i)
+{
+  validate_batch_t *batch = ctx;
+  return validate_frame_file(batch->file_names[i], batch->level);
+}
+
+
+int validate_frame_files(int *codes, const char *const *file_names,
+  int n_files, int level, int n_threads)
+{
+  validate_batch_t batch = {file_names, level};
+  workers_map(n_threads, n_files, validate_item, &batch, codes, NULL);
+  return MASKER_SUCCESS;
+}
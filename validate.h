@@ -0,0 +1,24 @@
+#ifndef MASKER_VALIDATE_H
+#  define MASKER_VALIDATE_H
+#  include "loader.h"
+
+/* Integrity checks for frame archives, returning the MASKER_* code a full
+ * read would fail with, or MASKER_SUCCESS.
+ *
+ * HEADER checks the signature and the IHDR (or tiled header) against the
+ * frame size, bit depth and colour types. CHUNKS also verifies every chunk
+ * CRC and inflates the IDAT stream, without unfiltering, to confirm it
+ * holds exactly the expected number of bytes and is followed by IEND.
+ * COLORS decodes fully and rejects unknown met colours in RGBA frames. */
+
+#  define MASKER_VALIDATE_HEADER 0
+#  define MASKER_VALIDATE_CHUNKS 1
+#  define MASKER_VALIDATE_COLORS 2
+
+int validate_frame_file(const char *file_name, int level);
+
+/* Validate many files on n_threads threads (0 for every core) */
+int validate_frame_files(int *codes, const char *const *file_names,
+  int n_files, int level, int n_threads);
+
+#endif	// MASKER_VALIDATE_H
@@ -0,0 +1,242 @@
+#define _POSIX_C_SOURCE 200809L
+#include "workers.h"
+#include "loader.h"
+#include <unistd.h>
+
+static masker_workers_t map_helpers;
+static int n_map_helpers = 0;
+// Held for reading by maps in flight, for writing to grow the pool
+static pthread_rwlock_t map_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+
+/* One workers_map call, on the caller's stack until every helper is done */
+typedef struct map_run {
+  masker_map_fn fn;
+  void *ctx;
+  int n;
+  int next;                 // next item to claim, atomically
+  int *statuses;
+  int failed, code;         // lowest failing item and its code
+  int helpers;              // submitted helpers not yet finished
+  pthread_mutex_t lock;
+  pthread_cond_t finished;
+} map_run_t;
+
+
+int workers_default_threads(void) {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (int)n : 1;
+}
+
+
+static void *worker_main(void *arg)
+{
+  masker_workers_t *workers = arg;
+
+  pthread_mutex_lock(&workers->lock);
+  for (;;) {
+    while (workers->count == 0 && !workers->stopping)
+      pthread_cond_wait(&workers->not_empty, &workers->lock);
+    if (workers->count == 0) break;   // stopping and drained
+
+    masker_task_t task = workers->queue[workers->head];
+    workers->head = (workers->head + 1) % workers->queue_depth;
+    workers->count--;
+    workers->active++;
+    pthread_cond_signal(&workers->not_full);
+    pthread_mutex_unlock(&workers->lock);
+
+    task.fn(task.arg);
+
+    pthread_mutex_lock(&workers->lock);
+    workers->active--;
+    if (workers->count == 0 && workers->active == 0)
+      pthread_cond_broadcast(&workers->idle);
+  }
+  pthread_mutex_unlock(&workers->lock);
+  return NULL;
+}
+
+
+int workers_create(masker_workers_t *workers, int n_threads, int queue_depth)
+{
+  if (n_threads <= 0) n_threads = workers_default_threads();
+  if (queue_depth <= 0) queue_depth = 4 * n_threads;
+
+  workers->threads = malloc(n_threads * sizeof(pthread_t));
+  workers->queue = malloc(queue_depth * sizeof(masker_task_t));
+  if (workers->threads == NULL || workers->queue == NULL) {
+    free(workers->threads);
+    free(workers->queue);
+    return MASKER_MEMORY_ERROR;
+  }
+
+  workers->n_threads = 0;
+  workers->queue_depth = queue_depth;
+  workers->head = 0;
+  workers->count = 0;
+  workers->active = 0;
+  workers->stopping = 0;
+  pthread_mutex_init(&workers->lock, NULL);
+  pthread_cond_init(&workers->not_empty, NULL);
+  pthread_cond_init(&workers->not_full, NULL);
+  pthread_cond_init(&workers->idle, NULL);
+
+  for (int t=0; t<n_threads; t++) {
+    if (pthread_create(&workers->threads[t], NULL, worker_main, workers) != 0)
+      break;
+    workers->n_threads++;
+  }
+  if (workers->n_threads == 0) {
+    workers_destroy(workers);
+    return MASKER_FAILURE;
+  }
+  return MASKER_SUCCESS;
+}
+
+
+void workers_submit(masker_workers_t *workers, masker_task_fn fn, void *arg)
+{
+  pthread_mutex_lock(&workers->lock);
+  while (workers->count == workers->queue_depth)
+    pthread_cond_wait(&workers->not_full, &workers->lock);
+
+  int tail = (workers->head + workers->count) % workers->queue_depth;
+  workers->queue[tail].fn = fn;
+  workers->queue[tail].arg = arg;
+  workers->count++;
+  pthread_cond_signal(&workers->not_empty);
+  pthread_mutex_unlock(&workers->lock);
+}
+
+
+/* As workers_submit, but fails instead of blocking when the queue is full */
+int workers_try_submit(masker_workers_t *workers, masker_task_fn fn, void *arg)
+{
+  pthread_mutex_lock(&workers->lock);
+  if (workers->count == workers->queue_depth) {
+    pthread_mutex_unlock(&workers->lock);
+    return MASKER_FAILURE;
+  }
+
+  int tail = (workers->head + workers->count) % workers->queue_depth;
+  workers->queue[tail].fn = fn;
+  workers->queue[tail].arg = arg;
+  workers->count++;
+  pthread_cond_signal(&workers->not_empty);
+  pthread_mutex_unlock(&workers->lock);
+  return MASKER_SUCCESS;
+}
+
+
+void workers_wait(masker_workers_t *workers)
+{
+  pthread_mutex_lock(&workers->lock);
+  while (workers->count > 0 || workers->active > 0)
+    pthread_cond_wait(&workers->idle, &workers->lock);
+  pthread_mutex_unlock(&workers->lock);
+}
+
+
+/* Runs any queued tasks to completion before joining */
+void workers_destroy(masker_workers_t *workers)
+{
+  pthread_mutex_lock(&workers->lock);
+  workers->stopping = 1;
+  pthread_cond_broadcast(&workers->not_empty);
+  pthread_mutex_unlock(&workers->lock);
+
+  for (int t=0; t<workers->n_threads; t++)
+    pthread_join(workers->threads[t], NULL);
+
+  pthread_mutex_destroy(&workers->lock);
+  pthread_cond_destroy(&workers->not_empty);
+  pthread_cond_destroy(&workers->not_full);
+  pthread_cond_destroy(&workers->idle);
+  free(workers->threads);
+  free(workers->queue);
+}
+
+
+/* ===== MAP ===== */
+static void map_claim(map_run_t *run)
+{
+  for (;;) {
+    int i = __sync_fetch_and_add(&run->next, 1);
+    if (i >= run->n) break;
+    int code = run->fn(run->ctx, i);
+    if (run->statuses != NULL) run->statuses[i] = code;
+    if (code == MASKER_SUCCESS) continue;
+    pthread_mutex_lock(&run->lock);
+    if (i < run->failed) {
+      run->failed = i;
+      run->code = code;
+    }
+    pthread_mutex_unlock(&run->lock);
+  }
+}
+
+static void map_help(void *arg)
+{
+  map_run_t *run = arg;
+  map_claim(run);
+  pthread_mutex_lock(&run->lock);
+  if (--run->helpers == 0) pthread_cond_broadcast(&run->finished);
+  pthread_mutex_unlock(&run->lock);
+}
+
+/* Take the pool for reading, first growing it to wanted threads if need
+ * be. Returns how many helpers are available. */
+static int map_helpers_acquire(int wanted)
+{
+  pthread_rwlock_rdlock(&map_lock);
+  if (n_map_helpers >= wanted) return wanted;
+
+  pthread_rwlock_unlock(&map_lock);
+  pthread_rwlock_wrlock(&map_lock);
+  if (n_map_helpers < wanted) {
+    if (n_map_helpers > 0) workers_destroy(&map_helpers);
+    n_map_helpers = 0;
+    if (workers_create(&map_helpers, wanted, 0) == MASKER_SUCCESS)
+      n_map_helpers = map_helpers.n_threads;
+  }
+  pthread_rwlock_unlock(&map_lock);
+  pthread_rwlock_rdlock(&map_lock);
+  return wanted < n_map_helpers ? wanted : n_map_helpers;
+}
+
+
+int workers_map(int n_threads, int n, masker_map_fn fn, void *ctx,
+  int *statuses, int *failed_index)
+{
+  if (n_threads <= 0) n_threads = workers_default_threads();
+  map_run_t run = {fn, ctx, n, 0, statuses, n, MASKER_SUCCESS, 0};
+  pthread_mutex_init(&run.lock, NULL);
+  pthread_cond_init(&run.finished, NULL);
+
+  int wanted = n_threads - 1 < n - 1 ? n_threads - 1 : n - 1;
+  int n_helpers = wanted > 0 ? map_helpers_acquire(wanted) : 0;
+  for (int h=0; h<n_helpers; h++) {
+    pthread_mutex_lock(&run.lock);
+    run.helpers++;
+    pthread_mutex_unlock(&run.lock);
+    if (workers_try_submit(&map_helpers, map_help, &run) != MASKER_SUCCESS) {
+      pthread_mutex_lock(&run.lock);
+      run.helpers--;
+      pthread_mutex_unlock(&run.lock);
+      break;
+    }
+  }
+
+  map_claim(&run);
+  pthread_mutex_lock(&run.lock);
+  while (run.helpers > 0) pthread_cond_wait(&run.finished, &run.lock);
+  pthread_mutex_unlock(&run.lock);
+  if (wanted > 0) pthread_rwlock_unlock(&map_lock);
+  pthread_mutex_destroy(&run.lock);
+  pthread_cond_destroy(&run.finished);
+
+  if (run.code != MASKER_SUCCESS && failed_index != NULL)
+    *failed_index = run.failed;
+  return run.code;
+}
@@ -0,0 +1,45 @@
+#ifndef MASKER_WORKERS_H
+#  define MASKER_WORKERS_H
+#  include <pthread.h>
+
+typedef void (*masker_task_fn)(void *arg);
+typedef int (*masker_map_fn)(void *ctx, int i);
+
+typedef struct masker_task {
+  masker_task_fn fn;
+  void *arg;
+} masker_task_t;
+
+/* Fixed set of threads draining a bounded task queue. Submitting to a
+ * full queue blocks, which gives callers backpressure for free. */
+typedef struct masker_workers {
+  pthread_t *threads;
+  int n_threads;
+  masker_task_t *queue;
+  int queue_depth;
+  int head, count;
+  int active;        // tasks currently running
+  int stopping;
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty, not_full, idle;
+} masker_workers_t;
+
+/* Number of online processors, at least one */
+int workers_default_threads(void);
+
+/* n_threads <= 0 uses every core, queue_depth <= 0 uses 4 per thread */
+int workers_create(masker_workers_t *workers, int n_threads, int queue_depth);
+void workers_submit(masker_workers_t *workers, masker_task_fn fn, void *arg);
+int workers_try_submit(masker_workers_t *workers, masker_task_fn fn, void *arg);
+void workers_wait(masker_workers_t *workers);
+void workers_destroy(masker_workers_t *workers);
+
+/* Call fn(ctx, i) for every i in [0, n) on up to n_threads threads (0 for
+ * every core), the caller being one of them. Helpers come from a pool kept
+ * across calls, so fn must not itself call workers_map. Each code goes to
+ * statuses[i] when that is not NULL. Returns the code of the lowest failing
+ * i, storing i in failed_index when that is not NULL, else MASKER_SUCCESS */
+int workers_map(int n_threads, int n, masker_map_fn fn, void *ctx,
+  int *statuses, int *failed_index);
+
+#endif	// MASKER_WORKERS_H